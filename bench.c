@@ -0,0 +1,291 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "camera.h"
+#include "capabilities.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "gpu_timers.h"
+#include "meshlets.h"
+#include "scene.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bench_frame {
+    double cpu_ms;
+    double gpu_ms;
+    double phases_ms[BENCH_PHASE_COUNT];
+    struct meshlet_stats stats;
+};
+
+struct bench_pass {
+    const char* name;
+    double total_ms;
+    uint32_t samples;
+};
+
+static bool running = false;
+static struct bench_frame* frames;
+static uint32_t frames_count;
+static uint32_t warmup_count;
+static uint32_t current_index;
+static double frame_start;
+static double last_mark;
+
+static struct bench_pass passes[MAX_GPU_TIMERS];
+static uint32_t passes_count;
+
+static vec3 path_center;
+static float path_radius;
+
+static const char* phase_names[BENCH_PHASE_COUNT] = {"wait", "update", "record", "submit"};
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+bool bench_begin(uint32_t frame_count, uint32_t warmup) {
+    frames = calloc(frame_count, sizeof(struct bench_frame));
+    if (frames == NULL) {
+        return false;
+    }
+
+    frames_count = frame_count;
+    warmup_count = warmup < frame_count ? warmup : 0;
+    passes_count = 0;
+
+    if (scene.instances_count > 0) {
+        scene_bounds(path_center, &path_radius);
+    } else {
+        vec3_dup(path_center, camera.target);
+        path_radius = 1.f;
+    }
+
+    running = true;
+    return true;
+}
+
+// One orbit over the run that swings between the edge of the bounds and
+// well outside them, so LOD selection and culling both change along the way
+void bench_frame_begin(uint32_t index) {
+    float t = (float)index / frames_count;
+    float angle = t * 6.2831853f;
+    float distance = path_radius * (1.6f + 0.9f * cosf(angle * 2.f));
+
+    camera.position[0] = path_center[0] + sinf(angle) * distance;
+    camera.position[1] = path_center[1] + path_radius * 0.4f * sinf(angle * 3.f);
+    camera.position[2] = path_center[2] + cosf(angle) * distance;
+    vec3_dup(camera.target, path_center);
+
+    current_index = index;
+    frame_start = now_ms();
+    last_mark = frame_start;
+}
+
+void bench_mark(enum bench_phase phase) {
+    if (!running) {
+        return;
+    }
+
+    double now = now_ms();
+    frames[current_index].phases_ms[phase] = now - last_mark;
+    last_mark = now;
+}
+
+static void add_pass(const char* name, float ms) {
+    for (uint32_t i = 0; i < passes_count; i++) {
+        if (strcmp(passes[i].name, name) == 0) {
+            passes[i].total_ms += ms;
+            passes[i].samples++;
+            return;
+        }
+    }
+
+    if (passes_count < MAX_GPU_TIMERS) {
+        passes[passes_count++] = (struct bench_pass){name, ms, 1};
+    }
+}
+
+void bench_frame_end(uint32_t frame) {
+    struct bench_frame* recorded = &frames[current_index];
+    recorded->cpu_ms = now_ms() - frame_start;
+    recorded->gpu_ms = gpu_timer_last("frame");
+    meshlets_stats(frame, &recorded->stats);
+
+    // Timers are read back a few frames late, the warmup covers that
+    if (current_index < warmup_count) {
+        return;
+    }
+
+    const char* name;
+    for (uint32_t i = 0; (name = gpu_timer_name(i)) != NULL; i++) {
+        float ms = gpu_timer_last(name);
+        if (ms >= 0.f) {
+            add_pass(name, ms);
+        }
+    }
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank on sorted values
+static double percentile(const double* sorted, uint32_t count, double p) {
+    uint32_t rank = (uint32_t)ceil(p * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void write_distribution(FILE* file, const char* name, double* values, uint32_t count) {
+    if (count == 0) {
+        fprintf(file, "  \"%s\": null,\n", name);
+        return;
+    }
+
+    qsort(values, count, sizeof(double), compare_doubles);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+
+    fprintf(file, "  \"%s\": {\"samples\": %u, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+        name, count, values[0], sum / count, percentile(values, count, 0.5), percentile(values, count, 0.9),
+        percentile(values, count, 0.99), values[count - 1]);
+}
+
+// Device heaps as the driver sees them, only known with VK_EXT_memory_budget
+static uint64_t device_local_usage() {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budget,
+    };
+    vkGetPhysicalDeviceMemoryProperties2(physical_device, &properties);
+
+    uint64_t usage = 0;
+    for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++) {
+        if (properties.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            usage += budget.heapUsage[i];
+        }
+    }
+
+    return usage;
+}
+
+static uint64_t host_resident_bytes() {
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+
+    unsigned long size = 0, resident = 0;
+    int matched = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return matched == 2 ? (uint64_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+static uint64_t host_peak_bytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+    // Linux reports kilobytes
+    return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+int bench_finish(const char* path) {
+    running = false;
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Failed to open %s\n", path);
+        free(frames);
+        return 1;
+    }
+
+    uint32_t count = frames_count - warmup_count;
+    double* values = malloc(sizeof(double) * (count > 0 ? count : 1));
+
+    uint64_t scene_triangles = 0;
+    for (uint32_t i = 0; i < scene.instances_count; i++) {
+        scene_triangles += scene.meshes[scene.instances[i].mesh].lods[0].index_count / 3;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", device_capabilities.name);
+    fprintf(file, "  \"frames\": %u,\n", count);
+    fprintf(file, "  \"warmup\": %u,\n", warmup_count);
+    fprintf(file, "  \"render_extent\": [%u, %u],\n", render_extent.width, render_extent.height);
+    fprintf(file, "  \"scene\": {\"meshes\": %u, \"instances\": %u, \"triangles\": %llu},\n",
+        scene.meshes_count, scene.instances_count, (unsigned long long)scene_triangles);
+
+    for (uint32_t i = 0; i < count; i++) {
+        values[i] = frames[warmup_count + i].cpu_ms;
+    }
+    write_distribution(file, "cpu_frame_ms", values, count);
+
+    uint32_t gpu_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (frames[warmup_count + i].gpu_ms >= 0.0) {
+            values[gpu_count++] = frames[warmup_count + i].gpu_ms;
+        }
+    }
+    write_distribution(file, "gpu_frame_ms", values, gpu_count);
+
+    fprintf(file, "  \"cpu_phases_ms\": {");
+    for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+        double sum = 0.0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += frames[warmup_count + i].phases_ms[phase];
+        }
+        fprintf(file, "%s\"%s\": %.4f", phase > 0 ? ", " : "", phase_names[phase], count > 0 ? sum / count : 0.0);
+    }
+    fprintf(file, "},\n");
+
+    fprintf(file, "  \"gpu_passes_ms\": {");
+    for (uint32_t i = 0; i < passes_count; i++) {
+        fprintf(file, "%s\"%s\": %.4f", i > 0 ? ", " : "", passes[i].name, passes[i].total_ms / passes[i].samples);
+    }
+    fprintf(file, "},\n");
+
+    // Counts are what the CPU submitted after frustum culling and LOD
+    // selection, meshlet culling on the GPU may draw less
+    double items = 0.0, meshlets = 0.0, triangles = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        items += frames[warmup_count + i].stats.items;
+        meshlets += frames[warmup_count + i].stats.meshlets;
+        triangles += (double)frames[warmup_count + i].stats.triangles;
+    }
+    uint32_t divisor = count > 0 ? count : 1;
+    fprintf(file, "  \"submitted\": {\"instances\": %.1f, \"meshlet_draws\": %.1f, \"triangles\": %.1f},\n",
+        items / divisor, meshlets / divisor, triangles / divisor);
+
+    // The heap sizes are not a use, without the budget there is nothing to report
+    char device_local[32] = "null";
+    if (device_capabilities.memory_budget) {
+        snprintf(device_local, sizeof(device_local), "%llu", (unsigned long long)device_local_usage());
+    }
+
+    fprintf(file, "  \"memory\": {\"device_local_bytes\": %s, \"device_local_budget\": %s, \"host_resident_bytes\": %llu, \"host_peak_bytes\": %llu}\n",
+        device_local, device_capabilities.memory_budget ? "true" : "false",
+        (unsigned long long)host_resident_bytes(), (unsigned long long)host_peak_bytes());
+    fprintf(file, "}\n");
+
+    fclose(file);
+    free(values);
+    free(frames);
+    frames = NULL;
+    return 0;
+}
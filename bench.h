@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BENCH_TIME_STEP (1.f / 60.f)
+#define BENCH_WARMUP_FRAMES 16
+
+// Generated scene used when no meshes are given, see scenegen.h
+#define BENCH_SCENE "medium"
+
+// CPU side of a frame, each phase runs from the previous mark to its own
+enum bench_phase {
+    BENCH_PHASE_WAIT,
+    BENCH_PHASE_UPDATE,
+    BENCH_PHASE_RECORD,
+    BENCH_PHASE_SUBMIT,
+    BENCH_PHASE_COUNT,
+};
+
+// A run over a fixed number of frames that flies the camera along a path
+// through the scene bounds, driven by the frame index alone so two runs of
+// the same build see the same frames. The first warmup frames are left out
+// of the report
+bool bench_begin(uint32_t frames, uint32_t warmup);
+
+// Places the camera for the frame
+void bench_frame_begin(uint32_t index);
+
+// Does nothing outside a run
+void bench_mark(enum bench_phase phase);
+
+// Collects the frame, frame is the slot draw_frame just used
+void bench_frame_end(uint32_t frame);
+
+// Writes the report as JSON and frees the run, returns 0 on success
+int bench_finish(const char* path);
@@ -0,0 +1,180 @@
+#include "buffers.h"
+#include "capabilities.h"
+#include "devices.h"
+#include "streaming.h"
+#include <string.h>
+
+uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags flags) {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if (!(type_filter & (1 << i))) {
+            continue;
+        }
+
+        if ((memory_properties.memoryTypes[i].propertyFlags & flags) == flags) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static VkResult allocate_buffer(VkBufferCreateInfo* create_info, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* buffer_memory) {
+    VkResult result = vkCreateBuffer(logical_device, create_info, NULL, buffer);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(logical_device, *buffer, &memory_requirements);
+
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memory_requirements.size,
+        .memoryTypeIndex = find_memory_type(memory_requirements.memoryTypeBits, properties)
+    };
+
+    result = vkAllocateMemory(logical_device, &allocate_info, NULL, buffer_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return vkBindBufferMemory(logical_device, *buffer, *buffer_memory, 0);
+}
+
+VkResult create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* buffer_memory) {
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+
+    return allocate_buffer(&create_info, properties, buffer, buffer_memory);
+}
+
+// Buffers touched by more than one queue family, concurrent sharing saves
+// the ownership transfer barriers on both queues
+VkResult create_shared_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* buffer_memory) {
+    struct queue_family_indices* queues = &device_capabilities.queues;
+
+    uint32_t families[3];
+    uint32_t family_count = 0;
+    families[family_count++] = queues->graphics_family.value;
+    if (queues->compute_family.assigned) {
+        families[family_count++] = queues->compute_family.value;
+    }
+
+    if (queues->transfer_family.assigned) {
+        families[family_count++] = queues->transfer_family.value;
+    }
+
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = family_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = family_count > 1 ? family_count : 0,
+        .pQueueFamilyIndices = family_count > 1 ? families : NULL,
+    };
+
+    return allocate_buffer(&create_info, properties, buffer, buffer_memory);
+}
+
+// Blocking upload through a temporary staging buffer on the transfer queue,
+// meant for load time. Per frame data goes through the streaming service.
+VkResult upload_buffers(const struct buffer_upload* uploads, uint32_t count) {
+    VkDeviceSize total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += uploads[i].size;
+    }
+
+    if (total == 0) {
+        return VK_SUCCESS;
+    }
+
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_memory;
+    VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkResult result = create_buffer(total, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, &staging_buffer, &staging_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    uint8_t* data;
+    vkMapMemory(logical_device, staging_memory, 0, total, 0, (void**)&data);
+    {
+        VkDeviceSize offset = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(data + offset, uploads[i].data, uploads[i].size);
+            offset += uploads[i].size;
+        }
+    }
+    vkUnmapMemory(logical_device, staging_memory);
+
+    struct queue_family_indices* queues = &device_capabilities.queues;
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queues->transfer_family.assigned ? queues->transfer_family.value : queues->graphics_family.value,
+    };
+
+    VkCommandPool pool;
+    vkCreateCommandPool(logical_device, &pool_info, NULL, &pool);
+
+    VkCommandBufferAllocateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer command_buffer;
+    vkAllocateCommandBuffers(logical_device, &buffer_info, &command_buffer);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    {
+        VkDeviceSize offset = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            VkBufferCopy region = {
+                .srcOffset = offset,
+                .dstOffset = uploads[i].offset,
+                .size = uploads[i].size,
+            };
+            vkCmdCopyBuffer(command_buffer, staging_buffer, uploads[i].destination, 1, &region);
+            offset += uploads[i].size;
+        }
+    }
+    vkEndCommandBuffer(command_buffer);
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VkFence fence;
+    vkCreateFence(logical_device, &fence_info, NULL, &fence);
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+
+    result = vkQueueSubmit(transfer_queue, 1, &submit_info, fence);
+    if (result == VK_SUCCESS) {
+        vkWaitForFences(logical_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+
+    vkDestroyFence(logical_device, fence, NULL);
+    vkDestroyCommandPool(logical_device, pool, NULL);
+    vkDestroyBuffer(logical_device, staging_buffer, NULL);
+    vkFreeMemory(logical_device, staging_memory, NULL);
+
+    return result;
+}
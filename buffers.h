@@ -0,0 +1,16 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+struct buffer_upload {
+    VkBuffer destination;
+    VkDeviceSize offset;
+    const void* data;
+    VkDeviceSize size;
+};
+
+uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags flags);
+VkResult create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* buffer_memory);
+VkResult create_shared_buffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* buffer_memory);
+VkResult upload_buffers(const struct buffer_upload* uploads, uint32_t count);
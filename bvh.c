@@ -0,0 +1,506 @@
+#include "bvh.h"
+#include "jobs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define BVH_BINS 16
+#define BVH_MAX_DEPTH 64
+#define BVH_ROOTS_PER_THREAD 4
+
+enum box_test {
+    BOX_OUTSIDE,
+    BOX_INTERSECTS,
+    BOX_INSIDE,
+};
+
+// Planes in structure of arrays form, padded to 8 with planes every box is
+// inside of
+struct cull_planes {
+    float x[8];
+    float y[8];
+    float z[8];
+    float w[8];
+    float abs_x[8];
+    float abs_y[8];
+    float abs_z[8];
+};
+
+struct build_context {
+    struct bvh* bvh;
+    float* centroids;
+};
+
+// Plain comparisons compile to single instructions where fminf is a call
+static inline float min_float(float a, float b) {
+    return a < b ? a : b;
+}
+
+static inline float max_float(float a, float b) {
+    return a > b ? a : b;
+}
+
+static void box_empty(float* min, float* max) {
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = INFINITY;
+        max[axis] = -INFINITY;
+    }
+}
+
+static void box_grow(float* min, float* max, const float* other_min, const float* other_max) {
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = min_float(min[axis], other_min[axis]);
+        max[axis] = max_float(max[axis], other_max[axis]);
+    }
+}
+
+static float box_area(const float* min, const float* max) {
+    float x = max[0] - min[0];
+    float y = max[1] - min[1];
+    float z = max[2] - min[2];
+    if (x < 0.f || y < 0.f || z < 0.f) {
+        return 0.f;
+    }
+
+    return x * y + y * z + z * x;
+}
+
+// Binned SAH over centroids, falls back to halving the range when every
+// centroid lands in one bin
+static uint32_t build_node(struct build_context* context, uint32_t first, uint32_t count, uint32_t depth) {
+    struct bvh* bvh = context->bvh;
+    uint32_t index = bvh->nodes_count++;
+    struct bvh_node* node = &bvh->nodes[index];
+    node->first = first;
+    node->count = count;
+
+    float centroid_min[3], centroid_max[3];
+    box_empty(node->min, node->max);
+    box_empty(centroid_min, centroid_max);
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t object = bvh->indices[i];
+        const float* centroid = &context->centroids[object * 3];
+        box_grow(node->min, node->max, bvh->boxes[object].min, bvh->boxes[object].max);
+        box_grow(centroid_min, centroid_max, centroid, centroid);
+    }
+
+    if (count <= BVH_LEAF_SIZE || depth + 1 >= BVH_MAX_DEPTH) {
+        node->right = 0;
+        return index;
+    }
+
+    float best_cost = INFINITY;
+    int best_axis = -1;
+    int best_bin = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroid_max[axis] - centroid_min[axis];
+        if (extent <= 0.f) {
+            continue;
+        }
+
+        uint32_t bin_counts[BVH_BINS] = {0};
+        float bin_min[BVH_BINS][3], bin_max[BVH_BINS][3];
+        for (int bin = 0; bin < BVH_BINS; bin++) {
+            box_empty(bin_min[bin], bin_max[bin]);
+        }
+
+        float scale = BVH_BINS / extent;
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t object = bvh->indices[i];
+            int bin = (int)((context->centroids[object * 3 + axis] - centroid_min[axis]) * scale);
+            bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+            bin_counts[bin]++;
+            box_grow(bin_min[bin], bin_max[bin], bvh->boxes[object].min, bvh->boxes[object].max);
+        }
+
+        // Sweep from the right for the areas, then from the left for the costs
+        float right_areas[BVH_BINS];
+        uint32_t right_counts[BVH_BINS];
+        float min[3], max[3];
+        box_empty(min, max);
+        uint32_t running = 0;
+        for (int bin = BVH_BINS - 1; bin > 0; bin--) {
+            box_grow(min, max, bin_min[bin], bin_max[bin]);
+            running += bin_counts[bin];
+            right_areas[bin] = box_area(min, max);
+            right_counts[bin] = running;
+        }
+
+        box_empty(min, max);
+        running = 0;
+        for (int bin = 0; bin < BVH_BINS - 1; bin++) {
+            box_grow(min, max, bin_min[bin], bin_max[bin]);
+            running += bin_counts[bin];
+            float cost = box_area(min, max) * running + right_areas[bin + 1] * right_counts[bin + 1];
+            if (running > 0 && right_counts[bin + 1] > 0 && cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = bin;
+            }
+        }
+    }
+
+    uint32_t middle = first + count / 2;
+    if (best_axis >= 0) {
+        float scale = BVH_BINS / (centroid_max[best_axis] - centroid_min[best_axis]);
+        uint32_t left = first;
+        uint32_t right = first + count;
+        while (left < right) {
+            uint32_t object = bvh->indices[left];
+            int bin = (int)((context->centroids[object * 3 + best_axis] - centroid_min[best_axis]) * scale);
+            bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+            if (bin <= best_bin) {
+                left++;
+            } else {
+                right--;
+                bvh->indices[left] = bvh->indices[right];
+                bvh->indices[right] = object;
+            }
+        }
+        middle = left;
+    }
+
+    build_node(context, first, middle - first, depth + 1);
+    node = &bvh->nodes[index];
+    node->right = build_node(context, middle, first + count - middle, depth + 1);
+    return index;
+}
+
+void build_bvh(struct bvh* bvh, const struct bvh_box* boxes, uint32_t count) {
+    destroy_bvh(bvh);
+    if (count == 0) {
+        return;
+    }
+
+    bvh->objects_count = count;
+    bvh->nodes = malloc(sizeof(struct bvh_node) * (2 * count - 1));
+    bvh->indices = malloc(sizeof(uint32_t) * count);
+    bvh->boxes = malloc(sizeof(struct bvh_box) * count);
+    float* centroids = malloc(sizeof(float) * 3 * count);
+    if (bvh->nodes == NULL || bvh->indices == NULL || bvh->boxes == NULL || centroids == NULL) {
+        puts("Out of memory");
+        exit(1);
+    }
+
+    memcpy(bvh->boxes, boxes, sizeof(struct bvh_box) * count);
+    for (uint32_t i = 0; i < count; i++) {
+        bvh->indices[i] = i;
+        for (int axis = 0; axis < 3; axis++) {
+            centroids[i * 3 + axis] = (boxes[i].min[axis] + boxes[i].max[axis]) * 0.5f;
+        }
+    }
+
+    struct build_context context = {
+        .bvh = bvh,
+        .centroids = centroids,
+    };
+    build_node(&context, 0, count, 0);
+
+    free(centroids);
+}
+
+// Children are stored after their parent, walking backwards sees them first
+void refit_bvh(struct bvh* bvh, const struct bvh_box* boxes) {
+    memcpy(bvh->boxes, boxes, sizeof(struct bvh_box) * bvh->objects_count);
+
+    for (uint32_t i = bvh->nodes_count; i-- > 0;) {
+        struct bvh_node* node = &bvh->nodes[i];
+        box_empty(node->min, node->max);
+
+        if (node->right == 0) {
+            for (uint32_t j = node->first; j < node->first + node->count; j++) {
+                const struct bvh_box* box = &bvh->boxes[bvh->indices[j]];
+                box_grow(node->min, node->max, box->min, box->max);
+            }
+            continue;
+        }
+
+        box_grow(node->min, node->max, bvh->nodes[i + 1].min, bvh->nodes[i + 1].max);
+        box_grow(node->min, node->max, bvh->nodes[node->right].min, bvh->nodes[node->right].max);
+    }
+}
+
+void destroy_bvh(struct bvh* bvh) {
+    free(bvh->nodes);
+    free(bvh->indices);
+    free(bvh->boxes);
+    memset(bvh, 0, sizeof(struct bvh));
+}
+
+static void prepare_planes(struct cull_planes* prepared, vec4 const planes[6]) {
+    for (int i = 0; i < 8; i++) {
+        const float padding[4] = {0.f, 0.f, 0.f, 1.f};
+        const float* plane = i < 6 ? planes[i] : padding;
+        prepared->x[i] = plane[0];
+        prepared->y[i] = plane[1];
+        prepared->z[i] = plane[2];
+        prepared->w[i] = plane[3];
+        prepared->abs_x[i] = fabsf(plane[0]);
+        prepared->abs_y[i] = fabsf(plane[1]);
+        prepared->abs_z[i] = fabsf(plane[2]);
+    }
+}
+
+// Signed distance of the box center against the projected half extent, four
+// planes at a time
+static enum box_test test_box(const struct cull_planes* planes, const float* min, const float* max) {
+#ifdef __SSE__
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 center_x = _mm_set1_ps((min[0] + max[0]) * 0.5f);
+    __m128 center_y = _mm_set1_ps((min[1] + max[1]) * 0.5f);
+    __m128 center_z = _mm_set1_ps((min[2] + max[2]) * 0.5f);
+    __m128 extent_x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max[0]), _mm_set1_ps(min[0])), half);
+    __m128 extent_y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max[1]), _mm_set1_ps(min[1])), half);
+    __m128 extent_z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max[2]), _mm_set1_ps(min[2])), half);
+    __m128 zero = _mm_setzero_ps();
+
+    int outside = 0;
+    int crossing = 0;
+    for (int i = 0; i < 8; i += 4) {
+        __m128 distance = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(center_x, _mm_loadu_ps(&planes->x[i])),
+            _mm_mul_ps(center_y, _mm_loadu_ps(&planes->y[i]))), _mm_add_ps(
+            _mm_mul_ps(center_z, _mm_loadu_ps(&planes->z[i])),
+            _mm_loadu_ps(&planes->w[i])));
+        __m128 radius = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(extent_x, _mm_loadu_ps(&planes->abs_x[i])),
+            _mm_mul_ps(extent_y, _mm_loadu_ps(&planes->abs_y[i]))),
+            _mm_mul_ps(extent_z, _mm_loadu_ps(&planes->abs_z[i])));
+
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        crossing |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+    }
+#else
+    float center[3], extent[3];
+    for (int axis = 0; axis < 3; axis++) {
+        center[axis] = (min[axis] + max[axis]) * 0.5f;
+        extent[axis] = (max[axis] - min[axis]) * 0.5f;
+    }
+
+    int outside = 0;
+    int crossing = 0;
+    for (int i = 0; i < 6; i++) {
+        float distance = center[0] * planes->x[i] + center[1] * planes->y[i] + center[2] * planes->z[i] + planes->w[i];
+        float radius = extent[0] * planes->abs_x[i] + extent[1] * planes->abs_y[i] + extent[2] * planes->abs_z[i];
+        outside |= distance + radius < 0.f;
+        crossing |= distance - radius < 0.f;
+    }
+#endif
+
+    if (outside) {
+        return BOX_OUTSIDE;
+    }
+
+    return crossing ? BOX_INTERSECTS : BOX_INSIDE;
+}
+
+// Subtrees entirely inside the frustum are copied out without further tests
+static uint32_t cull_subtree(const struct bvh* bvh, const struct cull_planes* planes, uint32_t root, uint32_t* visible) {
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    uint32_t stack_count = 0;
+    uint32_t count = 0;
+
+    stack[stack_count++] = root;
+    while (stack_count > 0) {
+        const struct bvh_node* node = &bvh->nodes[stack[--stack_count]];
+        enum box_test test = test_box(planes, node->min, node->max);
+        if (test == BOX_OUTSIDE) {
+            continue;
+        }
+
+        if (test == BOX_INSIDE) {
+            memcpy(visible + count, bvh->indices + node->first, sizeof(uint32_t) * node->count);
+            count += node->count;
+            continue;
+        }
+
+        if (node->right != 0) {
+            stack[stack_count++] = node->right;
+            stack[stack_count++] = (uint32_t)(node - bvh->nodes) + 1;
+            continue;
+        }
+
+        for (uint32_t i = node->first; i < node->first + node->count; i++) {
+            uint32_t object = bvh->indices[i];
+            if (test_box(planes, bvh->boxes[object].min, bvh->boxes[object].max) != BOX_OUTSIDE) {
+                visible[count++] = object;
+            }
+        }
+    }
+
+    return count;
+}
+
+struct cull_task {
+    const struct bvh* bvh;
+    const struct cull_planes* planes;
+    const uint32_t* roots;
+    uint32_t* visible;
+    uint32_t* counts;
+};
+
+// A subtree writes into the slice of the output matching its index range,
+// so jobs never share an output location
+static void cull_root(void* data, uint32_t index) {
+    struct cull_task* task = data;
+    const struct bvh_node* root = &task->bvh->nodes[task->roots[index]];
+    task->counts[index] = cull_subtree(task->bvh, task->planes, task->roots[index], task->visible + root->first);
+}
+
+// Visible must have room for every object. On more than one job thread the
+// top of the tree is split into subtrees that are culled as parallel jobs and
+// then compacted in index order
+uint32_t bvh_cull(const struct bvh* bvh, vec4 const planes[6], uint32_t* visible) {
+    if (bvh->nodes_count == 0) {
+        return 0;
+    }
+
+    struct cull_planes prepared;
+    prepare_planes(&prepared, planes);
+
+    uint32_t threads = job_threads_count();
+    threads = threads < MAX_JOB_THREADS ? threads : MAX_JOB_THREADS;
+    if (threads <= 1 || bvh->objects_count < BVH_PARALLEL_OBJECTS) {
+        return cull_subtree(bvh, &prepared, 0, visible);
+    }
+
+    uint32_t roots[MAX_JOB_THREADS * BVH_ROOTS_PER_THREAD];
+    uint32_t counts[MAX_JOB_THREADS * BVH_ROOTS_PER_THREAD];
+    uint32_t roots_count = 1;
+    roots[0] = 0;
+
+    // Widen breadth first, leaves stay as they are
+    uint32_t target = threads * BVH_ROOTS_PER_THREAD;
+    bool split = true;
+    while (roots_count < target && split) {
+        split = false;
+        uint32_t current = roots_count;
+        for (uint32_t i = 0; i < current && roots_count < target; i++) {
+            const struct bvh_node* node = &bvh->nodes[roots[i]];
+            if (node->right == 0) {
+                continue;
+            }
+
+            roots[roots_count++] = node->right;
+            roots[i] = roots[i] + 1;
+            split = true;
+        }
+    }
+
+    // Insertion sort by index range so compaction only ever moves data down
+    for (uint32_t i = 1; i < roots_count; i++) {
+        uint32_t root = roots[i];
+        uint32_t j = i;
+        while (j > 0 && bvh->nodes[roots[j - 1]].first > bvh->nodes[root].first) {
+            roots[j] = roots[j - 1];
+            j--;
+        }
+        roots[j] = root;
+    }
+
+    struct cull_task task = {
+        .bvh = bvh,
+        .planes = &prepared,
+        .roots = roots,
+        .visible = visible,
+        .counts = counts,
+    };
+    job_parallel_for(cull_root, &task, roots_count, "bvh_cull");
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < roots_count; i++) {
+        memmove(visible + count, visible + bvh->nodes[roots[i]].first, sizeof(uint32_t) * counts[i]);
+        count += counts[i];
+    }
+
+    return count;
+}
+
+// Entry distance along the ray, or INFINITY on a miss or past the limit
+static float ray_box(const float* origin, const float* inverse, const float* min, const float* max, float limit) {
+    float near = 0.f;
+    float far = limit;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (min[axis] - origin[axis]) * inverse[axis];
+        float t1 = (max[axis] - origin[axis]) * inverse[axis];
+        near = max_float(near, min_float(t0, t1));
+        far = min_float(far, max_float(t0, t1));
+    }
+
+    return near <= far ? near : INFINITY;
+}
+
+// Nearest object box hit along the ray, children are visited nearest first so
+// farther subtrees are mostly skipped
+bool bvh_raycast(const struct bvh* bvh, const vec3 origin, const vec3 direction, uint32_t* object, float* distance) {
+    if (bvh->nodes_count == 0) {
+        return false;
+    }
+
+    vec3 inverse;
+    for (int axis = 0; axis < 3; axis++) {
+        inverse[axis] = 1.f / direction[axis];
+    }
+
+    float nearest = INFINITY;
+    bool hit = false;
+
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    uint32_t stack_count = 0;
+    if (ray_box(origin, inverse, bvh->nodes[0].min, bvh->nodes[0].max, nearest) != INFINITY) {
+        stack[stack_count++] = 0;
+    }
+
+    while (stack_count > 0) {
+        uint32_t index = stack[--stack_count];
+        const struct bvh_node* node = &bvh->nodes[index];
+        if (ray_box(origin, inverse, node->min, node->max, nearest) == INFINITY) {
+            continue;
+        }
+
+        if (node->right == 0) {
+            for (uint32_t i = node->first; i < node->first + node->count; i++) {
+                const struct bvh_box* box = &bvh->boxes[bvh->indices[i]];
+                float t = ray_box(origin, inverse, box->min, box->max, nearest);
+                if (t < nearest) {
+                    nearest = t;
+                    *object = bvh->indices[i];
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        uint32_t left = index + 1;
+        uint32_t right = node->right;
+        float left_distance = ray_box(origin, inverse, bvh->nodes[left].min, bvh->nodes[left].max, nearest);
+        float right_distance = ray_box(origin, inverse, bvh->nodes[right].min, bvh->nodes[right].max, nearest);
+        if (left_distance > right_distance) {
+            uint32_t swap = left;
+            left = right;
+            right = swap;
+            float swap_distance = left_distance;
+            left_distance = right_distance;
+            right_distance = swap_distance;
+        }
+
+        if (right_distance != INFINITY) {
+            stack[stack_count++] = right;
+        }
+        if (left_distance != INFINITY) {
+            stack[stack_count++] = left;
+        }
+    }
+
+    if (hit) {
+        *distance = nearest;
+    }
+
+    return hit;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "linmath.h"
+
+#define BVH_LEAF_SIZE 4
+#define BVH_PARALLEL_OBJECTS 16384
+
+struct bvh_box {
+    float min[3];
+    float max[3];
+};
+
+// Nodes are stored depth first, the left child follows its parent and right
+// is 0 for leaves. Every node covers the objects indices[first, first + count)
+struct bvh_node {
+    float min[3];
+    uint32_t right;
+    float max[3];
+    uint32_t first;
+    uint32_t count;
+};
+
+struct bvh {
+    struct bvh_node* nodes;
+    uint32_t nodes_count;
+    uint32_t* indices;
+    struct bvh_box* boxes;
+    uint32_t objects_count;
+};
+
+void build_bvh(struct bvh* bvh, const struct bvh_box* boxes, uint32_t count);
+void refit_bvh(struct bvh* bvh, const struct bvh_box* boxes);
+void destroy_bvh(struct bvh* bvh);
+
+uint32_t bvh_cull(const struct bvh* bvh, vec4 const planes[6], uint32_t* visible);
+bool bvh_raycast(const struct bvh* bvh, const vec3 origin, const vec3 direction, uint32_t* object, float* distance);
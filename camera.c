@@ -0,0 +1,80 @@
+#include "camera.h"
+
+struct camera camera;
+
+void init_camera() {
+    vec3 position = {0.f, 0.f, 2.f};
+    vec3 target = {0.f, 0.f, 0.f};
+    vec3 up = {0.f, 1.f, 0.f};
+
+    vec3_dup(camera.position, position);
+    vec3_dup(camera.target, target);
+    vec3_dup(camera.up, up);
+
+    camera.fov_y = 1.0471976f;
+    camera.near_plane = 0.1f;
+    camera.far_plane = 1000.f;
+}
+
+// linmath builds OpenGL style projections, Vulkan wants y down and depth in [0, 1]
+static void perspective(mat4x4 m, float fov_y, float aspect, float n, float f) {
+    mat4x4_perspective(m, fov_y, aspect, n, f);
+    m[1][1] = -m[1][1];
+    m[2][2] = f / (n - f);
+    m[3][2] = (n * f) / (n - f);
+}
+
+void update_camera(float aspect) {
+    mat4x4_look_at(camera.view, camera.position, camera.target, camera.up);
+    perspective(camera.projection, camera.fov_y, aspect, camera.near_plane, camera.far_plane);
+    mat4x4_mul(camera.view_projection, camera.projection, camera.view);
+
+    // Gribb-Hartmann on the rows of the view projection, clip depth is [0, 1]
+    // so the near plane is the z row alone
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        mat4x4_row(rows[i], camera.view_projection, i);
+    }
+
+    vec4_add(camera.frustum[0], rows[3], rows[0]);
+    vec4_sub(camera.frustum[1], rows[3], rows[0]);
+    vec4_add(camera.frustum[2], rows[3], rows[1]);
+    vec4_sub(camera.frustum[3], rows[3], rows[1]);
+    vec4_dup(camera.frustum[4], rows[2]);
+    vec4_sub(camera.frustum[5], rows[3], rows[2]);
+
+    for (int i = 0; i < 6; i++) {
+        float length = vec3_len(camera.frustum[i]);
+        vec4_scale(camera.frustum[i], camera.frustum[i], 1.f / length);
+    }
+}
+
+bool camera_sphere_visible(const vec3 center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        const float* plane = camera.frustum[i];
+        if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// World ray through a point in normalized device coordinates, y pointing down
+// like the viewport
+void camera_ray(float x, float y, vec3 origin, vec3 direction) {
+    mat4x4 inverse;
+    mat4x4_invert(inverse, camera.view_projection);
+
+    vec4 near_clip = {x, y, 0.f, 1.f};
+    vec4 far_clip = {x, y, 1.f, 1.f};
+    vec4 near_world, far_world;
+    mat4x4_mul_vec4(near_world, inverse, near_clip);
+    mat4x4_mul_vec4(far_world, inverse, far_clip);
+
+    vec3 far_point;
+    vec3_scale(origin, near_world, 1.f / near_world[3]);
+    vec3_scale(far_point, far_world, 1.f / far_world[3]);
+    vec3_sub(direction, far_point, origin);
+    vec3_norm(direction, direction);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "linmath.h"
+
+struct camera {
+    vec3 position;
+    vec3 target;
+    vec3 up;
+
+    float fov_y;
+    float near_plane;
+    float far_plane;
+
+    mat4x4 view;
+    mat4x4 projection;
+    mat4x4 view_projection;
+
+    // World space planes facing inwards: left, right, bottom, top, near, far
+    vec4 frustum[6];
+};
+
+extern struct camera camera;
+
+void init_camera();
+void update_camera(float aspect);
+bool camera_sphere_visible(const vec3 center, float radius);
+void camera_ray(float x, float y, vec3 origin, vec3 direction);
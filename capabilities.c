@@ -0,0 +1,311 @@
+#include "capabilities.h"
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct device_capabilities device_capabilities;
+
+static bool has_extension(VkExtensionProperties* extensions, uint32_t count, const char* name) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(extensions[i].extensionName, name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void probe_memory(VkPhysicalDevice* device, struct device_capabilities* capabilities) {
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(*device, &memory);
+
+    for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+        if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            capabilities->device_local_bytes += memory.memoryHeaps[i].size;
+        }
+    }
+
+    VkMemoryPropertyFlags mappable = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < memory.memoryTypeCount; i++) {
+        if ((memory.memoryTypes[i].propertyFlags & mappable) != mappable) {
+            continue;
+        }
+
+        VkDeviceSize size = memory.memoryHeaps[memory.memoryTypes[i].heapIndex].size;
+        if (size > capabilities->host_visible_device_local_bytes) {
+            capabilities->host_visible_device_local_bytes = size;
+        }
+    }
+
+    capabilities->unified_memory = capabilities->device_local_bytes > 0 &&
+        capabilities->host_visible_device_local_bytes >= capabilities->device_local_bytes;
+}
+
+static void probe_properties(VkPhysicalDevice* device, struct device_capabilities* capabilities) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(*device, &properties);
+
+    memcpy(capabilities->name, properties.deviceName, sizeof(capabilities->name));
+    memcpy(capabilities->uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    capabilities->type = properties.deviceType;
+    // Core functionality above the instance's version is off limits
+    capabilities->api_version = properties.apiVersion < instance_api_version ? properties.apiVersion : instance_api_version;
+    capabilities->vendor_id = properties.vendorID;
+
+    VkPhysicalDeviceLimits* limits = &properties.limits;
+    capabilities->timestamp_period = limits->timestampComputeAndGraphics ? limits->timestampPeriod : 0.f;
+    capabilities->max_image_dimension_2d = limits->maxImageDimension2D;
+    capabilities->max_push_constants_size = limits->maxPushConstantsSize;
+    capabilities->max_compute_work_group_invocations = limits->maxComputeWorkGroupInvocations;
+    capabilities->max_draw_indirect_count = limits->maxDrawIndirectCount;
+    capabilities->max_sampler_anisotropy = limits->maxSamplerAnisotropy;
+    capabilities->min_uniform_buffer_offset_alignment = limits->minUniformBufferOffsetAlignment;
+    capabilities->min_storage_buffer_offset_alignment = limits->minStorageBufferOffsetAlignment;
+    capabilities->non_coherent_atom_size = limits->nonCoherentAtomSize;
+
+    // The pipeline cache UUID changes with driver updates, the device UUID does not
+    if (capabilities->api_version >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceIDProperties id_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+        };
+
+        VkPhysicalDeviceProperties2 properties2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &id_properties,
+        };
+        vkGetPhysicalDeviceProperties2(*device, &properties2);
+        memcpy(capabilities->uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+    }
+}
+
+static void probe_features(VkPhysicalDevice* device, struct device_capabilities* capabilities) {
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(*device, NULL, &extension_count, NULL);
+
+    VkExtensionProperties* extensions = malloc(extension_count * sizeof(VkExtensionProperties));
+    vkEnumerateDeviceExtensionProperties(*device, NULL, &extension_count, extensions);
+
+    capabilities->fragment_shading_rate = has_extension(extensions, extension_count, VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME);
+    capabilities->mesh_shader = has_extension(extensions, extension_count, VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    capabilities->calibrated_timestamps = has_extension(extensions, extension_count, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+    capabilities->memory_budget = has_extension(extensions, extension_count, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // The budget is read through vkGetPhysicalDeviceMemoryProperties2, core
+    // only when both the instance and the device are 1.1
+    if (capabilities->api_version < VK_API_VERSION_1_1) {
+        capabilities->memory_budget = false;
+    }
+
+    free(extensions);
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(*device, &features);
+    capabilities->multi_draw_indirect = features.multiDrawIndirect;
+    capabilities->draw_indirect_first_instance = features.drawIndirectFirstInstance;
+    capabilities->sampler_anisotropy = features.samplerAnisotropy;
+    capabilities->texture_compression_bc = features.textureCompressionBC;
+    capabilities->pipeline_statistics_query = features.pipelineStatisticsQuery;
+    capabilities->inherited_queries = features.inheritedQueries;
+    capabilities->sparse_residency_image_2d = features.sparseBinding && features.sparseResidencyImage2D;
+    capabilities->fragment_stores_and_atomics = features.fragmentStoresAndAtomics;
+
+    if (capabilities->api_version < VK_API_VERSION_1_2) {
+        // Everything below needs vkGetPhysicalDeviceFeatures2 and a 1.2 device
+        capabilities->mesh_shader = false;
+        capabilities->fragment_shading_rate = false;
+        return;
+    }
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT mesh_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+    };
+
+    VkPhysicalDeviceFragmentShadingRateFeaturesKHR shading_rate_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR,
+    };
+
+    VkPhysicalDeviceVulkan13Features features13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+    };
+
+    VkPhysicalDeviceVulkan12Features features12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+
+    VkPhysicalDeviceFeatures2 features2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features12,
+    };
+
+    void** tail = &features12.pNext;
+    if (capabilities->api_version >= VK_API_VERSION_1_3) {
+        *tail = &features13;
+        tail = &features13.pNext;
+    }
+
+    if (capabilities->mesh_shader) {
+        *tail = &mesh_features;
+        tail = &mesh_features.pNext;
+    }
+
+    if (capabilities->fragment_shading_rate) {
+        *tail = &shading_rate_features;
+        tail = &shading_rate_features.pNext;
+    }
+
+    vkGetPhysicalDeviceFeatures2(*device, &features2);
+
+    capabilities->timeline_semaphore = features12.timelineSemaphore;
+    capabilities->host_query_reset = features12.hostQueryReset;
+    capabilities->draw_indirect_count = features12.drawIndirectCount;
+    capabilities->dynamic_rendering = features13.dynamicRendering;
+    capabilities->mesh_shader = mesh_features.meshShader && mesh_features.taskShader;
+    capabilities->mesh_shader_queries = capabilities->mesh_shader && mesh_features.meshShaderQueries;
+    capabilities->fragment_shading_rate = shading_rate_features.attachmentFragmentShadingRate && shading_rate_features.pipelineFragmentShadingRate;
+    if (!capabilities->fragment_shading_rate) {
+        return;
+    }
+
+    VkPhysicalDeviceFragmentShadingRatePropertiesKHR shading_rate_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_PROPERTIES_KHR,
+    };
+
+    VkPhysicalDeviceProperties2 properties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &shading_rate_properties,
+    };
+    vkGetPhysicalDeviceProperties2(*device, &properties2);
+
+    // 16x16 texels where allowed, sizes are powers of two
+    VkExtent2D min_texel = shading_rate_properties.minFragmentShadingRateAttachmentTexelSize;
+    VkExtent2D max_texel = shading_rate_properties.maxFragmentShadingRateAttachmentTexelSize;
+    capabilities->shading_rate_texel_size.width = min_texel.width > 16 ? min_texel.width : (max_texel.width < 16 ? max_texel.width : 16);
+    capabilities->shading_rate_texel_size.height = min_texel.height > 16 ? min_texel.height : (max_texel.height < 16 ? max_texel.height : 16);
+
+    VkExtent2D max_fragment = shading_rate_properties.maxFragmentSize;
+    capabilities->shading_rate_max_size = max_fragment.width < max_fragment.height ? max_fragment.width : max_fragment.height;
+}
+
+void probe_device_capabilities(VkPhysicalDevice* device, struct device_capabilities* capabilities) {
+    memset(capabilities, 0, sizeof(struct device_capabilities));
+
+    probe_properties(device, capabilities);
+    probe_memory(device, capabilities);
+    probe_features(device, capabilities);
+
+    capabilities->queues = find_queue_families(device);
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(*device, &family_count, NULL);
+
+    VkQueueFamilyProperties* families = malloc(sizeof(VkQueueFamilyProperties) * family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(*device, &family_count, families);
+    if (capabilities->queues.graphics_family.assigned) {
+        capabilities->timestamp_valid_bits = families[capabilities->queues.graphics_family.value].timestampValidBits;
+    }
+
+    free(families);
+}
+
+static int64_t type_score(VkPhysicalDeviceType type, enum device_policy policy) {
+    switch (policy) {
+    case DEVICE_POLICY_LOW_POWER:
+        switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 10000;
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 5000;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2000;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return 500;
+        default: return 100;
+        }
+    case DEVICE_POLICY_SOFTWARE:
+        switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return 10000;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2000;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 1000;
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 1000;
+        default: return 100;
+        }
+    default:
+        switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 10000;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 5000;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2000;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return 500;
+        default: return 100;
+        }
+    }
+}
+
+int64_t score_device_capabilities(const struct device_capabilities* capabilities, enum device_policy policy) {
+    int64_t score = type_score(capabilities->type, policy);
+
+    // One point per 64 MiB of device local memory
+    score += (int64_t)(capabilities->device_local_bytes >> 26);
+
+    if (capabilities->queues.compute_family.assigned) {
+        score += 300;
+    }
+
+    if (capabilities->queues.transfer_family.assigned) {
+        score += 200;
+    }
+
+    if (capabilities->host_visible_device_local_bytes > 256 * 1024 * 1024) {
+        score += 100;
+    }
+
+    score += capabilities->dynamic_rendering ? 200 : 0;
+    score += capabilities->draw_indirect_count ? 150 : 0;
+    score += capabilities->mesh_shader ? 150 : 0;
+    score += capabilities->multi_draw_indirect ? 100 : 0;
+    score += capabilities->timeline_semaphore ? 100 : 0;
+    score += capabilities->texture_compression_bc ? 100 : 0;
+    score += capabilities->fragment_shading_rate ? 50 : 0;
+    score += capabilities->pipeline_statistics_query ? 25 : 0;
+    score += capabilities->calibrated_timestamps ? 25 : 0;
+    score += capabilities->max_image_dimension_2d / 1024;
+
+    return score;
+}
+
+static const char* type_name(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+    default: return "other";
+    }
+}
+
+void print_device_capabilities(const struct device_capabilities* capabilities) {
+    printf("%s (%s, Vulkan %u.%u), uuid ", capabilities->name, type_name(capabilities->type),
+        VK_API_VERSION_MAJOR(capabilities->api_version), VK_API_VERSION_MINOR(capabilities->api_version));
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        printf("%02x", capabilities->uuid[i]);
+    }
+    putchar('\n');
+
+    printf("  %llu MiB device local, %llu MiB host visible device local%s\n",
+        (unsigned long long)(capabilities->device_local_bytes >> 20),
+        (unsigned long long)(capabilities->host_visible_device_local_bytes >> 20),
+        capabilities->unified_memory ? ", unified" : "");
+
+    printf("  queues: graphics %u, present %u, compute %s, transfer %s\n",
+        capabilities->queues.graphics_family.value,
+        capabilities->queues.present_family.value,
+        capabilities->queues.compute_family.assigned ? "dedicated" : "shared",
+        capabilities->queues.transfer_family.assigned ? "dedicated" : "shared");
+
+    printf("  features:%s%s%s%s%s%s%s%s%s\n",
+        capabilities->dynamic_rendering ? " dynamic_rendering" : "",
+        capabilities->timeline_semaphore ? " timeline_semaphore" : "",
+        capabilities->draw_indirect_count ? " draw_indirect_count" : "",
+        capabilities->multi_draw_indirect ? " multi_draw_indirect" : "",
+        capabilities->texture_compression_bc ? " bc" : "",
+        capabilities->mesh_shader ? " mesh_shader" : "",
+        capabilities->fragment_shading_rate ? " fragment_shading_rate" : "",
+        capabilities->pipeline_statistics_query ? " pipeline_statistics" : "",
+        capabilities->calibrated_timestamps ? " calibrated_timestamps" : "");
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "devices.h"
+
+enum device_policy {
+    DEVICE_POLICY_PERFORMANCE,
+    DEVICE_POLICY_LOW_POWER,
+    DEVICE_POLICY_SOFTWARE,
+};
+
+struct device_capabilities {
+    char name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    uint8_t uuid[VK_UUID_SIZE];
+    VkPhysicalDeviceType type;
+    uint32_t api_version;
+    uint32_t vendor_id;
+
+    struct queue_family_indices queues;
+
+    // Memory
+    VkDeviceSize device_local_bytes;
+    VkDeviceSize host_visible_device_local_bytes;
+    bool unified_memory;
+
+    // Limits
+    float timestamp_period;
+    uint32_t timestamp_valid_bits;
+    uint32_t max_image_dimension_2d;
+    uint32_t max_push_constants_size;
+    uint32_t max_compute_work_group_invocations;
+    uint32_t max_draw_indirect_count;
+    float max_sampler_anisotropy;
+    VkDeviceSize min_uniform_buffer_offset_alignment;
+    VkDeviceSize min_storage_buffer_offset_alignment;
+    VkDeviceSize non_coherent_atom_size;
+
+    // Optional features, enabled on the logical device whenever present
+    bool dynamic_rendering;
+    bool timeline_semaphore;
+    bool host_query_reset;
+    bool draw_indirect_count;
+    bool multi_draw_indirect;
+    bool draw_indirect_first_instance;
+    bool sampler_anisotropy;
+    bool texture_compression_bc;
+    bool pipeline_statistics_query;
+    bool inherited_queries;
+    bool sparse_residency_image_2d;
+    bool fragment_stores_and_atomics;
+
+    // Optional extensions
+    bool mesh_shader;
+    bool mesh_shader_queries;
+    bool fragment_shading_rate;
+    bool calibrated_timestamps;
+    bool memory_budget;
+
+    // Shading rate attachment texel size and the largest fragment size, only
+    // set with fragment_shading_rate
+    VkExtent2D shading_rate_texel_size;
+    uint32_t shading_rate_max_size;
+};
+
+extern struct device_capabilities device_capabilities;
+
+void probe_device_capabilities(VkPhysicalDevice* device, struct device_capabilities* capabilities);
+int64_t score_device_capabilities(const struct device_capabilities* capabilities, enum device_policy policy);
+void print_device_capabilities(const struct device_capabilities* capabilities);
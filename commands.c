@@ -1,8 +1,26 @@
 #include "commands.h"
+#include "capabilities.h"
+#include "compute.h"
 #include "devices.h"
+#include "dynamic_geometry.h"
+#include "dynamic_resolution.h"
+#include "gpu_counters.h"
+#include "gpu_timers.h"
 #include "graphics_pipeline.h"
+#include "images.h"
+#include "jobs.h"
+#include "lights.h"
+#include "meshlets.h"
+#include "occlusion.h"
+#include "particles.h"
+#include "post.h"
+#include "scene.h"
+#include "shading_rate.h"
+#include "shadows.h"
 #include "swap_chain.h"
+#include "textures.h"
 #include "vertex_buffer.h"
+#include "virtual_textures.h"
 #include <stdlib.h>
 
 VkQueue graphics_queue;
@@ -11,53 +29,311 @@ VkQueue present_queue;
 VkCommandBuffer* command_buffers;
 VkCommandPool command_pool;
 
-VkResult record_command_buffer(VkCommandBuffer* buffer, uint32_t image_index) {
-    VkCommandBufferBeginInfo info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+// Secondary buffers for parallel recording, pools are per frame and job
+// thread so no pool is ever used by two threads at once
+static VkCommandPool secondary_pools[MAX_FRAMES_IN_FLIGHT][MAX_JOB_THREADS];
+static VkCommandBuffer secondary_buffers[MAX_FRAMES_IN_FLIGHT][MAX_JOB_THREADS][MAX_SECONDARY_BUFFERS];
+static uint32_t secondary_allocated[MAX_FRAMES_IN_FLIGHT][MAX_JOB_THREADS];
+static uint32_t secondary_used[MAX_FRAMES_IN_FLIGHT][MAX_JOB_THREADS];
+static uint32_t secondary_threads = 0;
+
+struct record_context {
+    uint32_t frame;
+    uint32_t phase;
+    uint32_t items_per_job;
+    uint32_t items_count;
+    VkQueryPipelineStatisticFlags statistics;
+    VkCommandBuffer recorded[MAX_SECONDARY_BUFFERS];
+};
+
+// Only the first pass of a frame clears, a later one continues on top of it
+static void begin_rendering(VkCommandBuffer buffer, bool first, bool secondary) {
+    VkClearValue clear_values[2] = {
+        {.color = {{0.f, 0.f, 0.f, 0.1f}}},
+        {.depthStencil = {1.f, 0}},
     };
 
-    vkBeginCommandBuffer(*buffer, &info);
+    if (!device_capabilities.dynamic_rendering) {
+        VkRenderPassBeginInfo render_pass_info = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = first ? render_pass : render_pass_load,
+            .framebuffer = swap_chain_frame_buffer,
+            .renderArea.offset = {0, 0},
+            .renderArea.extent = render_extent,
+            .clearValueCount = 2,
+            .pClearValues = clear_values
+        };
+
+        vkCmdBeginRenderPass(buffer, &render_pass_info, secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    if (first) {
+        transition_image(buffer, color_image, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+        transition_image(buffer, depth_image, VK_IMAGE_ASPECT_DEPTH_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
+    }
+
+    VkAttachmentLoadOp load_op = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
 
-    VkClearValue clear_color = {{{0.f, 0.f, 0.f, 0.1f}}};
-    VkRenderPassBeginInfo render_pass_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = render_pass,
-        .framebuffer = swap_chain_frame_buffers[image_index],
+    VkRenderingAttachmentInfo color_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = color_image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = load_op,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = clear_values[0],
+    };
+
+    VkRenderingAttachmentInfo depth_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = depth_image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = load_op,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = clear_values[1],
+    };
+
+    VkRenderingFragmentShadingRateAttachmentInfoKHR shading_rate_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_FRAGMENT_SHADING_RATE_ATTACHMENT_INFO_KHR,
+        .imageView = shading_rate_view,
+        .imageLayout = VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR,
+        .shadingRateAttachmentTexelSize = device_capabilities.shading_rate_texel_size,
+    };
+
+    VkRenderingInfo rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .pNext = shading_rate_enabled ? &shading_rate_attachment : NULL,
+        .flags = secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0,
         .renderArea.offset = {0, 0},
-        .renderArea.extent = swap_chain_extent,
-        .clearValueCount = 1,
-        .pClearValues = &clear_color
+        .renderArea.extent = render_extent,
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_attachment,
+        .pDepthAttachment = &depth_attachment,
     };
 
-    vkCmdBeginRenderPass(*buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-    {
-        vkCmdBindPipeline(*buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        VkViewport viewport = {
-            .x = 0.f,
-            .y = 0.f,
-            .width = swap_chain_extent.width,
-            .height = swap_chain_extent.height,
-        };
-        vkCmdSetViewport(*buffer, 0, 1, &viewport);
+    vkCmdBeginRendering(buffer, &rendering_info);
+}
 
-        VkRect2D scissors = {
-            .offset = {0, 0},
-            .extent = swap_chain_extent,
+static void end_rendering(VkCommandBuffer buffer) {
+    if (!device_capabilities.dynamic_rendering) {
+        vkCmdEndRenderPass(buffer);
+        return;
+    }
+
+    vkCmdEndRendering(buffer);
+}
+
+static void set_draw_state(VkCommandBuffer buffer) {
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    VkViewport viewport = {
+        .x = 0.f,
+        .y = 0.f,
+        .width = render_extent.width,
+        .height = render_extent.height,
+        .maxDepth = 1.f,
+    };
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+    VkRect2D scissors = {
+        .offset = {0, 0},
+        .extent = render_extent,
+    };
+    vkCmdSetScissor(buffer, 0, 1, &scissors);
+}
+
+static void draw_scene(VkCommandBuffer buffer, uint32_t frame, uint32_t phase) {
+    if (scene.instances_count > 0) {
+        meshlets_draw(buffer, frame, phase, 0, meshlets_items_count(frame));
+        return;
+    }
+
+    struct vertex_push_constants push = {0};
+    mat4x4_identity(push.model);
+    VkDescriptorSet sets[3] = {default_texture.set, virtual_texture_set(frame), light_set(frame)};
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1, 3, sets, 0, NULL);
+    vkCmdPushConstants(buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+
+    if (!dynamic_geometry_vertices(buffer, vertices, sizeof(vertices))) {
+        return;
+    }
+    vkCmdDraw(buffer, VERTICES_SIZE, 1, 0, 0);
+}
+
+static VkCommandBuffer take_secondary(uint32_t frame) {
+    uint32_t thread = job_thread_index();
+    uint32_t* used = &secondary_used[frame][thread];
+    if (*used == MAX_SECONDARY_BUFFERS) {
+        return VK_NULL_HANDLE;
+    }
+
+    if (*used == secondary_allocated[frame][thread]) {
+        VkCommandBufferAllocateInfo buffer_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = secondary_pools[frame][thread],
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
         };
-        vkCmdSetScissor(*buffer, 0, 1, &scissors);
 
-        VkBuffer vertex_buffers[] = {vertex_buffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(*buffer, 0, 1, vertex_buffers, offsets);
+        if (vkAllocateCommandBuffers(logical_device, &buffer_info, &secondary_buffers[frame][thread][*used]) != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+        secondary_allocated[frame][thread]++;
+    }
+
+    return secondary_buffers[frame][thread][(*used)++];
+}
+
+static void record_secondary(void* data, uint32_t index) {
+    struct record_context* context = data;
+    VkCommandBuffer buffer = take_secondary(context->frame);
+    context->recorded[index] = buffer;
+    if (buffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VkCommandBufferInheritanceRenderingInfo rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &color_format,
+        .depthAttachmentFormat = depth_format,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pipelineStatistics = context->statistics,
+    };
+
+    if (device_capabilities.dynamic_rendering) {
+        inheritance_info.pNext = &rendering_info;
+    } else {
+        inheritance_info.renderPass = context->phase == MESHLET_PHASE_LATE ? render_pass_load : render_pass;
+        inheritance_info.framebuffer = swap_chain_frame_buffer;
+    }
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
 
-        vkCmdDraw(*buffer, VERTICES_SIZE, 1, 0, 0);
+    uint32_t first = index * context->items_per_job;
+    uint32_t count = first + context->items_per_job < context->items_count ? context->items_per_job : context->items_count - first;
+
+    vkBeginCommandBuffer(buffer, &begin_info);
+    set_draw_state(buffer);
+    meshlets_draw(buffer, context->frame, context->phase, first, count);
+    if (first + count == context->items_count && context->phase != MESHLET_PHASE_EARLY) {
+        particles_draw(buffer);
+    }
+    vkEndCommandBuffer(buffer);
+}
+
+// Large scenes are split into item ranges recorded as secondary buffers on
+// the job threads, the primary only executes them in order
+static void draw_pass(VkCommandBuffer buffer, uint32_t frame, uint32_t phase) {
+    bool first = phase != MESHLET_PHASE_LATE;
+    bool last = phase != MESHLET_PHASE_EARLY;
+
+    uint32_t items_count = scene.instances_count > 0 ? meshlets_items_count(frame) : 0;
+    uint32_t threads = secondary_threads;
+    VkQueryPipelineStatisticFlags statistics = 0;
+    if (threads <= 1 || items_count < PARALLEL_RECORD_ITEMS || !gpu_counters_inherited(&statistics)) {
+        begin_rendering(buffer, first, false);
+        set_draw_state(buffer);
+        draw_scene(buffer, frame, phase);
+        if (last) {
+            particles_draw(buffer);
+        }
+        end_rendering(buffer);
+        return;
     }
-    vkCmdEndRenderPass(*buffer);
+
+    struct record_context context = {
+        .frame = frame,
+        .phase = phase,
+        .items_per_job = (items_count + threads - 1) / threads,
+        .items_count = items_count,
+        .statistics = statistics,
+    };
+    uint32_t jobs = (items_count + context.items_per_job - 1) / context.items_per_job;
+    job_parallel_for(record_secondary, &context, jobs, "record_commands");
+
+    begin_rendering(buffer, first, true);
+    for (uint32_t i = 0; i < jobs; i++) {
+        if (context.recorded[i] != VK_NULL_HANDLE) {
+            vkCmdExecuteCommands(buffer, 1, &context.recorded[i]);
+        }
+    }
+    end_rendering(buffer);
+}
+
+VkResult record_command_buffer(VkCommandBuffer* buffer, uint32_t image_index, uint32_t frame) {
+    VkCommandBufferBeginInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    };
+
+    vkBeginCommandBuffer(*buffer, &info);
+    gpu_timers_begin_frame(*buffer, frame);
+    gpu_counters_begin_frame(*buffer);
+    uint32_t frame_timer = gpu_timer_begin(*buffer, "frame");
+    compute_record_inline(*buffer);
+
+    // The frame's fence has signalled, its secondary buffers are free again
+    for (uint32_t i = 0; i < secondary_threads; i++) {
+        vkResetCommandPool(logical_device, secondary_pools[frame][i], 0);
+        secondary_used[frame][i] = 0;
+    }
+
+    virtual_textures_upload(*buffer, frame);
+
+    uint32_t pass = gpu_pass_begin(*buffer, "particles");
+    particles_simulate(*buffer);
+    gpu_pass_end(*buffer, pass);
+
+    pass = gpu_pass_begin(*buffer, "light_culling");
+    lights_cull(*buffer, frame);
+    gpu_pass_end(*buffer, pass);
+
+    pass = gpu_pass_begin(*buffer, "shadows");
+    shadows_render(*buffer);
+    gpu_pass_end(*buffer, pass);
+
+    shading_rate_prepare(*buffer);
+
+    // Draw what was visible last frame, build the depth pyramid from it and
+    // draw what it no longer hides
+    pass = gpu_pass_begin(*buffer, "scene");
+    if (occlusion_culling_enabled && scene.instances_count > 0) {
+        meshlets_cull(*buffer, frame, MESHLET_PHASE_EARLY);
+        draw_pass(*buffer, frame, MESHLET_PHASE_EARLY);
+        build_depth_pyramid(*buffer);
+        meshlets_cull(*buffer, frame, MESHLET_PHASE_LATE);
+        draw_pass(*buffer, frame, MESHLET_PHASE_LATE);
+    } else {
+        draw_pass(*buffer, frame, MESHLET_PHASE_ALL);
+    }
+    gpu_pass_end(*buffer, pass);
+
+    post_record(*buffer, image_index);
+    shading_rate_update(*buffer);
+    virtual_textures_feedback_barrier(*buffer, frame);
+    gpu_timer_end(*buffer, frame_timer);
     return vkEndCommandBuffer(*buffer);
 }
 
 VkResult create_command_pool() {
-    struct queue_family_indices indices = find_queue_families(&physical_device);
+    struct queue_family_indices indices = device_capabilities.queues;
     VkCommandPoolCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
@@ -78,3 +354,35 @@ VkResult create_command_buffers() {
 
     return vkAllocateCommandBuffers(logical_device, &buffer_info, command_buffers);
 }
+
+VkResult create_secondary_pools() {
+    secondary_threads = job_threads_count();
+    struct queue_family_indices indices = device_capabilities.queues;
+    VkCommandPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = indices.graphics_family.value,
+    };
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        for (uint32_t i = 0; i < secondary_threads; i++) {
+            VkResult result = vkCreateCommandPool(logical_device, &create_info, NULL, &secondary_pools[frame][i]);
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_secondary_pools() {
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        for (uint32_t i = 0; i < secondary_threads; i++) {
+            vkDestroyCommandPool(logical_device, secondary_pools[frame][i], NULL);
+            secondary_allocated[frame][i] = 0;
+        }
+    }
+
+    secondary_threads = 0;
+}
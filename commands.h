@@ -4,6 +4,8 @@
 #include <GLFW/glfw3.h>
 
 #define MAX_FRAMES_IN_FLIGHT 2
+#define MAX_SECONDARY_BUFFERS 64
+#define PARALLEL_RECORD_ITEMS 256
 
 extern VkQueue graphics_queue;
 extern VkQueue present_queue;
@@ -13,4 +15,6 @@ extern VkCommandPool command_pool;
 
 VkResult create_command_buffers();
 VkResult create_command_pool();
-VkResult record_command_buffer(VkCommandBuffer* buffer, uint32_t image_index);
+VkResult create_secondary_pools();
+void destroy_secondary_pools();
+VkResult record_command_buffer(VkCommandBuffer* buffer, uint32_t image_index, uint32_t frame);
@@ -0,0 +1,186 @@
+#include "compute.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+VkQueue compute_queue;
+bool async_compute_enabled = false;
+
+static VkCommandPool compute_command_pool;
+static VkCommandBuffer* compute_command_buffers;
+static VkSemaphore* compute_finished_semaphore;
+
+static struct compute_job jobs[MAX_COMPUTE_JOBS];
+static uint8_t job_push_constants[MAX_COMPUTE_JOBS][MAX_COMPUTE_PUSH_CONSTANTS];
+static uint32_t jobs_count = 0;
+
+VkResult create_compute_context() {
+    async_compute_enabled = device_capabilities.queues.compute_family.assigned && getenv("VL_NO_ASYNC_COMPUTE") == NULL;
+    if (!async_compute_enabled) {
+        // Jobs get recorded into the graphics command buffer instead
+        return VK_SUCCESS;
+    }
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = device_capabilities.queues.compute_family.value,
+    };
+
+    VkResult result = vkCreateCommandPool(logical_device, &pool_info, NULL, &compute_command_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    compute_command_buffers = malloc(sizeof(VkCommandBuffer) * MAX_FRAMES_IN_FLIGHT);
+    VkCommandBufferAllocateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = compute_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
+    };
+
+    result = vkAllocateCommandBuffers(logical_device, &buffer_info, compute_command_buffers);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+
+    compute_finished_semaphore = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        result = vkCreateSemaphore(logical_device, &semaphore_info, NULL, &compute_finished_semaphore[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_compute_context() {
+    if (!async_compute_enabled) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroySemaphore(logical_device, compute_finished_semaphore[i], NULL);
+    }
+
+    vkDestroyCommandPool(logical_device, compute_command_pool, NULL);
+
+    free(compute_finished_semaphore);
+    free(compute_command_buffers);
+}
+
+void compute_enqueue(const struct compute_job* job) {
+    if (jobs_count == MAX_COMPUTE_JOBS || job->push_constants_size > MAX_COMPUTE_PUSH_CONSTANTS) {
+        puts("Dropping compute job");
+        return;
+    }
+
+    // Callers often pass push constants from the stack
+    jobs[jobs_count] = *job;
+    if (job->push_constants_size > 0) {
+        memcpy(job_push_constants[jobs_count], job->push_constants, job->push_constants_size);
+        jobs[jobs_count].push_constants = job_push_constants[jobs_count];
+    }
+
+    jobs_count++;
+}
+
+void compute_record_jobs(VkCommandBuffer buffer, const struct compute_job* list, uint32_t count) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct compute_job* job = &list[i];
+        if (job->depends_on_previous && i > 0) {
+            vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+        }
+
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, job->pipeline);
+        if (job->descriptor_set != VK_NULL_HANDLE) {
+            vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, job->layout, 0, 1, &job->descriptor_set, 0, NULL);
+        }
+
+        if (job->push_constants_size > 0) {
+            vkCmdPushConstants(buffer, job->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, job->push_constants_size, job->push_constants);
+        }
+
+        vkCmdDispatch(buffer, job->group_count_x, job->group_count_y, job->group_count_z);
+    }
+}
+
+// Fallback without a dedicated compute family, runs the jobs at the start of
+// the frame's graphics command buffer and makes the results visible to drawing
+void compute_record_inline(VkCommandBuffer buffer) {
+    if (async_compute_enabled || jobs_count == 0) {
+        return;
+    }
+
+    compute_record_jobs(buffer, jobs, jobs_count);
+    jobs_count = 0;
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+    };
+
+    VkPipelineStageFlags dst_stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stages, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+// Submits the queued jobs on the compute queue. The returned semaphore has to
+// be waited on by the graphics submission of the same frame, it is left as
+// VK_NULL_HANDLE when nothing was submitted.
+VkResult compute_submit(uint32_t frame, VkSemaphore* signaled) {
+    *signaled = VK_NULL_HANDLE;
+    if (!async_compute_enabled || jobs_count == 0) {
+        return VK_SUCCESS;
+    }
+
+    VkCommandBuffer buffer = compute_command_buffers[frame];
+    vkResetCommandBuffer(buffer, 0);
+
+    VkCommandBufferBeginInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    vkBeginCommandBuffer(buffer, &info);
+    compute_record_jobs(buffer, jobs, jobs_count);
+    VkResult result = vkEndCommandBuffer(buffer);
+    jobs_count = 0;
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &compute_finished_semaphore[frame],
+    };
+
+    struct trace_zone zone = trace_zone_begin("submit_compute");
+    result = vkQueueSubmit(compute_queue, 1, &submit_info, VK_NULL_HANDLE);
+    trace_zone_end(&zone);
+    if (result == VK_SUCCESS) {
+        *signaled = compute_finished_semaphore[frame];
+    }
+
+    return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_COMPUTE_JOBS 256
+#define MAX_COMPUTE_PUSH_CONSTANTS 128
+
+extern VkQueue compute_queue;
+extern bool async_compute_enabled;
+
+struct compute_job {
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkDescriptorSet descriptor_set;
+
+    const void* push_constants;
+    uint32_t push_constants_size;
+
+    uint32_t group_count_x;
+    uint32_t group_count_y;
+    uint32_t group_count_z;
+
+    // Wait for every job queued before this one
+    bool depends_on_previous;
+};
+
+VkResult create_compute_context();
+void destroy_compute_context();
+
+void compute_enqueue(const struct compute_job* job);
+VkResult compute_submit(uint32_t frame, VkSemaphore* signaled);
+void compute_record_inline(VkCommandBuffer buffer);
+void compute_record_jobs(VkCommandBuffer buffer, const struct compute_job* jobs, uint32_t count);
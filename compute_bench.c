@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "compute_bench.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "compute.h"
+#include "devices.h"
+#include "shaders.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_ELEMENTS (1 << 20)
+#define BENCH_ITERATIONS 256
+#define BENCH_RUNS 15
+
+struct bench_push_constants {
+    uint32_t iterations;
+    uint32_t count;
+};
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void record_dispatch(VkCommandBuffer buffer, struct compute_job* job) {
+    VkCommandBufferBeginInfo info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    };
+
+    vkBeginCommandBuffer(buffer, &info);
+    compute_record_jobs(buffer, job, 1);
+    vkEndCommandBuffer(buffer);
+}
+
+static double timed_submit(VkQueue* queues, VkCommandBuffer* buffers, VkFence* fences, uint32_t count) {
+    vkResetFences(logical_device, count, fences);
+
+    double start = now_ms();
+    for (uint32_t i = 0; i < count; i++) {
+        VkSubmitInfo submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &buffers[i],
+        };
+        vkQueueSubmit(queues[i], 1, &submit_info, fences[i]);
+    }
+
+    vkWaitForFences(logical_device, count, fences, VK_TRUE, UINT64_MAX);
+    return now_ms() - start;
+}
+
+static double median(double* samples, uint32_t count) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    return samples[count / 2];
+}
+
+// The graphics queue half of the workload stands in for raster work, both
+// halves are the same ALU bound kernel so the gain is easy to read: 2x means
+// the two queues fully overlapped, 1x means they were serialized.
+int run_compute_benchmark() {
+    VkDeviceSize size = sizeof(float) * 4 * BENCH_ELEMENTS;
+
+    VkBuffer buffers[2];
+    VkDeviceMemory memory[2];
+    for (int i = 0; i < 2; i++) {
+        if (create_shared_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers[i], &memory[i]) != VK_SUCCESS) {
+            puts("Failed to create benchmark buffers");
+            return 1;
+        }
+    }
+
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    VkDescriptorSetLayout set_layout;
+    vkCreateDescriptorSetLayout(logical_device, &set_layout_info, NULL, &set_layout);
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 2,
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 2,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    VkDescriptorPool descriptor_pool;
+    vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+
+    VkDescriptorSetLayout set_layouts[2] = {set_layout, set_layout};
+    VkDescriptorSetAllocateInfo set_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 2,
+        .pSetLayouts = set_layouts,
+    };
+
+    VkDescriptorSet sets[2];
+    vkAllocateDescriptorSets(logical_device, &set_info, sets);
+    for (int i = 0; i < 2; i++) {
+        VkDescriptorBufferInfo buffer_info = {
+            .buffer = buffers[i],
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        };
+
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = sets[i],
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_info,
+        };
+        vkUpdateDescriptorSets(logical_device, 1, &write, 0, NULL);
+    }
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct bench_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkPipelineLayout layout;
+    vkCreatePipelineLayout(logical_device, &layout_info, NULL, &layout);
+
+    VkPipeline busy_pipeline;
+    if (create_compute_pipeline("./shaders/busy.spv", layout, &busy_pipeline) != VK_SUCCESS) {
+        puts("Failed to create benchmark pipeline");
+        return 1;
+    }
+
+    struct bench_push_constants push = {
+        .iterations = BENCH_ITERATIONS,
+        .count = BENCH_ELEMENTS,
+    };
+
+    struct compute_job jobs[2];
+    for (int i = 0; i < 2; i++) {
+        struct compute_job job = {
+            .pipeline = busy_pipeline,
+            .layout = layout,
+            .descriptor_set = sets[i],
+            .push_constants = &push,
+            .push_constants_size = sizeof(push),
+            .group_count_x = BENCH_ELEMENTS / 64,
+            .group_count_y = 1,
+            .group_count_z = 1,
+        };
+        jobs[i] = job;
+    }
+
+    // The serialized run keeps the halves ordered, as a graphics pass feeding
+    // a compute pass on one queue would be
+    jobs[1].depends_on_previous = true;
+
+    VkCommandPool compute_pool = command_pool;
+    if (async_compute_enabled) {
+        VkCommandPoolCreateInfo compute_pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .queueFamilyIndex = device_capabilities.queues.compute_family.value,
+        };
+        vkCreateCommandPool(logical_device, &compute_pool_info, NULL, &compute_pool);
+    }
+
+    // serial, graphics half, compute half
+    VkCommandBuffer command[3];
+    VkCommandBufferAllocateInfo graphics_alloc = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 2,
+    };
+    vkAllocateCommandBuffers(logical_device, &graphics_alloc, command);
+
+    VkCommandBufferAllocateInfo compute_alloc = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = compute_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    vkAllocateCommandBuffers(logical_device, &compute_alloc, &command[2]);
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VkFence fences[2];
+    vkCreateFence(logical_device, &fence_info, NULL, &fences[0]);
+    vkCreateFence(logical_device, &fence_info, NULL, &fences[1]);
+
+    VkQueue serial_queues[1] = {graphics_queue};
+
+    // Start from finite values, sin() of garbage can hit slow paths
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    };
+    vkBeginCommandBuffer(command[0], &begin_info);
+    vkCmdFillBuffer(command[0], buffers[0], 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(command[0], buffers[1], 0, VK_WHOLE_SIZE, 0);
+    vkEndCommandBuffer(command[0]);
+    timed_submit(serial_queues, &command[0], fences, 1);
+
+    vkBeginCommandBuffer(command[0], &begin_info);
+    compute_record_jobs(command[0], jobs, 2);
+    vkEndCommandBuffer(command[0]);
+
+    record_dispatch(command[1], &jobs[0]);
+    record_dispatch(command[2], &jobs[1]);
+    VkQueue overlapped_queues[2] = {graphics_queue, compute_queue};
+
+    // Warm up clocks and caches before sampling
+    timed_submit(serial_queues, &command[0], fences, 1);
+
+    double serial[BENCH_RUNS];
+    double overlapped[BENCH_RUNS];
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        serial[i] = timed_submit(serial_queues, &command[0], fences, 1);
+        overlapped[i] = timed_submit(overlapped_queues, &command[1], fences, 2);
+    }
+
+    double serial_ms = median(serial, BENCH_RUNS);
+    double overlapped_ms = median(overlapped, BENCH_RUNS);
+
+    printf("compute benchmark on %s\n", device_capabilities.name);
+    printf("  serialized: %.3f ms\n", serial_ms);
+    printf("  overlapped: %.3f ms\n", overlapped_ms);
+
+    // Both halves went to the graphics queue, nothing could overlap
+    if (async_compute_enabled) {
+        printf("  gain: %.2fx\n", serial_ms / overlapped_ms);
+    } else {
+        puts("  gain: N/A (no async compute queue)");
+    }
+
+    vkDestroyFence(logical_device, fences[0], NULL);
+    vkDestroyFence(logical_device, fences[1], NULL);
+    vkFreeCommandBuffers(logical_device, command_pool, 2, command);
+    if (async_compute_enabled) {
+        vkDestroyCommandPool(logical_device, compute_pool, NULL);
+    } else {
+        vkFreeCommandBuffers(logical_device, command_pool, 1, &command[2]);
+    }
+
+    vkDestroyPipeline(logical_device, busy_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, layout, NULL);
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+
+    for (int i = 0; i < 2; i++) {
+        vkDestroyBuffer(logical_device, buffers[i], NULL);
+        vkFreeMemory(logical_device, memory[i], NULL);
+    }
+
+    return 0;
+}
@@ -1,8 +1,13 @@
 #include "devices.h"
+#include "capabilities.h"
 #include "commands.h"
+#include "compute.h"
+#include "streaming.h"
 #include "main.h"
 #include "surfaces.h"
 #include "swap_chain.h"
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -24,7 +29,7 @@ static bool check_extension_support(VkPhysicalDevice* device) {
 
     uint32_t matches = 0;
     for (uint32_t i = 0; i < count; i++) {
-        for (uint32_t n = 0; n < extension_count; n++) { 
+        for (uint32_t n = 0; n < extension_count; n++) {
             if (strcmp(device_extensions[i], available[n].extensionName) == 0) {
                 matches++;
                 break;
@@ -38,13 +43,8 @@ static bool check_extension_support(VkPhysicalDevice* device) {
 }
 
 static bool device_suitable(VkPhysicalDevice* device) {
-    VkPhysicalDeviceProperties properties;
-    vkGetPhysicalDeviceProperties(*device, &properties);
-    
-    VkPhysicalDeviceFeatures features;
-    vkGetPhysicalDeviceFeatures(*device, &features);
     struct queue_family_indices indices = find_queue_families(device);
-    if (!indices.graphics_family.assigned) {
+    if (!indices.graphics_family.assigned || !indices.present_family.assigned) {
         return false;
     }
 
@@ -63,51 +63,144 @@ static bool device_suitable(VkPhysicalDevice* device) {
         }
     }
 
-    return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && features.geometryShader && supports_swap_chain;
+    return supports_swap_chain;
 }
 
+static uint32_t add_queue_family(uint32_t* families, uint32_t count, struct optional_uint32_t family) {
+    if (!family.assigned) {
+        return count;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (families[i] == family.value) {
+            return count;
+        }
+    }
+
+    families[count] = family.value;
+    return count + 1;
+}
 
 VkResult create_logical_device() {
-    struct queue_family_indices indices = find_queue_families(&physical_device);
+    struct queue_family_indices indices = device_capabilities.queues;
     float priority = 1.f;
 
-    uint32_t unique_count = 1;
-    if (indices.graphics_family.value != indices.present_family.value) {
-        unique_count = 2;
+    uint32_t families[4];
+    uint32_t unique_count = 0;
+    unique_count = add_queue_family(families, unique_count, indices.graphics_family);
+    unique_count = add_queue_family(families, unique_count, indices.present_family);
+    unique_count = add_queue_family(families, unique_count, indices.compute_family);
+    unique_count = add_queue_family(families, unique_count, indices.transfer_family);
+
+    VkDeviceQueueCreateInfo queue_create_infos[4];
+    for (uint32_t i = 0; i < unique_count; i++) {
+        VkDeviceQueueCreateInfo queue_create_info = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = families[i],
+            .queueCount = 1,
+            .pQueuePriorities = &priority,
+        };
+
+        queue_create_infos[i] = queue_create_info;
+    }
+
+    const char* extensions[8];
+    uint32_t extension_count = 0;
+    for (size_t i = 0; i < sizeof(device_extensions) / sizeof(char*); i++) {
+        extensions[extension_count++] = device_extensions[i];
+    }
+
+    if (device_capabilities.mesh_shader) {
+        extensions[extension_count++] = VK_EXT_MESH_SHADER_EXTENSION_NAME;
+    }
+
+    if (device_capabilities.fragment_shading_rate) {
+        extensions[extension_count++] = VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME;
+    }
+
+    if (device_capabilities.calibrated_timestamps) {
+        extensions[extension_count++] = VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+    }
+
+    if (device_capabilities.memory_budget) {
+        extensions[extension_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
     }
 
-    VkDeviceQueueCreateInfo queue_create_infos[2];
-    VkDeviceQueueCreateInfo graphics_queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = indices.graphics_family.value,
-        .queueCount = 1,
-        .pQueuePriorities = &priority,
+    VkPhysicalDeviceMeshShaderFeaturesEXT mesh_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = VK_TRUE,
+        .meshShader = VK_TRUE,
+        .meshShaderQueries = device_capabilities.mesh_shader_queries,
+    };
+
+    VkPhysicalDeviceFragmentShadingRateFeaturesKHR shading_rate_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR,
+        .pipelineFragmentShadingRate = VK_TRUE,
+        .attachmentFragmentShadingRate = VK_TRUE,
     };
 
-    VkDeviceQueueCreateInfo present_queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = indices.present_family.value,
-        .queueCount = 1,
-        .pQueuePriorities = &priority,
+    VkPhysicalDeviceVulkan13Features features13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .dynamicRendering = device_capabilities.dynamic_rendering,
     };
 
-    queue_create_infos[0] = graphics_queue_create_info;
-    queue_create_infos[1] = present_queue_create_info;
+    VkPhysicalDeviceVulkan12Features features12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .timelineSemaphore = device_capabilities.timeline_semaphore,
+        .hostQueryReset = device_capabilities.host_query_reset,
+        .drawIndirectCount = device_capabilities.draw_indirect_count,
+    };
+
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .features.multiDrawIndirect = device_capabilities.multi_draw_indirect,
+        .features.drawIndirectFirstInstance = device_capabilities.draw_indirect_first_instance,
+        .features.samplerAnisotropy = device_capabilities.sampler_anisotropy,
+        .features.textureCompressionBC = device_capabilities.texture_compression_bc,
+        .features.pipelineStatisticsQuery = device_capabilities.pipeline_statistics_query,
+        .features.inheritedQueries = device_capabilities.inherited_queries,
+        .features.sparseBinding = device_capabilities.sparse_residency_image_2d,
+        .features.sparseResidencyImage2D = device_capabilities.sparse_residency_image_2d,
+        .features.fragmentStoresAndAtomics = device_capabilities.fragment_stores_and_atomics,
+    };
+
+    void** tail = &features.pNext;
+    if (device_capabilities.api_version >= VK_API_VERSION_1_2) {
+        *tail = &features12;
+        tail = &features12.pNext;
+    }
 
-    VkPhysicalDeviceFeatures features;
-    memset(&features, VK_FALSE, sizeof(VkPhysicalDeviceFeatures));
+    if (device_capabilities.api_version >= VK_API_VERSION_1_3) {
+        *tail = &features13;
+        tail = &features13.pNext;
+    }
+
+    if (device_capabilities.mesh_shader) {
+        *tail = &mesh_features;
+        tail = &mesh_features.pNext;
+    }
+
+    if (device_capabilities.fragment_shading_rate) {
+        *tail = &shading_rate_features;
+        tail = &shading_rate_features.pNext;
+    }
 
-    size_t extension_count = sizeof(device_extensions) / sizeof(char*);
     VkDeviceCreateInfo device_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &features,
         .pQueueCreateInfos = queue_create_infos,
         .queueCreateInfoCount = unique_count,
-        .pEnabledFeatures = &features,
         .enabledLayerCount = 0,
         .enabledExtensionCount = extension_count,
-        .ppEnabledExtensionNames = device_extensions,
+        .ppEnabledExtensionNames = extensions,
     };
 
+    // Vulkan 1.0 devices only understand the plain feature struct
+    if (device_capabilities.api_version < VK_API_VERSION_1_1) {
+        device_create_info.pNext = NULL;
+        device_create_info.pEnabledFeatures = &features.features;
+    }
+
     VkResult out = vkCreateDevice(physical_device, &device_create_info, NULL, &logical_device);
     if (out != VK_SUCCESS) {
         return out;
@@ -116,32 +209,64 @@ VkResult create_logical_device() {
     vkGetDeviceQueue(logical_device, indices.graphics_family.value, 0, &graphics_queue);
     vkGetDeviceQueue(logical_device, indices.present_family.value, 0, &present_queue);
 
+    compute_queue = graphics_queue;
+    if (indices.compute_family.assigned) {
+        vkGetDeviceQueue(logical_device, indices.compute_family.value, 0, &compute_queue);
+    }
+
+    transfer_queue = graphics_queue;
+    if (indices.transfer_family.assigned) {
+        vkGetDeviceQueue(logical_device, indices.transfer_family.value, 0, &transfer_queue);
+    }
+
     return VK_SUCCESS;
 }
 
 struct queue_family_indices find_queue_families(VkPhysicalDevice* device) {
-    struct queue_family_indices indices;
+    struct queue_family_indices indices = {0};
     uint32_t family_count = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(*device, &family_count, NULL);
 
     VkQueueFamilyProperties* families = malloc(sizeof(VkQueueFamilyProperties) * family_count);
     vkGetPhysicalDeviceQueueFamilyProperties(*device, &family_count, families);
     for (uint32_t i = 0; i < family_count; i++) {
-        VkQueueFamilyProperties family = families[i];
-        if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        VkQueueFlags flags = families[i].queueFlags;
+
+        VkBool32 present_support = false;
+        vkGetPhysicalDeviceSurfaceSupportKHR(*device, i, surface, &present_support);
+
+        // A family that can both draw and present avoids sharing swap chain images
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && present_support) {
+            bool both = indices.graphics_family.assigned && indices.present_family.assigned &&
+                indices.graphics_family.value == indices.present_family.value;
+            if (!both) {
+                indices.graphics_family.value = i;
+                indices.graphics_family.assigned = true;
+                indices.present_family.value = i;
+                indices.present_family.assigned = true;
+            }
+        }
+
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphics_family.assigned) {
             indices.graphics_family.value = i;
             indices.graphics_family.assigned = true;
         }
 
-        VkBool32 present_support = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(*device, i, surface, &present_support);
-        if (present_support) {
+        if (present_support && !indices.present_family.assigned) {
             indices.present_family.value = i;
             indices.present_family.assigned = true;
         }
-        
-        if (indices.graphics_family.assigned && indices.present_family.assigned) {
-            break;
+
+        // Async compute, a compute family without graphics
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !indices.compute_family.assigned) {
+            indices.compute_family.value = i;
+            indices.compute_family.assigned = true;
+        }
+
+        // Copy engine, a family that can only transfer
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && !indices.transfer_family.assigned) {
+            indices.transfer_family.value = i;
+            indices.transfer_family.assigned = true;
         }
     }
 
@@ -150,6 +275,49 @@ struct queue_family_indices find_queue_families(VkPhysicalDevice* device) {
     return indices;
 }
 
+static enum device_policy read_device_policy() {
+    const char* policy = getenv("VL_DEVICE_POLICY");
+    if (policy == NULL) {
+        return DEVICE_POLICY_PERFORMANCE;
+    }
+
+    if (strcmp(policy, "low-power") == 0) {
+        return DEVICE_POLICY_LOW_POWER;
+    }
+
+    if (strcmp(policy, "software") == 0) {
+        return DEVICE_POLICY_SOFTWARE;
+    }
+
+    return DEVICE_POLICY_PERFORMANCE;
+}
+
+// Accepts the UUID as 32 hex digits, dashes are ignored
+static bool read_pinned_uuid(uint8_t* uuid) {
+    const char* text = getenv("VL_DEVICE_UUID");
+    if (text == NULL) {
+        return false;
+    }
+
+    uint32_t digits = 0;
+    memset(uuid, 0, VK_UUID_SIZE);
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '-') {
+            continue;
+        }
+
+        if (!isxdigit((unsigned char)*c) || digits == VK_UUID_SIZE * 2) {
+            puts("VL_DEVICE_UUID is not a valid device UUID, ignoring it");
+            return false;
+        }
+
+        uint8_t nibble = isdigit((unsigned char)*c) ? *c - '0' : (tolower((unsigned char)*c) - 'a') + 10;
+        uuid[digits / 2] |= digits % 2 == 0 ? nibble << 4 : nibble;
+        digits++;
+    }
+
+    return digits == VK_UUID_SIZE * 2;
+}
 
 VkResult init_device() {
     uint32_t device_count = 0;
@@ -161,22 +329,50 @@ VkResult init_device() {
     VkPhysicalDevice* devices = malloc(sizeof(VkPhysicalDevice) * device_count);
     vkEnumeratePhysicalDevices(instance, &device_count, devices);
 
+    enum device_policy policy = read_device_policy();
+    uint8_t pinned_uuid[VK_UUID_SIZE];
+    bool pinned = read_pinned_uuid(pinned_uuid);
+
     physical_device = VK_NULL_HANDLE;
+    int64_t best_score = -1;
     for (uint32_t i = 0; i < device_count; i++) {
         VkPhysicalDevice device = devices[i];
         if (!device_suitable(&device)) {
             continue;
         }
 
+        struct device_capabilities capabilities;
+        probe_device_capabilities(&device, &capabilities);
+
+        int64_t score = score_device_capabilities(&capabilities, policy);
+        if (pinned) {
+            if (memcmp(capabilities.uuid, pinned_uuid, VK_UUID_SIZE) != 0) {
+                continue;
+            }
+
+            score = INT64_MAX;
+        }
+
+        if (score <= best_score) {
+            continue;
+        }
+
         physical_device = device;
-        break;
+        device_capabilities = capabilities;
+        best_score = score;
     }
 
     free(devices);
 
     if (physical_device == VK_NULL_HANDLE) {
+        if (pinned) {
+            puts("No suitable device matches VL_DEVICE_UUID");
+        }
+
         return !VK_SUCCESS;
     }
 
+    print_device_capabilities(&device_capabilities);
+
     return VK_SUCCESS;
 }
@@ -15,6 +15,8 @@ struct optional_uint32_t {
 struct queue_family_indices {
     struct optional_uint32_t graphics_family;
     struct optional_uint32_t present_family;
+    struct optional_uint32_t compute_family;
+    struct optional_uint32_t transfer_family;
 };
 
 struct queue_family_indices find_queue_families(VkPhysicalDevice* device);
@@ -0,0 +1,87 @@
+#include "dynamic_geometry.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include <string.h>
+
+static VkBuffer buffer;
+static VkDeviceMemory memory;
+static uint8_t* mapped;
+static VkDeviceSize region_offset = 0;
+static VkDeviceSize region_used = 0;
+
+VkResult create_dynamic_geometry() {
+    VkDeviceSize size = (VkDeviceSize)DYNAMIC_GEOMETRY_FRAME_BYTES * MAX_FRAMES_IN_FLIGHT;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    // Where the device can map its own memory the GPU reads the writes
+    // without crossing the bus again
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    if (device_capabilities.unified_memory) {
+        result = create_buffer(size, usage, host | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer, &memory);
+    }
+
+    if (result != VK_SUCCESS) {
+        result = create_buffer(size, usage, host, &buffer, &memory);
+    }
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return vkMapMemory(logical_device, memory, 0, size, 0, (void**)&mapped);
+}
+
+void destroy_dynamic_geometry() {
+    // Freeing the memory unmaps it
+    vkDestroyBuffer(logical_device, buffer, NULL);
+    vkFreeMemory(logical_device, memory, NULL);
+    mapped = NULL;
+}
+
+void dynamic_geometry_begin(uint32_t frame) {
+    region_offset = (VkDeviceSize)frame * DYNAMIC_GEOMETRY_FRAME_BYTES;
+    __atomic_store_n(&region_used, 0, __ATOMIC_RELAXED);
+}
+
+bool dynamic_geometry_allocate(VkDeviceSize size, struct dynamic_allocation* allocation) {
+    VkDeviceSize aligned = (size + DYNAMIC_GEOMETRY_ALIGNMENT - 1) & ~(VkDeviceSize)(DYNAMIC_GEOMETRY_ALIGNMENT - 1);
+    VkDeviceSize offset = __atomic_fetch_add(&region_used, aligned, __ATOMIC_RELAXED);
+    if (offset + aligned > DYNAMIC_GEOMETRY_FRAME_BYTES) {
+        return false;
+    }
+
+    allocation->buffer = buffer;
+    allocation->offset = region_offset + offset;
+    allocation->data = mapped + allocation->offset;
+    return true;
+}
+
+bool dynamic_geometry_vertices(VkCommandBuffer command_buffer, const void* vertices, VkDeviceSize size) {
+    struct dynamic_allocation allocation;
+    if (!dynamic_geometry_allocate(size, &allocation)) {
+        return false;
+    }
+
+    memcpy(allocation.data, vertices, size);
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &allocation.buffer, &allocation.offset);
+    return true;
+}
+
+bool dynamic_geometry_indices(VkCommandBuffer command_buffer, const uint32_t* indices, uint32_t count) {
+    struct dynamic_allocation allocation;
+    if (!dynamic_geometry_allocate(sizeof(uint32_t) * count, &allocation)) {
+        return false;
+    }
+
+    memcpy(allocation.data, indices, sizeof(uint32_t) * count);
+    vkCmdBindIndexBuffer(command_buffer, allocation.buffer, allocation.offset, VK_INDEX_TYPE_UINT32);
+    return true;
+}
+
+VkDeviceSize dynamic_geometry_used() {
+    VkDeviceSize used = __atomic_load_n(&region_used, __ATOMIC_RELAXED);
+    return used < DYNAMIC_GEOMETRY_FRAME_BYTES ? used : DYNAMIC_GEOMETRY_FRAME_BYTES;
+}
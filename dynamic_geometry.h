@@ -0,0 +1,35 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define DYNAMIC_GEOMETRY_FRAME_BYTES (8 << 20)
+#define DYNAMIC_GEOMETRY_ALIGNMENT 16
+
+// Geometry written by the CPU every frame, debug lines, UI and the like. One
+// buffer stays mapped for the life of the device, split into a region per
+// frame in flight, so writing never waits on the GPU or maps anything
+struct dynamic_allocation {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void* data;
+};
+
+VkResult create_dynamic_geometry();
+void destroy_dynamic_geometry();
+
+// Starts over at the beginning of the frame's region, its fence must have
+// signalled
+void dynamic_geometry_begin(uint32_t frame);
+
+// Bump allocates from the current frame's region and is safe to call from
+// jobs. Fails once the region is full, the allocation is valid until the
+// frame's region comes around again
+bool dynamic_geometry_allocate(VkDeviceSize size, struct dynamic_allocation* allocation);
+
+// Copies the data in and binds it as vertex buffer binding 0
+bool dynamic_geometry_vertices(VkCommandBuffer buffer, const void* vertices, VkDeviceSize size);
+bool dynamic_geometry_indices(VkCommandBuffer buffer, const uint32_t* indices, uint32_t count);
+
+VkDeviceSize dynamic_geometry_used();
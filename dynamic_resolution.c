@@ -0,0 +1,79 @@
+#include "dynamic_resolution.h"
+#include "commands.h"
+#include "gpu_timers.h"
+#include "swap_chain.h"
+#include <math.h>
+
+// Aim a little under the target so noise does not push frames over it, and
+// leave a band around it where the scale holds still
+#define DYNAMIC_RESOLUTION_HEADROOM 0.9f
+#define DYNAMIC_RESOLUTION_DEADBAND 0.05f
+
+bool dynamic_resolution_enabled = false;
+VkExtent2D render_extent;
+float render_scale = 1.f;
+
+static float target_frame_ms = 0.f;
+
+// Scale each frame slot was last drawn at, 0 before its first frame. The
+// timer read back for a slot belongs to that frame, not to render_scale
+static float frame_scales[MAX_FRAMES_IN_FLIGHT];
+
+static void apply_scale() {
+    render_extent.width = (uint32_t)(swap_chain_extent.width * render_scale + 0.5f);
+    render_extent.height = (uint32_t)(swap_chain_extent.height * render_scale + 0.5f);
+    if (render_extent.width == 0) {
+        render_extent.width = 1;
+    }
+    if (render_extent.height == 0) {
+        render_extent.height = 1;
+    }
+}
+
+void init_dynamic_resolution(float target_ms) {
+    target_frame_ms = target_ms;
+    dynamic_resolution_enabled = target_ms > 0.f;
+    render_scale = 1.f;
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        frame_scales[i] = 0.f;
+    }
+    apply_scale();
+}
+
+// The cost of a frame goes with its pixel count, the square of the scale.
+// The scale moves in whole steps, at least one once outside the band and at
+// most a few so one slow frame cannot halve the resolution. Steps are taken
+// from the scale the measured frame was drawn at, so frames still in flight
+// at an older scale ask for the same change rather than adding to it
+static void adjust(float measured_scale, float frame_ms) {
+    float goal = target_frame_ms * DYNAMIC_RESOLUTION_HEADROOM;
+    float error = frame_ms / goal - 1.f;
+    if (fabsf(error) < DYNAMIC_RESOLUTION_DEADBAND) {
+        return;
+    }
+
+    float wanted = measured_scale * sqrtf(goal / frame_ms);
+    float steps = (wanted - measured_scale) / DYNAMIC_RESOLUTION_STEP;
+    steps = steps > 0.f ? ceilf(steps) : floorf(steps);
+    steps = fmaxf(fminf(steps, DYNAMIC_RESOLUTION_MAX_STEPS), -DYNAMIC_RESOLUTION_MAX_STEPS);
+    float scale = measured_scale + steps * DYNAMIC_RESOLUTION_STEP;
+    render_scale = fmaxf(fminf(scale, 1.f), DYNAMIC_RESOLUTION_MIN_SCALE);
+    apply_scale();
+}
+
+void dynamic_resolution_update(uint32_t frame) {
+    if (!dynamic_resolution_enabled) {
+        return;
+    }
+
+    float frame_ms = gpu_timer_last("frame");
+    if (frame_ms > 0.f && frame_scales[frame] > 0.f) {
+        adjust(frame_scales[frame], frame_ms);
+    }
+
+    frame_scales[frame] = render_scale;
+}
+
+void dynamic_resolution_resize() {
+    apply_scale();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+#define DYNAMIC_RESOLUTION_STEP 0.025f
+#define DYNAMIC_RESOLUTION_MAX_STEPS 4
+
+// The scene is drawn into the top left render_extent of the color and depth
+// targets, which stay at swap chain size so scaling never reallocates. Post
+// processing upscales the rectangle to the whole swap chain. Without a
+// target frame time the rectangle covers everything
+extern bool dynamic_resolution_enabled;
+extern VkExtent2D render_extent;
+extern float render_scale;
+
+void init_dynamic_resolution(float target_ms);
+
+// Picks the frame's render extent from the GPU frame time last measured in
+// this frame slot, after the timers were updated
+void dynamic_resolution_update(uint32_t frame);
+
+// The swap chain changed size
+void dynamic_resolution_resize();
@@ -0,0 +1,242 @@
+#include "golden.h"
+#include "buffers.h"
+#include "devices.h"
+#include "images.h"
+#include "png.h"
+#include "swap_chain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Squared YIQ distance between black and white
+#define GOLDEN_MAX_DELTA 35215.f
+
+static bool swizzled_format(VkFormat format, bool* swizzled) {
+    switch (format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        *swizzled = true;
+        return true;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        *swizzled = false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static VkBuffer capture_buffer = VK_NULL_HANDLE;
+static VkDeviceMemory capture_memory = VK_NULL_HANDLE;
+static bool capture_requested = false;
+static bool captured = false;
+
+static void destroy_capture() {
+    vkDestroyBuffer(logical_device, capture_buffer, NULL);
+    vkFreeMemory(logical_device, capture_memory, NULL);
+    capture_buffer = VK_NULL_HANDLE;
+    capture_memory = VK_NULL_HANDLE;
+}
+
+VkResult golden_request_capture() {
+    if ((swap_chain_usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) == 0) {
+        puts("The surface does not allow reading the swap chain back");
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    VkDeviceSize size = (VkDeviceSize)swap_chain_extent.width * swap_chain_extent.height * 4;
+    VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    destroy_capture();
+    VkResult result = create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, flags, &capture_buffer, &capture_memory);
+    capture_requested = result == VK_SUCCESS;
+    captured = false;
+    return result;
+}
+
+void golden_record_capture(VkCommandBuffer buffer, VkImage image, VkImageLayout layout) {
+    if (!capture_requested) {
+        return;
+    }
+
+    VkAccessFlags write_access = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    VkPipelineStageFlags write_stages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    transition_image(buffer, image, VK_IMAGE_ASPECT_COLOR_BIT,
+        layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        write_access, VK_ACCESS_TRANSFER_READ_BIT,
+        write_stages, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkBufferImageCopy region = {
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .layerCount = 1,
+        },
+        .imageExtent = {swap_chain_extent.width, swap_chain_extent.height, 1},
+    };
+    vkCmdCopyImageToBuffer(buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, capture_buffer, 1, &region);
+
+    // Back to where the frame left it, the transition to present follows
+    transition_image(buffer, image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, layout,
+        VK_ACCESS_TRANSFER_READ_BIT, 0,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, write_stages);
+
+    VkBufferMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = capture_buffer,
+        .size = VK_WHOLE_SIZE,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &host_barrier, 0, NULL);
+
+    capture_requested = false;
+    captured = true;
+}
+
+static float luma(const uint8_t* pixel) {
+    return pixel[0] * 0.29889531f + pixel[1] * 0.58662247f + pixel[2] * 0.11448223f;
+}
+
+// Squared distance in YIQ weighted by how visible each axis is, alpha is
+// ignored since the swap chain is opaque
+static float color_delta(const uint8_t* a, const uint8_t* b) {
+    float r = (float)a[0] - b[0];
+    float g = (float)a[1] - b[1];
+    float blue = (float)a[2] - b[2];
+
+    float y = r * 0.29889531f + g * 0.58662247f + blue * 0.11448223f;
+    float i = r * 0.59597799f - g * 0.27417610f - blue * 0.32180189f;
+    float q = r * 0.21147017f - g * 0.52261711f + blue * 0.31114694f;
+    return 0.5053f * y * y + 0.299f * i * i + 0.1957f * q * q;
+}
+
+// Differences in red over a faded copy of the expected image
+static uint64_t compare(const uint8_t* expected, const uint8_t* actual, uint32_t pixel_count, uint8_t* diff) {
+    float max_delta = GOLDEN_MAX_DELTA * GOLDEN_PIXEL_THRESHOLD * GOLDEN_PIXEL_THRESHOLD;
+    uint64_t different = 0;
+    for (uint32_t i = 0; i < pixel_count; i++) {
+        const uint8_t* a = expected + i * 4;
+        const uint8_t* b = actual + i * 4;
+        uint8_t* out = diff + i * 4;
+
+        if (color_delta(a, b) > max_delta) {
+            different++;
+            out[0] = 255;
+            out[1] = 0;
+            out[2] = 0;
+        } else {
+            uint8_t faded = (uint8_t)(255.f - (255.f - luma(a)) * 0.1f);
+            out[0] = faded;
+            out[1] = faded;
+            out[2] = faded;
+        }
+        out[3] = 255;
+    }
+    return different;
+}
+
+static char* diff_path(const char* path) {
+    size_t length = strlen(path);
+    if (length > 4 && strcmp(path + length - 4, ".png") == 0) {
+        length -= 4;
+    }
+
+    char* result = malloc(length + sizeof(".diff.png"));
+    memcpy(result, path, length);
+    strcpy(result + length, ".diff.png");
+    return result;
+}
+
+int golden_check(const char* path, bool update) {
+    bool swizzled;
+    if (!swizzled_format(swap_chain_format, &swizzled)) {
+        puts("Golden images need an 8 bit RGBA or BGRA swap chain");
+        destroy_capture();
+        return 1;
+    }
+
+    if (!captured) {
+        puts("No frame was captured");
+        destroy_capture();
+        return 1;
+    }
+
+    uint32_t width = swap_chain_extent.width;
+    uint32_t height = swap_chain_extent.height;
+    uint32_t pixel_count = width * height;
+    uint8_t* actual = malloc((size_t)pixel_count * 4);
+
+    void* data;
+    VkResult result = vkMapMemory(logical_device, capture_memory, 0, (VkDeviceSize)pixel_count * 4, 0, &data);
+    if (result == VK_SUCCESS) {
+        memcpy(actual, data, (size_t)pixel_count * 4);
+        vkUnmapMemory(logical_device, capture_memory);
+    }
+
+    destroy_capture();
+    captured = false;
+    if (result != VK_SUCCESS) {
+        puts("Failed to read back the swap chain image");
+        free(actual);
+        return 1;
+    }
+
+    for (uint32_t i = 0; swizzled && i < pixel_count; i++) {
+        uint8_t blue = actual[i * 4];
+        actual[i * 4] = actual[i * 4 + 2];
+        actual[i * 4 + 2] = blue;
+    }
+
+    if (update) {
+        bool written = write_png(path, actual, width, height);
+        printf(written ? "Wrote %s\n" : "Failed to write %s\n", path);
+        free(actual);
+        return written ? 0 : 1;
+    }
+
+    // A missing reference fails, a check that compared nothing must not pass
+    FILE* reference = fopen(path, "rb");
+    if (reference == NULL) {
+        printf("No golden image at %s, make golden-update writes it\n", path);
+        free(actual);
+        return 1;
+    }
+    fclose(reference);
+
+    uint8_t* expected;
+    uint32_t expected_width, expected_height;
+    if (!read_png(path, &expected, &expected_width, &expected_height)) {
+        printf("Failed to read %s, make golden-update writes it\n", path);
+        free(actual);
+        return 1;
+    }
+
+    if (expected_width != width || expected_height != height) {
+        printf("%s is %ux%u, the render is %ux%u\n", path, expected_width, expected_height, width, height);
+        free(expected);
+        free(actual);
+        return 1;
+    }
+
+    uint8_t* diff = malloc((size_t)pixel_count * 4);
+    uint64_t different = compare(expected, actual, pixel_count, diff);
+    float share = (float)different / pixel_count;
+    int status = share > GOLDEN_MAX_DIFFERENT ? 1 : 0;
+
+    printf("%s: %llu of %u pixels differ, %.3f%%\n", path, (unsigned long long)different, pixel_count, share * 100.f);
+    if (status != 0) {
+        char* output = diff_path(path);
+        if (write_png(output, diff, width, height)) {
+            printf("Differences written to %s\n", output);
+        }
+        free(output);
+    }
+
+    free(diff);
+    free(expected);
+    free(actual);
+    return status;
+}
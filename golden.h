@@ -0,0 +1,29 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+// Frames rendered before the capture, enough for culling, the depth
+// pyramid and the shadow cascades to settle
+#define GOLDEN_FRAMES 8
+
+// Per pixel YIQ distance, 0 to 1, above which a pixel counts as different
+#define GOLDEN_PIXEL_THRESHOLD 0.1f
+
+// Share of pixels that may differ before the image fails
+#define GOLDEN_MAX_DIFFERENT 0.005f
+
+// The next frame copies its swap chain image to a host buffer once post
+// has written it, before it is handed to present
+VkResult golden_request_capture();
+
+// Recorded after the last write to the swap chain image, which is left in
+// layout. Does nothing unless a capture was requested
+void golden_record_capture(VkCommandBuffer buffer, VkImage image, VkImageLayout layout);
+
+// Compares the captured frame against the PNG at path, or writes the PNG
+// when updating. On a mismatch the differences are written next to it as
+// <name>.diff.png, a missing reference fails. The device must be idle.
+// Returns 0 when the image matches or was written
+int golden_check(const char* path, bool update);
@@ -0,0 +1,270 @@
+#include "gpu_counters.h"
+#include "capabilities.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "gpu_timers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Results come back in bit order, which is also the order of enum gpu_counter
+static const VkQueryPipelineStatisticFlagBits counter_bits[GPU_COUNTER_COUNT] = {
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT,
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT,
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT,
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT,
+    VK_QUERY_PIPELINE_STATISTIC_MESH_SHADER_INVOCATIONS_BIT_EXT,
+};
+
+struct gpu_pass {
+    const char* name;
+    struct gpu_pass_stats stats;
+    bool collected;
+};
+
+struct counter_slot {
+    VkQueryPool pool;
+    uint32_t passes[MAX_GPU_PASSES];
+    uint32_t count;
+    bool pending;
+    VkExtent2D render_extent;
+};
+
+bool gpu_counters_enabled = false;
+
+static VkQueryPipelineStatisticFlags statistics = 0;
+static uint32_t counters_count = 0;
+static enum gpu_counter counter_order[GPU_COUNTER_COUNT];
+
+static struct counter_slot slots[GPU_COUNTERS_RING];
+static uint32_t recording_slot = 0;
+static uint32_t next_slot = 0;
+// Query of the pass being recorded, passes do not nest
+static uint32_t active_query = UINT32_MAX;
+
+static struct gpu_pass passes[MAX_GPU_PASSES];
+static uint32_t passes_count = 0;
+
+VkResult create_gpu_counters() {
+    gpu_counters_enabled = device_capabilities.pipeline_statistics_query && getenv("VL_GPU_COUNTERS") != NULL;
+    if (!gpu_counters_enabled) {
+        return VK_SUCCESS;
+    }
+
+    statistics = 0;
+    counters_count = 0;
+    for (int i = 0; i < GPU_COUNTER_COUNT; i++) {
+        if (i == GPU_COUNTER_MESH_INVOCATIONS && !device_capabilities.mesh_shader_queries) {
+            continue;
+        }
+
+        statistics |= counter_bits[i];
+        counter_order[counters_count++] = i;
+    }
+
+    VkQueryPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = MAX_GPU_PASSES,
+        .pipelineStatistics = statistics,
+    };
+
+    for (int i = 0; i < GPU_COUNTERS_RING; i++) {
+        slots[i] = (struct counter_slot){0};
+        VkResult result = vkCreateQueryPool(logical_device, &pool_info, NULL, &slots[i].pool);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_gpu_counters() {
+    if (!gpu_counters_enabled) {
+        return;
+    }
+
+    for (int i = 0; i < GPU_COUNTERS_RING; i++) {
+        vkDestroyQueryPool(logical_device, slots[i].pool, NULL);
+    }
+
+    gpu_counters_enabled = false;
+    passes_count = 0;
+}
+
+static enum gpu_pass_load classify(const struct gpu_pass_stats* stats) {
+    uint64_t vertices = stats->counters[GPU_COUNTER_VERTEX_INVOCATIONS] + stats->counters[GPU_COUNTER_MESH_INVOCATIONS];
+    uint64_t fragments = stats->counters[GPU_COUNTER_FRAGMENT_INVOCATIONS];
+    if (vertices == 0 && fragments == 0) {
+        return stats->counters[GPU_COUNTER_COMPUTE_INVOCATIONS] > 0 ? GPU_PASS_LOAD_COMPUTE : GPU_PASS_LOAD_NONE;
+    }
+
+    if (vertices > fragments * GPU_COUNTERS_VERTEX_RATIO) {
+        return GPU_PASS_LOAD_VERTEX;
+    }
+
+    return stats->overdraw > GPU_COUNTERS_OVERDRAW ? GPU_PASS_LOAD_OVERDRAW : GPU_PASS_LOAD_BALANCED;
+}
+
+static void collect(struct counter_slot* slot, const uint64_t* results) {
+    uint64_t pixels = (uint64_t)slot->render_extent.width * slot->render_extent.height;
+    for (uint32_t i = 0; i < slot->count; i++) {
+        struct gpu_pass* pass = &passes[slot->passes[i]];
+        const uint64_t* values = results + i * (counters_count + 1);
+
+        struct gpu_pass_stats* stats = &pass->stats;
+        memset(stats->counters, 0, sizeof(stats->counters));
+        for (uint32_t k = 0; k < counters_count; k++) {
+            stats->counters[counter_order[k]] = values[k];
+        }
+
+        uint64_t primitives = stats->counters[GPU_COUNTER_CLIPPING_PRIMITIVES];
+        uint64_t fragments = stats->counters[GPU_COUNTER_FRAGMENT_INVOCATIONS];
+        stats->ms = gpu_timer_last(pass->name);
+        stats->overdraw = pixels > 0 ? (float)fragments / pixels : 0.f;
+        stats->fragments_per_primitive = primitives > 0 ? (float)fragments / primitives : 0.f;
+        stats->load = classify(stats);
+        pass->collected = true;
+    }
+}
+
+void gpu_counters_update() {
+    if (!gpu_counters_enabled) {
+        return;
+    }
+
+    // Oldest first so the newest frame is what stays
+    for (uint32_t n = 0; n < GPU_COUNTERS_RING; n++) {
+        struct counter_slot* slot = &slots[(next_slot + n) % GPU_COUNTERS_RING];
+        if (!slot->pending || slot->count == 0) {
+            continue;
+        }
+
+        // Each query is followed by its availability word
+        uint64_t results[MAX_GPU_PASSES * (GPU_COUNTER_COUNT + 1)];
+        VkDeviceSize stride = sizeof(uint64_t) * (counters_count + 1);
+        VkResult result = vkGetQueryPoolResults(logical_device, slot->pool, 0, slot->count, sizeof(results), results, stride,
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_SUCCESS) {
+            continue;
+        }
+
+        collect(slot, results);
+        slot->pending = false;
+    }
+}
+
+void gpu_counters_begin_frame(VkCommandBuffer buffer) {
+    if (!gpu_counters_enabled) {
+        return;
+    }
+
+    // Anything this slot still held is dropped, it should have been read a
+    // few frames ago
+    recording_slot = next_slot;
+    next_slot = (next_slot + 1) % GPU_COUNTERS_RING;
+
+    struct counter_slot* slot = &slots[recording_slot];
+    slot->count = 0;
+    slot->pending = true;
+    slot->render_extent = render_extent;
+    active_query = UINT32_MAX;
+    vkCmdResetQueryPool(buffer, slot->pool, 0, MAX_GPU_PASSES);
+}
+
+static uint32_t find_pass(const char* name) {
+    for (uint32_t i = 0; i < passes_count; i++) {
+        if (strcmp(passes[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (passes_count == MAX_GPU_PASSES) {
+        return UINT32_MAX;
+    }
+
+    passes[passes_count] = (struct gpu_pass){.name = name, .stats.name = name};
+    return passes_count++;
+}
+
+uint32_t gpu_pass_begin(VkCommandBuffer buffer, const char* name) {
+    uint32_t timer = gpu_timer_begin(buffer, name);
+    struct counter_slot* slot = &slots[recording_slot];
+    if (!gpu_counters_enabled || slot->count == MAX_GPU_PASSES || active_query != UINT32_MAX) {
+        return timer;
+    }
+
+    uint32_t pass = find_pass(name);
+    if (pass == UINT32_MAX) {
+        return timer;
+    }
+
+    active_query = slot->count++;
+    slot->passes[active_query] = pass;
+    vkCmdBeginQuery(buffer, slot->pool, active_query, 0);
+    return timer;
+}
+
+void gpu_pass_end(VkCommandBuffer buffer, uint32_t pass) {
+    if (active_query != UINT32_MAX) {
+        vkCmdEndQuery(buffer, slots[recording_slot].pool, active_query);
+        active_query = UINT32_MAX;
+    }
+
+    gpu_timer_end(buffer, pass);
+}
+
+bool gpu_counters_inherited(VkQueryPipelineStatisticFlags* inherited) {
+    if (!gpu_counters_enabled || active_query == UINT32_MAX) {
+        *inherited = 0;
+        return true;
+    }
+
+    *inherited = device_capabilities.inherited_queries ? statistics : 0;
+    return device_capabilities.inherited_queries;
+}
+
+bool gpu_pass_stats(uint32_t index, struct gpu_pass_stats* stats) {
+    if (index >= passes_count) {
+        return false;
+    }
+
+    *stats = passes[index].stats;
+    return true;
+}
+
+static const char* load_name(enum gpu_pass_load load) {
+    switch (load) {
+    case GPU_PASS_LOAD_COMPUTE:
+        return "compute";
+    case GPU_PASS_LOAD_VERTEX:
+        return "vertex bound";
+    case GPU_PASS_LOAD_OVERDRAW:
+        return "overdraw bound";
+    case GPU_PASS_LOAD_BALANCED:
+        return "balanced";
+    default:
+        return "";
+    }
+}
+
+void gpu_counters_print() {
+    printf("%-14s %9s %11s %11s %11s %11s %9s %10s\n", "pass", "ms", "vertices", "primitives", "fragments", "compute",
+        "overdraw", "frag/prim");
+    for (uint32_t i = 0; i < passes_count; i++) {
+        const struct gpu_pass* pass = &passes[i];
+        if (!pass->collected) {
+            continue;
+        }
+
+        const struct gpu_pass_stats* stats = &pass->stats;
+        printf("%-14s %9.3f %11llu %11llu %11llu %11llu %8.2fx %10.1f  %s\n", pass->name, stats->ms,
+            (unsigned long long)(stats->counters[GPU_COUNTER_VERTEX_INVOCATIONS] + stats->counters[GPU_COUNTER_MESH_INVOCATIONS]),
+            (unsigned long long)stats->counters[GPU_COUNTER_CLIPPING_PRIMITIVES],
+            (unsigned long long)stats->counters[GPU_COUNTER_FRAGMENT_INVOCATIONS],
+            (unsigned long long)stats->counters[GPU_COUNTER_COMPUTE_INVOCATIONS],
+            stats->overdraw, stats->fragments_per_primitive, load_name(stats->load));
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_GPU_PASSES 16
+
+// Query pools recorded round robin, deeper than the frames in flight so a
+// pool is always complete by the time it is read and reads never wait
+#define GPU_COUNTERS_RING 4
+
+// Fragments per render target pixel above which a pass counts as overdraw
+// bound, and shaded vertices per fragment above which it counts as vertex
+// bound
+#define GPU_COUNTERS_OVERDRAW 2.5f
+#define GPU_COUNTERS_VERTEX_RATIO 0.5f
+
+enum gpu_counter {
+    GPU_COUNTER_VERTEX_INVOCATIONS,
+    GPU_COUNTER_CLIPPING_INVOCATIONS,
+    GPU_COUNTER_CLIPPING_PRIMITIVES,
+    GPU_COUNTER_FRAGMENT_INVOCATIONS,
+    GPU_COUNTER_COMPUTE_INVOCATIONS,
+    // Only counted where the device has mesh shader queries
+    GPU_COUNTER_MESH_INVOCATIONS,
+    GPU_COUNTER_COUNT,
+};
+
+enum gpu_pass_load {
+    GPU_PASS_LOAD_NONE,
+    GPU_PASS_LOAD_COMPUTE,
+    GPU_PASS_LOAD_VERTEX,
+    GPU_PASS_LOAD_OVERDRAW,
+    GPU_PASS_LOAD_BALANCED,
+};
+
+struct gpu_pass_stats {
+    const char* name;
+    // Negative without timestamps
+    float ms;
+    uint64_t counters[GPU_COUNTER_COUNT];
+    // Fragments per pixel of the render extent
+    float overdraw;
+    float fragments_per_primitive;
+    enum gpu_pass_load load;
+};
+
+// Pipeline statistics around the passes of the frame, next to their GPU
+// timers. Off unless VL_GPU_COUNTERS is set, as the queries are not free,
+// and on devices without pipeline statistics queries
+extern bool gpu_counters_enabled;
+
+VkResult create_gpu_counters();
+void destroy_gpu_counters();
+
+// Collects every recorded frame whose queries are available, never waits
+void gpu_counters_update();
+
+// After gpu_timers_begin_frame, outside any render pass
+void gpu_counters_begin_frame(VkCommandBuffer buffer);
+
+// Times the pass with gpu_timer_begin and counts its work, passes do not
+// nest and stay outside render passes. The name must outlive the counters
+uint32_t gpu_pass_begin(VkCommandBuffer buffer, const char* name);
+void gpu_pass_end(VkCommandBuffer buffer, uint32_t pass);
+
+// Statistics secondary buffers executed inside the current pass inherit.
+// False when the pass counts but the device cannot inherit queries, the
+// pass then has to be recorded inline
+bool gpu_counters_inherited(VkQueryPipelineStatisticFlags* statistics);
+
+// Latest collected frame in the order passes were first used, false past
+// the last one
+bool gpu_pass_stats(uint32_t index, struct gpu_pass_stats* stats);
+
+// The latest frame as a text table, one line per pass
+void gpu_counters_print();
@@ -0,0 +1,176 @@
+#include "gpu_timers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+// Weight of the newest frame in the averages
+#define GPU_TIMER_SMOOTHING 0.05f
+
+struct gpu_timer {
+    const char* name;
+    double average_ms;
+    double last_ms;
+    uint64_t samples;
+};
+
+static bool timers_enabled = false;
+static VkQueryPool query_pools[MAX_FRAMES_IN_FLIGHT];
+
+// Which timer every query pair of a frame slot belongs to
+static uint32_t recorded[MAX_FRAMES_IN_FLIGHT][MAX_GPU_TIMERS];
+static uint32_t recorded_count[MAX_FRAMES_IN_FLIGHT];
+static uint32_t recording_frame = 0;
+
+static struct gpu_timer timers[MAX_GPU_TIMERS];
+static uint32_t timers_count = 0;
+
+VkResult create_gpu_timers() {
+    timers_enabled = device_capabilities.timestamp_period > 0.f && device_capabilities.timestamp_valid_bits > 0;
+    if (!timers_enabled) {
+        return VK_SUCCESS;
+    }
+
+    VkQueryPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = MAX_GPU_TIMERS * 2,
+    };
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        VkResult result = vkCreateQueryPool(logical_device, &pool_info, NULL, &query_pools[frame]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+        recorded_count[frame] = 0;
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_gpu_timers() {
+    if (!timers_enabled) {
+        return;
+    }
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        vkDestroyQueryPool(logical_device, query_pools[frame], NULL);
+    }
+
+    timers_enabled = false;
+    timers_count = 0;
+}
+
+void gpu_timers_update(uint32_t frame) {
+    uint32_t count = recorded_count[frame];
+    if (!timers_enabled || count == 0) {
+        return;
+    }
+
+    uint64_t timestamps[MAX_GPU_TIMERS * 2];
+    VkResult result = vkGetQueryPoolResults(logical_device, query_pools[frame], 0, count * 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    recorded_count[frame] = 0;
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    uint64_t mask = device_capabilities.timestamp_valid_bits >= 64 ? UINT64_MAX : (1ull << device_capabilities.timestamp_valid_bits) - 1;
+    const char* names[MAX_GPU_TIMERS];
+    for (uint32_t i = 0; i < count; i++) {
+        timestamps[i * 2] &= mask;
+        timestamps[i * 2 + 1] &= mask;
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & mask;
+        double ms = ticks * (double)device_capabilities.timestamp_period / 1e6;
+
+        struct gpu_timer* timer = &timers[recorded[frame][i]];
+        timer->last_ms = ms;
+        timer->average_ms = timer->samples == 0 ? ms : timer->average_ms + (ms - timer->average_ms) * GPU_TIMER_SMOOTHING;
+        timer->samples++;
+        names[i] = timer->name;
+    }
+
+    trace_gpu_zones(names, timestamps, count);
+}
+
+void gpu_timers_begin_frame(VkCommandBuffer buffer, uint32_t frame) {
+    recording_frame = frame;
+    recorded_count[frame] = 0;
+    if (timers_enabled) {
+        vkCmdResetQueryPool(buffer, query_pools[frame], 0, MAX_GPU_TIMERS * 2);
+    }
+}
+
+static uint32_t find_timer(const char* name) {
+    for (uint32_t i = 0; i < timers_count; i++) {
+        if (strcmp(timers[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (timers_count == MAX_GPU_TIMERS) {
+        return UINT32_MAX;
+    }
+
+    timers[timers_count] = (struct gpu_timer){.name = name};
+    return timers_count++;
+}
+
+uint32_t gpu_timer_begin(VkCommandBuffer buffer, const char* name) {
+    uint32_t frame = recording_frame;
+    if (!timers_enabled || recorded_count[frame] == MAX_GPU_TIMERS) {
+        return UINT32_MAX;
+    }
+
+    uint32_t timer = find_timer(name);
+    if (timer == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    uint32_t slot = recorded_count[frame]++;
+    recorded[frame][slot] = timer;
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pools[frame], slot * 2);
+    return slot;
+}
+
+void gpu_timer_end(VkCommandBuffer buffer, uint32_t timer) {
+    if (timer == UINT32_MAX) {
+        return;
+    }
+
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pools[recording_frame], timer * 2 + 1);
+}
+
+float gpu_timer_average(const char* name) {
+    for (uint32_t i = 0; i < timers_count; i++) {
+        if (strcmp(timers[i].name, name) == 0 && timers[i].samples > 0) {
+            return (float)timers[i].average_ms;
+        }
+    }
+
+    return -1.f;
+}
+
+float gpu_timer_last(const char* name) {
+    for (uint32_t i = 0; i < timers_count; i++) {
+        if (strcmp(timers[i].name, name) == 0 && timers[i].samples > 0) {
+            return (float)timers[i].last_ms;
+        }
+    }
+
+    return -1.f;
+}
+
+const char* gpu_timer_name(uint32_t index) {
+    return index < timers_count ? timers[index].name : NULL;
+}
+
+void gpu_timers_print() {
+    for (uint32_t i = 0; i < timers_count; i++) {
+        if (timers[i].samples > 0) {
+            printf("GPU %-12s %.3f ms\n", timers[i].name, timers[i].average_ms);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_GPU_TIMERS 32
+
+// Timestamp pairs around passes of the frame, read back once the frame
+// slot's fence has signalled and kept as running averages by name. Devices
+// without timestamps on the graphics queue record nothing
+VkResult create_gpu_timers();
+void destroy_gpu_timers();
+
+// Collects what the frame slot recorded last time, after its fence
+void gpu_timers_update(uint32_t frame);
+
+// First in the frame's command buffer, outside any render pass
+void gpu_timers_begin_frame(VkCommandBuffer buffer, uint32_t frame);
+
+// Returns a handle for gpu_timer_end, the name must outlive the timers
+uint32_t gpu_timer_begin(VkCommandBuffer buffer, const char* name);
+void gpu_timer_end(VkCommandBuffer buffer, uint32_t timer);
+
+// Average milliseconds of the named pass, negative before any result
+float gpu_timer_average(const char* name);
+
+// Milliseconds of the named pass in the most recently collected frame
+float gpu_timer_last(const char* name);
+
+// Names in the order timers were first used, NULL past the last one
+const char* gpu_timer_name(uint32_t index);
+void gpu_timers_print();
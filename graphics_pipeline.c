@@ -1,86 +1,30 @@
 #include "graphics_pipeline.h"
+#include "capabilities.h"
+#include "lights.h"
 #include "devices.h"
+#include "shaders.h"
+#include "shading_rate.h"
+#include "startup.h"
 #include "swap_chain.h"
+#include "textures.h"
 #include "vertex_buffer.h"
+#include "virtual_textures.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <vulkan/vulkan_core.h>
 
 VkRenderPass render_pass;
+VkRenderPass render_pass_load;
 VkPipelineLayout pipeline_layout;
+VkDescriptorSetLayout empty_set_layout;
 VkPipeline pipeline;
 
-static char* read_file(char* path, uint32_t* size) {
-    FILE* file = fopen(path, "r");
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    rewind(file);
-
-    while ((*size % 32) != 0) {
-        (*size)++;
-    }
-
-    char* ret = malloc(*size * sizeof(char));
-    fread(ret, sizeof(char), *size, file);
-
-    return ret;
-}
-
-static VkShaderModule create_shader_module(char* binary, uint32_t size) {
-    VkShaderModuleCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .pCode = (uint32_t*)binary,
-        .codeSize = size 
-    };
-
-    VkShaderModule shader_module;
-    vkCreateShaderModule(logical_device, &create_info, NULL, &shader_module);
-    return shader_module;
-}
-
-VkResult create_graphics_pipeline() {
-    uint32_t vertex_shader_size;
-    uint32_t fragment_shader_size;
-
-    char* vertex_shader_code = read_file("./shaders/vert.spv", &vertex_shader_size);
-    char* fragment_shader_code = read_file("./shaders/frag.spv", &fragment_shader_size);
-
-    VkShaderModule vertex_shader = create_shader_module(vertex_shader_code, vertex_shader_size);
-    VkShaderModule fragment_shader = create_shader_module(fragment_shader_code, fragment_shader_size);
-
-    VkVertexInputBindingDescription bind_description = get_binding_description();
-    uint32_t size;
-    VkVertexInputAttributeDescription* attribute_description = get_attribute_description(&size);
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .vertexAttributeDescriptionCount = size,
-        .pVertexBindingDescriptions = &bind_description,
-        .pVertexAttributeDescriptions = attribute_description,
-
-    };    
-
-    VkPipelineShaderStageCreateInfo vertex_shader_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = vertex_shader,
-        .pName = "main"
-    };
-
-    VkPipelineShaderStageCreateInfo fragment_shader_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = fragment_shader,
-        .pName = "main"
-    };
-
-    VkPipelineShaderStageCreateInfo shader_stages[2] = {
-        vertex_shader_create_info,
-        fragment_shader_create_info
-    };
-
+// Fixed function state shared by every scene pipeline. Vertex input is left
+// out when no vertex binding is given, for the mesh shader path.
+VkResult build_graphics_pipeline(const VkPipelineShaderStageCreateInfo* stages, uint32_t stage_count,
+    const VkPipelineVertexInputStateCreateInfo* vertex_input, VkPipelineLayout layout, VkPipeline* created) {
     VkPipelineInputAssemblyStateCreateInfo input_assembly_create_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
         .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
@@ -110,6 +54,15 @@ VkResult create_graphics_pipeline() {
         .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
     };
 
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = VK_TRUE,
+        .depthWriteEnable = VK_TRUE,
+        .depthCompareOp = VK_COMPARE_OP_LESS,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE,
+    };
+
     VkPipelineColorBlendAttachmentState color_blend_attachment = {
         .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
         .blendEnable = VK_FALSE,
@@ -133,51 +86,163 @@ VkResult create_graphics_pipeline() {
         .dynamicStateCount = 2,
     };
 
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pushConstantRangeCount = 0,
+    VkPipelineRenderingCreateInfo rendering_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &color_format,
+        .depthAttachmentFormat = depth_format,
     };
 
-    vkCreatePipelineLayout(logical_device, &pipeline_layout_create_info, NULL, &pipeline_layout);
+    // The attachment rate replaces the pipeline rate of 1x1, primitive rates
+    // are never written so the first combiner keeps it
+    VkPipelineFragmentShadingRateStateCreateInfoKHR shading_rate_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_FRAGMENT_SHADING_RATE_STATE_CREATE_INFO_KHR,
+        .fragmentSize = {1, 1},
+        .combinerOps = {
+            VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR,
+            VK_FRAGMENT_SHADING_RATE_COMBINER_OP_REPLACE_KHR,
+        },
+    };
+
+    if (shading_rate_enabled) {
+        rendering_create_info.pNext = &shading_rate_create_info;
+    }
 
     VkGraphicsPipelineCreateInfo pipeline_create_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .pStages = shader_stages,
-        .stageCount = 2,
-        .pVertexInputState = &vertex_input_create_info,
-        .pInputAssemblyState = &input_assembly_create_info,
+        .pNext = device_capabilities.dynamic_rendering ? &rendering_create_info : NULL,
+        .flags = shading_rate_enabled ? VK_PIPELINE_CREATE_RENDERING_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR : 0,
+        .pStages = stages,
+        .stageCount = stage_count,
+        .pVertexInputState = vertex_input,
+        .pInputAssemblyState = vertex_input != NULL ? &input_assembly_create_info : NULL,
         .pViewportState = &viewport_state_create_info,
         .pRasterizationState = &rasterizer_create_info,
         .pMultisampleState = &multisampling_create_info,
+        .pDepthStencilState = &depth_stencil_create_info,
         .pColorBlendState = &color_blend_create_info,
         .pDynamicState = &dynamic_state_create_info,
-        .layout = pipeline_layout,
+        .layout = layout,
         .renderPass = render_pass,
         .subpass = 0,
     };
 
-    VkResult result = vkCreateGraphicsPipelines(logical_device, VK_NULL_HANDLE, 1, &pipeline_create_info, NULL, &pipeline);
+    return vkCreateGraphicsPipelines(logical_device, pipeline_cache, 1, &pipeline_create_info, NULL, created);
+}
+
+static VkResult compile_scene_pipeline(void* data) {
+    (void)data;
+    VkShaderModule vertex_shader = load_shader_module("./shaders/vert.spv");
+    VkShaderModule fragment_shader = load_shader_module("./shaders/frag.spv");
+
+    VkVertexInputBindingDescription bind_description = get_binding_description();
+    uint32_t size;
+    VkVertexInputAttributeDescription* attribute_description = get_attribute_description(&size);
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .vertexAttributeDescriptionCount = size,
+        .pVertexBindingDescriptions = &bind_description,
+        .pVertexAttributeDescriptions = attribute_description,
+
+    };    
+
+    VkPipelineShaderStageCreateInfo vertex_shader_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = vertex_shader,
+        .pName = "main"
+    };
+
+    VkPipelineShaderStageCreateInfo fragment_shader_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = fragment_shader,
+        .pName = "main"
+    };
+
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {
+        vertex_shader_create_info,
+        fragment_shader_create_info
+    };
+
+    VkResult result = build_graphics_pipeline(shader_stages, 2, &vertex_input_create_info, pipeline_layout, &pipeline);
 
     vkDestroyShaderModule(logical_device, vertex_shader, NULL);
     vkDestroyShaderModule(logical_device, fragment_shader, NULL);
 
-    free(vertex_shader_code);
-    free(fragment_shader_code);
+    free(attribute_description);
 
     return result;
 }
 
-VkResult create_render_pass() {
+VkResult create_graphics_pipeline() {
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(struct vertex_push_constants),
+    };
+
+    // The fragment shader reads its texture from set 1, virtual textures from
+    // set 2 and lights from set 3 on both paths, set 0 stays empty here and
+    // holds the meshlet buffers on the mesh shading path
+    VkDescriptorSetLayoutCreateInfo empty_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    };
+
+    vkCreateDescriptorSetLayout(logical_device, &empty_layout_info, NULL, &empty_set_layout);
+
+    VkDescriptorSetLayout set_layouts[4] = {
+        empty_set_layout,
+        texture_set_layout,
+        virtual_texture_set_layout,
+        light_set_layout,
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 4,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+
+    vkCreatePipelineLayout(logical_device, &pipeline_layout_create_info, NULL, &pipeline_layout);
+
+    // Compiled on a job thread while the rest of startup goes on
+    return startup_defer("scene_pipeline", compile_scene_pipeline, NULL);
+}
+
+// A loading pass continues a frame after the depth pyramid build, the depth
+// is stored either way for the pyramid to read. Color stays an attachment,
+// post processing moves it on once the frame's passes are done
+static VkResult build_render_pass(bool load, VkRenderPass* created) {
     VkAttachmentDescription color_attachment = {
-        .format = swap_chain_format,
+        .format = color_format,
         .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
         .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
         .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .initialLayout = load ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkAttachmentDescription depth_attachment = {
+        .format = depth_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    VkAttachmentDescription attachments[2] = {
+        color_attachment,
+        depth_attachment,
     };
 
     VkAttachmentReference attachment_reference = {
@@ -185,28 +250,53 @@ VkResult create_render_pass() {
         .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
     };
 
+    VkAttachmentReference depth_reference = {
+        .attachment = 1,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
     VkSubpassDescription subpass = {
         .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
         .pColorAttachments = &attachment_reference,
         .colorAttachmentCount = 1,
+        .pDepthStencilAttachment = &depth_reference,
     };
 
+    // The previous frame's post processing may still be reading the color
     VkSubpassDependency dependancy = {
         .srcSubpass = VK_SUBPASS_EXTERNAL,
         .dstSubpass = 0,
-        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
     };
 
     VkRenderPassCreateInfo render_pass_info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .pAttachments = &color_attachment,
-        .attachmentCount = 1,
+        .pAttachments = attachments,
+        .attachmentCount = 2,
         .pSubpasses = &subpass,
         .subpassCount = 1,
         .pDependencies = &dependancy,
         .dependencyCount = 1,
     };
 
-    return vkCreateRenderPass(logical_device, &render_pass_info, NULL, &render_pass);
+    return vkCreateRenderPass(logical_device, &render_pass_info, NULL, created);
+}
+
+VkResult create_render_pass() {
+    if (device_capabilities.dynamic_rendering) {
+        render_pass = VK_NULL_HANDLE;
+        render_pass_load = VK_NULL_HANDLE;
+        return VK_SUCCESS;
+    }
+
+    VkResult result = build_render_pass(false, &render_pass);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return build_render_pass(true, &render_pass_load);
 }
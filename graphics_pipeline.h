@@ -3,9 +3,22 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "linmath.h"
+
+// The view projection comes from the light set. Virtual texture index plus
+// one, 0 samples the mesh texture instead
+struct vertex_push_constants {
+    mat4x4 model;
+    uint32_t virtual_texture;
+};
+
 extern VkRenderPass render_pass;
+extern VkRenderPass render_pass_load;
 extern VkPipelineLayout pipeline_layout;
+extern VkDescriptorSetLayout empty_set_layout;
 extern VkPipeline pipeline;
 
 VkResult create_render_pass();
 VkResult create_graphics_pipeline();
+VkResult build_graphics_pipeline(const VkPipelineShaderStageCreateInfo* stages, uint32_t stage_count,
+    const VkPipelineVertexInputStateCreateInfo* vertex_input, VkPipelineLayout layout, VkPipeline* created);
@@ -0,0 +1,106 @@
+#include "images.h"
+#include "buffers.h"
+#include "devices.h"
+
+VkResult create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage* image, VkDeviceMemory* image_memory) {
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent.width = width,
+        .extent.height = height,
+        .extent.depth = 1,
+        .mipLevels = mip_levels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VkResult result = vkCreateImage(logical_device, &create_info, NULL, image);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    vkGetImageMemoryRequirements(logical_device, *image, &memory_requirements);
+
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memory_requirements.size,
+        .memoryTypeIndex = find_memory_type(memory_requirements.memoryTypeBits, properties),
+    };
+
+    result = vkAllocateMemory(logical_device, &allocate_info, NULL, image_memory);
+    if (result != VK_SUCCESS) {
+        vkDestroyImage(logical_device, *image, NULL);
+        *image = VK_NULL_HANDLE;
+        *image_memory = VK_NULL_HANDLE;
+        return result;
+    }
+
+    // Nothing is left behind on failure, the handles come back null
+    result = vkBindImageMemory(logical_device, *image, *image_memory, 0);
+    if (result != VK_SUCCESS) {
+        vkDestroyImage(logical_device, *image, NULL);
+        vkFreeMemory(logical_device, *image_memory, NULL);
+        *image = VK_NULL_HANDLE;
+        *image_memory = VK_NULL_HANDLE;
+    }
+
+    return result;
+}
+
+VkResult create_image_view_2d(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t base_mip, uint32_t mip_levels, VkImageView* view) {
+    VkImageViewCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+        .components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+        .components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+        .components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+        .subresourceRange.aspectMask = aspect,
+        .subresourceRange.baseMipLevel = base_mip,
+        .subresourceRange.levelCount = mip_levels,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+    };
+
+    return vkCreateImageView(logical_device, &create_info, NULL, view);
+}
+
+VkFormat find_supported_format(const VkFormat* candidates, uint32_t count, VkFormatFeatureFlags features) {
+    for (uint32_t i = 0; i < count; i++) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device, candidates[i], &properties);
+        if ((properties.optimalTilingFeatures & features) == features) {
+            return candidates[i];
+        }
+    }
+
+    return VK_FORMAT_UNDEFINED;
+}
+
+void transition_image(VkCommandBuffer buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange.aspectMask = aspect,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS,
+    };
+
+    vkCmdPipelineBarrier(buffer, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
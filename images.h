@@ -0,0 +1,9 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+VkResult create_image(uint32_t width, uint32_t height, uint32_t mip_levels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage* image, VkDeviceMemory* image_memory);
+VkResult create_image_view_2d(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t base_mip, uint32_t mip_levels, VkImageView* view);
+VkFormat find_supported_format(const VkFormat* candidates, uint32_t count, VkFormatFeatureFlags features);
+void transition_image(VkCommandBuffer buffer, VkImage image, VkImageAspectFlags aspect, VkImageLayout old_layout, VkImageLayout new_layout, VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage);
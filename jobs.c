@@ -0,0 +1,365 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "jobs.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOB_DEQUE_MASK (JOB_DEQUE_SIZE - 1)
+
+// Chase-Lev deque, the owner pushes and pops at the bottom while other
+// workers steal from the top
+struct job_deque {
+    int64_t top;
+    int64_t bottom;
+    struct job jobs[JOB_DEQUE_SIZE];
+};
+
+struct worker {
+    struct job_deque deque;
+    pthread_t thread;
+    uint32_t index;
+    uint32_t steal_seed;
+};
+
+static struct worker* workers;
+static uint32_t workers_count = 0;
+static bool running = false;
+static job_timing_hook timing_hook = NULL;
+
+// Idle workers sleep until a job is queued
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_wake = PTHREAD_COND_INITIALIZER;
+static uint32_t queued = 0;
+static uint32_t sleeping = 0;
+
+// Jobs between reading the timing hook and leaving execute, on any thread
+static uint32_t executing = 0;
+
+static __thread int32_t current_worker = -1;
+
+static bool deque_push(struct job_deque* deque, const struct job* job) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+
+    deque->jobs[bottom & JOB_DEQUE_MASK] = *job;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool deque_pop(struct job_deque* deque, struct job* job) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    *job = deque->jobs[bottom & JOB_DEQUE_MASK];
+    if (top < bottom) {
+        return true;
+    }
+
+    // Last job, race the thieves for it
+    bool taken = __atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return taken;
+}
+
+static bool deque_steal(struct job_deque* deque, struct job* job) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return false;
+    }
+
+    struct job stolen = deque->jobs[top & JOB_DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    *job = stolen;
+    return true;
+}
+
+static void counter_lock(struct job_counter* counter) {
+    while (__atomic_exchange_n(&counter->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+}
+
+static void counter_unlock(struct job_counter* counter) {
+    __atomic_store_n(&counter->lock, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+static void wake_workers() {
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&idle_lock);
+    pthread_cond_broadcast(&idle_wake);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+static void execute(const struct job* job);
+
+static void queue_job(const struct job* job) {
+    if (current_worker < 0 || !deque_push(&workers[current_worker].deque, job)) {
+        execute(job);
+        return;
+    }
+
+    __atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+    wake_workers();
+}
+
+// Every change to pending happens under the counter lock so a waiter that
+// has seen zero and taken the lock knows no finishing job still touches it
+static void finish_counter(struct job_counter* counter) {
+    struct job ready[JOB_MAX_CONTINUATIONS];
+    uint32_t ready_count = 0;
+
+    counter_lock(counter);
+    if (__atomic_sub_fetch(&counter->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        ready_count = counter->continuations_count;
+        memcpy(ready, counter->continuations, sizeof(struct job) * ready_count);
+        counter->continuations_count = 0;
+    }
+    counter_unlock(counter);
+
+    for (uint32_t i = 0; i < ready_count; i++) {
+        queue_job(&ready[i]);
+    }
+}
+
+static void execute(const struct job* job) {
+    __atomic_add_fetch(&executing, 1, __ATOMIC_SEQ_CST);
+    job_timing_hook hook = __atomic_load_n(&timing_hook, __ATOMIC_SEQ_CST);
+    uint64_t start = hook != NULL ? now_ns() : 0;
+
+    job->function(job->data, job->index);
+
+    if (hook != NULL) {
+        hook(job->name, current_worker < 0 ? 0 : (uint32_t)current_worker, start, now_ns());
+    }
+    __atomic_sub_fetch(&executing, 1, __ATOMIC_SEQ_CST);
+
+    if (job->counter != NULL) {
+        finish_counter(job->counter);
+    }
+}
+
+static bool take_job(struct worker* worker, struct job* job) {
+    bool found = deque_pop(&worker->deque, job);
+
+    // Start stealing at a different victim each time to spread contention
+    for (uint32_t i = 1; !found && i < workers_count; i++) {
+        worker->steal_seed = worker->steal_seed * 1664525u + 1013904223u;
+        uint32_t victim = (worker->index + 1 + (worker->steal_seed >> 16) % (workers_count - 1)) % workers_count;
+        if (victim != worker->index) {
+            found = deque_steal(&workers[victim].deque, job);
+        }
+    }
+
+    if (found) {
+        __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return found;
+}
+
+static void* worker_main(void* argument) {
+    struct worker* worker = argument;
+    current_worker = worker->index;
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        struct job job;
+        if (take_job(worker, &job)) {
+            execute(&job);
+            continue;
+        }
+
+        // Announce the sleep before checking for work, a queuing thread
+        // either sees the sleeper or the sleeper sees its job
+        pthread_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&idle_wake, &idle_lock);
+        }
+        __atomic_sub_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&idle_lock);
+    }
+
+    return NULL;
+}
+
+bool create_job_system(uint32_t threads) {
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (uint32_t)cores : 1;
+    }
+
+    const char* override = getenv("VL_JOB_THREADS");
+    if (override != NULL && atoi(override) > 0) {
+        threads = (uint32_t)atoi(override);
+    }
+
+    threads = threads < MAX_JOB_THREADS ? threads : MAX_JOB_THREADS;
+
+    workers = calloc(threads, sizeof(struct worker));
+    if (workers == NULL) {
+        return false;
+    }
+
+    workers_count = threads;
+    running = true;
+    current_worker = 0;
+
+    for (uint32_t i = 0; i < threads; i++) {
+        workers[i].index = i;
+        workers[i].steal_seed = i * 2654435761u + 1;
+    }
+
+    for (uint32_t i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            // Jobs already spread over the started workers still complete
+            workers_count = i;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void destroy_job_system() {
+    if (workers == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&idle_lock);
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&idle_wake);
+    pthread_mutex_unlock(&idle_lock);
+
+    for (uint32_t i = 1; i < workers_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    free(workers);
+    workers = NULL;
+    workers_count = 0;
+    current_worker = -1;
+}
+
+uint32_t job_threads_count() {
+    return workers_count > 0 ? workers_count : 1;
+}
+
+uint32_t job_thread_index() {
+    return current_worker < 0 ? 0 : (uint32_t)current_worker;
+}
+
+void job_set_timing_hook(job_timing_hook hook) {
+    __atomic_store_n(&timing_hook, hook, __ATOMIC_SEQ_CST);
+}
+
+void job_run(const struct job* job) {
+    if (job->counter != NULL) {
+        __atomic_add_fetch(&job->counter->pending, 1, __ATOMIC_SEQ_CST);
+    }
+
+    queue_job(job);
+}
+
+void job_run_after(struct job_counter* dependency, const struct job* job) {
+    if (job->counter != NULL) {
+        __atomic_add_fetch(&job->counter->pending, 1, __ATOMIC_SEQ_CST);
+    }
+
+    counter_lock(dependency);
+    if (dependency->pending > 0 && dependency->continuations_count < JOB_MAX_CONTINUATIONS) {
+        dependency->continuations[dependency->continuations_count++] = *job;
+        counter_unlock(dependency);
+        return;
+    }
+    counter_unlock(dependency);
+
+    // A full continuation list falls back to waiting here
+    job_wait(dependency);
+    queue_job(job);
+}
+
+void job_run_range(job_function function, void* data, uint32_t count, const char* name, struct job_counter* counter) {
+    if (counter != NULL) {
+        __atomic_add_fetch(&counter->pending, count, __ATOMIC_SEQ_CST);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct job job = {
+            .function = function,
+            .data = data,
+            .index = i,
+            .name = name,
+            .counter = counter,
+        };
+        queue_job(&job);
+    }
+}
+
+// Waiting workers run queued jobs instead of blocking
+void job_wait(struct job_counter* counter) {
+    while (__atomic_load_n(&counter->pending, __ATOMIC_ACQUIRE) != 0) {
+        struct job job;
+        if (current_worker >= 0 && take_job(&workers[current_worker], &job)) {
+            execute(&job);
+        } else {
+            sched_yield();
+        }
+    }
+
+    counter_lock(counter);
+    counter_unlock(counter);
+}
+
+// Jobs counted in executing read the hook before it was changed or after,
+// either way they are done with it once the count reaches zero
+void job_wait_idle() {
+    while (true) {
+        bool waiting = workers != NULL && __atomic_load_n(&queued, __ATOMIC_SEQ_CST) != 0;
+        if (!waiting && __atomic_load_n(&executing, __ATOMIC_SEQ_CST) == 0) {
+            return;
+        }
+
+        struct job job;
+        if (current_worker >= 0 && take_job(&workers[current_worker], &job)) {
+            execute(&job);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+void job_parallel_for(job_function function, void* data, uint32_t count, const char* name) {
+    struct job_counter counter = {0};
+    job_run_range(function, data, count, name, &counter);
+    job_wait(&counter);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_JOB_THREADS 32
+#define JOB_DEQUE_SIZE 4096
+#define JOB_MAX_CONTINUATIONS 16
+
+typedef void (*job_function)(void* data, uint32_t index);
+typedef void (*job_timing_hook)(const char* name, uint32_t thread, uint64_t start_ns, uint64_t end_ns);
+
+struct job_counter;
+
+struct job {
+    job_function function;
+    void* data;
+    uint32_t index;
+    const char* name;
+
+    // Decremented when the job finishes, may be NULL
+    struct job_counter* counter;
+};
+
+// Zero initialised counters are ready to use, jobs queued behind a counter
+// start once it drops to zero
+struct job_counter {
+    uint32_t pending;
+    uint32_t lock;
+    uint32_t continuations_count;
+    struct job continuations[JOB_MAX_CONTINUATIONS];
+};
+
+// Threads of 0 uses one per core and VL_JOB_THREADS overrides either, the
+// calling thread becomes worker 0 and only runs jobs while it waits
+bool create_job_system(uint32_t threads);
+void destroy_job_system();
+
+uint32_t job_threads_count();
+uint32_t job_thread_index();
+void job_set_timing_hook(job_timing_hook hook);
+
+// Only workers queue jobs, other threads run them inline
+void job_run(const struct job* job);
+void job_run_after(struct job_counter* dependency, const struct job* job);
+void job_run_range(job_function function, void* data, uint32_t count, const char* name, struct job_counter* counter);
+void job_wait(struct job_counter* counter);
+
+// Returns once no job is queued or running on any thread, after which none
+// still uses a replaced timing hook. Must not be called from inside a job
+void job_wait_idle();
+void job_parallel_for(job_function function, void* data, uint32_t count, const char* name);
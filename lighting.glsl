@@ -0,0 +1,38 @@
+// Set 3 of the scene pipelines and set 0 of the light culling pass, layouts
+// match lights.c
+#ifndef LIGHT_SET
+#define LIGHT_SET 3
+#endif
+
+struct Light {
+    vec3 position;
+    float range;
+    vec3 color;
+    float cos_inner;
+    vec3 direction;
+    float cos_outer;
+};
+
+layout(std140, set = LIGHT_SET, binding = 0) uniform Frame {
+    mat4 view_projection;
+    mat4 view;
+    vec4 projection;
+    uvec3 grid;
+    uint light_count;
+    vec4 slicing;
+    vec4 camera_position;
+    mat4 shadow_matrices[4];
+    vec4 shadow_splits;
+    vec4 sun_direction;
+    vec4 sun_color;
+};
+
+layout(std430, set = LIGHT_SET, binding = 1) readonly buffer Lights {
+    Light lights[];
+};
+
+const uint MAX_CLUSTER_LIGHTS = 128;
+
+uint cluster_index(uvec3 cluster) {
+    return (cluster.z * grid.y + cluster.y) * grid.x + cluster.x;
+}
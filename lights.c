@@ -0,0 +1,327 @@
+#include "lights.h"
+#include "buffers.h"
+#include "camera.h"
+#include "commands.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "shaders.h"
+#include "shadows.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LIGHT_BINDINGS 5
+#define LIGHT_BUFFER_BINDINGS 4
+
+// Matches Frame in lighting.glsl. Projection holds the x and y scale of the
+// projection and the near and far planes, slicing the log of the view depth
+// scale and bias. The sun direction's w is 1 while it casts shadows
+struct light_frame {
+    mat4x4 view_projection;
+    mat4x4 view;
+    vec4 projection;
+    uint32_t grid[3];
+    uint32_t light_count;
+    vec4 slicing;
+    vec4 camera_position;
+    mat4x4 shadow_matrices[SHADOW_CASCADES];
+    vec4 shadow_splits;
+    vec4 sun_direction;
+    vec4 sun_color;
+};
+
+VkDescriptorSetLayout light_set_layout;
+
+static struct light lights[MAX_LIGHTS];
+static uint32_t lights_count = 0;
+static uint64_t lights_version = 1;
+
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+static VkPipelineLayout cull_layout;
+static VkPipeline cull_pipeline;
+
+static VkBuffer frame_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory frame_memory[MAX_FRAMES_IN_FLIGHT];
+static struct light_frame* frame_data[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer light_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory light_memory[MAX_FRAMES_IN_FLIGHT];
+static struct light* light_data[MAX_FRAMES_IN_FLIGHT];
+static uint64_t lights_uploaded[MAX_FRAMES_IN_FLIGHT];
+
+// Per cluster light counts followed by MAX_CLUSTER_LIGHTS indices for each,
+// CLUSTER_COUNT is a multiple of 64 so the indices start at an offset every
+// device accepts for storage buffers
+static VkBuffer cluster_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory cluster_memory[MAX_FRAMES_IN_FLIGHT];
+
+bool lights_add(const struct light* light) {
+    if (lights_count == MAX_LIGHTS) {
+        return false;
+    }
+
+    lights[lights_count++] = *light;
+    lights_version++;
+    return true;
+}
+
+void lights_clear() {
+    lights_count = 0;
+    lights_version++;
+}
+
+static float random_unit() {
+    return (float)rand() / (float)RAND_MAX;
+}
+
+void lights_scatter(uint32_t count, const vec3 center, float radius) {
+    float range = radius * 2.f / cbrtf((float)(count > 0 ? count : 1));
+    for (uint32_t i = 0; i < count; i++) {
+        struct light light = {
+            .range = range * (0.5f + random_unit()),
+            .color = {random_unit(), random_unit(), random_unit()},
+            .cos_inner = -1.f,
+            .cos_outer = -2.f,
+        };
+
+        for (int axis = 0; axis < 3; axis++) {
+            light.position[axis] = center[axis] + (random_unit() * 2.f - 1.f) * radius;
+        }
+
+        // Every fourth light is a spot pointing down
+        if (i % 4 == 3) {
+            vec3 down = {0.f, -1.f, 0.f};
+            vec3_dup(light.direction, down);
+            light.cos_outer = cosf(0.6f);
+            light.cos_inner = cosf(0.4f);
+        }
+
+        if (!lights_add(&light)) {
+            return;
+        }
+    }
+}
+
+static VkResult create_light_set() {
+    VkDescriptorSetLayoutBinding bindings[LIGHT_BINDINGS];
+    for (uint32_t i = 0; i < LIGHT_BINDINGS; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    // The sun's shadow map
+    bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[4].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = LIGHT_BINDINGS,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &layout_info, NULL, &light_set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[3] = {
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, MAX_FRAMES_IN_FLIGHT},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, (LIGHT_BUFFER_BINDINGS - 1) * MAX_FRAMES_IN_FLIGHT},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_FRAMES_IN_FLIGHT},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = 3,
+        .pPoolSizes = pool_sizes,
+    };
+
+    return vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+}
+
+static VkResult create_frame_resources(int frame) {
+    VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkResult result = create_buffer(sizeof(struct light_frame), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, host, &frame_buffers[frame], &frame_memory[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    vkMapMemory(logical_device, frame_memory[frame], 0, sizeof(struct light_frame), 0, (void**)&frame_data[frame]);
+
+    result = create_buffer(sizeof(struct light) * MAX_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host, &light_buffers[frame], &light_memory[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    vkMapMemory(logical_device, light_memory[frame], 0, sizeof(struct light) * MAX_LIGHTS, 0, (void**)&light_data[frame]);
+    lights_uploaded[frame] = 0;
+
+    VkDeviceSize counts_size = sizeof(uint32_t) * CLUSTER_COUNT;
+    VkDeviceSize cluster_size = counts_size + sizeof(uint32_t) * CLUSTER_COUNT * MAX_CLUSTER_LIGHTS;
+    result = create_buffer(cluster_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cluster_buffers[frame], &cluster_memory[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &light_set_layout,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, &sets[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorBufferInfo buffer_infos[LIGHT_BUFFER_BINDINGS] = {
+        {frame_buffers[frame], 0, VK_WHOLE_SIZE},
+        {light_buffers[frame], 0, VK_WHOLE_SIZE},
+        {cluster_buffers[frame], 0, counts_size},
+        {cluster_buffers[frame], counts_size, VK_WHOLE_SIZE},
+    };
+
+    VkWriteDescriptorSet writes[LIGHT_BINDINGS];
+    for (uint32_t i = 0; i < LIGHT_BUFFER_BINDINGS; i++) {
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = sets[frame],
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[i],
+        };
+    }
+
+    VkDescriptorImageInfo shadow_info = {
+        .sampler = shadow_sampler,
+        .imageView = shadow_map_view,
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+    };
+
+    writes[4] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = sets[frame],
+        .dstBinding = 4,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &shadow_info,
+    };
+
+    vkUpdateDescriptorSets(logical_device, LIGHT_BINDINGS, writes, 0, NULL);
+    return VK_SUCCESS;
+}
+
+VkResult create_lights() {
+    VkResult result = create_light_set();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        result = create_frame_resources(frame);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &light_set_layout,
+    };
+
+    result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &cull_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_compute_pipeline("./shaders/light_cull.spv", cull_layout, &cull_pipeline);
+}
+
+void destroy_lights() {
+    vkDestroyPipeline(logical_device, cull_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, cull_layout, NULL);
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        vkDestroyBuffer(logical_device, frame_buffers[frame], NULL);
+        vkFreeMemory(logical_device, frame_memory[frame], NULL);
+        vkDestroyBuffer(logical_device, light_buffers[frame], NULL);
+        vkFreeMemory(logical_device, light_memory[frame], NULL);
+        vkDestroyBuffer(logical_device, cluster_buffers[frame], NULL);
+        vkFreeMemory(logical_device, cluster_memory[frame], NULL);
+    }
+
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, light_set_layout, NULL);
+    lights_count = 0;
+}
+
+// Slices are spaced exponentially in view depth, so a cluster is about as
+// deep as it is wide on screen
+void lights_prepare(uint32_t frame) {
+    struct light_frame* data = frame_data[frame];
+    float near_plane = camera.near_plane;
+    float far_plane = camera.far_plane;
+    float log_ratio = logf(far_plane / near_plane);
+
+    mat4x4_dup(data->view_projection, camera.view_projection);
+    mat4x4_dup(data->view, camera.view);
+    data->projection[0] = camera.projection[0][0];
+    data->projection[1] = camera.projection[1][1];
+    data->projection[2] = near_plane;
+    data->projection[3] = far_plane;
+    data->grid[0] = CLUSTER_GRID_X;
+    data->grid[1] = CLUSTER_GRID_Y;
+    data->grid[2] = CLUSTER_GRID_Z;
+    data->light_count = lights_count;
+    data->slicing[0] = CLUSTER_GRID_Z / log_ratio;
+    data->slicing[1] = -CLUSTER_GRID_Z * logf(near_plane) / log_ratio;
+    data->slicing[2] = (float)render_extent.width / CLUSTER_GRID_X;
+    data->slicing[3] = (float)render_extent.height / CLUSTER_GRID_Y;
+    data->camera_position[0] = camera.position[0];
+    data->camera_position[1] = camera.position[1];
+    data->camera_position[2] = camera.position[2];
+    data->camera_position[3] = 1.f;
+
+    for (int i = 0; i < SHADOW_CASCADES; i++) {
+        mat4x4_dup(data->shadow_matrices[i], shadow_matrices[i]);
+        data->shadow_splits[i] = shadow_splits[i];
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        data->sun_direction[axis] = sun_direction[axis];
+        data->sun_color[axis] = sun_color[axis];
+    }
+    data->sun_direction[3] = shadows_enabled ? 1.f : 0.f;
+    data->sun_color[3] = 1.f;
+
+    if (lights_uploaded[frame] != lights_version) {
+        memcpy(light_data[frame], lights, sizeof(struct light) * lights_count);
+        lights_uploaded[frame] = lights_version;
+    }
+}
+
+void lights_cull(VkCommandBuffer buffer, uint32_t frame) {
+    if (lights_count == 0) {
+        return;
+    }
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 0, 1, &sets[frame], 0, NULL);
+    vkCmdDispatch(buffer, CLUSTER_COUNT, 1, 1);
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+VkDescriptorSet light_set(uint32_t frame) {
+    return sets[frame];
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "linmath.h"
+
+#define MAX_LIGHTS 4096
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_CLUSTER_LIGHTS 128
+
+// Matches Light in lighting.glsl. Point lights have a cos_outer below -1 so
+// every direction is inside their cone
+struct light {
+    vec3 position;
+    float range;
+    vec3 color;
+    float cos_inner;
+    vec3 direction;
+    float cos_outer;
+};
+
+// Set 3 of the scene pipelines: the frame's camera, the lights and the light
+// list of every view space cluster, then the sun's shadow map
+extern VkDescriptorSetLayout light_set_layout;
+
+VkResult create_lights();
+void destroy_lights();
+
+// Returns false once MAX_LIGHTS are in the scene
+bool lights_add(const struct light* light);
+void lights_clear();
+
+// Random point and spot lights inside the sphere, for testing at scale
+void lights_scatter(uint32_t count, const vec3 center, float radius);
+
+// Writes the camera and lights for the frame, after the camera update
+void lights_prepare(uint32_t frame);
+
+// Bins the lights into the cluster grid, recorded before the frame's passes
+void lights_cull(VkCommandBuffer buffer, uint32_t frame);
+
+VkDescriptorSet light_set(uint32_t frame);
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <string.h>
+#include <math.h>
 #include <vulkan/vulkan_core.h>
 #include "devices.h"
 #include "graphics_pipeline.h"
@@ -10,9 +11,32 @@
 #include "main.h"
 #include "sync_objects.h"
 #include "swap_chain.h"
-#include "vertex_buffer.h"
+#include "dynamic_geometry.h"
+#include "dynamic_resolution.h"
 #include "window.h"
+#include "camera.h"
 #include "commands.h"
+#include "compute.h"
+#include "streaming.h"
+#include "compute_bench.h"
+#include "scene.h"
+#include "meshlets.h"
+#include "occlusion.h"
+#include "jobs.h"
+#include "lights.h"
+#include "particles.h"
+#include "post.h"
+#include "gpu_counters.h"
+#include "gpu_timers.h"
+#include "shadows.h"
+#include "shading_rate.h"
+#include "textures.h"
+#include "virtual_textures.h"
+#include "bench.h"
+#include "scenegen.h"
+#include "golden.h"
+#include "trace.h"
+#include "startup.h"
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -20,23 +44,58 @@
 #include <stdio.h>
 
 VkInstance instance;
+uint32_t instance_api_version = VK_API_VERSION_1_0;
 static uint32_t current_frame = 0;
+static uint32_t particle_count = 0;
+static bool sun_enabled = false;
+static float target_frame_ms = 0.f;
+static uint32_t bench_frames = 0;
+static const char* bench_output = "bench.json";
+static const char* generated_scene = NULL;
+static const char* golden_path = NULL;
+static bool golden_update = false;
+
+// Loaders older than 1.1 have no vkEnumerateInstanceVersion and reject any
+// apiVersion above 1.0
+static uint32_t instance_version() {
+    PFN_vkEnumerateInstanceVersion enumerate = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+    uint32_t version = VK_API_VERSION_1_0;
+    if (enumerate != NULL && enumerate(&version) != VK_SUCCESS) {
+        version = VK_API_VERSION_1_0;
+    }
+
+    return version;
+}
 
 static VkResult create_instance() {
+    uint32_t version = instance_version();
+    instance_api_version = version < VK_API_VERSION_1_3 ? version : VK_API_VERSION_1_3;
+
     struct VkApplicationInfo application_info = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
         .pApplicationName = "Meow",
         .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
         .pEngineName = "Meowgine",
         .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-        .apiVersion = VK_API_VERSION_1_0
+        .apiVersion = instance_api_version
     };
 
     uint32_t extensions_count = 0;
-    const char** extensions = glfwGetRequiredInstanceExtensions(&extensions_count);
+    const char** extensions;
+    const char* headless_extensions[2] = {
+        VK_KHR_SURFACE_EXTENSION_NAME,
+        VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME,
+    };
+
+    if (window_headless) {
+        extensions = headless_extensions;
+        extensions_count = 2;
+    } else {
+        extensions = glfwGetRequiredInstanceExtensions(&extensions_count);
+    }
 
     struct VkInstanceCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
         .pApplicationInfo = &application_info,
         .enabledExtensionCount = extensions_count,
         .ppEnabledExtensionNames = extensions,
@@ -47,6 +106,8 @@ static VkResult create_instance() {
 }
 
 static VkResult init_vulkan() {
+    TRACE_ZONE(zone, "init_vulkan");
+    STARTUP_STAGE(stage, "create_instance");
     VkResult result;
     result = create_instance();
     if (result != VK_SUCCESS) {
@@ -54,72 +115,205 @@ static VkResult init_vulkan() {
         return result;
     }
 
+    startup_stage_next(&stage, "create_surface");
     result = create_surface();
     if (result != VK_SUCCESS) {
         puts("Failed to create surface");
         return result;
     }
 
+    startup_stage_next(&stage, "init_device");
     result = init_device();
     if (result != VK_SUCCESS) {
         puts("Failed to create device");
         return result;
     }
 
+    startup_stage_next(&stage, "create_logical_device");
     result = create_logical_device();
     if (result != VK_SUCCESS) {
         puts("Failed to create logical device");
         return result;
     }
 
+    startup_stage_next(&stage, "create_pipeline_cache");
+    result = create_pipeline_cache();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create pipeline cache");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_swap_chain");
     result = create_swap_chain();
     if (result != VK_SUCCESS) {
         puts("Failed to create swap chain");
         return result;
     }
 
+    init_dynamic_resolution(target_frame_ms);
+
+    startup_stage_next(&stage, "create_image_view");
     result = create_image_view();
     if (result != VK_SUCCESS) {
         puts("Failed to create image view");
         return result;
     }
 
+    startup_stage_next(&stage, "create_color_resources");
+    result = create_color_resources();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create color resources");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_depth_resources");
+    result = create_depth_resources();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create depth resources");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_render_pass");
     result = create_render_pass();
     if (result != VK_SUCCESS) {
         puts("Failed to create render pass");
         return result;
     }
 
+    startup_stage_next(&stage, "create_textures");
+    result = create_textures();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create textures");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_virtual_textures");
+    result = create_virtual_textures();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create virtual textures");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_shadows");
+    result = create_shadows(sun_enabled);
+    if (result != VK_SUCCESS) {
+        puts("Failed to create shadows");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_lights");
+    result = create_lights();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create lights");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_shading_rate");
+    result = create_shading_rate();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create shading rate");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_graphics_pipeline");
     result = create_graphics_pipeline();
     if (result != VK_SUCCESS) {
         puts("Failed to create graphics pipeline");
         return result;
     }
 
+    startup_stage_next(&stage, "create_frame_buffer");
     result = create_frame_buffer();
     if (result != VK_SUCCESS) {
         puts("Failed to create frame buffers");
         return result;
     }
 
+    startup_stage_next(&stage, "create_command_pool");
     result = create_command_pool();
     if (result != VK_SUCCESS) {
         puts("Failed to create command pool");
         return result;
     }
 
-    result = create_vertex_buffer();
+    startup_stage_next(&stage, "create_compute_context");
+    result = create_compute_context();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create compute context");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_streaming");
+    result = create_streaming();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create streaming");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_depth_pyramid");
+    result = create_depth_pyramid();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create depth pyramid");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_post");
+    result = create_post();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create post processing");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_gpu_timers");
+    result = create_gpu_timers();
     if (result != VK_SUCCESS) {
-        puts("Failed to create vertex buffer");
+        puts("Failed to create GPU timers");
         return result;
     }
 
+    startup_stage_next(&stage, "create_gpu_counters");
+    result = create_gpu_counters();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create GPU counters");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_meshlet_culling");
+    result = create_meshlet_culling();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create meshlet culling");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_particles");
+    result = create_particles(particle_count);
+    if (result != VK_SUCCESS) {
+        puts("Failed to create particles");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_dynamic_geometry");
+    result = create_dynamic_geometry();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create dynamic geometry");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_command_buffers");
     result = create_command_buffers();
     if (result != VK_SUCCESS) {
         puts("Failed to create command buffer");
         return result;
     }
 
+    startup_stage_next(&stage, "create_secondary_pools");
+    result = create_secondary_pools();
+    if (result != VK_SUCCESS) {
+        puts("Failed to create secondary command pools");
+        return result;
+    }
+
+    startup_stage_next(&stage, "create_sync_objects");
     result = create_sync_objects();
     if (result != VK_SUCCESS) {
         puts("Failed to create sync objects");
@@ -130,6 +324,8 @@ static VkResult init_vulkan() {
 }
 
 static void draw_frame() {
+    TRACE_ZONE(zone, "draw_frame");
+    TRACE_ZONE(phase, "wait");
     vkWaitForFences(logical_device, 1, &in_flight_fence[current_frame], VK_TRUE, UINT64_MAX);
 
     uint32_t image_index;
@@ -139,23 +335,57 @@ static void draw_frame() {
         return;
     }
     vkResetFences(logical_device, 1, &in_flight_fence[current_frame]);
+    bench_mark(BENCH_PHASE_WAIT);
+    trace_zone_next(&phase, "update");
+
+    // The fence covers the feedback and geometry this frame slot wrote last
+    // time
+    dynamic_geometry_begin(current_frame);
+    virtual_textures_update(current_frame);
+    gpu_timers_update(current_frame);
+    gpu_counters_update();
+    dynamic_resolution_update(current_frame);
+    update_camera((float)swap_chain_extent.width / swap_chain_extent.height);
+    shadows_prepare();
+    lights_prepare(current_frame);
+    streaming_update(current_frame, camera.position);
+    meshlets_prepare(current_frame);
+
+    VkSemaphore compute_finished;
+    compute_submit(current_frame, &compute_finished);
+    bench_mark(BENCH_PHASE_UPDATE);
+    trace_zone_next(&phase, "record");
 
     vkResetCommandBuffer(command_buffers[current_frame], 0);
-    record_command_buffer(&command_buffers[current_frame], image_index);
+    record_command_buffer(&command_buffers[current_frame], image_index, current_frame);
+    bench_mark(BENCH_PHASE_RECORD);
+    trace_zone_next(&phase, "submit");
+
+    VkSemaphore wait_semaphores[2] = {
+        image_available_semaphore[current_frame],
+        compute_finished,
+    };
+
+    VkPipelineStageFlags flags[2] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+    };
 
-    VkPipelineStageFlags flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pWaitSemaphores = &image_available_semaphore[current_frame],
-        .waitSemaphoreCount = 1,
-        .pWaitDstStageMask = &flags,
+        .pWaitSemaphores = wait_semaphores,
+        .waitSemaphoreCount = compute_finished != VK_NULL_HANDLE ? 2 : 1,
+        .pWaitDstStageMask = flags,
         .commandBufferCount = 1,
         .pCommandBuffers = &command_buffers[current_frame],
         .signalSemaphoreCount = 1,
         .pSignalSemaphores = &render_finished_semaphore[current_frame],
     };
 
+    struct trace_zone submit = trace_zone_begin("submit_graphics");
     vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fence[current_frame]);
+    trace_zone_next(&submit, "present");
+
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
@@ -165,36 +395,113 @@ static void draw_frame() {
         .pImageIndices = &image_index,
     };
     vkQueuePresentKHR(present_queue, &present_info);
+    trace_zone_end(&submit);
+    bench_mark(BENCH_PHASE_SUBMIT);
+    startup_first_frame();
 
     current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+static void print_job_timing(const char* name, uint32_t thread, uint64_t start_ns, uint64_t end_ns) {
+    printf("Job %s on thread %u took %.3f ms\n", name, thread, (end_ns - start_ns) / 1e6);
+}
+
+// Left click reports the instance under the cursor
+static void pick_instance(GLFWwindow* handle, int button, int action, int mods) {
+    (void)mods;
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+        return;
+    }
+
+    double x, y;
+    int width, height;
+    glfwGetCursorPos(handle, &x, &y);
+    glfwGetWindowSize(handle, &width, &height);
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    vec3 origin, direction;
+    camera_ray(2.f * x / width - 1.f, 2.f * y / height - 1.f, origin, direction);
+
+    float distance;
+    int32_t picked = scene_pick(origin, direction, &distance);
+    if (picked >= 0) {
+        printf("Picked instance %d at distance %.2f\n", picked, distance);
+    }
+}
+
 static void main_loop() {
+    glfwSetMouseButtonCallback(window, pick_instance);
+
+    // With counters on their table is reprinted once a second
+    double counters_printed = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
         draw_frame();
+
+        if (gpu_counters_enabled && glfwGetTime() - counters_printed >= 1.0) {
+            counters_printed = glfwGetTime();
+            gpu_counters_print();
+        }
     }
 
     vkDeviceWaitIdle(logical_device);
 }
 
-static void cleanup_swap_chain() {
-    for (uint32_t i = 0; i < swap_chain_images_count; i++) {
-        vkDestroyFramebuffer(logical_device, swap_chain_frame_buffers[i], NULL);
+// Headless, fixed time steps and a camera driven by the frame index
+static int bench_loop() {
+    particles_set_time_step(BENCH_TIME_STEP);
+    if (!bench_begin(bench_frames, BENCH_WARMUP_FRAMES)) {
+        puts("Failed to start benchmark");
+        return 1;
     }
 
+    for (uint32_t i = 0; i < bench_frames; i++) {
+        bench_frame_begin(i);
+        uint32_t frame = current_frame;
+        draw_frame();
+        bench_frame_end(frame);
+    }
+
+    vkDeviceWaitIdle(logical_device);
+    return bench_finish(bench_output);
+}
+
+// Same fixed steps as the benchmark with the camera where load_scene put it
+static int golden_loop() {
+    particles_set_time_step(BENCH_TIME_STEP);
+    for (uint32_t i = 0; i < GOLDEN_FRAMES; i++) {
+        // The last frame copies its image out before presenting it
+        if (i == GOLDEN_FRAMES - 1 && golden_request_capture() != VK_SUCCESS) {
+            puts("Failed to create golden capture");
+            return 1;
+        }
+        draw_frame();
+    }
+
+    vkDeviceWaitIdle(logical_device);
+    return golden_check(golden_path, golden_update);
+}
+
+static void cleanup_swap_chain() {
+    vkDestroyFramebuffer(logical_device, swap_chain_frame_buffer, NULL);
+    swap_chain_frame_buffer = VK_NULL_HANDLE;
+
     for (uint32_t i = 0; i < swap_chain_images_count; i++) {
         vkDestroyImageView(logical_device, swap_chain_image_views[i], NULL);
     }
 
+    destroy_color_resources();
+    destroy_depth_resources();
+
     vkDestroySwapchainKHR(logical_device, swap_chain, NULL);
 }
 
 static void cleanup() {
     cleanup_swap_chain();
 
-    vkDestroyBuffer(logical_device, vertex_buffer, NULL);
-    vkFreeMemory(logical_device, vertex_buffer_memory, NULL);
+    destroy_dynamic_geometry();
 
     for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vkDestroySemaphore(logical_device, image_available_semaphore[i], NULL);
@@ -206,13 +513,32 @@ static void cleanup() {
     free(render_finished_semaphore);
     free(in_flight_fence);
 
+    destroy_secondary_pools();
     vkDestroyCommandPool(logical_device, command_pool, NULL);
     free(command_buffers);
 
+    destroy_compute_context();
+    destroy_particles();
+    destroy_gpu_counters();
+    destroy_gpu_timers();
+    destroy_post();
+    destroy_meshlet_culling();
+    destroy_depth_pyramid();
+    destroy_streaming();
+    destroy_scene();
+
     vkDestroyPipeline(logical_device, pipeline, NULL);
     vkDestroyPipelineLayout(logical_device, pipeline_layout, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, empty_set_layout, NULL);
+    destroy_shading_rate();
+    destroy_lights();
+    destroy_shadows();
+    destroy_virtual_textures();
+    destroy_textures();
     vkDestroyRenderPass(logical_device, render_pass, NULL);
+    vkDestroyRenderPass(logical_device, render_pass_load, NULL);
 
+    destroy_pipeline_cache();
     vkDestroyDevice(logical_device, NULL);
 
     vkDestroySurfaceKHR(instance, surface, NULL);
@@ -221,18 +547,177 @@ static void cleanup() {
     free(swap_chain_images);
     free(swap_chain_image_views);
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    destroy_window();
+
+    destroy_job_system();
+    trace_finish();
 }
 
-int main() {
+static void load_scene(int argc, char** argv) {
+    TRACE_ZONE(zone, "load_scene");
+    mat4x4 identity;
+    mat4x4_identity(identity);
+
+    // A texture applies to the mesh given before it
+    int32_t mesh = -1;
+    uint32_t light_count = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--lights") == 0) {
+            light_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+
+        if (strcmp(argv[i], "--texture") == 0) {
+            int32_t texture = scene_add_texture(argv[++i]);
+            if (mesh >= 0 && texture >= 0) {
+                scene_set_mesh_texture(mesh, texture);
+            }
+            continue;
+        }
+
+        if (strcmp(argv[i], "--virtual-texture") == 0) {
+            int32_t texture = load_virtual_texture(argv[++i]);
+            if (mesh >= 0 && texture >= 0) {
+                scene_set_mesh_virtual_texture(mesh, texture);
+            }
+            continue;
+        }
+
+        bool streamed = strcmp(argv[i], "--stream-mesh") == 0;
+        if (!streamed && strcmp(argv[i], "--mesh") != 0) {
+            continue;
+        }
+
+        mesh = scene_add_mesh(argv[++i], streamed);
+        if (mesh >= 0) {
+            scene_add_instance(mesh, identity);
+        }
+    }
+
+    // Benchmarks without meshes of their own run over a generated scene
+    if (generated_scene == NULL && scene.instances_count == 0 && bench_frames > 0) {
+        generated_scene = BENCH_SCENE;
+    }
+
+    struct scenegen_settings settings;
+    if (generated_scene != NULL && parse_scenegen_settings(generated_scene, &settings)) {
+        scenegen_build(&settings);
+    }
+
+    if (scene.instances_count == 0) {
+        return;
+    }
+
+    vec3 center;
+    float radius;
+    scene_bounds(center, &radius);
+
+    vec3_dup(camera.target, center);
+    vec3 offset = {0.f, 0.f, radius * 2.5f};
+    vec3_add(camera.position, center, offset);
+    camera.far_plane = fmaxf(camera.far_plane, radius * 10.f);
+
+    lights_scatter(light_count, center, radius);
+    shadows_set_bounds(center, radius);
+}
+
+int main(int argc, char** argv) {
+    startup_begin();
+    bool compute_benchmark = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compute-bench") == 0) {
+            compute_benchmark = true;
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            particle_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--sun") == 0) {
+            sun_enabled = true;
+        } else if (strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc) {
+            target_frame_ms = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--post") == 0 && i + 1 < argc) {
+            if (!parse_post_quality(argv[++i], &post_quality)) {
+                puts("Post quality is low, medium or high");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--vrs") == 0 && i + 1 < argc) {
+            if (!parse_shading_rate_mode(argv[++i], &shading_rate_mode)) {
+                puts("Shading rate mode is off, content or foveated");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+            window_headless = true;
+        } else if ((strcmp(argv[i], "--golden") == 0 || strcmp(argv[i], "--golden-update") == 0) && i + 1 < argc) {
+            golden_update = strcmp(argv[i], "--golden-update") == 0;
+            golden_path = argv[++i];
+            window_headless = true;
+        } else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc) {
+            bench_output = argv[++i];
+        } else if (strcmp(argv[i], "--scene-gen") == 0 && i + 1 < argc) {
+            struct scenegen_settings settings;
+            generated_scene = argv[++i];
+            if (!parse_scenegen_settings(generated_scene, &settings)) {
+                puts("Scene is a preset, tiny, small, medium or large, and or key=value pairs");
+                return 1;
+            }
+        }
+    }
+
+    const char* trace_output = getenv("VL_TRACE");
+    if (trace_output != NULL && !trace_begin(trace_output)) {
+        puts("Failed to start tracing");
+        return 1;
+    }
+
     init_window();
+    init_camera();
+
+    if (!create_job_system(0)) {
+        puts("Failed to create job system");
+        return 1;
+    }
+
+    // Tracing records jobs through the same hook
+    if (getenv("VL_JOB_TIMING") != NULL && !trace_enabled) {
+        job_set_timing_hook(print_job_timing);
+    }
 
     if (init_vulkan() != VK_SUCCESS) {
         return 1;
     }
 
+    // Pipelines compile on the job threads while the scene loads and
+    // uploads, nothing records before they are done
+    if (!compute_benchmark) {
+        load_scene(argc, argv);
+    }
+
+    if (startup_finish() != VK_SUCCESS) {
+        return 1;
+    }
+
+    if (compute_benchmark) {
+        int status = run_compute_benchmark();
+        vkDeviceWaitIdle(logical_device);
+        cleanup();
+        return status;
+    }
+
+    if (bench_frames > 0) {
+        int status = bench_loop();
+        cleanup();
+        return status;
+    }
+
+    if (golden_path != NULL) {
+        int status = golden_loop();
+        cleanup();
+        return status;
+    }
+
     main_loop();
+    if (getenv("VL_GPU_TIMING") != NULL) {
+        gpu_timers_print();
+    }
     cleanup();
 
     return 0;
@@ -4,3 +4,6 @@
 #include <GLFW/glfw3.h>
 
 extern VkInstance instance;
+
+// The version the instance was created with, devices are used up to it
+extern uint32_t instance_api_version;
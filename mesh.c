@@ -0,0 +1,334 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mesh.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "devices.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool validate_header(const struct mesh_header* header, uint64_t file_size, const char* path) {
+    if (header->magic != MESH_MAGIC || header->version != MESH_VERSION) {
+        printf("%s is not a version %u baked mesh, rebake it with mesh_baker\n", path, MESH_VERSION);
+        return false;
+    }
+
+    if (header->vertex_stride != sizeof(struct vertex)) {
+        printf("%s has a vertex stride of %u, expected %zu\n", path, header->vertex_stride, sizeof(struct vertex));
+        return false;
+    }
+
+    if (header->vertex_count == 0 || header->index_count == 0) {
+        printf("%s has no geometry\n", path);
+        return false;
+    }
+
+    if (header->lod_count == 0 || header->lod_count > MESH_MAX_LODS) {
+        printf("%s has an invalid LOD table\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        const struct mesh_section* section = &header->sections[i];
+        if (section->offset % MESH_SECTION_ALIGNMENT != 0
+            || section->offset > file_size || section->size > file_size - section->offset) {
+            printf("%s is truncated or has a misaligned section\n", path);
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->lod_count; i++) {
+        const struct mesh_lod* lod = &header->lods[i];
+        if ((uint64_t)lod->index_offset + lod->index_count > header->index_count || lod->index_count % 3 != 0) {
+            printf("%s has a LOD outside its index section\n", path);
+            return false;
+        }
+
+        if ((uint64_t)lod->meshlet_offset + lod->meshlet_count > header->meshlet_count) {
+            printf("%s has a LOD outside its meshlet section\n", path);
+            return false;
+        }
+    }
+
+    uint64_t sizes[MESH_SECTION_COUNT] = {
+        [MESH_SECTION_VERTICES] = (uint64_t)header->vertex_count * header->vertex_stride,
+        [MESH_SECTION_INDICES] = (uint64_t)header->index_count * sizeof(uint32_t),
+        [MESH_SECTION_MESHLETS] = (uint64_t)header->meshlet_count * sizeof(struct meshlet),
+        [MESH_SECTION_MESHLET_VERTICES] = (uint64_t)header->meshlet_vertex_count * sizeof(uint32_t),
+        [MESH_SECTION_MESHLET_TRIANGLES] = (uint64_t)header->meshlet_triangle_count * sizeof(uint32_t),
+    };
+
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        if (header->sections[i].size != sizes[i] || sizes[i] == 0) {
+            printf("%s section sizes do not match its counts\n", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The shaders and draws index with what the sections hold, a stale or
+// corrupt file must not turn into reads outside the buffers
+static bool validate_contents(const struct mesh_header* header, const uint8_t* data, const char* path) {
+    const uint32_t* indices = (const uint32_t*)(data + header->sections[MESH_SECTION_INDICES].offset);
+    for (uint32_t i = 0; i < header->index_count; i++) {
+        if (indices[i] >= header->vertex_count) {
+            printf("%s has an index outside its vertices\n", path);
+            return false;
+        }
+    }
+
+    const uint32_t* meshlet_vertices = (const uint32_t*)(data + header->sections[MESH_SECTION_MESHLET_VERTICES].offset);
+    for (uint32_t i = 0; i < header->meshlet_vertex_count; i++) {
+        if (meshlet_vertices[i] >= header->vertex_count) {
+            printf("%s has a meshlet vertex outside its vertices\n", path);
+            return false;
+        }
+    }
+
+    const struct meshlet* meshlets = (const struct meshlet*)(data + header->sections[MESH_SECTION_MESHLETS].offset);
+    const uint32_t* triangles = (const uint32_t*)(data + header->sections[MESH_SECTION_MESHLET_TRIANGLES].offset);
+    for (uint32_t i = 0; i < header->meshlet_count; i++) {
+        const struct meshlet* meshlet = &meshlets[i];
+        if (meshlet->vertex_count > MESHLET_MAX_VERTICES || meshlet->triangle_count > MESHLET_MAX_TRIANGLES
+            || (uint64_t)meshlet->vertex_offset + meshlet->vertex_count > header->meshlet_vertex_count
+            || (uint64_t)meshlet->triangle_offset + meshlet->triangle_count > header->meshlet_triangle_count
+            || (uint64_t)meshlet->index_offset + (uint64_t)meshlet->triangle_count * 3 > header->index_count) {
+            printf("%s has a meshlet outside its sections\n", path);
+            return false;
+        }
+
+        for (uint32_t k = 0; k < meshlet->triangle_count; k++) {
+            uint32_t packed = triangles[meshlet->triangle_offset + k];
+            if ((packed & 0xff) >= meshlet->vertex_count || ((packed >> 8) & 0xff) >= meshlet->vertex_count
+                || ((packed >> 16) & 0xff) >= meshlet->vertex_count) {
+                printf("%s has a meshlet triangle outside its vertices\n", path);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void read_header(const struct mesh_header* header, struct mesh* mesh) {
+    mesh->vertex_count = header->vertex_count;
+    mesh->index_count = header->index_count;
+    mesh->meshlet_count = header->meshlet_count;
+    mesh->bounds = header->bounds;
+    mesh->lod_count = header->lod_count;
+    memcpy(mesh->lods, header->lods, sizeof(mesh->lods));
+}
+
+// Everything is readable from compute, task and mesh shaders, the culling
+// passes and the mesh shader path fetch geometry straight from storage buffers
+static const VkBufferUsageFlags section_usage[MESH_SECTION_COUNT] = {
+    [MESH_SECTION_VERTICES] = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    [MESH_SECTION_INDICES] = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    [MESH_SECTION_MESHLETS] = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    [MESH_SECTION_MESHLET_VERTICES] = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    [MESH_SECTION_MESHLET_TRIANGLES] = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+};
+
+static VkResult create_mesh_buffers(struct mesh* mesh, const struct mesh_header* header, VkMemoryPropertyFlags properties, VkBufferUsageFlags extra_usage) {
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        VkResult result = create_shared_buffer(header->sections[i].size, section_usage[i] | extra_usage, properties, &mesh->buffers[i], &mesh->memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+static VkResult copy_mapped(VkDeviceMemory memory, const void* data, VkDeviceSize size) {
+    void* mapped;
+    VkResult result = vkMapMemory(logical_device, memory, 0, size, 0, &mapped);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    memcpy(mapped, data, size);
+    vkUnmapMemory(logical_device, memory);
+
+    return VK_SUCCESS;
+}
+
+// The file is mapped and its sections uploaded from the mapping
+VkResult load_mesh(const char* path, struct mesh* mesh) {
+    memset(mesh, 0, sizeof(struct mesh));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s\n", path);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(struct mesh_header)) {
+        close(fd);
+        printf("%s is too small to be a mesh\n", path);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint8_t* file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        printf("Failed to map %s\n", path);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    const struct mesh_header* header = (const struct mesh_header*)file;
+    if (!validate_header(header, info.st_size, path) || !validate_contents(header, file, path)) {
+        munmap(file, info.st_size);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkResult result = create_mesh(header, file, mesh);
+    munmap(file, info.st_size);
+    return result;
+}
+
+// Sections are handed to the GPU as they are, on unified memory devices
+// they are copied straight into device local memory
+VkResult create_mesh(const struct mesh_header* header, const uint8_t* data, struct mesh* mesh) {
+    memset(mesh, 0, sizeof(struct mesh));
+    read_header(header, mesh);
+
+    VkResult result;
+    if (device_capabilities.unified_memory) {
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        result = create_mesh_buffers(mesh, header, properties, 0);
+        for (int i = 0; i < MESH_SECTION_COUNT && result == VK_SUCCESS; i++) {
+            result = copy_mapped(mesh->memory[i], data + header->sections[i].offset, header->sections[i].size);
+        }
+    } else {
+        result = create_mesh_buffers(mesh, header, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        if (result == VK_SUCCESS) {
+            struct buffer_upload uploads[MESH_SECTION_COUNT];
+            for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+                uploads[i] = (struct buffer_upload){mesh->buffers[i], 0, data + header->sections[i].offset, header->sections[i].size};
+            }
+            result = upload_buffers(uploads, MESH_SECTION_COUNT);
+        }
+    }
+
+    if (result != VK_SUCCESS) {
+        destroy_mesh(mesh);
+        return result;
+    }
+
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        mesh->streams[i] = -1;
+    }
+    mesh->resident_sections = MESH_SECTION_COUNT;
+
+    return result;
+}
+
+static void on_section_resident(stream_handle handle, void* user) {
+    struct mesh* mesh = user;
+    stream_release(handle);
+    mesh->resident_sections++;
+}
+
+// Only the header and the checks read the file up front, the sections
+// arrive through the streaming service over the next frames, nearest
+// meshes first
+VkResult stream_mesh(const char* path, struct mesh* mesh) {
+    memset(mesh, 0, sizeof(struct mesh));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s\n", path);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    struct mesh_header header;
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header);
+    if (!ok || !validate_header(&header, info.st_size, path)) {
+        close(fd);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // The contents are checked from a mapping before anything is streamed,
+    // the pages read here are usually still cached when the reads arrive
+    uint8_t* file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        printf("Failed to map %s\n", path);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    ok = validate_contents(&header, file, path);
+    munmap(file, info.st_size);
+    if (!ok) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    read_header(&header, mesh);
+
+    VkResult result = create_mesh_buffers(mesh, &header, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    if (result != VK_SUCCESS) {
+        destroy_mesh(mesh);
+        return result;
+    }
+
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        struct stream_request request = {
+            .path = path,
+            .file_offset = header.sections[i].offset,
+            .size = header.sections[i].size,
+            .destination = mesh->buffers[i],
+            .destination_offset = 0,
+            .center = {header.bounds.center[0], header.bounds.center[1], header.bounds.center[2]},
+            .radius = header.bounds.radius,
+            .bias = 0.f,
+            .on_resident = on_section_resident,
+            .user = mesh,
+        };
+
+        mesh->streams[i] = stream_request(&request);
+        if (mesh->streams[i] < 0) {
+            // Nothing has been submitted for these yet, the buffers can go
+            for (int j = 0; j < i; j++) {
+                stream_release(mesh->streams[j]);
+            }
+            destroy_mesh(mesh);
+            return VK_ERROR_TOO_MANY_OBJECTS;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+bool mesh_resident(const struct mesh* mesh) {
+    return mesh->resident_sections == MESH_SECTION_COUNT;
+}
+
+// LOD errors only grow along the chain, the last one that projects to at
+// most max_error_pixels is the cheapest that still looks the same
+uint32_t mesh_select_lod(const struct mesh* mesh, float pixels_per_unit, float max_error_pixels) {
+    uint32_t lod = 0;
+    while (lod + 1 < mesh->lod_count && mesh->lods[lod + 1].error * pixels_per_unit <= max_error_pixels) {
+        lod++;
+    }
+
+    return lod;
+}
+
+// Safe to call again, failed loads already destroyed what they created
+void destroy_mesh(struct mesh* mesh) {
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        vkDestroyBuffer(logical_device, mesh->buffers[i], NULL);
+        vkFreeMemory(logical_device, mesh->memory[i], NULL);
+        mesh->buffers[i] = VK_NULL_HANDLE;
+        mesh->memory[i] = VK_NULL_HANDLE;
+    }
+}
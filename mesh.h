@@ -0,0 +1,36 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#include "mesh_format.h"
+#include "streaming.h"
+
+// One buffer per section, indexed by enum mesh_section_type
+struct mesh {
+    VkBuffer buffers[MESH_SECTION_COUNT];
+    VkDeviceMemory memory[MESH_SECTION_COUNT];
+
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t meshlet_count;
+    struct mesh_bounds bounds;
+
+    uint32_t lod_count;
+    struct mesh_lod lods[MESH_MAX_LODS];
+
+    // Streamed meshes draw once every section is resident
+    stream_handle streams[MESH_SECTION_COUNT];
+    uint32_t resident_sections;
+};
+
+VkResult load_mesh(const char* path, struct mesh* mesh);
+VkResult stream_mesh(const char* path, struct mesh* mesh);
+
+// Section offsets in the header are relative to data, laid out like a baked
+// file but not validated
+VkResult create_mesh(const struct mesh_header* header, const uint8_t* data, struct mesh* mesh);
+bool mesh_resident(const struct mesh* mesh);
+uint32_t mesh_select_lod(const struct mesh* mesh, float pixels_per_unit, float max_error_pixels);
+void destroy_mesh(struct mesh* mesh);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "linmath.h"
+
+// Baked meshes are written by tools/mesh_baker and loaded with load_mesh().
+// Every section starts on a MESH_SECTION_ALIGNMENT boundary and holds data in
+// the exact layout the GPU consumes, so loading is mmap plus copy.
+
+#define MESH_MAGIC 0x48534d56
+#define MESH_VERSION 2
+#define MESH_SECTION_ALIGNMENT 256
+#define MESH_MAX_LODS 8
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct vertex {
+    vec3 position;
+    vec3 normal;
+    vec2 uv;
+    vec3 color;
+};
+
+enum mesh_section_type {
+    MESH_SECTION_VERTICES,
+    MESH_SECTION_INDICES,
+    MESH_SECTION_MESHLETS,
+    MESH_SECTION_MESHLET_VERTICES,
+    MESH_SECTION_MESHLET_TRIANGLES,
+    MESH_SECTION_COUNT,
+};
+
+struct mesh_section {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct mesh_bounds {
+    float min[3];
+    float max[3];
+    float center[3];
+    float radius;
+};
+
+// Matches the std430 layout the culling and mesh shaders read. The
+// triangles of a meshlet are also contiguous in the index section, starting
+// at index_offset, so plain vertex pipelines can draw them with one indexed
+// draw. Meshlet triangles pack three local vertex indices per uint32.
+struct meshlet {
+    float center[3];
+    float radius;
+
+    // Every triangle faces away when seen from inside the cone, a cutoff of
+    // 1 disables the test
+    float cone_axis[3];
+    float cone_cutoff;
+
+    uint32_t index_offset;
+    uint32_t vertex_offset;
+    uint32_t triangle_offset;
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    uint32_t reserved[3];
+};
+
+// Every LOD indexes the shared vertex section, error is in object space units
+struct mesh_lod {
+    uint32_t index_offset;
+    uint32_t index_count;
+    uint32_t meshlet_offset;
+    uint32_t meshlet_count;
+    float error;
+    uint32_t reserved;
+};
+
+struct mesh_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_stride;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t lod_count;
+    uint32_t meshlet_count;
+    uint32_t meshlet_vertex_count;
+    uint32_t meshlet_triangle_count;
+    uint32_t reserved;
+
+    struct mesh_section sections[MESH_SECTION_COUNT];
+    struct mesh_bounds bounds;
+    struct mesh_lod lods[MESH_MAX_LODS];
+};
+
+static inline uint64_t mesh_align(uint64_t offset) {
+    return (offset + MESH_SECTION_ALIGNMENT - 1) & ~(uint64_t)(MESH_SECTION_ALIGNMENT - 1);
+}
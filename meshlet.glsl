@@ -0,0 +1,144 @@
+// Shared by cull.comp and the mesh shader path, layouts match mesh_format.h
+// and meshlets.h
+
+struct Meshlet {
+    vec4 sphere;
+    vec4 cone;
+    uint index_offset;
+    uint vertex_offset;
+    uint triangle_offset;
+    uint vertex_count;
+    uint triangle_count;
+    uint reserved[3];
+};
+
+struct MeshletItem {
+    mat4 model;
+    uint meshlet_offset;
+    uint meshlet_count;
+    uint draw_offset;
+    float scale;
+    vec4 sphere;
+    uint instance;
+    uint virtual_texture;
+    uint reserved[2];
+};
+
+const uint PHASE_ALL = 0;
+const uint PHASE_EARLY = 1;
+const uint PHASE_LATE = 2;
+
+layout(std430, binding = 0) readonly buffer Frame {
+    vec4 frustum[6];
+    vec4 camera_position;
+    mat4 view;
+    vec4 projection;
+    vec4 pyramid;
+};
+
+layout(std430, binding = 1) readonly buffer Items {
+    MeshletItem items[];
+};
+
+layout(std430, binding = 2) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+layout(std430, binding = 8) readonly buffer PreviousVisibility {
+    uint previous_visibility[];
+};
+
+layout(std430, binding = 9) writeonly buffer Visibility {
+    uint visibility[];
+};
+
+layout(binding = 10) uniform sampler2D depth_pyramid;
+
+// Screen rectangle of a view space sphere with z forward, from "2D Polyhedral
+// Bounds of a Clipped, Perspective-Projected 3D Sphere" (Mara, McGuire 2013)
+bool project_sphere(vec3 center, float radius, out vec4 rectangle) {
+    if (center.z < radius + pyramid.w) {
+        return false;
+    }
+
+    vec3 scaled = center * radius;
+    float depth_squared = center.z * center.z - radius * radius;
+
+    float vx = sqrt(center.x * center.x + depth_squared);
+    float min_x = (vx * center.x - scaled.z) / (vx * center.z + scaled.x);
+    float max_x = (vx * center.x + scaled.z) / (vx * center.z - scaled.x);
+
+    float vy = sqrt(center.y * center.y + depth_squared);
+    float min_y = (vy * center.y - scaled.z) / (vy * center.z + scaled.y);
+    float max_y = (vy * center.y + scaled.z) / (vy * center.z - scaled.y);
+
+    rectangle = vec4(min_x * projection.x, min_y * projection.y, max_x * projection.x, max_y * projection.y);
+    rectangle = rectangle.xwzy * vec4(0.5, -0.5, 0.5, -0.5) + vec4(0.5);
+    return true;
+}
+
+// Spheres crossing the near plane are never occluded
+bool sphere_occluded(vec3 center, float radius) {
+    vec3 view_center = (view * vec4(center, 1.0)).xyz;
+    view_center.z = -view_center.z;
+
+    vec4 rectangle;
+    if (!project_sphere(view_center, radius, rectangle)) {
+        return false;
+    }
+
+    // At this level the rectangle covers at most two texels on each axis
+    float size = max((rectangle.z - rectangle.x) * pyramid.x, (rectangle.w - rectangle.y) * pyramid.y);
+    int level = clamp(int(ceil(log2(max(size, 1.0)))), 0, int(pyramid.z) - 1);
+    ivec2 level_size = max(ivec2(pyramid.xy) >> level, ivec2(1));
+    ivec2 first = clamp(ivec2(rectangle.xy * vec2(level_size)), ivec2(0), level_size - 1);
+    ivec2 last = clamp(ivec2(rectangle.zw * vec2(level_size)), ivec2(0), level_size - 1);
+
+    float depth = max(
+        max(texelFetch(depth_pyramid, first, level).x, texelFetch(depth_pyramid, ivec2(last.x, first.y), level).x),
+        max(texelFetch(depth_pyramid, ivec2(first.x, last.y), level).x, texelFetch(depth_pyramid, last, level).x));
+
+    float nearest = projection.z + projection.w / (view_center.z - radius);
+    return nearest > depth;
+}
+
+// Whether the item's meshlets are tested in this phase: the early phase takes
+// instances visible last frame, the late phase the rest. The late phase also
+// records this frame's visibility for the next one
+bool item_in_phase(MeshletItem item, uint phase, bool record) {
+    if (phase == PHASE_ALL) {
+        return true;
+    }
+
+    bool previous = previous_visibility[item.instance] != 0;
+    if (phase == PHASE_EARLY) {
+        return previous;
+    }
+
+    bool occluded = sphere_occluded(item.sphere.xyz, item.sphere.w);
+    if (record) {
+        visibility[item.instance] = occluded ? 0 : 1;
+    }
+
+    return !previous && !occluded;
+}
+
+bool meshlet_visible(Meshlet meshlet, MeshletItem item, uint phase) {
+    vec3 center = (item.model * vec4(meshlet.sphere.xyz, 1.0)).xyz;
+    float radius = meshlet.sphere.w * item.scale;
+
+    for (int i = 0; i < 6; i++) {
+        if (dot(frustum[i].xyz, center) + frustum[i].w < -radius) {
+            return false;
+        }
+    }
+
+    // Backfacing cluster, every triangle in it faces away from the camera
+    vec3 axis = normalize(mat3(item.model) * meshlet.cone.xyz);
+    vec3 direction = center - camera_position.xyz;
+    if (dot(direction, axis) >= meshlet.cone.w * length(direction) + radius) {
+        return false;
+    }
+
+    return phase != PHASE_LATE || !sphere_occluded(center, radius);
+}
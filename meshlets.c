@@ -0,0 +1,711 @@
+#include "meshlets.h"
+#include "buffers.h"
+#include "camera.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "compute.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "graphics_pipeline.h"
+#include "jobs.h"
+#include "lights.h"
+#include "occlusion.h"
+#include "scene.h"
+#include "shaders.h"
+#include "startup.h"
+#include "textures.h"
+#include "virtual_textures.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Items start past the frame block, at an offset every device accepts for
+// storage buffer bindings
+#define ITEMS_OFFSET 256
+#define MESHLET_BINDINGS 11
+#define MESHLET_BUFFER_BINDINGS 10
+#define TASK_GROUP_SIZE 32
+#define PREPARE_ITEMS_PER_JOB 256
+
+struct cull_push_constants {
+    uint32_t item_offset;
+    uint32_t compact;
+    uint32_t phase;
+    uint32_t draw_base;
+    uint32_t count_base;
+};
+
+struct mesh_push_constants {
+    mat4x4 view_projection;
+    uint32_t item_index;
+    uint32_t phase;
+};
+
+// Items of one mesh are contiguous so its buffers are bound once
+struct meshlet_batch {
+    uint32_t mesh;
+    uint32_t item_offset;
+    uint32_t item_count;
+};
+
+bool mesh_shading_enabled = false;
+
+static VkDescriptorSetLayout set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT][MAX_SCENE_MESHES];
+
+static VkPipelineLayout cull_layout;
+static VkPipeline cull_pipeline;
+static VkPipelineLayout mesh_layout;
+static VkPipeline mesh_pipeline;
+static PFN_vkCmdDrawMeshTasksEXT draw_mesh_tasks;
+
+static VkBuffer item_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory item_memory[MAX_FRAMES_IN_FLIGHT];
+static uint8_t* item_data[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer draw_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory draw_memory[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer count_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory count_memory[MAX_FRAMES_IN_FLIGHT];
+
+// Per instance visibility written by the late phase, read back as last
+// frame's by the next frame's early phase
+static VkBuffer visibility_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory visibility_memory[MAX_FRAMES_IN_FLIGHT];
+static bool visibility_cleared = false;
+
+// What the draw pass needs without reading back mapped memory
+static struct meshlet_batch batches[MAX_FRAMES_IN_FLIGHT][MAX_SCENE_MESHES];
+static uint32_t batches_count[MAX_FRAMES_IN_FLIGHT];
+static uint32_t item_instances[MAX_FRAMES_IN_FLIGHT][MAX_MESHLET_ITEMS];
+static uint32_t item_meshlets[MAX_FRAMES_IN_FLIGHT][MAX_MESHLET_ITEMS];
+static uint32_t item_draws[MAX_FRAMES_IN_FLIGHT][MAX_MESHLET_ITEMS];
+static struct meshlet_stats stats[MAX_FRAMES_IN_FLIGHT];
+
+static VkResult create_set_layout() {
+    VkDescriptorSetLayoutBinding bindings[MESHLET_BINDINGS];
+    for (uint32_t i = 0; i < MESHLET_BINDINGS; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = i < MESHLET_BUFFER_BINDINGS ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+
+        if (device_capabilities.mesh_shader) {
+            bindings[i].stageFlags |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+        }
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = MESHLET_BINDINGS,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &layout_info, NULL, &set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MESHLET_BUFFER_BINDINGS * MAX_SCENE_MESHES * MAX_FRAMES_IN_FLIGHT},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, (MESHLET_BINDINGS - MESHLET_BUFFER_BINDINGS) * MAX_SCENE_MESHES * MAX_FRAMES_IN_FLIGHT},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_SCENE_MESHES * MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+
+    return vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+}
+
+static VkResult create_cull_pipeline() {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct cull_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &cull_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_compute_pipeline("./shaders/cull.spv", cull_layout, &cull_pipeline);
+}
+
+static VkResult build_mesh_pipeline() {
+    VkShaderModule task_shader = load_shader_module("./shaders/task.spv");
+    VkShaderModule mesh_shader = load_shader_module("./shaders/mesh.spv");
+    VkShaderModule fragment_shader = load_shader_module("./shaders/frag.spv");
+
+    VkResult result = VK_ERROR_INITIALIZATION_FAILED;
+    if (task_shader != VK_NULL_HANDLE && mesh_shader != VK_NULL_HANDLE && fragment_shader != VK_NULL_HANDLE) {
+        VkPipelineShaderStageCreateInfo stages[3] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_TASK_BIT_EXT,
+                .module = task_shader,
+                .pName = "main",
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_MESH_BIT_EXT,
+                .module = mesh_shader,
+                .pName = "main",
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = fragment_shader,
+                .pName = "main",
+            },
+        };
+
+        result = build_graphics_pipeline(stages, 3, NULL, mesh_layout, &mesh_pipeline);
+    }
+
+    vkDestroyShaderModule(logical_device, task_shader, NULL);
+    vkDestroyShaderModule(logical_device, mesh_shader, NULL);
+    vkDestroyShaderModule(logical_device, fragment_shader, NULL);
+
+    draw_mesh_tasks = (PFN_vkCmdDrawMeshTasksEXT)vkGetDeviceProcAddr(logical_device, "vkCmdDrawMeshTasksEXT");
+    if (result == VK_SUCCESS && draw_mesh_tasks == NULL) {
+        result = VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+
+    return result;
+}
+
+// Falls back to culling in compute when the pipeline does not build
+static VkResult compile_mesh_pipeline(void* data) {
+    (void)data;
+    mesh_shading_enabled = build_mesh_pipeline() == VK_SUCCESS;
+    if (!mesh_shading_enabled) {
+        puts("Mesh shader pipeline unavailable, culling meshlets in compute");
+    }
+
+    return VK_SUCCESS;
+}
+
+static VkResult create_mesh_pipeline() {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+        .offset = 0,
+        .size = sizeof(struct mesh_push_constants),
+    };
+
+    VkDescriptorSetLayout set_layouts[4] = {
+        set_layout,
+        texture_set_layout,
+        virtual_texture_set_layout,
+        light_set_layout,
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 4,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &mesh_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return startup_defer("mesh_pipeline", compile_mesh_pipeline, NULL);
+}
+
+static VkResult create_cull_buffers() {
+    VkDeviceSize item_size = ITEMS_OFFSET + sizeof(struct meshlet_item) * MAX_MESHLET_ITEMS;
+    VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkResult result = create_shared_buffer(item_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host, &item_buffers[i], &item_memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        result = vkMapMemory(logical_device, item_memory[i], 0, item_size, 0, (void**)&item_data[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        // The late phase writes its draws and counts after the early ones
+        result = create_shared_buffer(sizeof(VkDrawIndexedIndirectCommand) * MAX_MESHLET_DRAWS * 2,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &draw_buffers[i], &draw_memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        result = create_shared_buffer(sizeof(uint32_t) * MAX_MESHLET_ITEMS * 2,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &count_buffers[i], &count_memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        result = create_shared_buffer(sizeof(uint32_t) * MAX_SCENE_INSTANCES,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &visibility_buffers[i], &visibility_memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+// Culling runs as a compute job ahead of the vertex pipeline, or inside the
+// task shader when the device has mesh shaders. With occlusion culling the
+// compute path is recorded inline, split around the depth pyramid build
+VkResult create_meshlet_culling() {
+    VkResult result = create_set_layout();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    visibility_cleared = false;
+    result = create_cull_buffers();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_cull_pipeline();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    if (device_capabilities.mesh_shader && getenv("VL_NO_MESH_SHADERS") == NULL && create_mesh_pipeline() != VK_SUCCESS) {
+        puts("Mesh shader pipeline unavailable, culling meshlets in compute");
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_meshlet_culling() {
+    vkDestroyPipeline(logical_device, mesh_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, mesh_layout, NULL);
+    vkDestroyPipeline(logical_device, cull_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, cull_layout, NULL);
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyBuffer(logical_device, item_buffers[i], NULL);
+        vkFreeMemory(logical_device, item_memory[i], NULL);
+        vkDestroyBuffer(logical_device, draw_buffers[i], NULL);
+        vkFreeMemory(logical_device, draw_memory[i], NULL);
+        vkDestroyBuffer(logical_device, count_buffers[i], NULL);
+        vkFreeMemory(logical_device, count_memory[i], NULL);
+        vkDestroyBuffer(logical_device, visibility_buffers[i], NULL);
+        vkFreeMemory(logical_device, visibility_memory[i], NULL);
+    }
+
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+    memset(sets, 0, sizeof(sets));
+}
+
+// Sets hold the depth pyramid view, they are rebuilt on demand after it changes
+void meshlets_reset_sets() {
+    vkResetDescriptorPool(logical_device, descriptor_pool, 0);
+    memset(sets, 0, sizeof(sets));
+}
+
+VkPipelineStageFlags meshlet_cull_stages() {
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (mesh_shading_enabled) {
+        stages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT;
+    }
+
+    return stages;
+}
+
+static VkDescriptorSet mesh_set(uint32_t frame, uint32_t mesh_index) {
+    if (sets[frame][mesh_index] != VK_NULL_HANDLE) {
+        return sets[frame][mesh_index];
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &set_layout,
+    };
+
+    VkDescriptorSet set;
+    if (vkAllocateDescriptorSets(logical_device, &allocate_info, &set) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    struct mesh* mesh = &scene.meshes[mesh_index];
+    uint32_t previous = (frame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+    VkDescriptorBufferInfo buffers[MESHLET_BUFFER_BINDINGS] = {
+        {item_buffers[frame], 0, sizeof(struct meshlet_frame)},
+        {item_buffers[frame], ITEMS_OFFSET, VK_WHOLE_SIZE},
+        {mesh->buffers[MESH_SECTION_MESHLETS], 0, VK_WHOLE_SIZE},
+        {draw_buffers[frame], 0, VK_WHOLE_SIZE},
+        {count_buffers[frame], 0, VK_WHOLE_SIZE},
+        {mesh->buffers[MESH_SECTION_VERTICES], 0, VK_WHOLE_SIZE},
+        {mesh->buffers[MESH_SECTION_MESHLET_VERTICES], 0, VK_WHOLE_SIZE},
+        {mesh->buffers[MESH_SECTION_MESHLET_TRIANGLES], 0, VK_WHOLE_SIZE},
+        {visibility_buffers[previous], 0, VK_WHOLE_SIZE},
+        {visibility_buffers[frame], 0, VK_WHOLE_SIZE},
+    };
+
+    VkDescriptorImageInfo pyramid = {
+        .sampler = depth_pyramid_sampler,
+        .imageView = depth_pyramid_view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+
+    VkWriteDescriptorSet writes[MESHLET_BINDINGS];
+    for (uint32_t i = 0; i < MESHLET_BUFFER_BINDINGS; i++) {
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffers[i],
+        };
+    }
+
+    writes[MESHLET_BUFFER_BINDINGS] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = MESHLET_BUFFER_BINDINGS,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &pyramid,
+    };
+    vkUpdateDescriptorSets(logical_device, MESHLET_BINDINGS, writes, 0, NULL);
+
+    sets[frame][mesh_index] = set;
+    return set;
+}
+
+struct prepare_context {
+    uint32_t frame;
+    struct meshlet_item* items;
+    uint32_t count;
+};
+
+static uint32_t visible[MAX_MESHLET_ITEMS];
+static uint8_t visible_lods[MAX_MESHLET_ITEMS];
+static uint32_t visible_items[MAX_MESHLET_ITEMS];
+
+static void select_lods(void* data, uint32_t index) {
+    struct prepare_context* context = data;
+    uint32_t first = index * PREPARE_ITEMS_PER_JOB;
+    uint32_t last = first + PREPARE_ITEMS_PER_JOB < context->count ? first + PREPARE_ITEMS_PER_JOB : context->count;
+    for (uint32_t i = first; i < last; i++) {
+        visible_lods[i] = instance_lod(&scene.instances[visible[i]], render_extent.height);
+    }
+}
+
+static void write_items(void* data, uint32_t index) {
+    struct prepare_context* context = data;
+    uint32_t first = index * PREPARE_ITEMS_PER_JOB;
+    uint32_t last = first + PREPARE_ITEMS_PER_JOB < context->count ? first + PREPARE_ITEMS_PER_JOB : context->count;
+    for (uint32_t i = first; i < last; i++) {
+        struct instance* instance = &scene.instances[visible[i]];
+        struct mesh_lod* lod = &scene.meshes[instance->mesh].lods[visible_lods[i]];
+        uint32_t item = visible_items[i];
+        struct meshlet_item* written = &context->items[item];
+
+        mat4x4_dup(written->model, instance->transform);
+        written->meshlet_offset = lod->meshlet_offset;
+        written->meshlet_count = item_meshlets[context->frame][item];
+        written->draw_offset = item_draws[context->frame][item];
+        written->scale = instance_scale(instance);
+        instance_sphere(instance, written->sphere, &written->sphere[3]);
+        written->instance = visible[i];
+        written->virtual_texture = scene.mesh_virtual_textures[instance->mesh];
+    }
+}
+
+// Instances are frustum culled through the scene BVH and given a LOD on the
+// CPU, the GPU then tests each meshlet of the survivors against the frustum
+// and its normal cone
+void meshlets_prepare(uint32_t frame) {
+    struct meshlet_frame* frame_data = (struct meshlet_frame*)item_data[frame];
+    struct meshlet_item* items = (struct meshlet_item*)(item_data[frame] + ITEMS_OFFSET);
+
+    memcpy(frame_data->frustum, camera.frustum, sizeof(camera.frustum));
+    vec4 camera_position = {camera.position[0], camera.position[1], camera.position[2], 1.f};
+    vec4_dup(frame_data->camera_position, camera_position);
+    mat4x4_dup(frame_data->view, camera.view);
+
+    // The projection flips y, the occlusion test works with y up
+    vec4 projection = {camera.projection[0][0], -camera.projection[1][1], -camera.projection[2][2], camera.projection[3][2]};
+    vec4_dup(frame_data->projection, projection);
+    vec4 pyramid = {depth_pyramid_width, depth_pyramid_height, depth_pyramid_levels, camera.near_plane};
+    vec4_dup(frame_data->pyramid, pyramid);
+
+    static uint32_t in_frustum[MAX_SCENE_INSTANCES];
+    uint32_t mesh_counts[MAX_SCENE_MESHES] = {0};
+
+    scene_update_bvh();
+    uint32_t in_frustum_count = scene_cull(camera.frustum, in_frustum);
+
+    struct prepare_context context = {
+        .frame = frame,
+        .items = items,
+        .count = 0,
+    };
+
+    for (uint32_t i = 0; i < in_frustum_count && context.count < MAX_MESHLET_ITEMS; i++) {
+        struct instance* instance = &scene.instances[in_frustum[i]];
+        if (!mesh_resident(&scene.meshes[instance->mesh])) {
+            continue;
+        }
+
+        visible[context.count++] = in_frustum[i];
+        mesh_counts[instance->mesh]++;
+    }
+
+    uint32_t jobs = (context.count + PREPARE_ITEMS_PER_JOB - 1) / PREPARE_ITEMS_PER_JOB;
+    job_parallel_for(select_lods, &context, jobs, "select_lods");
+
+    uint32_t mesh_offsets[MAX_SCENE_MESHES];
+    batches_count[frame] = 0;
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < scene.meshes_count; i++) {
+        mesh_offsets[i] = offset;
+        if (mesh_counts[i] > 0) {
+            batches[frame][batches_count[frame]++] = (struct meshlet_batch){i, offset, 0};
+        }
+        offset += mesh_counts[i];
+    }
+
+    // Slots and draw ranges are a running sum, the items themselves are
+    // written in parallel afterwards
+    uint32_t draw_offset = 0;
+    uint64_t triangles = 0;
+    for (uint32_t i = 0; i < context.count; i++) {
+        struct instance* instance = &scene.instances[visible[i]];
+        struct mesh_lod* lod = &scene.meshes[instance->mesh].lods[visible_lods[i]];
+
+        // Past the draw budget an instance keeps its slot but draws nothing
+        uint32_t meshlet_count = lod->meshlet_count;
+        if (draw_offset + meshlet_count > MAX_MESHLET_DRAWS) {
+            meshlet_count = 0;
+        }
+
+        uint32_t item = mesh_offsets[instance->mesh]++;
+        visible_items[i] = item;
+        item_instances[frame][item] = visible[i];
+        item_meshlets[frame][item] = meshlet_count;
+        item_draws[frame][item] = draw_offset;
+        draw_offset += meshlet_count;
+        triangles += meshlet_count > 0 ? lod->index_count / 3 : 0;
+    }
+
+    stats[frame] = (struct meshlet_stats){context.count, draw_offset, triangles};
+
+    job_parallel_for(write_items, &context, jobs, "write_items");
+
+    for (uint32_t i = 0; i < batches_count[frame]; i++) {
+        struct meshlet_batch* batch = &batches[frame][i];
+        batch->item_count = mesh_counts[batch->mesh];
+
+        // Sets are made here so recording threads only ever read them
+        mesh_set(frame, batch->mesh);
+
+        // Both occlusion phases are recorded inline around the depth pyramid
+        if (mesh_shading_enabled || occlusion_culling_enabled) {
+            continue;
+        }
+
+        struct cull_push_constants push = {
+            .item_offset = batch->item_offset,
+            .compact = device_capabilities.draw_indirect_count,
+            .phase = MESHLET_PHASE_ALL,
+        };
+
+        struct compute_job job = {
+            .pipeline = cull_pipeline,
+            .layout = cull_layout,
+            .descriptor_set = mesh_set(frame, batch->mesh),
+            .push_constants = &push,
+            .push_constants_size = sizeof(push),
+            .group_count_x = batch->item_count,
+            .group_count_y = 1,
+            .group_count_z = 1,
+        };
+        compute_enqueue(&job);
+    }
+}
+
+static uint32_t phase_draw_base(uint32_t phase) {
+    return phase == MESHLET_PHASE_LATE ? MAX_MESHLET_DRAWS : 0;
+}
+
+static uint32_t phase_count_base(uint32_t phase) {
+    return phase == MESHLET_PHASE_LATE ? MAX_MESHLET_ITEMS : 0;
+}
+
+static void memory_barrier(VkCommandBuffer buffer, VkAccessFlags src_access, VkAccessFlags dst_access,
+    VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+    };
+    vkCmdPipelineBarrier(buffer, src_stage, dst_stage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+// Records one occlusion phase of culling into the graphics command buffer,
+// with mesh shaders the task shader culls while drawing and only the
+// visibility buffers need ordering here
+void meshlets_cull(VkCommandBuffer buffer, uint32_t frame, uint32_t phase) {
+    VkPipelineStageFlags stages = meshlet_cull_stages();
+
+    if (phase == MESHLET_PHASE_EARLY) {
+        // Nothing was visible before the first frame
+        if (!visibility_cleared) {
+            for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                vkCmdFillBuffer(buffer, visibility_buffers[i], 0, VK_WHOLE_SIZE, 0);
+            }
+            memory_barrier(buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, stages);
+            visibility_cleared = true;
+        }
+
+        // Last frame's late phase wrote the visibility read here
+        memory_barrier(buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, stages, stages);
+    }
+
+    if (mesh_shading_enabled) {
+        return;
+    }
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    for (uint32_t i = 0; i < batches_count[frame]; i++) {
+        struct meshlet_batch* batch = &batches[frame][i];
+
+        struct cull_push_constants push = {
+            .item_offset = batch->item_offset,
+            .compact = device_capabilities.draw_indirect_count,
+            .phase = phase,
+            .draw_base = phase_draw_base(phase),
+            .count_base = phase_count_base(phase),
+        };
+
+        VkDescriptorSet set = mesh_set(frame, batch->mesh);
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 0, 1, &set, 0, NULL);
+        vkCmdPushConstants(buffer, cull_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(buffer, batch->item_count, 1, 1);
+    }
+
+    memory_barrier(buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+}
+
+static void draw_item_indirect(VkCommandBuffer buffer, uint32_t frame, uint32_t item, uint32_t phase) {
+    VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize offset = (phase_draw_base(phase) + item_draws[frame][item]) * stride;
+    VkDeviceSize count_offset = (phase_count_base(phase) + item) * sizeof(uint32_t);
+    uint32_t count = item_meshlets[frame][item];
+
+    if (device_capabilities.draw_indirect_count) {
+        vkCmdDrawIndexedIndirectCount(buffer, draw_buffers[frame], offset, count_buffers[frame], count_offset, count, stride);
+        return;
+    }
+
+    // Culled meshlets are zero index draws here, still cheaper than drawing them
+    uint32_t batch = device_capabilities.multi_draw_indirect ? device_capabilities.max_draw_indirect_count : 1;
+    for (uint32_t first = 0; first < count; first += batch) {
+        uint32_t draws = count - first < batch ? count - first : batch;
+        vkCmdDrawIndexedIndirect(buffer, draw_buffers[frame], offset + first * stride, draws, stride);
+    }
+}
+
+void meshlets_stats(uint32_t frame, struct meshlet_stats* frame_stats) {
+    *frame_stats = stats[frame];
+}
+
+uint32_t meshlets_items_count(uint32_t frame) {
+    if (batches_count[frame] == 0) {
+        return 0;
+    }
+
+    struct meshlet_batch* last = &batches[frame][batches_count[frame] - 1];
+    return last->item_offset + last->item_count;
+}
+
+// Draws items [first_item, first_item + item_count), ranges are independent
+// so several threads can record one frame
+void meshlets_draw(VkCommandBuffer buffer, uint32_t frame, uint32_t phase, uint32_t first_item, uint32_t item_count) {
+    VkDeviceSize offsets[] = {0};
+    uint32_t end_item = first_item + item_count;
+
+    // Virtual textures and lights share one set each per frame, meshes only
+    // pick a virtual texture index
+    VkDescriptorSet frame_sets[2] = {virtual_texture_set(frame), light_set(frame)};
+    if (mesh_shading_enabled) {
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline);
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_layout, 2, 2, frame_sets, 0, NULL);
+    } else {
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 2, 2, frame_sets, 0, NULL);
+    }
+
+    for (uint32_t i = 0; i < batches_count[frame]; i++) {
+        struct meshlet_batch* batch = &batches[frame][i];
+        struct mesh* mesh = &scene.meshes[batch->mesh];
+        uint32_t batch_first = batch->item_offset > first_item ? batch->item_offset : first_item;
+        uint32_t batch_end = batch->item_offset + batch->item_count < end_item ? batch->item_offset + batch->item_count : end_item;
+        if (batch_first >= batch_end) {
+            continue;
+        }
+
+        if (mesh_shading_enabled) {
+            VkDescriptorSet sets[2] = {mesh_set(frame, batch->mesh), scene_texture_set(batch->mesh)};
+            vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_layout, 0, 2, sets, 0, NULL);
+
+            struct mesh_push_constants push;
+            mat4x4_dup(push.view_projection, camera.view_projection);
+            push.phase = phase;
+            for (uint32_t item = batch_first; item < batch_end; item++) {
+                if (item_meshlets[frame][item] == 0) {
+                    continue;
+                }
+
+                push.item_index = item;
+                vkCmdPushConstants(buffer, mesh_layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(push), &push);
+                draw_mesh_tasks(buffer, (item_meshlets[frame][item] + TASK_GROUP_SIZE - 1) / TASK_GROUP_SIZE, 1, 1);
+            }
+            continue;
+        }
+
+        VkDescriptorSet texture_set = scene_texture_set(batch->mesh);
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1, 1, &texture_set, 0, NULL);
+        vkCmdBindVertexBuffers(buffer, 0, 1, &mesh->buffers[MESH_SECTION_VERTICES], offsets);
+        vkCmdBindIndexBuffer(buffer, mesh->buffers[MESH_SECTION_INDICES], 0, VK_INDEX_TYPE_UINT32);
+
+        for (uint32_t item = batch_first; item < batch_end; item++) {
+            struct instance* instance = &scene.instances[item_instances[frame][item]];
+
+            struct vertex_push_constants push = {
+                .virtual_texture = scene.mesh_virtual_textures[instance->mesh],
+            };
+            mat4x4_dup(push.model, instance->transform);
+            vkCmdPushConstants(buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+
+            draw_item_indirect(buffer, frame, item, phase);
+        }
+    }
+}
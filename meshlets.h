@@ -0,0 +1,65 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#include "linmath.h"
+
+#define MAX_MESHLET_ITEMS 16384
+#define MAX_MESHLET_DRAWS (1 << 18)
+
+// Without occlusion culling everything is culled and drawn at once. With it
+// the early phase draws what was visible last frame and the late phase tests
+// the rest against a depth pyramid built from the early phase
+enum meshlet_phase {
+    MESHLET_PHASE_ALL,
+    MESHLET_PHASE_EARLY,
+    MESHLET_PHASE_LATE,
+};
+
+// One visible instance at its selected LOD, matches MeshletItem in meshlet.glsl
+struct meshlet_item {
+    mat4x4 model;
+    uint32_t meshlet_offset;
+    uint32_t meshlet_count;
+    uint32_t draw_offset;
+    float scale;
+    vec4 sphere;
+    uint32_t instance;
+    // Virtual texture index plus one, 0 for none
+    uint32_t virtual_texture;
+    uint32_t reserved[2];
+};
+
+// Projection terms for the occlusion test: projection holds x and y scale and
+// the depth of a view distance d as z + w / d, pyramid holds its size, level
+// count and the near plane
+struct meshlet_frame {
+    vec4 frustum[6];
+    vec4 camera_position;
+    mat4x4 view;
+    vec4 projection;
+    vec4 pyramid;
+};
+
+// What the CPU handed the GPU for a frame, before any meshlet was culled
+struct meshlet_stats {
+    uint32_t items;
+    uint32_t meshlets;
+    uint64_t triangles;
+};
+
+extern bool mesh_shading_enabled;
+
+VkResult create_meshlet_culling();
+void destroy_meshlet_culling();
+
+void meshlets_reset_sets();
+VkPipelineStageFlags meshlet_cull_stages();
+
+void meshlets_prepare(uint32_t frame);
+void meshlets_cull(VkCommandBuffer buffer, uint32_t frame, uint32_t phase);
+uint32_t meshlets_items_count(uint32_t frame);
+void meshlets_stats(uint32_t frame, struct meshlet_stats* frame_stats);
+void meshlets_draw(VkCommandBuffer buffer, uint32_t frame, uint32_t phase, uint32_t first_item, uint32_t item_count);
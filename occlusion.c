@@ -0,0 +1,312 @@
+#include "occlusion.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "images.h"
+#include "meshlets.h"
+#include "shaders.h"
+#include "swap_chain.h"
+#include "textures.h"
+#include <stdlib.h>
+
+struct reduce_push_constants {
+    int32_t source_width;
+    int32_t source_height;
+    int32_t destination_width;
+    int32_t destination_height;
+};
+
+bool occlusion_culling_enabled = false;
+
+VkImage depth_pyramid;
+VkImageView depth_pyramid_view;
+VkSampler depth_pyramid_sampler;
+uint32_t depth_pyramid_width;
+uint32_t depth_pyramid_height;
+uint32_t depth_pyramid_levels;
+
+static VkDeviceMemory depth_pyramid_memory;
+static VkImageView level_views[MAX_PYRAMID_LEVELS];
+
+static VkDescriptorSetLayout set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet level_sets[MAX_PYRAMID_LEVELS];
+static VkPipelineLayout reduce_layout;
+static VkPipeline reduce_pipeline;
+
+static uint32_t previous_power_of_two(uint32_t value) {
+    uint32_t result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+
+    return result;
+}
+
+static VkResult create_reduce_pipeline() {
+    VkDescriptorSetLayoutBinding bindings[2] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &set_layout_info, NULL, &set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_PYRAMID_LEVELS},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_PYRAMID_LEVELS},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_PYRAMID_LEVELS,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct reduce_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &reduce_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    struct sampler_key sampler_key = {
+        .filter = VK_FILTER_NEAREST,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+
+    depth_pyramid_sampler = get_sampler(&sampler_key);
+    if (depth_pyramid_sampler == VK_NULL_HANDLE) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // Without occlusion culling nothing reduces the depth buffer, the
+    // pipeline is left for the first pyramid build to create
+    if (!occlusion_culling_enabled) {
+        return VK_SUCCESS;
+    }
+
+    return create_compute_pipeline("./shaders/depth_reduce.spv", reduce_layout, &reduce_pipeline);
+}
+
+// Level 0 is the largest power of two that fits in the depth buffer, every
+// texel holds the farthest depth of the area it covers
+static VkResult create_pyramid_image() {
+    depth_pyramid_width = previous_power_of_two(swap_chain_extent.width);
+    depth_pyramid_height = previous_power_of_two(swap_chain_extent.height);
+
+    depth_pyramid_levels = 1;
+    while (depth_pyramid_levels < MAX_PYRAMID_LEVELS &&
+        ((depth_pyramid_width >> depth_pyramid_levels) > 0 || (depth_pyramid_height >> depth_pyramid_levels) > 0)) {
+        depth_pyramid_levels++;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    VkResult result = create_image(depth_pyramid_width, depth_pyramid_height, depth_pyramid_levels, VK_FORMAT_R32_SFLOAT, usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depth_pyramid, &depth_pyramid_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_image_view_2d(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, depth_pyramid_levels, &depth_pyramid_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorSetLayout layouts[MAX_PYRAMID_LEVELS];
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        layouts[i] = set_layout;
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = depth_pyramid_levels,
+        .pSetLayouts = layouts,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, level_sets);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        result = create_image_view_2d(depth_pyramid, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, &level_views[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        VkDescriptorImageInfo source = {
+            .sampler = depth_pyramid_sampler,
+            .imageView = i == 0 ? depth_image_view : level_views[i - 1],
+            .imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL,
+        };
+
+        VkDescriptorImageInfo destination = {
+            .imageView = level_views[i],
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+
+        VkWriteDescriptorSet writes[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = level_sets[i],
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &source,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = level_sets[i],
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                .pImageInfo = &destination,
+            },
+        };
+        vkUpdateDescriptorSets(logical_device, 2, writes, 0, NULL);
+    }
+
+    return VK_SUCCESS;
+}
+
+static void destroy_pyramid_image() {
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        vkDestroyImageView(logical_device, level_views[i], NULL);
+    }
+
+    vkDestroyImageView(logical_device, depth_pyramid_view, NULL);
+    vkDestroyImage(logical_device, depth_pyramid, NULL);
+    vkFreeMemory(logical_device, depth_pyramid_memory, NULL);
+    vkResetDescriptorPool(logical_device, descriptor_pool, 0);
+    depth_pyramid_levels = 0;
+}
+
+// The pyramid always exists, culling sets bind it whether or not the two
+// phase scheme is in use
+VkResult create_depth_pyramid() {
+    occlusion_culling_enabled = getenv("VL_NO_OCCLUSION") == NULL;
+
+    VkResult result = create_reduce_pipeline();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_pyramid_image();
+}
+
+void destroy_depth_pyramid() {
+    destroy_pyramid_image();
+
+    vkDestroyPipeline(logical_device, reduce_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, reduce_layout, NULL);
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+}
+
+// The pyramid follows the depth buffer size, culling sets refer to it
+VkResult recreate_depth_pyramid() {
+    destroy_pyramid_image();
+    meshlets_reset_sets();
+    return create_pyramid_image();
+}
+
+// Called between the two culling phases: the depth buffer holds what was
+// visible last frame and is returned to attachment layout for the second
+// phase to draw into
+void build_depth_pyramid(VkCommandBuffer buffer) {
+    if (reduce_pipeline == VK_NULL_HANDLE
+        && create_compute_pipeline("./shaders/depth_reduce.spv", reduce_layout, &reduce_pipeline) != VK_SUCCESS) {
+        return;
+    }
+
+    transition_image(buffer, depth_image, VK_IMAGE_ASPECT_DEPTH_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    transition_image(buffer, depth_pyramid, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        meshlet_cull_stages(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline);
+
+    // Only the rendered rectangle of the depth buffer is reduced, the
+    // pyramid covers the screen whatever the render scale
+    uint32_t source_width = render_extent.width;
+    uint32_t source_height = render_extent.height;
+    for (uint32_t i = 0; i < depth_pyramid_levels; i++) {
+        uint32_t width = depth_pyramid_width >> i > 0 ? depth_pyramid_width >> i : 1;
+        uint32_t height = depth_pyramid_height >> i > 0 ? depth_pyramid_height >> i : 1;
+
+        struct reduce_push_constants push = {
+            .source_width = source_width,
+            .source_height = source_height,
+            .destination_width = width,
+            .destination_height = height,
+        };
+
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_layout, 0, 1, &level_sets[i], 0, NULL);
+        vkCmdPushConstants(buffer, reduce_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(buffer, (width + 7) / 8, (height + 7) / 8, 1);
+
+        VkImageMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = depth_pyramid,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1},
+        };
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, meshlet_cull_stages(), 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        source_width = width;
+        source_height = height;
+    }
+
+    transition_image(buffer, depth_image, VK_IMAGE_ASPECT_DEPTH_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
+}
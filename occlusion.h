@@ -0,0 +1,22 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_PYRAMID_LEVELS 16
+
+extern bool occlusion_culling_enabled;
+
+extern VkImage depth_pyramid;
+extern VkImageView depth_pyramid_view;
+extern VkSampler depth_pyramid_sampler;
+extern uint32_t depth_pyramid_width;
+extern uint32_t depth_pyramid_height;
+extern uint32_t depth_pyramid_levels;
+
+VkResult create_depth_pyramid();
+void destroy_depth_pyramid();
+VkResult recreate_depth_pyramid();
+
+void build_depth_pyramid(VkCommandBuffer buffer);
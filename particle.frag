@@ -0,0 +1,13 @@
+#version 450
+
+layout(location = 0) in vec3 frag_color;
+layout(location = 1) in vec2 frag_corner;
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    if (dot(frag_corner, frag_corner) > 1.0) {
+        discard;
+    }
+
+    out_color = vec4(frag_color, 1.0);
+}
@@ -0,0 +1,43 @@
+// Shared by the particle compute shaders, layouts match particles.c
+
+layout(std430, binding = 0) buffer Positions {
+    vec4 positions[];
+};
+
+layout(std430, binding = 1) buffer Velocities {
+    vec4 velocities[];
+};
+
+// Two lists of capacity entries, the one being simulated and the survivors
+layout(std430, binding = 2) buffer Alive {
+    uint alive[];
+};
+
+layout(std430, binding = 3) buffer Dead {
+    uint dead[];
+};
+
+layout(std430, binding = 4) buffer Counters {
+    uint alive_count[2];
+    int dead_count;
+    uint reserved;
+    uvec3 simulate_groups;
+    uint reserved_dispatch;
+    uint draw_vertex_count;
+    uint draw_instance_count;
+    uint draw_first_vertex;
+    uint draw_first_instance;
+};
+
+layout(push_constant) uniform Push {
+    vec4 emitter;
+    float delta_time;
+    float lifetime;
+    uint emit_count;
+    uint current;
+    uint capacity;
+    uint seed;
+    uint mode;
+};
+
+const uint SIMULATE_GROUP_SIZE = 256;
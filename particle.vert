@@ -0,0 +1,44 @@
+#version 450
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_corner;
+
+// Layouts match particle.glsl
+layout(std430, binding = 0) readonly buffer Positions {
+    vec4 positions[];
+};
+
+layout(std430, binding = 1) readonly buffer Velocities {
+    vec4 velocities[];
+};
+
+layout(std430, binding = 2) readonly buffer Alive {
+    uint alive[];
+};
+
+layout(push_constant) uniform Push {
+    mat4 view_projection;
+    vec4 right;
+    vec4 up;
+    uint alive_base;
+};
+
+// Two triangles facing the camera, wound clockwise on screen
+const vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(1.0, -1.0),
+    vec2(-1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0)
+);
+
+void main() {
+    uint particle = alive[alive_base + gl_InstanceIndex];
+    vec4 position = positions[particle];
+    float age = position.w / velocities[particle].w;
+
+    vec2 corner = corners[gl_VertexIndex];
+    float size = right.w * (1.0 - 0.5 * age);
+    vec3 world = position.xyz + (corner.x * right.xyz + corner.y * up.xyz) * size;
+
+    gl_Position = view_projection * vec4(world, 1.0);
+    frag_color = mix(vec3(1.0, 0.85, 0.4), vec3(0.8, 0.2, 0.1), age);
+    frag_corner = corner;
+}
@@ -0,0 +1,442 @@
+#include "particles.h"
+#include "buffers.h"
+#include "camera.h"
+#include "devices.h"
+#include "graphics_pipeline.h"
+#include "shaders.h"
+#include "startup.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PARTICLE_BINDINGS 5
+#define EMIT_GROUP_SIZE 64
+#define ARGS_PREPARE 0
+#define ARGS_FINISH 1
+
+// Matches Counters in particle.glsl
+struct particle_counters {
+    uint32_t alive_count[2];
+    int32_t dead_count;
+    uint32_t reserved;
+    VkDispatchIndirectCommand simulate;
+    uint32_t reserved_dispatch;
+    VkDrawIndirectCommand draw;
+};
+
+struct particle_compute_push_constants {
+    vec4 emitter;
+    float delta_time;
+    float lifetime;
+    uint32_t emit_count;
+    uint32_t current;
+    uint32_t capacity;
+    uint32_t seed;
+    uint32_t mode;
+};
+
+struct particle_draw_push_constants {
+    mat4x4 view_projection;
+    vec4 right;
+    vec4 up;
+    uint32_t alive_base;
+};
+
+// Positions carry the age in w and velocities the lifetime, the rest of a
+// particle follows from those
+enum particle_buffer {
+    PARTICLE_POSITIONS,
+    PARTICLE_VELOCITIES,
+    PARTICLE_ALIVE,
+    PARTICLE_DEAD,
+    PARTICLE_COUNTERS,
+};
+
+bool particles_enabled = false;
+
+static uint32_t capacity;
+static VkBuffer buffers[PARTICLE_BINDINGS];
+static VkDeviceMemory memory[PARTICLE_BINDINGS];
+
+static VkDescriptorSetLayout set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet set;
+static VkPipelineLayout compute_layout;
+static VkPipeline emit_pipeline;
+static VkPipeline simulate_pipeline;
+static VkPipeline args_pipeline;
+static VkPipelineLayout draw_layout;
+static VkPipeline draw_pipeline;
+
+// The alive list simulated this frame, survivors go to the other one
+static uint32_t current = 0;
+static float emit_remainder = 0.f;
+static double last_time = 0.0;
+
+// Zero follows the wall clock
+static float fixed_time_step = 0.f;
+static uint32_t seed = 0;
+
+static VkResult create_particle_buffers() {
+    VkDeviceSize sizes[PARTICLE_BINDINGS] = {
+        [PARTICLE_POSITIONS] = sizeof(vec4) * capacity,
+        [PARTICLE_VELOCITIES] = sizeof(vec4) * capacity,
+        [PARTICLE_ALIVE] = sizeof(uint32_t) * capacity * 2,
+        [PARTICLE_DEAD] = sizeof(uint32_t) * capacity,
+        [PARTICLE_COUNTERS] = sizeof(struct particle_counters),
+    };
+
+    for (uint32_t i = 0; i < PARTICLE_BINDINGS; i++) {
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        if (i == PARTICLE_COUNTERS) {
+            usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        }
+
+        VkResult result = create_buffer(sizes[i], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers[i], &memory[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    // Every particle starts out on the free list
+    uint32_t* dead = malloc(sizeof(uint32_t) * capacity);
+    for (uint32_t i = 0; i < capacity; i++) {
+        dead[i] = i;
+    }
+
+    struct particle_counters counters = {
+        .dead_count = (int32_t)capacity,
+        .simulate = {0, 1, 1},
+        .draw = {6, 0, 0, 0},
+    };
+
+    struct buffer_upload uploads[2] = {
+        {buffers[PARTICLE_DEAD], 0, dead, sizes[PARTICLE_DEAD]},
+        {buffers[PARTICLE_COUNTERS], 0, &counters, sizeof(counters)},
+    };
+
+    VkResult result = upload_buffers(uploads, 2);
+    free(dead);
+    return result;
+}
+
+static VkResult create_particle_set() {
+    VkDescriptorSetLayoutBinding bindings[PARTICLE_BINDINGS];
+    for (uint32_t i = 0; i < PARTICLE_BINDINGS; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = PARTICLE_BINDINGS,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &layout_info, NULL, &set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_size = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, PARTICLE_BINDINGS};
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &set_layout,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, &set);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorBufferInfo buffer_infos[PARTICLE_BINDINGS];
+    VkWriteDescriptorSet writes[PARTICLE_BINDINGS];
+    for (uint32_t i = 0; i < PARTICLE_BINDINGS; i++) {
+        buffer_infos[i] = (VkDescriptorBufferInfo){buffers[i], 0, VK_WHOLE_SIZE};
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[i],
+        };
+    }
+
+    vkUpdateDescriptorSets(logical_device, PARTICLE_BINDINGS, writes, 0, NULL);
+    return VK_SUCCESS;
+}
+
+static VkResult create_compute_pipelines() {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct particle_compute_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &compute_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_compute_pipeline("./shaders/particle_emit.spv", compute_layout, &emit_pipeline);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_compute_pipeline("./shaders/particle_simulate.spv", compute_layout, &simulate_pipeline);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_compute_pipeline("./shaders/particle_args.spv", compute_layout, &args_pipeline);
+}
+
+static VkResult compile_draw_pipeline(void* data) {
+    (void)data;
+    VkShaderModule vertex_shader = load_shader_module("./shaders/particle_vert.spv");
+    VkShaderModule fragment_shader = load_shader_module("./shaders/particle_frag.spv");
+
+    VkResult result = VK_ERROR_INITIALIZATION_FAILED;
+    if (vertex_shader != VK_NULL_HANDLE && fragment_shader != VK_NULL_HANDLE) {
+        VkPipelineShaderStageCreateInfo stages[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                .module = vertex_shader,
+                .pName = "main",
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = fragment_shader,
+                .pName = "main",
+            },
+        };
+
+        // Quads are built from the vertex and instance index alone
+        VkPipelineVertexInputStateCreateInfo vertex_input = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        };
+
+        result = build_graphics_pipeline(stages, 2, &vertex_input, draw_layout, &draw_pipeline);
+    }
+
+    vkDestroyShaderModule(logical_device, vertex_shader, NULL);
+    vkDestroyShaderModule(logical_device, fragment_shader, NULL);
+    return result;
+}
+
+static VkResult create_draw_pipeline() {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(struct particle_draw_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &draw_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return startup_defer("particle_draw_pipeline", compile_draw_pipeline, NULL);
+}
+
+VkResult create_particles(uint32_t count) {
+    if (count == 0) {
+        return VK_SUCCESS;
+    }
+
+    capacity = count < MAX_PARTICLES ? count : MAX_PARTICLES;
+    VkResult result = create_particle_buffers();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_particle_set();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_compute_pipelines();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_draw_pipeline();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    particles_enabled = true;
+    last_time = glfwGetTime();
+    printf("Particles: %u\n", capacity);
+    return VK_SUCCESS;
+}
+
+void destroy_particles() {
+    if (capacity == 0) {
+        return;
+    }
+
+    vkDestroyPipeline(logical_device, draw_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, draw_layout, NULL);
+    vkDestroyPipeline(logical_device, emit_pipeline, NULL);
+    vkDestroyPipeline(logical_device, simulate_pipeline, NULL);
+    vkDestroyPipeline(logical_device, args_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, compute_layout, NULL);
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+
+    for (uint32_t i = 0; i < PARTICLE_BINDINGS; i++) {
+        vkDestroyBuffer(logical_device, buffers[i], NULL);
+        vkFreeMemory(logical_device, memory[i], NULL);
+    }
+
+    capacity = 0;
+    particles_enabled = false;
+}
+
+static void compute_barrier(VkCommandBuffer buffer, VkAccessFlags dst_access, VkPipelineStageFlags dst_stages) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = dst_access,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stages, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+// Emit into the current list, size the simulation from it, simulate into the
+// other list and hand its count to the draw
+void particles_set_time_step(float seconds) {
+    fixed_time_step = seconds;
+}
+
+void particles_simulate(VkCommandBuffer buffer) {
+    if (!particles_enabled) {
+        return;
+    }
+
+    float delta_time = fixed_time_step;
+    if (delta_time == 0.f) {
+        double now = glfwGetTime();
+        delta_time = (float)(now - last_time);
+        last_time = now;
+    }
+    if (delta_time > 0.1f) {
+        delta_time = 0.1f;
+    }
+
+    emit_remainder += capacity / PARTICLE_LIFETIME * delta_time;
+    uint32_t emit_count = (uint32_t)emit_remainder;
+    emit_remainder -= emit_count;
+    if (emit_count > capacity) {
+        emit_count = capacity;
+    }
+
+    // The fountain sits at what the camera looks at, sized to its distance
+    vec3 offset;
+    vec3_sub(offset, camera.position, camera.target);
+    float distance = vec3_len(offset);
+
+    struct particle_compute_push_constants push = {
+        .emitter = {camera.target[0], camera.target[1], camera.target[2], distance * 0.5f},
+        .delta_time = delta_time,
+        .lifetime = PARTICLE_LIFETIME,
+        .emit_count = emit_count,
+        .current = current,
+        .capacity = capacity,
+        .seed = seed++,
+    };
+
+    // The previous frame's draw still reads the lists written here, only
+    // the execution has to be ordered
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute_layout, 0, 1, &set, 0, NULL);
+
+    if (emit_count > 0) {
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, emit_pipeline);
+        vkCmdPushConstants(buffer, compute_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(buffer, (emit_count + EMIT_GROUP_SIZE - 1) / EMIT_GROUP_SIZE, 1, 1);
+        compute_barrier(buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, args_pipeline);
+    push.mode = ARGS_PREPARE;
+    vkCmdPushConstants(buffer, compute_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(buffer, 1, 1, 1);
+    compute_barrier(buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, simulate_pipeline);
+    vkCmdDispatchIndirect(buffer, buffers[PARTICLE_COUNTERS], offsetof(struct particle_counters, simulate));
+    compute_barrier(buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, args_pipeline);
+    push.mode = ARGS_FINISH;
+    vkCmdPushConstants(buffer, compute_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(buffer, 1, 1, 1);
+    compute_barrier(buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+
+    current = 1 - current;
+}
+
+void particles_draw(VkCommandBuffer buffer) {
+    if (!particles_enabled) {
+        return;
+    }
+
+    // The view matrix rows are the camera axes in world space
+    vec3 offset;
+    vec3_sub(offset, camera.position, camera.target);
+    float size = vec3_len(offset) * 0.004f;
+
+    struct particle_draw_push_constants push = {
+        .right = {camera.view[0][0], camera.view[1][0], camera.view[2][0], size},
+        .up = {camera.view[0][1], camera.view[1][1], camera.view[2][1], 0.f},
+        .alive_base = current * capacity,
+    };
+    mat4x4_dup(push.view_projection, camera.view_projection);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_layout, 0, 1, &set, 0, NULL);
+    vkCmdPushConstants(buffer, draw_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+    vkCmdDrawIndirect(buffer, buffers[PARTICLE_COUNTERS], offsetof(struct particle_counters, draw), 1, sizeof(VkDrawIndirectCommand));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_PARTICLES (1 << 20)
+#define PARTICLE_LIFETIME 4.f
+
+extern bool particles_enabled;
+
+// Particles live entirely on the GPU: emission takes indices off an atomic
+// free list, simulation appends survivors to the other of two alive lists
+// and returns the dead, and the draw reads its instance count from the
+// buffer simulation wrote. Nothing is read back
+VkResult create_particles(uint32_t capacity);
+void destroy_particles();
+
+// Recorded before the frame's passes, emits enough to keep the pool full
+// over PARTICLE_LIFETIME seconds
+void particles_simulate(VkCommandBuffer buffer);
+
+// Steps every frame by the given seconds instead of the time that passed,
+// for runs that must repeat exactly. Zero goes back to the wall clock
+void particles_set_time_step(float seconds);
+
+// Recorded inside the last pass of the frame
+void particles_draw(VkCommandBuffer buffer);
@@ -0,0 +1,628 @@
+#include "png.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PNG_WINDOW 32768
+#define PNG_HASH_BITS 15
+#define PNG_MAX_CHAIN 64
+#define PNG_MIN_MATCH 3
+#define PNG_MAX_MATCH 258
+
+static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+    if (crc_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            crc_table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+static uint32_t read_be32(const uint8_t* data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static void write_be32(uint8_t* data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+struct bit_writer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    uint32_t bits;
+    uint32_t count;
+};
+
+static void put_bits(struct bit_writer* writer, uint32_t value, uint32_t count) {
+    writer->bits |= value << writer->count;
+    writer->count += count;
+    while (writer->count >= 8) {
+        if (writer->size == writer->capacity) {
+            writer->capacity *= 2;
+            writer->data = realloc(writer->data, writer->capacity);
+        }
+        writer->data[writer->size++] = writer->bits & 0xff;
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+// Huffman codes go out most significant bit first
+static void put_code(struct bit_writer* writer, uint32_t code, uint32_t length) {
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+    }
+    put_bits(writer, reversed, length);
+}
+
+static void put_literal(struct bit_writer* writer, uint32_t symbol) {
+    if (symbol < 144) {
+        put_code(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(writer, symbol - 256, 7);
+    } else {
+        put_code(writer, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(struct bit_writer* writer, uint32_t length, uint32_t distance) {
+    int code = 28;
+    while (length_base[code] > length) {
+        code--;
+    }
+    put_literal(writer, 257 + code);
+    put_bits(writer, length - length_base[code], length_extra[code]);
+
+    code = 29;
+    while (distance_base[code] > distance) {
+        code--;
+    }
+    put_code(writer, code, 5);
+    put_bits(writer, distance - distance_base[code], distance_extra[code]);
+}
+
+static uint32_t hash3(const uint8_t* data) {
+    return ((uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2]) * 2654435761u >> (32 - PNG_HASH_BITS);
+}
+
+// A zlib stream of one fixed Huffman block, matches come from hash chains
+// over the last 32 KiB. Golden images are mostly flat, this gets most of
+// what a full encoder would
+static uint8_t* deflate(const uint8_t* data, size_t size, size_t* compressed_size) {
+    struct bit_writer writer = {.capacity = size / 4 + 1024};
+    writer.data = malloc(writer.capacity);
+    int32_t* head = malloc(sizeof(int32_t) << PNG_HASH_BITS);
+    int32_t* previous = malloc(sizeof(int32_t) * PNG_WINDOW);
+    if (writer.data == NULL || head == NULL || previous == NULL) {
+        free(writer.data);
+        free(head);
+        free(previous);
+        return NULL;
+    }
+
+    memset(head, 0xff, sizeof(int32_t) << PNG_HASH_BITS);
+    put_bits(&writer, 0x78, 8);
+    put_bits(&writer, 0x01, 8);
+    put_bits(&writer, 1, 1);
+    put_bits(&writer, 1, 2);
+
+    size_t position = 0;
+    while (position < size) {
+        uint32_t best_length = 0;
+        uint32_t best_distance = 0;
+        if (position + PNG_MIN_MATCH <= size) {
+            uint32_t hash = hash3(data + position);
+            int32_t candidate = head[hash];
+            size_t limit = size - position < PNG_MAX_MATCH ? size - position : PNG_MAX_MATCH;
+            for (int chain = 0; chain < PNG_MAX_CHAIN && candidate >= 0 && position - candidate <= PNG_WINDOW - 1; chain++) {
+                uint32_t length = 0;
+                while (length < limit && data[candidate + length] == data[position + length]) {
+                    length++;
+                }
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = position - candidate;
+                    if (length == limit) {
+                        break;
+                    }
+                }
+                candidate = previous[candidate % PNG_WINDOW];
+            }
+        }
+
+        uint32_t advance = best_length >= PNG_MIN_MATCH ? best_length : 1;
+        if (best_length >= PNG_MIN_MATCH) {
+            put_match(&writer, best_length, best_distance);
+        } else {
+            put_literal(&writer, data[position]);
+        }
+
+        for (uint32_t i = 0; i < advance; i++, position++) {
+            if (position + PNG_MIN_MATCH <= size) {
+                uint32_t hash = hash3(data + position);
+                previous[position % PNG_WINDOW] = head[hash];
+                head[hash] = (int32_t)position;
+            }
+        }
+    }
+
+    put_literal(&writer, 256);
+    put_bits(&writer, 0, (8 - writer.count) % 8);
+
+    uint32_t checksum = adler32(data, size);
+    for (int i = 3; i >= 0; i--) {
+        put_bits(&writer, (checksum >> (i * 8)) & 0xff, 8);
+    }
+
+    free(head);
+    free(previous);
+    *compressed_size = writer.size;
+    return writer.data;
+}
+
+struct bit_reader {
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint32_t bits;
+    uint32_t count;
+    bool overrun;
+};
+
+static uint32_t get_bits(struct bit_reader* reader, uint32_t count) {
+    while (reader->count < count) {
+        if (reader->position == reader->size) {
+            reader->overrun = true;
+            return 0;
+        }
+        reader->bits |= (uint32_t)reader->data[reader->position++] << reader->count;
+        reader->count += 8;
+    }
+
+    uint32_t value = reader->bits & ((1u << count) - 1);
+    reader->bits >>= count;
+    reader->count -= count;
+    return value;
+}
+
+// Canonical Huffman table as counts per length and symbols in code order
+struct huffman {
+    uint16_t counts[16];
+    uint16_t symbols[288];
+};
+
+static bool build_huffman(struct huffman* table, const uint8_t* lengths, uint32_t count) {
+    memset(table->counts, 0, sizeof(table->counts));
+    for (uint32_t i = 0; i < count; i++) {
+        table->counts[lengths[i]]++;
+    }
+    table->counts[0] = 0;
+
+    uint16_t offsets[16] = {0};
+    for (int i = 1; i < 15; i++) {
+        offsets[i + 1] = offsets[i] + table->counts[i];
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (lengths[i] != 0) {
+            table->symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+static int decode_symbol(struct bit_reader* reader, const struct huffman* table) {
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length < 16; length++) {
+        code |= get_bits(reader, 1);
+        int count = table->counts[length];
+        if (code - first < count) {
+            return table->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+        if (reader->overrun) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static bool inflate_block(struct bit_reader* reader, const struct huffman* literals, const struct huffman* distances,
+    uint8_t* output, size_t output_size, size_t* written) {
+    for (;;) {
+        int symbol = decode_symbol(reader, literals);
+        if (symbol < 0) {
+            return false;
+        }
+
+        if (symbol < 256) {
+            if (*written == output_size) {
+                return false;
+            }
+            output[(*written)++] = symbol;
+            continue;
+        }
+
+        if (symbol == 256) {
+            return true;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        uint32_t length = length_base[symbol] + get_bits(reader, length_extra[symbol]);
+
+        int distance_symbol = decode_symbol(reader, distances);
+        if (distance_symbol < 0 || distance_symbol >= 30) {
+            return false;
+        }
+        uint32_t distance = distance_base[distance_symbol] + get_bits(reader, distance_extra[distance_symbol]);
+        if (distance > *written || *written + length > output_size || reader->overrun) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < length; i++, (*written)++) {
+            output[*written] = output[*written - distance];
+        }
+    }
+}
+
+static bool read_dynamic_tables(struct bit_reader* reader, struct huffman* literals, struct huffman* distances) {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    uint32_t literal_count = get_bits(reader, 5) + 257;
+    uint32_t distance_count = get_bits(reader, 5) + 1;
+    uint32_t code_count = get_bits(reader, 4) + 4;
+    if (literal_count > 286 || distance_count > 30) {
+        return false;
+    }
+
+    uint8_t lengths[288 + 32] = {0};
+    for (uint32_t i = 0; i < code_count; i++) {
+        lengths[order[i]] = get_bits(reader, 3);
+    }
+
+    struct huffman code_lengths;
+    build_huffman(&code_lengths, lengths, 19);
+
+    uint32_t total = literal_count + distance_count;
+    uint32_t index = 0;
+    memset(lengths, 0, sizeof(lengths));
+    while (index < total) {
+        int symbol = decode_symbol(reader, &code_lengths);
+        if (symbol < 0) {
+            return false;
+        }
+
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        uint32_t repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (index == 0) {
+                return false;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + get_bits(reader, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(reader, 3);
+        } else {
+            repeat = 11 + get_bits(reader, 7);
+        }
+
+        if (index + repeat > total) {
+            return false;
+        }
+        while (repeat-- > 0) {
+            lengths[index++] = value;
+        }
+    }
+
+    build_huffman(literals, lengths, literal_count);
+    build_huffman(distances, lengths + literal_count, distance_count);
+    return !reader->overrun;
+}
+
+// Stored, fixed and dynamic blocks, the output size is known from the header
+static bool inflate(const uint8_t* data, size_t size, uint8_t* output, size_t output_size) {
+    if (size < 6 || (data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0) {
+        return false;
+    }
+
+    struct bit_reader reader = {.data = data + 2, .size = size - 6};
+    size_t written = 0;
+    bool last = false;
+    while (!last) {
+        last = get_bits(&reader, 1);
+        uint32_t type = get_bits(&reader, 2);
+
+        if (type == 0) {
+            reader.bits = 0;
+            reader.count = 0;
+            if (reader.position + 4 > reader.size) {
+                return false;
+            }
+            uint32_t length = reader.data[reader.position] | reader.data[reader.position + 1] << 8;
+            reader.position += 4;
+            if (reader.position + length > reader.size || written + length > output_size) {
+                return false;
+            }
+            memcpy(output + written, reader.data + reader.position, length);
+            reader.position += length;
+            written += length;
+            continue;
+        }
+
+        struct huffman literals, distances;
+        if (type == 1) {
+            uint8_t lengths[288 + 30];
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 112);
+            memset(lengths + 256, 7, 24);
+            memset(lengths + 280, 8, 8);
+            memset(lengths + 288, 5, 30);
+            build_huffman(&literals, lengths, 288);
+            build_huffman(&distances, lengths + 288, 30);
+        } else if (type != 2 || !read_dynamic_tables(&reader, &literals, &distances)) {
+            return false;
+        }
+
+        if (!inflate_block(&reader, &literals, &distances, output, output_size, &written)) {
+            return false;
+        }
+    }
+
+    const uint8_t* checksum = data + size - 4;
+    return written == output_size && !reader.overrun && read_be32(checksum) == adler32(output, output_size);
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+// Byte x of a row after filter type, left, up and up left are 0 outside
+static uint8_t predict(int type, const uint8_t* row, const uint8_t* above, uint32_t x, uint32_t stride) {
+    uint8_t left = x >= stride ? row[x - stride] : 0;
+    uint8_t up = above != NULL ? above[x] : 0;
+    uint8_t up_left = x >= stride && above != NULL ? above[x - stride] : 0;
+    switch (type) {
+    case 1:
+        return left;
+    case 2:
+        return up;
+    case 3:
+        return (left + up) / 2;
+    case 4:
+        return paeth(left, up, up_left);
+    default:
+        return 0;
+    }
+}
+
+static bool write_chunk(FILE* file, const char* type, const uint8_t* data, uint32_t size) {
+    uint8_t header[8];
+    write_be32(header, size);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = crc32(0, header + 4, 4);
+    if (size > 0) {
+        crc = crc32(crc, data, size);
+    }
+    uint8_t footer[4];
+    write_be32(footer, crc);
+
+    return fwrite(header, 1, 8, file) == 8 && (size == 0 || fwrite(data, 1, size, file) == size) && fwrite(footer, 1, 4, file) == 4;
+}
+
+// Each row takes the filter with the smallest sum of absolute residuals
+bool write_png(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height) {
+    uint32_t row_size = width * 4;
+    size_t raw_size = (size_t)(row_size + 1) * height;
+    uint8_t* raw = malloc(raw_size);
+    if (raw == NULL) {
+        return false;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* row = pixels + (size_t)y * row_size;
+        const uint8_t* above = y > 0 ? row - row_size : NULL;
+        uint8_t* filtered = raw + (size_t)y * (row_size + 1);
+
+        int best_type = 0;
+        uint64_t best_cost = UINT64_MAX;
+        for (int type = 0; type < 5; type++) {
+            uint64_t cost = 0;
+            for (uint32_t x = 0; x < row_size; x++) {
+                int8_t residual = (int8_t)(row[x] - predict(type, row, above, x, 4));
+                cost += abs(residual);
+            }
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_type = type;
+            }
+        }
+
+        filtered[0] = best_type;
+        for (uint32_t x = 0; x < row_size; x++) {
+            filtered[x + 1] = row[x] - predict(best_type, row, above, x, 4);
+        }
+    }
+
+    size_t compressed_size;
+    uint8_t* compressed = deflate(raw, raw_size, &compressed_size);
+    free(raw);
+    if (compressed == NULL) {
+        return false;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        free(compressed);
+        return false;
+    }
+
+    // 8 bit RGBA, deflate, adaptive filtering, no interlacing
+    uint8_t header[13] = {0};
+    write_be32(header, width);
+    write_be32(header + 4, height);
+    header[8] = 8;
+    header[9] = 6;
+
+    bool ok = fwrite(signature, 1, 8, file) == 8
+        && write_chunk(file, "IHDR", header, 13)
+        && write_chunk(file, "IDAT", compressed, compressed_size)
+        && write_chunk(file, "IEND", NULL, 0);
+
+    free(compressed);
+    return fclose(file) == 0 && ok;
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = length > 0 ? malloc(length) : NULL;
+    if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    *size = length;
+    return data;
+}
+
+bool read_png(const char* path, uint8_t** pixels, uint32_t* width, uint32_t* height) {
+    size_t size;
+    uint8_t* file = read_file(path, &size);
+    if (file == NULL) {
+        return false;
+    }
+
+    if (size < 8 + 25 || memcmp(file, signature, 8) != 0 || memcmp(file + 12, "IHDR", 4) != 0) {
+        printf("%s is not a PNG file\n", path);
+        free(file);
+        return false;
+    }
+
+    const uint8_t* header = file + 16;
+    *width = read_be32(header);
+    *height = read_be32(header + 4);
+    uint32_t channels = header[9] == 6 ? 4 : (header[9] == 2 ? 3 : 0);
+    if (header[8] != 8 || channels == 0 || header[12] != 0 || *width == 0 || *height == 0 || *width > 16384 || *height > 16384) {
+        printf("%s is not an 8 bit RGB or RGBA PNG without interlacing\n", path);
+        free(file);
+        return false;
+    }
+
+    // IDAT chunks concatenate into one zlib stream
+    uint8_t* compressed = malloc(size);
+    size_t compressed_size = 0;
+    size_t offset = 8;
+    while (compressed != NULL && offset + 12 <= size) {
+        uint32_t length = read_be32(file + offset);
+        if (length > size - offset - 12) {
+            break;
+        }
+        if (memcmp(file + offset + 4, "IDAT", 4) == 0) {
+            memcpy(compressed + compressed_size, file + offset + 8, length);
+            compressed_size += length;
+        }
+        offset += length + 12;
+    }
+
+    uint32_t stride = *width * channels;
+    size_t raw_size = (size_t)(stride + 1) * *height;
+    uint8_t* raw = malloc(raw_size);
+    bool ok = compressed != NULL && raw != NULL && inflate(compressed, compressed_size, raw, raw_size);
+    free(compressed);
+    free(file);
+
+    *pixels = ok ? malloc((size_t)*width * *height * 4) : NULL;
+    ok = ok && *pixels != NULL;
+    for (uint32_t y = 0; ok && y < *height; y++) {
+        uint8_t* row = raw + (size_t)y * (stride + 1) + 1;
+        const uint8_t* above = y > 0 ? row - (stride + 1) : NULL;
+        int type = row[-1];
+        if (type > 4) {
+            ok = false;
+            break;
+        }
+
+        for (uint32_t x = 0; x < stride; x++) {
+            row[x] += predict(type, row, above, x, channels);
+        }
+
+        for (uint32_t x = 0; x < *width; x++) {
+            uint8_t* pixel = *pixels + ((size_t)y * *width + x) * 4;
+            memcpy(pixel, row + x * channels, channels);
+            if (channels == 3) {
+                pixel[3] = 255;
+            }
+        }
+    }
+
+    free(raw);
+    if (!ok) {
+        printf("%s has corrupt image data\n", path);
+        free(*pixels);
+        *pixels = NULL;
+    }
+    return ok;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Just enough PNG for golden images: 8 bit RGB or RGBA, no interlacing.
+// Pixels are always RGBA8, rows top down without padding
+
+bool write_png(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height);
+
+// The pixels are allocated, free them
+bool read_png(const char* path, uint8_t** pixels, uint32_t* width, uint32_t* height);
@@ -0,0 +1,766 @@
+#include "post.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "golden.h"
+#include "gpu_counters.h"
+#include "gpu_timers.h"
+#include "images.h"
+#include "shaders.h"
+#include "startup.h"
+#include "swap_chain.h"
+#include "textures.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define POST_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+// Bloom down and up per level, the resolve and the copy pass
+#define POST_SETS (MAX_BLOOM_LEVELS * 2 + 2)
+
+// Matches Push in post.glsl
+#define POST_FIRST_LEVEL 1
+#define POST_OUTPUT_LINEAR 2
+
+struct post_push_constants {
+    float texel[2];
+    float source_lod;
+    float threshold;
+    float bloom_intensity;
+    float exposure;
+    uint32_t fxaa_steps;
+    uint32_t flags;
+    float scene_scale[2];
+};
+
+static const struct post_settings tiers[3] = {
+    [POST_QUALITY_LOW] = {
+        .resolve_scale = 0.5f,
+        .bloom_divisor = 4,
+        .bloom_levels = 4,
+        .fxaa_steps = 0,
+        .bloom_threshold = 1.f,
+        .bloom_intensity = 0.05f,
+        .exposure = 1.f,
+    },
+    [POST_QUALITY_MEDIUM] = {
+        .resolve_scale = 1.f,
+        .bloom_divisor = 2,
+        .bloom_levels = 5,
+        .fxaa_steps = 5,
+        .bloom_threshold = 1.f,
+        .bloom_intensity = 0.05f,
+        .exposure = 1.f,
+    },
+    [POST_QUALITY_HIGH] = {
+        .resolve_scale = 1.f,
+        .bloom_divisor = 2,
+        .bloom_levels = 7,
+        .fxaa_steps = 12,
+        .bloom_threshold = 1.f,
+        .bloom_intensity = 0.05f,
+        .exposure = 1.f,
+    },
+};
+
+enum post_quality post_quality = POST_QUALITY_MEDIUM;
+struct post_settings post_settings;
+
+static VkImage bloom_image;
+static VkDeviceMemory bloom_memory;
+static VkImageView bloom_view;
+static VkImageView bloom_level_views[MAX_BLOOM_LEVELS];
+static uint32_t bloom_width;
+static uint32_t bloom_height;
+static uint32_t bloom_levels = 0;
+
+static VkImage output_image;
+static VkDeviceMemory output_memory;
+static VkImageView output_view;
+static uint32_t output_width;
+static uint32_t output_height;
+
+static VkSampler linear_sampler;
+static VkDescriptorSetLayout set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet down_sets[MAX_BLOOM_LEVELS];
+static VkDescriptorSet up_sets[MAX_BLOOM_LEVELS];
+static VkDescriptorSet resolve_set;
+static VkPipelineLayout post_layout;
+static VkPipeline down_pipeline;
+static VkPipeline up_pipeline;
+static VkPipeline resolve_pipeline;
+
+// Swap chains that cannot be transfer targets get the output drawn in
+static bool copy_pass = false;
+static VkRenderPass copy_render_pass;
+static VkDescriptorSetLayout copy_set_layout;
+static VkDescriptorSet copy_set;
+static VkPipelineLayout copy_layout;
+static VkPipeline copy_pipeline;
+static VkFramebuffer* copy_framebuffers = NULL;
+static uint32_t copy_framebuffers_count = 0;
+
+bool parse_post_quality(const char* name, enum post_quality* quality) {
+    const char* names[3] = {"low", "medium", "high"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *quality = (enum post_quality)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool format_is_srgb(VkFormat format) {
+    return format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_A8B8G8R8_SRGB_PACK32;
+}
+
+static uint32_t max_u32(uint32_t a, uint32_t b) {
+    return a > b ? a : b;
+}
+
+static VkResult compile_copy_pipeline(void* data) {
+    (void)data;
+    VkShaderModule vertex_shader = load_shader_module("./shaders/post_copy_vert.spv");
+    VkShaderModule fragment_shader = load_shader_module("./shaders/post_copy_frag.spv");
+
+    VkResult result = VK_ERROR_INITIALIZATION_FAILED;
+    if (vertex_shader != VK_NULL_HANDLE && fragment_shader != VK_NULL_HANDLE) {
+        VkPipelineShaderStageCreateInfo stages[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_VERTEX_BIT,
+                .module = vertex_shader,
+                .pName = "main",
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = fragment_shader,
+                .pName = "main",
+            },
+        };
+
+        VkPipelineVertexInputStateCreateInfo vertex_input = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        };
+
+        VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        };
+
+        // The swap chain size changes without the pipeline being rebuilt
+        VkPipelineViewportStateCreateInfo viewport_state = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .scissorCount = 1,
+        };
+
+        VkDynamicState dynamic_states[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamic_state = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = 2,
+            .pDynamicStates = dynamic_states,
+        };
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .cullMode = VK_CULL_MODE_NONE,
+            .frontFace = VK_FRONT_FACE_CLOCKWISE,
+            .lineWidth = 1.f,
+        };
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        };
+
+        VkPipelineColorBlendAttachmentState blend_attachment = {
+            .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        };
+
+        VkPipelineColorBlendStateCreateInfo color_blend = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments = &blend_attachment,
+        };
+
+        VkGraphicsPipelineCreateInfo pipeline_info = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount = 2,
+            .pStages = stages,
+            .pVertexInputState = &vertex_input,
+            .pInputAssemblyState = &input_assembly,
+            .pViewportState = &viewport_state,
+            .pRasterizationState = &rasterizer,
+            .pMultisampleState = &multisampling,
+            .pColorBlendState = &color_blend,
+            .pDynamicState = &dynamic_state,
+            .layout = copy_layout,
+            .renderPass = copy_render_pass,
+            .subpass = 0,
+        };
+
+        result = vkCreateGraphicsPipelines(logical_device, pipeline_cache, 1, &pipeline_info, NULL, &copy_pipeline);
+    }
+
+    vkDestroyShaderModule(logical_device, vertex_shader, NULL);
+    vkDestroyShaderModule(logical_device, fragment_shader, NULL);
+    return result;
+}
+
+// The image is left as a color attachment so a golden capture can follow,
+// post_record moves it to present
+static VkResult create_copy_pass() {
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &set_layout_info, NULL, &copy_set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &copy_set_layout,
+    };
+
+    result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &copy_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkAttachmentDescription attachment = {
+        .format = swap_chain_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkAttachmentReference reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &reference,
+    };
+
+    // The acquire semaphore waits at color output, the layout change has to
+    // follow it
+    VkSubpassDependency dependency = {
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = 0,
+        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+    };
+
+    VkRenderPassCreateInfo render_pass_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &dependency,
+    };
+
+    result = vkCreateRenderPass(logical_device, &render_pass_info, NULL, &copy_render_pass);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return startup_defer("post_copy_pipeline", compile_copy_pipeline, NULL);
+}
+
+static VkResult create_copy_targets() {
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &copy_set_layout,
+    };
+
+    VkResult result = vkAllocateDescriptorSets(logical_device, &allocate_info, &copy_set);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorImageInfo image_info = {linear_sampler, output_view, VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = copy_set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(logical_device, 1, &write, 0, NULL);
+
+    copy_framebuffers = calloc(swap_chain_images_count, sizeof(VkFramebuffer));
+    copy_framebuffers_count = swap_chain_images_count;
+    for (uint32_t i = 0; i < swap_chain_images_count; i++) {
+        VkFramebufferCreateInfo framebuffer_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = copy_render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &swap_chain_image_views[i],
+            .width = swap_chain_extent.width,
+            .height = swap_chain_extent.height,
+            .layers = 1,
+        };
+
+        result = vkCreateFramebuffer(logical_device, &framebuffer_info, NULL, &copy_framebuffers[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+// Every pass reads a sampled source and writes one storage image, the
+// resolve pass reads the finished bloom as well
+static VkResult create_post_pipelines() {
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = i == 1 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &set_layout_info, NULL, &set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, POST_SETS * 2},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, POST_SETS},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = POST_SETS,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct post_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &post_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    struct sampler_key sampler_key = {
+        .filter = VK_FILTER_LINEAR,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+
+    linear_sampler = get_sampler(&sampler_key);
+    if (linear_sampler == VK_NULL_HANDLE) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    result = create_compute_pipeline("./shaders/post_bloom_down.spv", post_layout, &down_pipeline);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_compute_pipeline("./shaders/post_bloom_up.spv", post_layout, &up_pipeline);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_compute_pipeline("./shaders/post_resolve.spv", post_layout, &resolve_pipeline);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    copy_pass = (swap_chain_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) == 0;
+    return copy_pass ? create_copy_pass() : VK_SUCCESS;
+}
+
+static void write_set(VkDescriptorSet set, VkImageView source, VkImageLayout source_layout, VkImageView destination) {
+    VkDescriptorImageInfo infos[3] = {
+        {linear_sampler, source, source_layout},
+        {VK_NULL_HANDLE, destination, VK_IMAGE_LAYOUT_GENERAL},
+        {linear_sampler, bloom_view, VK_IMAGE_LAYOUT_GENERAL},
+    };
+
+    VkWriteDescriptorSet writes[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = i == 1 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &infos[i],
+        };
+    }
+
+    vkUpdateDescriptorSets(logical_device, 3, writes, 0, NULL);
+}
+
+// Bloom levels halve until the tier's depth or two texels, whichever comes
+// first. The resolve output is what the blit scales to the swap chain
+static VkResult create_post_images() {
+    bloom_width = max_u32(swap_chain_extent.width / post_settings.bloom_divisor, 1);
+    bloom_height = max_u32(swap_chain_extent.height / post_settings.bloom_divisor, 1);
+    bloom_levels = 1;
+    while (bloom_levels < post_settings.bloom_levels && bloom_levels < MAX_BLOOM_LEVELS &&
+        (bloom_width >> bloom_levels) >= 2 && (bloom_height >> bloom_levels) >= 2) {
+        bloom_levels++;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    VkResult result = create_image(bloom_width, bloom_height, bloom_levels, POST_FORMAT, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &bloom_image, &bloom_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_image_view_2d(bloom_image, POST_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, bloom_levels, &bloom_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < bloom_levels; i++) {
+        result = create_image_view_2d(bloom_image, POST_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, &bloom_level_views[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    output_width = max_u32((uint32_t)(swap_chain_extent.width * post_settings.resolve_scale + 0.5f), 1);
+    output_height = max_u32((uint32_t)(swap_chain_extent.height * post_settings.resolve_scale + 0.5f), 1);
+    usage = VK_IMAGE_USAGE_STORAGE_BIT | (copy_pass ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    result = create_image(output_width, output_height, 1, POST_FORMAT, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &output_image, &output_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_image_view_2d(output_image, POST_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, &output_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorSetLayout layouts[POST_SETS];
+    for (uint32_t i = 0; i < POST_SETS; i++) {
+        layouts[i] = set_layout;
+    }
+
+    VkDescriptorSet sets[POST_SETS];
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = bloom_levels * 2 + 1,
+        .pSetLayouts = layouts,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, sets);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // Levels sample the one before them, or the scene for the first
+    for (uint32_t i = 0; i < bloom_levels; i++) {
+        down_sets[i] = sets[i];
+        up_sets[i] = sets[bloom_levels + i];
+        if (i == 0) {
+            write_set(down_sets[i], color_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, bloom_level_views[i]);
+        } else {
+            write_set(down_sets[i], bloom_view, VK_IMAGE_LAYOUT_GENERAL, bloom_level_views[i]);
+        }
+        write_set(up_sets[i], bloom_view, VK_IMAGE_LAYOUT_GENERAL, bloom_level_views[i]);
+    }
+
+    resolve_set = sets[bloom_levels * 2];
+    write_set(resolve_set, color_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, output_view);
+    return copy_pass ? create_copy_targets() : VK_SUCCESS;
+}
+
+static void destroy_post_images() {
+    for (uint32_t i = 0; i < copy_framebuffers_count; i++) {
+        vkDestroyFramebuffer(logical_device, copy_framebuffers[i], NULL);
+    }
+    free(copy_framebuffers);
+    copy_framebuffers = NULL;
+    copy_framebuffers_count = 0;
+
+    for (uint32_t i = 0; i < bloom_levels; i++) {
+        vkDestroyImageView(logical_device, bloom_level_views[i], NULL);
+    }
+
+    vkDestroyImageView(logical_device, bloom_view, NULL);
+    vkDestroyImage(logical_device, bloom_image, NULL);
+    vkFreeMemory(logical_device, bloom_memory, NULL);
+    vkDestroyImageView(logical_device, output_view, NULL);
+    vkDestroyImage(logical_device, output_image, NULL);
+    vkFreeMemory(logical_device, output_memory, NULL);
+    vkResetDescriptorPool(logical_device, descriptor_pool, 0);
+    bloom_levels = 0;
+}
+
+VkResult create_post() {
+    post_settings = tiers[post_quality];
+
+    VkResult result = create_post_pipelines();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_post_images();
+}
+
+void destroy_post() {
+    destroy_post_images();
+
+    vkDestroyPipeline(logical_device, down_pipeline, NULL);
+    vkDestroyPipeline(logical_device, up_pipeline, NULL);
+    vkDestroyPipeline(logical_device, resolve_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, post_layout, NULL);
+    if (copy_pass) {
+        vkDestroyPipeline(logical_device, copy_pipeline, NULL);
+        vkDestroyPipelineLayout(logical_device, copy_layout, NULL);
+        vkDestroyRenderPass(logical_device, copy_render_pass, NULL);
+        vkDestroyDescriptorSetLayout(logical_device, copy_set_layout, NULL);
+        copy_pass = false;
+    }
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+}
+
+// The images follow the scene color and swap chain size
+VkResult recreate_post() {
+    destroy_post_images();
+    return create_post_images();
+}
+
+static void compute_barrier(VkCommandBuffer buffer) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void dispatch(VkCommandBuffer buffer, VkDescriptorSet set, const struct post_push_constants* push, uint32_t width, uint32_t height, uint32_t group) {
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, post_layout, 0, 1, &set, 0, NULL);
+    vkCmdPushConstants(buffer, post_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*push), push);
+    vkCmdDispatch(buffer, (width + group - 1) / group, (height + group - 1) / group, 1);
+}
+
+// Bloom goes down the pyramid and back up, each level adding the blurred
+// one below it, so level 0 ends up holding every level
+static void record_bloom(VkCommandBuffer buffer, const float scene_scale[2]) {
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, down_pipeline);
+    for (uint32_t i = 0; i < bloom_levels; i++) {
+        uint32_t width = max_u32(bloom_width >> i, 1);
+        uint32_t height = max_u32(bloom_height >> i, 1);
+        struct post_push_constants push = {
+            .texel = {1.f / width, 1.f / height},
+            .source_lod = i == 0 ? 0.f : (float)(i - 1),
+            .threshold = post_settings.bloom_threshold,
+            .flags = i == 0 ? POST_FIRST_LEVEL : 0,
+            .scene_scale = {i == 0 ? scene_scale[0] : 1.f, i == 0 ? scene_scale[1] : 1.f},
+        };
+
+        dispatch(buffer, down_sets[i], &push, width, height, 8);
+        compute_barrier(buffer);
+    }
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, up_pipeline);
+    for (uint32_t i = bloom_levels - 1; i-- > 0;) {
+        uint32_t width = max_u32(bloom_width >> i, 1);
+        uint32_t height = max_u32(bloom_height >> i, 1);
+        struct post_push_constants push = {
+            .texel = {1.f / width, 1.f / height},
+            .source_lod = (float)(i + 1),
+            .scene_scale = {1.f, 1.f},
+        };
+
+        dispatch(buffer, up_sets[i], &push, width, height, 8);
+        compute_barrier(buffer);
+    }
+}
+
+// Draws the output over the swap chain image where it cannot be blitted to
+static void record_copy(VkCommandBuffer buffer, uint32_t image_index) {
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    VkRenderPassBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = copy_render_pass,
+        .framebuffer = copy_framebuffers[image_index],
+        .renderArea = {{0, 0}, swap_chain_extent},
+    };
+
+    VkViewport viewport = {0.f, 0.f, (float)swap_chain_extent.width, (float)swap_chain_extent.height, 0.f, 1.f};
+    VkRect2D scissor = {{0, 0}, swap_chain_extent};
+
+    uint32_t timer = gpu_timer_begin(buffer, "copy");
+    vkCmdBeginRenderPass(buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, copy_pipeline);
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, copy_layout, 0, 1, &copy_set, 0, NULL);
+    vkCmdDraw(buffer, 3, 1, 0, 0);
+    vkCmdEndRenderPass(buffer);
+    gpu_timer_end(buffer, timer);
+    golden_record_capture(buffer, swap_chain_images[image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    transition_image(buffer, swap_chain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+void post_record(VkCommandBuffer buffer, uint32_t image_index) {
+    transition_image(buffer, color_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    // Last frame's contents are never read again, only its reads need to be
+    // done before writing
+    transition_image(buffer, bloom_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+        0, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    transition_image(buffer, output_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+        0, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    // Dynamic resolution leaves the scene in the top left of the target, the
+    // first bloom level and the resolve stretch it over the screen
+    float scene_scale[2] = {
+        (float)render_extent.width / swap_chain_extent.width,
+        (float)render_extent.height / swap_chain_extent.height,
+    };
+
+    uint32_t pass = gpu_pass_begin(buffer, "bloom");
+    record_bloom(buffer, scene_scale);
+    gpu_pass_end(buffer, pass);
+
+    pass = gpu_pass_begin(buffer, "resolve");
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, resolve_pipeline);
+    struct post_push_constants push = {
+        .texel = {1.f / output_width, 1.f / output_height},
+        .bloom_intensity = post_settings.bloom_intensity / bloom_levels,
+        .exposure = post_settings.exposure,
+        .fxaa_steps = post_settings.fxaa_steps,
+        .flags = format_is_srgb(swap_chain_format) ? POST_OUTPUT_LINEAR : 0,
+        .scene_scale = {scene_scale[0], scene_scale[1]},
+    };
+    dispatch(buffer, resolve_set, &push, output_width, output_height, 16);
+    gpu_pass_end(buffer, pass);
+
+    if (copy_pass) {
+        record_copy(buffer, image_index);
+        return;
+    }
+
+    // The acquire semaphore waits at color output, the blit has to follow it
+    VkImageMemoryBarrier barriers[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = output_image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = swap_chain_images[image_index],
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        },
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+
+    VkImageBlit region = {
+        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .srcOffsets = {{0, 0, 0}, {(int32_t)output_width, (int32_t)output_height, 1}},
+        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .dstOffsets = {{0, 0, 0}, {(int32_t)swap_chain_extent.width, (int32_t)swap_chain_extent.height, 1}},
+    };
+
+    uint32_t timer = gpu_timer_begin(buffer, "blit");
+    vkCmdBlitImage(buffer, output_image, VK_IMAGE_LAYOUT_GENERAL, swap_chain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &region, VK_FILTER_LINEAR);
+    gpu_timer_end(buffer, timer);
+    golden_record_capture(buffer, swap_chain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    transition_image(buffer, swap_chain_images[image_index], VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
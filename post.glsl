@@ -0,0 +1,26 @@
+// Push constants of every post pass, matches post_push_constants in post.c.
+// Texel is the size of a destination texel in uv, scene scale the part of
+// the scene color that was rendered to
+layout(push_constant) uniform Push {
+    vec2 texel;
+    float source_lod;
+    float threshold;
+    float bloom_intensity;
+    float exposure;
+    uint fxaa_steps;
+    uint flags;
+    vec2 scene_scale;
+};
+
+const uint POST_FIRST_LEVEL = 1;
+const uint POST_OUTPUT_LINEAR = 2;
+
+// Scene color uv for a screen uv, kept far enough inside the rendered part
+// that bilinear taps never reach past it
+vec2 scene_uv(vec2 uv, vec2 offset, vec2 source_texel) {
+    return min(uv * scene_scale + offset, scene_scale - 0.5 * source_texel);
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_BLOOM_LEVELS 8
+
+enum post_quality {
+    POST_QUALITY_LOW,
+    POST_QUALITY_MEDIUM,
+    POST_QUALITY_HIGH,
+};
+
+// What a quality tier runs. The resolve pass tonemaps, adds the bloom and
+// runs FXAA in one dispatch at resolve_scale of the swap chain, the blit to
+// the swap chain scales it back up. Bloom starts at 1 / bloom_divisor of the
+// scene and is that many levels deep, FXAA searches edges that many steps,
+// none turns it off
+struct post_settings {
+    float resolve_scale;
+    uint32_t bloom_divisor;
+    uint32_t bloom_levels;
+    uint32_t fxaa_steps;
+    float bloom_threshold;
+    float bloom_intensity;
+    float exposure;
+};
+
+extern enum post_quality post_quality;
+extern struct post_settings post_settings;
+
+// Parses low, medium or high
+bool parse_post_quality(const char* name, enum post_quality* quality);
+
+// Reads post_quality, the images follow the swap chain size
+VkResult create_post();
+void destroy_post();
+VkResult recreate_post();
+
+// After the frame's passes: the scene color goes through the chain and ends
+// up in the swap chain image, ready to present
+void post_record(VkCommandBuffer buffer, uint32_t image_index);
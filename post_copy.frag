@@ -0,0 +1,12 @@
+#version 450
+
+layout(binding = 0) uniform sampler2D resolved;
+
+layout(location = 0) in vec2 frag_uv;
+layout(location = 0) out vec4 out_color;
+
+// Stands in for the blit on swap chains that cannot be transfer targets,
+// sRGB targets encode on write the same way
+void main() {
+    out_color = vec4(texture(resolved, frag_uv).rgb, 1.0);
+}
@@ -0,0 +1,268 @@
+#include "scene.h"
+#include "camera.h"
+#include "jobs.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BOXES_PER_JOB 1024
+
+struct scene scene;
+
+static struct bvh_box* boxes;
+static uint32_t boxes_capacity;
+
+int32_t scene_add_mesh(const char* path, bool streamed) {
+    if (scene.meshes_count == MAX_SCENE_MESHES) {
+        puts("Too many meshes in the scene");
+        return -1;
+    }
+
+    struct mesh* mesh = &scene.meshes[scene.meshes_count];
+    VkResult result = streamed ? stream_mesh(path, mesh) : load_mesh(path, mesh);
+    if (result != VK_SUCCESS) {
+        destroy_mesh(mesh);
+        return -1;
+    }
+
+    return scene.meshes_count++;
+}
+
+int32_t scene_add_generated_mesh(const struct mesh_header* header, const uint8_t* data) {
+    if (scene.meshes_count == MAX_SCENE_MESHES) {
+        puts("Too many meshes in the scene");
+        return -1;
+    }
+
+    struct mesh* mesh = &scene.meshes[scene.meshes_count];
+    if (create_mesh(header, data, mesh) != VK_SUCCESS) {
+        destroy_mesh(mesh);
+        return -1;
+    }
+
+    return scene.meshes_count++;
+}
+
+void scene_add_instance(uint32_t mesh, mat4x4 transform) {
+    // Occlusion culling keeps a visibility slot per instance
+    if (scene.instances_count == MAX_SCENE_INSTANCES) {
+        puts("Too many instances in the scene");
+        return;
+    }
+
+    if (scene.instances_count == scene.instances_capacity) {
+        scene.instances_capacity = scene.instances_capacity == 0 ? 64 : scene.instances_capacity * 2;
+        scene.instances = realloc(scene.instances, sizeof(struct instance) * scene.instances_capacity);
+    }
+
+    struct instance* instance = &scene.instances[scene.instances_count++];
+    mat4x4_dup(instance->transform, transform);
+    instance->mesh = mesh;
+    scene.casters_version++;
+}
+
+int32_t scene_add_texture(const char* path) {
+    if (scene.textures_count == MAX_SCENE_TEXTURES) {
+        puts("Too many textures in the scene");
+        return -1;
+    }
+
+    struct texture* texture = &scene.textures[scene.textures_count];
+    if (load_texture(path, texture) != VK_SUCCESS) {
+        destroy_texture(texture);
+        return -1;
+    }
+
+    return scene.textures_count++;
+}
+
+// RGBA8 sRGB pixels, the mip chain is generated on the GPU
+int32_t scene_add_generated_texture(const void* pixels, uint32_t width, uint32_t height) {
+    if (scene.textures_count == MAX_SCENE_TEXTURES) {
+        puts("Too many textures in the scene");
+        return -1;
+    }
+
+    struct texture* texture = &scene.textures[scene.textures_count];
+    if (create_texture(pixels, width, height, VK_FORMAT_R8G8B8A8_SRGB, texture) != VK_SUCCESS) {
+        destroy_texture(texture);
+        return -1;
+    }
+
+    return scene.textures_count++;
+}
+
+void scene_set_mesh_texture(uint32_t mesh, uint32_t texture) {
+    scene.mesh_textures[mesh] = texture + 1;
+}
+
+void scene_set_mesh_virtual_texture(uint32_t mesh, uint32_t virtual_texture) {
+    scene.mesh_virtual_textures[mesh] = virtual_texture + 1;
+}
+
+VkDescriptorSet scene_texture_set(uint32_t mesh) {
+    uint32_t texture = scene.mesh_textures[mesh];
+    return texture == 0 ? default_texture.set : scene.textures[texture - 1].set;
+}
+
+void scene_set_transform(uint32_t instance, mat4x4 transform) {
+    mat4x4_dup(scene.instances[instance].transform, transform);
+    scene.instances_moved = true;
+    scene.casters_version++;
+}
+
+// World box of the mesh box under the instance transform, each axis takes
+// the absolute contribution of every local axis
+void instance_box(const struct instance* instance, struct bvh_box* box) {
+    struct mesh_bounds* bounds = &scene.meshes[instance->mesh].bounds;
+
+    for (int row = 0; row < 3; row++) {
+        float center = instance->transform[3][row];
+        float extent = 0.f;
+        for (int column = 0; column < 3; column++) {
+            float local_center = (bounds->min[column] + bounds->max[column]) * 0.5f;
+            float local_extent = (bounds->max[column] - bounds->min[column]) * 0.5f;
+            center += instance->transform[column][row] * local_center;
+            extent += fabsf(instance->transform[column][row]) * local_extent;
+        }
+
+        box->min[row] = center - extent;
+        box->max[row] = center + extent;
+    }
+}
+
+static void update_boxes(void* data, uint32_t index) {
+    (void)data;
+    uint32_t first = index * BOXES_PER_JOB;
+    uint32_t last = first + BOXES_PER_JOB < scene.instances_count ? first + BOXES_PER_JOB : scene.instances_count;
+    for (uint32_t i = first; i < last; i++) {
+        instance_box(&scene.instances[i], &boxes[i]);
+    }
+}
+
+void scene_update_bvh() {
+    bool rebuild = scene.bvh.objects_count != scene.instances_count;
+    if (!rebuild && !scene.instances_moved) {
+        return;
+    }
+
+    if (boxes_capacity < scene.instances_count) {
+        boxes_capacity = scene.instances_capacity;
+        boxes = realloc(boxes, sizeof(struct bvh_box) * boxes_capacity);
+    }
+
+    uint32_t jobs = (scene.instances_count + BOXES_PER_JOB - 1) / BOXES_PER_JOB;
+    job_parallel_for(update_boxes, NULL, jobs, "instance_boxes");
+
+    if (rebuild) {
+        build_bvh(&scene.bvh, boxes, scene.instances_count);
+    } else {
+        refit_bvh(&scene.bvh, boxes);
+    }
+    scene.instances_moved = false;
+}
+
+// Visible needs room for every instance
+uint32_t scene_cull(vec4 const planes[6], uint32_t* visible) {
+    return bvh_cull(&scene.bvh, planes, visible);
+}
+
+// Nearest instance whose world box the ray hits, -1 on a miss
+int32_t scene_pick(const vec3 origin, const vec3 direction, float* distance) {
+    uint32_t instance;
+    if (!bvh_raycast(&scene.bvh, origin, direction, &instance, distance)) {
+        return -1;
+    }
+
+    return instance;
+}
+
+// Largest axis scale, bounds stay conservative under non uniform scaling
+float instance_scale(const struct instance* instance) {
+    float scale = vec3_len(instance->transform[0]);
+    scale = fmaxf(scale, vec3_len(instance->transform[1]));
+    return fmaxf(scale, vec3_len(instance->transform[2]));
+}
+
+void instance_sphere(const struct instance* instance, vec3 center, float* radius) {
+    struct mesh_bounds* bounds = &scene.meshes[instance->mesh].bounds;
+
+    vec4 local = {bounds->center[0], bounds->center[1], bounds->center[2], 1.f};
+    vec4 world;
+    mat4x4_mul_vec4(world, instance->transform, local);
+
+    vec3_dup(center, world);
+    *radius = bounds->radius * instance_scale(instance);
+}
+
+// Projected error uses the nearest point of the bounding sphere, a camera
+// inside the sphere always gets full detail
+uint32_t instance_lod(const struct instance* instance, float viewport_height) {
+    vec3 center;
+    float radius;
+    instance_sphere(instance, center, &radius);
+
+    vec3 offset;
+    vec3_sub(offset, center, camera.position);
+    float distance = vec3_len(offset) - radius;
+    if (distance <= camera.near_plane) {
+        return 0;
+    }
+
+    float scale = instance_scale(instance);
+    float pixels_per_unit = scale * viewport_height / (2.f * tanf(camera.fov_y * 0.5f) * distance);
+    return mesh_select_lod(&scene.meshes[instance->mesh], pixels_per_unit, LOD_ERROR_PIXELS);
+}
+
+// World space sphere around every instance, used to frame the camera
+void scene_bounds(float* center, float* radius) {
+    vec3 min = {INFINITY, INFINITY, INFINITY};
+    vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = 0; i < scene.instances_count; i++) {
+        vec3 world;
+        float r;
+        instance_sphere(&scene.instances[i], world, &r);
+
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = fminf(min[axis], world[axis] - r);
+            max[axis] = fmaxf(max[axis], world[axis] + r);
+        }
+    }
+
+    if (scene.instances_count == 0) {
+        center[0] = center[1] = center[2] = 0.f;
+        *radius = 1.f;
+        return;
+    }
+
+    vec3 extent;
+    vec3_sub(extent, max, min);
+    for (int axis = 0; axis < 3; axis++) {
+        center[axis] = (min[axis] + max[axis]) * 0.5f;
+    }
+    *radius = vec3_len(extent) * 0.5f;
+}
+
+void destroy_scene() {
+    for (uint32_t i = 0; i < scene.meshes_count; i++) {
+        destroy_mesh(&scene.meshes[i]);
+        scene.mesh_textures[i] = 0;
+        scene.mesh_virtual_textures[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < scene.textures_count; i++) {
+        destroy_texture(&scene.textures[i]);
+    }
+    scene.textures_count = 0;
+
+    destroy_bvh(&scene.bvh);
+    free(boxes);
+    boxes = NULL;
+    boxes_capacity = 0;
+
+    free(scene.instances);
+    scene.instances = NULL;
+    scene.meshes_count = 0;
+    scene.instances_count = 0;
+    scene.instances_capacity = 0;
+}
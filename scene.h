@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "bvh.h"
+#include "linmath.h"
+#include "mesh.h"
+#include "textures.h"
+
+#define MAX_SCENE_MESHES 256
+#define MAX_SCENE_INSTANCES (1 << 16)
+#define MAX_SCENE_TEXTURES 128
+#define LOD_ERROR_PIXELS 1.f
+
+struct instance {
+    mat4x4 transform;
+    uint32_t mesh;
+};
+
+struct scene {
+    struct mesh meshes[MAX_SCENE_MESHES];
+    uint32_t meshes_count;
+
+    // Texture index plus one for every mesh, 0 draws with the default texture
+    uint32_t mesh_textures[MAX_SCENE_MESHES];
+    struct texture textures[MAX_SCENE_TEXTURES];
+    uint32_t textures_count;
+
+    // Virtual texture index plus one, non-zero replaces the mesh texture
+    uint32_t mesh_virtual_textures[MAX_SCENE_MESHES];
+
+    struct instance* instances;
+    uint32_t instances_count;
+    uint32_t instances_capacity;
+
+    // Rebuilt when instances are added, refit when they move
+    struct bvh bvh;
+    bool instances_moved;
+
+    // Bumped on any instance change, cached shadow cascades compare it
+    uint64_t casters_version;
+};
+
+extern struct scene scene;
+
+int32_t scene_add_mesh(const char* path, bool streamed);
+int32_t scene_add_generated_mesh(const struct mesh_header* header, const uint8_t* data);
+void scene_add_instance(uint32_t mesh, mat4x4 transform);
+int32_t scene_add_texture(const char* path);
+int32_t scene_add_generated_texture(const void* pixels, uint32_t width, uint32_t height);
+void scene_set_mesh_texture(uint32_t mesh, uint32_t texture);
+void scene_set_mesh_virtual_texture(uint32_t mesh, uint32_t virtual_texture);
+VkDescriptorSet scene_texture_set(uint32_t mesh);
+void scene_set_transform(uint32_t instance, mat4x4 transform);
+void scene_update_bvh();
+uint32_t scene_cull(vec4 const planes[6], uint32_t* visible);
+int32_t scene_pick(const vec3 origin, const vec3 direction, float* distance);
+void instance_box(const struct instance* instance, struct bvh_box* box);
+float instance_scale(const struct instance* instance);
+void instance_sphere(const struct instance* instance, vec3 center, float* radius);
+uint32_t instance_lod(const struct instance* instance, float viewport_height);
+void scene_bounds(float* center, float* radius);
+void destroy_scene();
@@ -0,0 +1,521 @@
+#include "scenegen.h"
+#include "lights.h"
+#include "linmath.h"
+#include "mesh_format.h"
+#include "scene.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCENEGEN_PI 3.14159265f
+
+// Largest radius a generated sphere reaches with its bumps
+#define SCENEGEN_RADIUS 1.15f
+
+struct scenegen_preset {
+    const char* name;
+    struct scenegen_settings settings;
+};
+
+static const struct scenegen_preset presets[] = {
+    {"tiny", {.meshes = 1, .instances = 16, .materials = 1, .lights = 4, .rings = 8}},
+    {"small", {.meshes = 4, .instances = 256, .materials = 2, .lights = 32, .rings = 16}},
+    {"medium", {.meshes = 8, .instances = 1024, .materials = 4, .lights = 128, .rings = 24}},
+    {"large", {.meshes = 16, .instances = 4500, .materials = 8, .lights = 512, .rings = 24}},
+};
+
+struct sphere_shape {
+    float bumps;
+    float frequency;
+};
+
+struct generated_mesh {
+    struct vertex* vertices;
+    uint32_t vertex_count;
+    uint32_t* indices;
+    uint32_t index_count;
+    struct meshlet* meshlets;
+    uint32_t meshlet_count;
+    uint32_t* meshlet_vertices;
+    uint32_t meshlet_vertex_count;
+    uint32_t* meshlet_triangles;
+    uint32_t meshlet_triangle_count;
+    struct mesh_lod lods[MESH_MAX_LODS];
+    uint32_t lod_count;
+};
+
+// Same sequence on every platform, unlike rand()
+static uint32_t hash(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7feb352d;
+    value ^= value >> 15;
+    value *= 0x846ca68b;
+    value ^= value >> 16;
+    return value;
+}
+
+static float hash_unit(uint32_t value) {
+    return (hash(value) >> 8) / 16777216.f;
+}
+
+static void sphere_point(const struct sphere_shape* shape, float theta, float phi, vec3 point) {
+    float radius = 1.f + shape->bumps * sinf(shape->frequency * theta) * cosf(shape->frequency * phi);
+    point[0] = sinf(theta) * cosf(phi) * radius;
+    point[1] = cosf(theta) * radius;
+    point[2] = sinf(theta) * sinf(phi) * radius;
+}
+
+// Central differences along both parameters, the poles have no phi
+// derivative and take the radial direction
+static void sphere_normal(const struct sphere_shape* shape, float theta, float phi, vec3 normal) {
+    const float epsilon = 1e-3f;
+    vec3 a, b, c, d, along_theta, along_phi;
+    sphere_point(shape, theta + epsilon, phi, a);
+    sphere_point(shape, theta - epsilon, phi, b);
+    sphere_point(shape, theta, phi + epsilon, c);
+    sphere_point(shape, theta, phi - epsilon, d);
+    vec3_sub(along_theta, a, b);
+    vec3_sub(along_phi, c, d);
+    vec3_mul_cross(normal, along_phi, along_theta);
+
+    if (vec3_len(normal) < 1e-6f) {
+        sphere_point(shape, theta, phi, normal);
+    }
+    vec3_norm(normal, normal);
+}
+
+static void meshlet_bounds(struct meshlet* meshlet, const struct vertex* vertices, const uint32_t* local_vertices, const uint32_t* indices) {
+    vec3 min = {INFINITY, INFINITY, INFINITY};
+    vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = 0; i < meshlet->vertex_count; i++) {
+        const float* position = vertices[local_vertices[i]].position;
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = fminf(min[axis], position[axis]);
+            max[axis] = fmaxf(max[axis], position[axis]);
+        }
+    }
+
+    meshlet->radius = 0.f;
+    for (int axis = 0; axis < 3; axis++) {
+        meshlet->center[axis] = (min[axis] + max[axis]) * 0.5f;
+    }
+
+    for (uint32_t i = 0; i < meshlet->vertex_count; i++) {
+        vec3 offset;
+        vec3_sub(offset, (float*)vertices[local_vertices[i]].position, meshlet->center);
+        meshlet->radius = fmaxf(meshlet->radius, vec3_len(offset));
+    }
+
+    vec3 normals[MESHLET_MAX_TRIANGLES];
+    uint32_t normals_count = 0;
+    vec3 axis = {0.f, 0.f, 0.f};
+    for (uint32_t i = 0; i < meshlet->triangle_count; i++) {
+        const uint32_t* triangle = &indices[i * 3];
+        vec3 ab, ac, normal;
+        vec3_sub(ab, (float*)vertices[triangle[1]].position, (float*)vertices[triangle[0]].position);
+        vec3_sub(ac, (float*)vertices[triangle[2]].position, (float*)vertices[triangle[0]].position);
+        vec3_mul_cross(normal, ab, ac);
+        float length = vec3_len(normal);
+        if (length == 0.f) {
+            continue;
+        }
+
+        vec3_scale(normals[normals_count], normal, 1.f / length);
+        vec3_add(axis, axis, normals[normals_count]);
+        normals_count++;
+    }
+
+    float length = vec3_len(axis);
+    float min_dot = 1.f;
+    if (length > 0.f) {
+        vec3_scale(axis, axis, 1.f / length);
+        for (uint32_t i = 0; i < normals_count; i++) {
+            min_dot = fminf(min_dot, vec3_mul_inner(axis, normals[i]));
+        }
+    }
+
+    // Same rule as the baker, a cutoff of 1 disables the cone test
+    vec3_dup(meshlet->cone_axis, axis);
+    meshlet->cone_cutoff = length == 0.f || min_dot <= 0.1f ? 1.f : sqrtf(1.f - min_dot * min_dot);
+}
+
+// One meshlet per patch of quads of the LOD grid, quads touching a pole
+// lose the triangle that collapses onto it
+static void add_patch(struct generated_mesh* mesh, uint32_t row_stride, uint32_t step, uint32_t ring_first, uint32_t ring_count,
+    uint32_t segment_first, uint32_t segment_count, uint32_t rings) {
+    struct meshlet* meshlet = &mesh->meshlets[mesh->meshlet_count++];
+    memset(meshlet, 0, sizeof(struct meshlet));
+    meshlet->index_offset = mesh->index_count;
+    meshlet->vertex_offset = mesh->meshlet_vertex_count;
+    meshlet->triangle_offset = mesh->meshlet_triangle_count;
+
+    uint32_t columns = segment_count + 1;
+    uint32_t* local_vertices = &mesh->meshlet_vertices[mesh->meshlet_vertex_count];
+    for (uint32_t r = 0; r <= ring_count; r++) {
+        for (uint32_t s = 0; s <= segment_count; s++) {
+            local_vertices[meshlet->vertex_count++] = (ring_first + r) * step * row_stride + (segment_first + s) * step;
+        }
+    }
+
+    uint32_t* indices = &mesh->indices[mesh->index_count];
+    for (uint32_t r = 0; r < ring_count; r++) {
+        for (uint32_t s = 0; s < segment_count; s++) {
+            uint32_t a = r * columns + s;
+            uint32_t b = a + columns;
+            uint32_t quad[2][3] = {{a, a + 1, b}, {a + 1, b + 1, b}};
+            for (int t = 0; t < 2; t++) {
+                bool collapsed = t == 0 ? ring_first + r == 0 : ring_first + r == rings - 1;
+                if (collapsed) {
+                    continue;
+                }
+
+                uint32_t packed = 0;
+                for (int k = 0; k < 3; k++) {
+                    indices[meshlet->triangle_count * 3 + k] = local_vertices[quad[t][k]];
+                    packed |= quad[t][k] << (k * 8);
+                }
+                mesh->meshlet_triangles[mesh->meshlet_triangle_count + meshlet->triangle_count++] = packed;
+            }
+        }
+    }
+
+    meshlet_bounds(meshlet, mesh->vertices, local_vertices, indices);
+    mesh->index_count += meshlet->triangle_count * 3;
+    mesh->meshlet_vertex_count += meshlet->vertex_count;
+    mesh->meshlet_triangle_count += meshlet->triangle_count;
+}
+
+static bool generate_sphere(const struct sphere_shape* shape, uint32_t rings, const vec3 color, struct generated_mesh* mesh) {
+    uint32_t segments = rings * 2;
+    uint32_t row_stride = segments + 1;
+
+    mesh->lod_count = 1;
+    while (mesh->lod_count < SCENEGEN_MAX_LODS && (rings >> mesh->lod_count) >= 4) {
+        mesh->lod_count++;
+    }
+
+    uint32_t max_meshlets = 0;
+    uint32_t max_triangles = 0;
+    for (uint32_t lod = 0; lod < mesh->lod_count; lod++) {
+        uint32_t lod_rings = rings >> lod;
+        uint32_t lod_segments = segments >> lod;
+        max_meshlets += ((lod_rings + SCENEGEN_PATCH - 1) / SCENEGEN_PATCH) * ((lod_segments + SCENEGEN_PATCH - 1) / SCENEGEN_PATCH);
+        max_triangles += lod_rings * lod_segments * 2;
+    }
+
+    mesh->vertex_count = (rings + 1) * row_stride;
+    mesh->vertices = malloc(sizeof(struct vertex) * mesh->vertex_count);
+    mesh->indices = malloc(sizeof(uint32_t) * max_triangles * 3);
+    mesh->meshlets = malloc(sizeof(struct meshlet) * max_meshlets);
+    mesh->meshlet_vertices = malloc(sizeof(uint32_t) * max_meshlets * (SCENEGEN_PATCH + 1) * (SCENEGEN_PATCH + 1));
+    mesh->meshlet_triangles = malloc(sizeof(uint32_t) * max_triangles);
+    if (mesh->vertices == NULL || mesh->indices == NULL || mesh->meshlets == NULL || mesh->meshlet_vertices == NULL || mesh->meshlet_triangles == NULL) {
+        return false;
+    }
+
+    for (uint32_t r = 0; r <= rings; r++) {
+        for (uint32_t s = 0; s <= segments; s++) {
+            float theta = SCENEGEN_PI * r / rings;
+            float phi = 2.f * SCENEGEN_PI * s / segments;
+            struct vertex* vertex = &mesh->vertices[r * row_stride + s];
+            sphere_point(shape, theta, phi, vertex->position);
+            sphere_normal(shape, theta, phi, vertex->normal);
+            vertex->uv[0] = (float)s / segments;
+            vertex->uv[1] = (float)r / rings;
+            vec3_dup(vertex->color, color);
+        }
+    }
+
+    for (uint32_t lod = 0; lod < mesh->lod_count; lod++) {
+        uint32_t lod_rings = rings >> lod;
+        uint32_t lod_segments = segments >> lod;
+        struct mesh_lod* mesh_lod = &mesh->lods[lod];
+        mesh_lod->index_offset = mesh->index_count;
+        mesh_lod->meshlet_offset = mesh->meshlet_count;
+
+        for (uint32_t r = 0; r < lod_rings; r += SCENEGEN_PATCH) {
+            for (uint32_t s = 0; s < lod_segments; s += SCENEGEN_PATCH) {
+                uint32_t ring_count = lod_rings - r < SCENEGEN_PATCH ? lod_rings - r : SCENEGEN_PATCH;
+                uint32_t segment_count = lod_segments - s < SCENEGEN_PATCH ? lod_segments - s : SCENEGEN_PATCH;
+                add_patch(mesh, row_stride, 1u << lod, r, ring_count, s, segment_count, lod_rings);
+            }
+        }
+
+        mesh_lod->index_count = mesh->index_count - mesh_lod->index_offset;
+        mesh_lod->meshlet_count = mesh->meshlet_count - mesh_lod->meshlet_offset;
+
+        // Chord sag of the coarser rings, plus the bumps once they are too
+        // fine for the rings to follow
+        float sag = (1.f + shape->bumps) * (1.f - cosf(SCENEGEN_PI / lod_rings));
+        bool aliased = lod_rings < shape->frequency * 4.f;
+        mesh_lod->error = lod == 0 ? 0.f : sag + (aliased ? shape->bumps : 0.f);
+    }
+
+    return true;
+}
+
+static void free_generated_mesh(struct generated_mesh* mesh) {
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->meshlets);
+    free(mesh->meshlet_vertices);
+    free(mesh->meshlet_triangles);
+}
+
+// Lays the mesh out the way a baked file is, header first and every section
+// aligned, and hands it to the scene
+static int32_t add_generated_mesh(const struct generated_mesh* mesh) {
+    struct mesh_header header = {
+        .magic = MESH_MAGIC,
+        .version = MESH_VERSION,
+        .vertex_stride = sizeof(struct vertex),
+        .vertex_count = mesh->vertex_count,
+        .index_count = mesh->index_count,
+        .lod_count = mesh->lod_count,
+        .meshlet_count = mesh->meshlet_count,
+        .meshlet_vertex_count = mesh->meshlet_vertex_count,
+        .meshlet_triangle_count = mesh->meshlet_triangle_count,
+    };
+
+    const void* sources[MESH_SECTION_COUNT] = {
+        mesh->vertices, mesh->indices, mesh->meshlets, mesh->meshlet_vertices, mesh->meshlet_triangles,
+    };
+    uint64_t sizes[MESH_SECTION_COUNT] = {
+        (uint64_t)mesh->vertex_count * sizeof(struct vertex),
+        (uint64_t)mesh->index_count * sizeof(uint32_t),
+        (uint64_t)mesh->meshlet_count * sizeof(struct meshlet),
+        (uint64_t)mesh->meshlet_vertex_count * sizeof(uint32_t),
+        (uint64_t)mesh->meshlet_triangle_count * sizeof(uint32_t),
+    };
+
+    uint64_t offset = mesh_align(sizeof(struct mesh_header));
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        header.sections[i] = (struct mesh_section){offset, sizes[i]};
+        offset = mesh_align(offset + sizes[i]);
+    }
+
+    vec3 min = {INFINITY, INFINITY, INFINITY};
+    vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = fminf(min[axis], mesh->vertices[i].position[axis]);
+            max[axis] = fmaxf(max[axis], mesh->vertices[i].position[axis]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        header.bounds.min[axis] = min[axis];
+        header.bounds.max[axis] = max[axis];
+        header.bounds.center[axis] = (min[axis] + max[axis]) * 0.5f;
+    }
+
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        vec3 offset_from_center;
+        vec3_sub(offset_from_center, (float*)mesh->vertices[i].position, header.bounds.center);
+        header.bounds.radius = fmaxf(header.bounds.radius, vec3_len(offset_from_center));
+    }
+
+    memcpy(header.lods, mesh->lods, sizeof(struct mesh_lod) * mesh->lod_count);
+
+    uint8_t* data = calloc(1, offset);
+    if (data == NULL) {
+        return -1;
+    }
+
+    memcpy(data, &header, sizeof(header));
+    for (int i = 0; i < MESH_SECTION_COUNT; i++) {
+        memcpy(data + header.sections[i].offset, sources[i], sizes[i]);
+    }
+
+    int32_t index = scene_add_generated_mesh(&header, data);
+    free(data);
+    return index;
+}
+
+static bool parse_pair(const char* pair, size_t length, struct scenegen_settings* settings) {
+    const char* equals = memchr(pair, '=', length);
+    if (equals == NULL) {
+        return false;
+    }
+
+    size_t key_length = equals - pair;
+    const char* keys[] = {"meshes", "instances", "materials", "lights", "rings", "layers"};
+    uint32_t* fields[] = {
+        &settings->meshes, &settings->instances, &settings->materials,
+        &settings->lights, &settings->rings, &settings->layers,
+    };
+
+    char value[32];
+    size_t value_length = length - key_length - 1;
+    if (value_length == 0 || value_length >= sizeof(value)) {
+        return false;
+    }
+    memcpy(value, equals + 1, value_length);
+    value[value_length] = '\0';
+
+    char* end;
+    if (key_length == strlen("overlap") && strncmp(pair, "overlap", key_length) == 0) {
+        settings->overlap = strtof(value, &end);
+        return *end == '\0' && settings->overlap >= 0.f && settings->overlap < 1.f;
+    }
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (key_length == strlen(keys[i]) && strncmp(pair, keys[i], key_length) == 0) {
+            *fields[i] = (uint32_t)strtoul(value, &end, 10);
+            return *end == '\0';
+        }
+    }
+
+    return false;
+}
+
+bool parse_scenegen_settings(const char* spec, struct scenegen_settings* settings) {
+    *settings = presets[0].settings;
+
+    bool first = true;
+    while (*spec != '\0') {
+        const char* comma = strchr(spec, ',');
+        size_t length = comma != NULL ? (size_t)(comma - spec) : strlen(spec);
+
+        bool matched = false;
+        for (size_t i = 0; first && i < sizeof(presets) / sizeof(presets[0]); i++) {
+            if (length == strlen(presets[i].name) && strncmp(spec, presets[i].name, length) == 0) {
+                *settings = presets[i].settings;
+                matched = true;
+            }
+        }
+
+        if (!matched && !parse_pair(spec, length, settings)) {
+            return false;
+        }
+
+        first = false;
+        spec += length + (comma != NULL ? 1 : 0);
+    }
+
+    return settings->meshes > 0 && settings->materials > 0 && settings->instances > 0;
+}
+
+// Checkers of two tints per material, cells shrink with the material index
+static bool generate_material(uint32_t material) {
+    static uint8_t pixels[SCENEGEN_TEXTURE_SIZE * SCENEGEN_TEXTURE_SIZE * 4];
+    uint32_t cell = 16 >> (material % 3);
+    float hue = hash_unit(material * 3 + 3);
+
+    for (uint32_t y = 0; y < SCENEGEN_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < SCENEGEN_TEXTURE_SIZE; x++) {
+            bool dark = ((x / cell) + (y / cell)) % 2 == 1;
+            uint8_t* pixel = &pixels[(y * SCENEGEN_TEXTURE_SIZE + x) * 4];
+            for (int channel = 0; channel < 3; channel++) {
+                float tint = 0.75f + 0.25f * cosf(2.f * SCENEGEN_PI * (hue + channel / 3.f));
+                pixel[channel] = (uint8_t)(255.f * tint * (dark ? 0.45f : 1.f));
+            }
+            pixel[3] = 255;
+        }
+    }
+
+    return scene_add_generated_texture(pixels, SCENEGEN_TEXTURE_SIZE, SCENEGEN_TEXTURE_SIZE) >= 0;
+}
+
+bool scenegen_build(const struct scenegen_settings* settings) {
+    if (scene.meshes_count + settings->meshes * settings->materials > MAX_SCENE_MESHES
+        || scene.textures_count + settings->materials > MAX_SCENE_TEXTURES
+        || scene.instances_count + settings->instances > MAX_SCENE_INSTANCES) {
+        puts("Generated scene does not fit the scene limits");
+        return false;
+    }
+
+    uint32_t first_texture = scene.textures_count;
+    for (uint32_t i = 0; i < settings->materials; i++) {
+        if (!generate_material(i)) {
+            puts("Failed to generate a scene material");
+            return false;
+        }
+    }
+
+    // Every LOD needs whole rings, so the finest has a multiple of 8
+    uint32_t rings = (settings->rings < 8 ? 8 : settings->rings + 7) & ~7u;
+    uint32_t first_mesh = scene.meshes_count;
+    uint64_t mesh_triangles[MAX_SCENE_MESHES];
+
+    for (uint32_t i = 0; i < settings->meshes; i++) {
+        struct sphere_shape shape = {
+            .bumps = 0.05f * (i % 4),
+            .frequency = (float)(3 + i % 5),
+        };
+
+        float hue = hash_unit(i * 3 + 1);
+        vec3 color = {
+            0.5f + 0.5f * cosf(2.f * SCENEGEN_PI * hue),
+            0.5f + 0.5f * cosf(2.f * SCENEGEN_PI * (hue + 1.f / 3.f)),
+            0.5f + 0.5f * cosf(2.f * SCENEGEN_PI * (hue + 2.f / 3.f)),
+        };
+
+        struct generated_mesh mesh = {0};
+        bool generated = generate_sphere(&shape, rings, color, &mesh);
+        for (uint32_t material = 0; generated && material < settings->materials; material++) {
+            int32_t index = add_generated_mesh(&mesh);
+            generated = index >= 0;
+            if (generated) {
+                scene_set_mesh_texture(index, first_texture + material);
+                mesh_triangles[index - first_mesh] = mesh.lods[0].index_count / 3;
+            }
+        }
+        free_generated_mesh(&mesh);
+
+        if (!generated) {
+            puts("Failed to generate a scene mesh");
+            return false;
+        }
+    }
+
+    uint32_t layers = settings->layers;
+    if (layers == 0) {
+        layers = 1;
+        while (layers * layers * layers < settings->instances) {
+            layers++;
+        }
+    }
+
+    uint32_t per_layer = (settings->instances + layers - 1) / layers;
+    uint32_t columns = 1;
+    while (columns * columns < per_layer) {
+        columns++;
+    }
+    uint32_t rows = (per_layer + columns - 1) / columns;
+
+    float spacing = 2.f * SCENEGEN_RADIUS * (1.f - settings->overlap);
+    vec3 half = {(columns - 1) * spacing * 0.5f, (rows - 1) * spacing * 0.5f, (layers - 1) * spacing * 0.5f};
+    uint64_t triangles = 0;
+
+    for (uint32_t i = 0; i < settings->instances; i++) {
+        uint32_t layer = i / per_layer;
+        uint32_t slot = i % per_layer;
+
+        mat4x4 rotation, transform;
+        mat4x4_identity(rotation);
+        mat4x4_rotate_Y(rotation, rotation, 2.f * SCENEGEN_PI * hash_unit(i * 3 + 2));
+        mat4x4_translate(transform,
+            (slot % columns) * spacing - half[0],
+            (slot / columns) * spacing - half[1],
+            layer * spacing - half[2]);
+        mat4x4_mul(transform, transform, rotation);
+
+        // Shapes cycle fastest so neighbours differ, materials after them
+        uint32_t shape = i % settings->meshes;
+        uint32_t material = (i / settings->meshes) % settings->materials;
+        uint32_t mesh = shape * settings->materials + material;
+        scene_add_instance(first_mesh + mesh, transform);
+        triangles += mesh_triangles[mesh];
+    }
+
+    vec3 center;
+    float radius;
+    scene_bounds(center, &radius);
+    lights_scatter(settings->lights, center, radius);
+
+    printf("Generated %u meshes, %u instances, %u materials, %u lights, %llu triangles\n",
+        settings->meshes, settings->instances, settings->materials, settings->lights, (unsigned long long)triangles);
+    return true;
+}
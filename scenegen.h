@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCENEGEN_MAX_LODS 4
+#define SCENEGEN_PATCH 7
+#define SCENEGEN_TEXTURE_SIZE 64
+
+// Fills the scene with procedural bumpy spheres, no files involved, so the
+// same settings always give the same scene. Each LOD halves the rings and
+// segments of the one before, meshlets are patches of SCENEGEN_PATCH by
+// SCENEGEN_PATCH quads
+struct scenegen_settings {
+    uint32_t meshes;
+    uint32_t instances;
+
+    // Generated textures. Textures bind per mesh, so every mesh is uploaded
+    // once per material and each pair is its own draw batch
+    uint32_t materials;
+    uint32_t lights;
+
+    // Rings of the finest LOD, it has twice as many segments and about
+    // 4 * rings * rings triangles
+    uint32_t rings;
+
+    // Instances sit on a grid of layers along z, 0 makes it a cube. Seen
+    // along z every covered pixel has one sphere per layer behind it
+    uint32_t layers;
+
+    // 0 leaves neighbours just touching, towards 1 they sink into each other
+    float overlap;
+};
+
+// A preset, tiny, small, medium or large, key=value pairs on top of tiny,
+// or a preset followed by pairs that override it, as in
+// "medium,lights=512,layers=8". Keys are the field names above. Presets go
+// from a few thousand triangles to about ten million at full detail
+bool parse_scenegen_settings(const char* spec, struct scenegen_settings* settings);
+
+bool scenegen_build(const struct scenegen_settings* settings);
@@ -1,9 +1,175 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "lighting.glsl"
 
 layout(location = 0) in vec3 frag_color;
+layout(location = 1) in vec2 frag_uv;
+layout(location = 2) flat in uint frag_virtual_texture;
+layout(location = 3) in vec3 frag_position;
+layout(location = 4) in vec3 frag_normal;
 layout(location = 0) out vec4 out_color;
 
+// Set 0 belongs to the meshlet buffers on the mesh shading path
+layout(set = 1, binding = 0) uniform sampler2D albedo;
+
+// Layouts match virtual_textures.c
+struct VirtualTexture {
+    uint width;
+    uint height;
+    uint levels;
+    uint table_offset;
+    uint level_offsets[16];
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer PageTable {
+    uint feedback_width;
+    uint feedback_capacity;
+    uint jitter;
+    uint page_size;
+    uint slot_size;
+    uint atlas_size;
+    uint border;
+    uint reserved;
+    VirtualTexture virtual_textures[16];
+    uint page_table[];
+};
+
+layout(std430, set = 2, binding = 1) writeonly buffer Feedback {
+    uint feedback[];
+};
+
+layout(set = 2, binding = 2) uniform sampler2D atlas;
+
+// Matches VT_FEEDBACK_TILE, one pixel of each tile reports per frame
+const uint FEEDBACK_TILE = 8;
+
+vec4 sample_virtual(uint index, vec2 uv) {
+    VirtualTexture info = virtual_textures[index];
+    uvec2 size = uvec2(info.width, info.height);
+
+    vec2 texel = uv * vec2(size);
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    uint level = uint(clamp(lod, 0.0, float(info.levels - 1)));
+
+    vec2 wrapped = fract(uv);
+    uvec2 level_size = max(size >> level, uvec2(1));
+    uvec2 pages = (level_size + page_size - 1) / page_size;
+    uvec2 page = min(uvec2(wrapped * vec2(level_size)) / page_size, pages - 1);
+
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    if (pixel % FEEDBACK_TILE == uvec2(jitter % FEEDBACK_TILE, jitter / FEEDBACK_TILE)) {
+        uint tile = (pixel.y / FEEDBACK_TILE) * feedback_width + pixel.x / FEEDBACK_TILE;
+        if (tile < feedback_capacity) {
+            feedback[tile] = index << 28 | level << 24 | page.y << 12 | page.x;
+        }
+    }
+
+    // The entry names the sharpest resident level, which may be coarser
+    uint entry = page_table[info.table_offset + info.level_offsets[level] + page.y * pages.x + page.x];
+    uvec2 slot = uvec2(entry & 0x3ff, (entry >> 10) & 0x3ff);
+    uint resident_level = entry >> 20;
+
+    vec2 resident_texel = wrapped * vec2(max(size >> resident_level, uvec2(1)));
+    vec2 local = resident_texel - floor(resident_texel / float(page_size)) * float(page_size);
+    vec2 atlas_texel = vec2(slot * slot_size + border) + local;
+    return textureLod(atlas, atlas_texel / float(atlas_size), 0.0);
+}
+
+layout(std430, set = 3, binding = 2) readonly buffer ClusterCounts {
+    uint cluster_counts[];
+};
+
+layout(std430, set = 3, binding = 3) readonly buffer ClusterLights {
+    uint cluster_lights[];
+};
+
+layout(set = 3, binding = 4) uniform sampler2DArrayShadow shadow_map;
+
+const vec3 AMBIENT = vec3(0.03);
+
+// The nearest cascade holding the fragment, sampled 3x3 on top of the
+// hardware 2x2 comparison. The position is pushed out along the normal by
+// about a texel of that cascade to keep acne off surfaces facing the sun
+float sun_shadow(float depth, vec3 normal) {
+    uint cascade = 0;
+    while (cascade < 3 && depth > shadow_splits[cascade]) {
+        cascade++;
+    }
+
+    vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0).xy);
+    mat4 matrix = shadow_matrices[cascade];
+    float world_texel = 2.0 / (length(vec3(matrix[0][0], matrix[1][0], matrix[2][0])) * float(textureSize(shadow_map, 0).x));
+    vec3 offset_position = frag_position + normal * world_texel * 1.5;
+    vec4 coordinates = matrix * vec4(offset_position, 1.0);
+    vec2 uv = coordinates.xy * 0.5 + 0.5;
+    if (coordinates.z >= 1.0) {
+        return 1.0;
+    }
+
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            lit += texture(shadow_map, vec4(uv + vec2(x, y) * texel, float(cascade), coordinates.z));
+        }
+    }
+    return lit / 9.0;
+}
+
+// Only the lights binned into this fragment's cluster are visited
+vec3 shade(vec3 albedo_color) {
+    bool sun = sun_direction.w != 0.0;
+    if (light_count == 0 && !sun) {
+        return albedo_color;
+    }
+
+    float depth = -(view * vec4(frag_position, 1.0)).z;
+    vec3 normal = normalize(frag_normal);
+    vec3 to_camera = normalize(camera_position.xyz - frag_position);
+    vec3 lit = AMBIENT;
+
+    if (sun) {
+        vec3 direction = -sun_direction.xyz;
+        float diffuse = max(dot(normal, direction), 0.0);
+        float specular = pow(max(dot(normal, normalize(direction + to_camera)), 0.0), 32.0);
+        if (diffuse > 0.0) {
+            lit += sun_color.rgb * (diffuse + 0.25 * specular) * sun_shadow(depth, normal);
+        }
+    }
+
+    if (light_count == 0) {
+        return albedo_color * lit;
+    }
+
+    uint slice = uint(clamp(log(depth) * slicing.x + slicing.y, 0.0, float(grid.z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / slicing.zw), grid.xy - 1);
+    uint cluster = cluster_index(uvec3(tile, slice));
+
+    uint count = cluster_counts[cluster];
+    for (uint i = 0; i < count; i++) {
+        Light light = lights[cluster_lights[cluster * MAX_CLUSTER_LIGHTS + i]];
+        vec3 to_light = light.position - frag_position;
+        float distance = length(to_light);
+        if (distance >= light.range) {
+            continue;
+        }
+
+        vec3 direction = to_light / distance;
+        float spot = smoothstep(light.cos_outer, light.cos_inner, dot(-direction, light.direction));
+        float falloff = 1.0 - distance / light.range;
+        float diffuse = max(dot(normal, direction), 0.0);
+        float specular = pow(max(dot(normal, normalize(direction + to_camera)), 0.0), 32.0);
+        lit += light.color * (diffuse + 0.25 * specular) * falloff * falloff * spot;
+    }
+
+    return albedo_color * lit;
+}
 
 void main() {
-    out_color = vec4(frag_color, 1.0);
+    vec3 base = frag_virtual_texture != 0
+        ? sample_virtual(frag_virtual_texture - 1, frag_uv).rgb
+        : texture(albedo, frag_uv).rgb;
+    out_color = vec4(shade(frag_color * base), 1.0);
 }
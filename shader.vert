@@ -1,11 +1,30 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 
-layout(location = 0) in vec2 in_position;
-layout(location = 1) in vec3 in_color;
+#include "lighting.glsl"
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec2 in_uv;
+layout(location = 3) in vec3 in_color;
 
 layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_uv;
+layout(location = 2) flat out uint frag_virtual_texture;
+layout(location = 3) out vec3 frag_position;
+layout(location = 4) out vec3 frag_normal;
+
+layout(push_constant) uniform Push {
+    mat4 model;
+    uint virtual_texture;
+};
 
 void main() {
-    gl_Position = vec4(in_position, 0.0, 1.0);
+    vec4 world = model * vec4(in_position, 1.0);
+    gl_Position = view_projection * world;
     frag_color = in_color;
+    frag_uv = in_uv;
+    frag_virtual_texture = virtual_texture;
+    frag_position = world.xyz;
+    frag_normal = mat3(model) * in_normal;
 }
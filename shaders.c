@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "shaders.h"
+#include "devices.h"
+#include "startup.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Vulkan's header in front of the cache data
+#define PIPELINE_CACHE_HEADER_SIZE 32
+
+struct compute_request {
+    const char* path;
+    VkPipelineLayout layout;
+    VkPipeline* pipeline;
+};
+
+VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+
+static struct compute_request compute_requests[MAX_STARTUP_TASKS];
+static uint32_t compute_requests_count = 0;
+
+char* read_file(const char* path, uint32_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Failed to open %s\n", path);
+        *size = 0;
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    char* ret = malloc(*size * sizeof(char));
+    *size = fread(ret, sizeof(char), *size, file);
+    fclose(file);
+
+    return ret;
+}
+
+VkShaderModule create_shader_module(char* binary, uint32_t size) {
+    VkShaderModuleCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .pCode = (uint32_t*)binary,
+        .codeSize = size
+    };
+
+    VkShaderModule shader_module = VK_NULL_HANDLE;
+    vkCreateShaderModule(logical_device, &create_info, NULL, &shader_module);
+    return shader_module;
+}
+
+VkShaderModule load_shader_module(const char* path) {
+    uint32_t size;
+    char* code = read_file(path, &size);
+    if (code == NULL) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModule shader_module = create_shader_module(code, size);
+    free(code);
+
+    return shader_module;
+}
+
+static VkResult compile_compute_pipeline(void* data) {
+    const struct compute_request* request = data;
+    VkShaderModule shader = load_shader_module(request->path);
+    if (shader == VK_NULL_HANDLE) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkComputePipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+        .stage.module = shader,
+        .stage.pName = "main",
+        .layout = request->layout,
+    };
+
+    VkResult result = vkCreateComputePipelines(logical_device, pipeline_cache, 1, &create_info, NULL, request->pipeline);
+    vkDestroyShaderModule(logical_device, shader, NULL);
+
+    return result;
+}
+
+VkResult create_compute_pipeline(const char* path, VkPipelineLayout layout, VkPipeline* pipeline) {
+    struct compute_request request = {path, layout, pipeline};
+
+    // Once startup has waited no deferred request is left to read its slot
+    if (!startup_deferring()) {
+        compute_requests_count = 0;
+        return compile_compute_pipeline(&request);
+    }
+
+    if (compute_requests_count == MAX_STARTUP_TASKS) {
+        printf("Compiling %s on the main thread, startup has no task left\n", path);
+        return compile_compute_pipeline(&request);
+    }
+
+    // Deferred requests have to outlive the call
+    struct compute_request* deferred = &compute_requests[compute_requests_count++];
+    *deferred = request;
+    return startup_defer(path, compile_compute_pipeline, deferred);
+}
+
+// A cache written by another driver or device is dropped rather than
+// handed to this one
+static bool cache_matches(const uint8_t* data, size_t size) {
+    if (size < PIPELINE_CACHE_HEADER_SIZE) {
+        return false;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    uint32_t header[4];
+    memcpy(header, data, sizeof(header));
+    return header[0] >= PIPELINE_CACHE_HEADER_SIZE
+        && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header[2] == properties.vendorID
+        && header[3] == properties.deviceID
+        && memcmp(data + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static bool make_directory(const char* path) {
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// The directories are only created when writing, false if one of them could
+// not be
+static bool pipeline_cache_path(char* path, size_t size, bool create) {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char directory[512];
+    if (cache_home != NULL && cache_home[0] == '/') {
+        snprintf(directory, sizeof(directory), "%s", cache_home);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(directory, sizeof(directory), "%s/.cache", home);
+    } else {
+        snprintf(path, size, "./shaders/%s", PIPELINE_CACHE_FILE);
+        return true;
+    }
+
+    if (create && !make_directory(directory)) {
+        return false;
+    }
+
+    size_t length = strlen(directory);
+    snprintf(directory + length, sizeof(directory) - length, "/%s", PIPELINE_CACHE_DIRECTORY);
+    if (create && !make_directory(directory)) {
+        return false;
+    }
+
+    return snprintf(path, size, "%s/%s", directory, PIPELINE_CACHE_FILE) < (int)size;
+}
+
+VkResult create_pipeline_cache() {
+    char path[512];
+    FILE* file = pipeline_cache_path(path, sizeof(path), false) ? fopen(path, "rb") : NULL;
+    uint8_t* data = NULL;
+    size_t size = 0;
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        rewind(file);
+
+        data = length > 0 ? malloc(length) : NULL;
+        size = data != NULL ? fread(data, 1, length, file) : 0;
+        fclose(file);
+    }
+
+    bool matches = cache_matches(data, size);
+    VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = matches ? size : 0,
+        .pInitialData = matches ? data : NULL,
+    };
+
+    VkResult result = vkCreatePipelineCache(logical_device, &create_info, NULL, &pipeline_cache);
+    free(data);
+    return result;
+}
+
+void destroy_pipeline_cache() {
+    if (pipeline_cache == VK_NULL_HANDLE) {
+        return;
+    }
+
+    size_t size = 0;
+    vkGetPipelineCacheData(logical_device, pipeline_cache, &size, NULL);
+    uint8_t* data = size > 0 ? malloc(size) : NULL;
+    char path[512];
+    if (data != NULL && vkGetPipelineCacheData(logical_device, pipeline_cache, &size, data) == VK_SUCCESS
+        && pipeline_cache_path(path, sizeof(path), true)) {
+        FILE* file = fopen(path, "wb");
+        if (file != NULL) {
+            fwrite(data, 1, size, file);
+            fclose(file);
+        }
+    }
+
+    free(data);
+    vkDestroyPipelineCache(logical_device, pipeline_cache, NULL);
+    pipeline_cache = VK_NULL_HANDLE;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+// Pipelines compile against one cache, read at startup and written back on
+// exit so later starts skip most of the compilation. It lives in
+// $XDG_CACHE_HOME/vl or ~/.cache/vl, next to the shaders without either
+#define PIPELINE_CACHE_DIRECTORY "vl"
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+
+extern VkPipelineCache pipeline_cache;
+
+VkResult create_pipeline_cache();
+void destroy_pipeline_cache();
+
+char* read_file(const char* path, uint32_t* size);
+VkShaderModule create_shader_module(char* binary, uint32_t size);
+VkShaderModule load_shader_module(const char* path);
+
+// Deferred to a job thread during startup, the pipeline is only set once
+// startup_finish has returned
+VkResult create_compute_pipeline(const char* path, VkPipelineLayout layout, VkPipeline* pipeline);
@@ -0,0 +1,338 @@
+#include "shading_rate.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "devices.h"
+#include "dynamic_resolution.h"
+#include "gpu_counters.h"
+#include "images.h"
+#include "shaders.h"
+#include "swap_chain.h"
+#include "textures.h"
+#include <stdio.h>
+#include <string.h>
+
+// Average luma step between neighbouring pixels under which an axis is
+// shaded at half rate, a quarter of it allows the largest fragments
+#define SHADING_RATE_THRESHOLD 0.012f
+
+struct shading_rate_push_constants {
+    int32_t render_size[2];
+    int32_t tile_size[2];
+    uint32_t width;
+    uint32_t height;
+    uint32_t mode;
+    uint32_t max_rate;
+    float threshold;
+};
+
+enum shading_rate_mode shading_rate_mode = SHADING_RATE_OFF;
+bool shading_rate_enabled = false;
+VkImageView shading_rate_view;
+
+static VkImage shading_rate_image;
+static VkDeviceMemory shading_rate_memory;
+static uint32_t attachment_width;
+static uint32_t attachment_height;
+static bool attachment_initialized = false;
+
+// The compute pass writes bytes into a buffer, R8_UINT storage images are
+// not something every device offers
+static VkBuffer rates_buffer;
+static VkDeviceMemory rates_memory;
+static VkDeviceSize rates_size;
+
+static VkDescriptorSetLayout set_layout;
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet descriptor_set;
+static VkPipelineLayout rate_layout;
+static VkPipeline rate_pipeline;
+
+bool parse_shading_rate_mode(const char* name, enum shading_rate_mode* mode) {
+    const char* names[3] = {"off", "content", "foveated"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *mode = (enum shading_rate_mode)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static VkResult create_rate_pipeline() {
+    VkDescriptorSetLayoutBinding bindings[2] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &set_layout_info, NULL, &set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct shading_rate_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &rate_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_compute_pipeline("./shaders/shading_rate.spv", rate_layout, &rate_pipeline);
+}
+
+// One texel per tile of the color target, rates are read from the scene
+// color by texel so the sampler is never filtering
+static VkResult create_attachment() {
+    VkExtent2D texel = device_capabilities.shading_rate_texel_size;
+    attachment_width = (swap_chain_extent.width + texel.width - 1) / texel.width;
+    attachment_height = (swap_chain_extent.height + texel.height - 1) / texel.height;
+    attachment_initialized = false;
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    VkResult result = create_image(attachment_width, attachment_height, 1, VK_FORMAT_R8_UINT, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &shading_rate_image, &shading_rate_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_image_view_2d(shading_rate_image, VK_FORMAT_R8_UINT, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, &shading_rate_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    rates_size = ((VkDeviceSize)attachment_width * attachment_height + 3) & ~(VkDeviceSize)3;
+    VkBufferUsageFlags buffer_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    result = create_buffer(rates_size, buffer_usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &rates_buffer, &rates_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &set_layout,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, &descriptor_set);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    struct sampler_key sampler_key = {
+        .filter = VK_FILTER_NEAREST,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+
+    VkDescriptorImageInfo scene_info = {
+        .sampler = get_sampler(&sampler_key),
+        .imageView = color_image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    VkDescriptorBufferInfo rates_info = {rates_buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet writes[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptor_set,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &scene_info,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = descriptor_set,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &rates_info,
+        },
+    };
+    vkUpdateDescriptorSets(logical_device, 2, writes, 0, NULL);
+
+    return VK_SUCCESS;
+}
+
+static void destroy_attachment() {
+    vkDestroyImageView(logical_device, shading_rate_view, NULL);
+    vkDestroyImage(logical_device, shading_rate_image, NULL);
+    vkFreeMemory(logical_device, shading_rate_memory, NULL);
+    vkDestroyBuffer(logical_device, rates_buffer, NULL);
+    vkFreeMemory(logical_device, rates_memory, NULL);
+    vkResetDescriptorPool(logical_device, descriptor_pool, 0);
+}
+
+VkResult create_shading_rate() {
+    shading_rate_enabled = false;
+    if (shading_rate_mode == SHADING_RATE_OFF) {
+        return VK_SUCCESS;
+    }
+
+    if (!device_capabilities.fragment_shading_rate || !device_capabilities.dynamic_rendering) {
+        puts("Fragment shading rate attachments are not supported, shading at full rate");
+        return VK_SUCCESS;
+    }
+
+    VkResult result = create_rate_pipeline();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_attachment();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    shading_rate_enabled = true;
+    return VK_SUCCESS;
+}
+
+void destroy_shading_rate() {
+    if (!shading_rate_enabled) {
+        return;
+    }
+
+    destroy_attachment();
+    vkDestroyPipeline(logical_device, rate_pipeline, NULL);
+    vkDestroyPipelineLayout(logical_device, rate_layout, NULL);
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, set_layout, NULL);
+    shading_rate_enabled = false;
+}
+
+// The attachment follows the color target size
+VkResult recreate_shading_rate() {
+    if (!shading_rate_enabled) {
+        return VK_SUCCESS;
+    }
+
+    destroy_attachment();
+    return create_attachment();
+}
+
+void shading_rate_prepare(VkCommandBuffer buffer) {
+    if (!shading_rate_enabled || attachment_initialized) {
+        return;
+    }
+
+    transition_image(buffer, shading_rate_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkClearColorValue full_rate = {.uint32 = {0, 0, 0, 0}};
+    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(buffer, shading_rate_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &full_rate, 1, &range);
+
+    transition_image(buffer, shading_rate_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR);
+    attachment_initialized = true;
+}
+
+void shading_rate_update(VkCommandBuffer buffer) {
+    if (!shading_rate_enabled) {
+        return;
+    }
+
+    uint32_t pass = gpu_pass_begin(buffer, "shading_rate");
+
+    // One buffer serves every frame in flight, the previous frame's copy
+    // into the attachment may still be reading it
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 0, NULL, 0, NULL, 0, NULL);
+    vkCmdFillBuffer(buffer, rates_buffer, 0, rates_size, 0);
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    VkExtent2D texel = device_capabilities.shading_rate_texel_size;
+    struct shading_rate_push_constants push = {
+        .render_size = {(int32_t)render_extent.width, (int32_t)render_extent.height},
+        .tile_size = {(int32_t)texel.width, (int32_t)texel.height},
+        .width = attachment_width,
+        .height = attachment_height,
+        .mode = shading_rate_mode,
+        .max_rate = device_capabilities.shading_rate_max_size >= 4 ? 4 : 2,
+        .threshold = SHADING_RATE_THRESHOLD,
+    };
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rate_pipeline);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rate_layout, 0, 1, &descriptor_set, 0, NULL);
+    vkCmdPushConstants(buffer, rate_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(buffer, attachment_width, attachment_height, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    // This frame's passes are done with the attachment
+    transition_image(buffer, shading_rate_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkBufferImageCopy region = {
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageExtent = {attachment_width, attachment_height, 1},
+    };
+    vkCmdCopyBufferToImage(buffer, rates_buffer, shading_rate_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    transition_image(buffer, shading_rate_image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_FRAGMENT_SHADING_RATE_ATTACHMENT_READ_BIT_KHR,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR);
+    gpu_pass_end(buffer, pass);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+enum shading_rate_mode {
+    SHADING_RATE_OFF,
+    SHADING_RATE_CONTENT,
+    SHADING_RATE_FOVEATED,
+};
+
+// A fragment shading rate attachment for the scene passes. Content mode
+// coarsens tiles whose last frame barely changed along an axis, foveated
+// mode coarsens with distance from the screen center. Only the dynamic
+// rendering path takes the attachment, elsewhere every pixel is shaded
+extern enum shading_rate_mode shading_rate_mode;
+extern bool shading_rate_enabled;
+extern VkImageView shading_rate_view;
+
+// Parses off, content or foveated
+bool parse_shading_rate_mode(const char* name, enum shading_rate_mode* mode);
+
+// Reads shading_rate_mode, before the scene pipelines are built as they
+// need to know about the attachment
+VkResult create_shading_rate();
+void destroy_shading_rate();
+VkResult recreate_shading_rate();
+
+// Before the frame's passes, the attachment starts out at full rate
+void shading_rate_prepare(VkCommandBuffer buffer);
+
+// After post processing, builds the next frame's rates from this frame's
+// scene color
+void shading_rate_update(VkCommandBuffer buffer);
@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in vec3 in_position;
+
+layout(push_constant) uniform Push {
+    mat4 model_light_projection;
+};
+
+void main() {
+    gl_Position = model_light_projection * vec4(in_position, 1.0);
+}
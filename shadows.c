@@ -0,0 +1,605 @@
+#include "shadows.h"
+#include "buffers.h"
+#include "camera.h"
+#include "devices.h"
+#include "mesh.h"
+#include "scene.h"
+#include "shaders.h"
+#include "startup.h"
+#include "swap_chain.h"
+#include "vertex_buffer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct cascade {
+    vec3 center;
+    float radius;
+    uint64_t casters_version;
+    bool valid;
+};
+
+bool shadows_enabled = false;
+vec3 sun_direction = {-0.4f, -1.f, -0.3f};
+vec3 sun_color = {1.f, 0.95f, 0.85f};
+
+VkImageView shadow_map_view;
+VkSampler shadow_sampler;
+
+mat4x4 shadow_matrices[SHADOW_CASCADES];
+float shadow_splits[SHADOW_CASCADES];
+
+static VkImage shadow_map;
+static VkDeviceMemory shadow_map_memory;
+static bool shadow_map_initialized = false;
+static VkImageView layer_views[SHADOW_CASCADES];
+static VkFramebuffer framebuffers[SHADOW_CASCADES];
+static VkRenderPass shadow_render_pass;
+static VkPipelineLayout shadow_layout;
+static VkPipeline shadow_pipeline;
+
+static struct cascade cascades[SHADOW_CASCADES];
+static bool cascades_rendered[SHADOW_CASCADES];
+static vec3 scene_center = {0.f, 0.f, 0.f};
+static float scene_radius = 1.f;
+static uint32_t resident_meshes = 0;
+static uint64_t casters_version = 0;
+static uint32_t* casters;
+
+static VkResult create_shadow_map(uint32_t size) {
+    VkImageCreateInfo image_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = depth_format,
+        .extent = {size, size, 1},
+        .mipLevels = 1,
+        .arrayLayers = SHADOW_CASCADES,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VkResult result = vkCreateImage(logical_device, &image_info, NULL, &shadow_map);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(logical_device, shadow_map, &requirements);
+
+    VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = find_memory_type(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+    };
+
+    result = vkAllocateMemory(logical_device, &allocate_info, NULL, &shadow_map_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = vkBindImageMemory(logical_device, shadow_map, shadow_map_memory, 0);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = shadow_map,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = depth_format,
+        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, SHADOW_CASCADES},
+    };
+
+    result = vkCreateImageView(logical_device, &view_info, NULL, &shadow_map_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // Hardware comparison, linear filtering gives 2x2 PCF for free
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+        .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+        .compareEnable = VK_TRUE,
+        .compareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+        .maxLod = 0.f,
+    };
+
+    return vkCreateSampler(logical_device, &sampler_info, NULL, &shadow_sampler);
+}
+
+static VkResult create_shadow_render_pass() {
+    VkAttachmentDescription depth_attachment = {
+        .format = depth_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+    };
+
+    VkAttachmentReference depth_reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .pDepthStencilAttachment = &depth_reference,
+    };
+
+    // The previous frame may still be sampling the layer being redrawn, and
+    // this frame samples it once drawn
+    VkSubpassDependency dependencies[2] = {
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = 0,
+            .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        },
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        },
+    };
+
+    VkRenderPassCreateInfo render_pass_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &depth_attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 2,
+        .pDependencies = dependencies,
+    };
+
+    VkResult result = vkCreateRenderPass(logical_device, &render_pass_info, NULL, &shadow_render_pass);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        VkImageViewCreateInfo view_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = shadow_map,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = depth_format,
+            .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1},
+        };
+
+        result = vkCreateImageView(logical_device, &view_info, NULL, &layer_views[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        VkFramebufferCreateInfo framebuffer_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = shadow_render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &layer_views[i],
+            .width = SHADOW_MAP_SIZE,
+            .height = SHADOW_MAP_SIZE,
+            .layers = 1,
+        };
+
+        result = vkCreateFramebuffer(logical_device, &framebuffer_info, NULL, &framebuffers[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    return VK_SUCCESS;
+}
+
+// Depth only, positions alone, no culling so open meshes still cast
+static VkResult compile_shadow_pipeline(void* data) {
+    (void)data;
+    VkShaderModule vertex_shader = load_shader_module("./shaders/shadow_vert.spv");
+    if (vertex_shader == VK_NULL_HANDLE) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkPipelineShaderStageCreateInfo stage = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = vertex_shader,
+        .pName = "main",
+    };
+
+    VkVertexInputBindingDescription binding = get_binding_description();
+    VkVertexInputAttributeDescription position = {
+        .location = 0,
+        .binding = 0,
+        .format = VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = 0,
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &binding,
+        .vertexAttributeDescriptionCount = 1,
+        .pVertexAttributeDescriptions = &position,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    };
+
+    VkViewport viewport = {0.f, 0.f, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0.f, 1.f};
+    VkRect2D scissor = {{0, 0}, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE}};
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .pViewports = &viewport,
+        .scissorCount = 1,
+        .pScissors = &scissor,
+    };
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_TRUE,
+        .depthBiasConstantFactor = 1.25f,
+        .depthBiasSlopeFactor = 1.75f,
+        .lineWidth = 1.f,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = VK_TRUE,
+        .depthWriteEnable = VK_TRUE,
+        .depthCompareOp = VK_COMPARE_OP_LESS,
+    };
+
+    VkPipelineColorBlendStateCreateInfo color_blend = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+    };
+
+    VkGraphicsPipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = 1,
+        .pStages = &stage,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pDepthStencilState = &depth_stencil,
+        .pColorBlendState = &color_blend,
+        .layout = shadow_layout,
+        .renderPass = shadow_render_pass,
+        .subpass = 0,
+    };
+
+    VkResult result = vkCreateGraphicsPipelines(logical_device, pipeline_cache, 1, &pipeline_info, NULL, &shadow_pipeline);
+    vkDestroyShaderModule(logical_device, vertex_shader, NULL);
+    return result;
+}
+
+static VkResult create_shadow_pipeline() {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(mat4x4),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(logical_device, &layout_info, NULL, &shadow_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return startup_defer("shadow_pipeline", compile_shadow_pipeline, NULL);
+}
+
+// Without shadows a single texel map is still bound so the light set stays
+// complete, the shader never samples it
+VkResult create_shadows(bool enabled) {
+    VkResult result = create_shadow_map(enabled ? SHADOW_MAP_SIZE : 1);
+    if (result != VK_SUCCESS || !enabled) {
+        return result;
+    }
+
+    result = create_shadow_render_pass();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = create_shadow_pipeline();
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    casters = malloc(sizeof(uint32_t) * MAX_SCENE_INSTANCES);
+    vec3_norm(sun_direction, sun_direction);
+    shadows_enabled = true;
+    return VK_SUCCESS;
+}
+
+void destroy_shadows() {
+    if (shadows_enabled) {
+        vkDestroyPipeline(logical_device, shadow_pipeline, NULL);
+        vkDestroyPipelineLayout(logical_device, shadow_layout, NULL);
+        for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+            vkDestroyFramebuffer(logical_device, framebuffers[i], NULL);
+            vkDestroyImageView(logical_device, layer_views[i], NULL);
+        }
+        vkDestroyRenderPass(logical_device, shadow_render_pass, NULL);
+        free(casters);
+    }
+
+    vkDestroySampler(logical_device, shadow_sampler, NULL);
+    vkDestroyImageView(logical_device, shadow_map_view, NULL);
+    vkDestroyImage(logical_device, shadow_map, NULL);
+    vkFreeMemory(logical_device, shadow_map_memory, NULL);
+    shadows_enabled = false;
+    shadow_map_initialized = false;
+}
+
+void shadows_set_bounds(const vec3 center, float radius) {
+    vec3_dup(scene_center, center);
+    scene_radius = radius;
+}
+
+// Bounding sphere of the view frustum between two view depths
+static void slice_sphere(float near_depth, float far_depth, vec3 center, float* radius) {
+    vec3 right = {camera.view[0][0], camera.view[1][0], camera.view[2][0]};
+    vec3 up = {camera.view[0][1], camera.view[1][1], camera.view[2][1]};
+    vec3 forward = {-camera.view[0][2], -camera.view[1][2], -camera.view[2][2]};
+    float tan_y = tanf(camera.fov_y * 0.5f);
+    float tan_x = tan_y * fabsf(camera.projection[1][1] / camera.projection[0][0]);
+
+    vec3 corners[8];
+    vec3 sum = {0.f, 0.f, 0.f};
+    for (int i = 0; i < 8; i++) {
+        float depth = i < 4 ? near_depth : far_depth;
+        float x = (i & 1 ? 1.f : -1.f) * tan_x * depth;
+        float y = (i & 2 ? 1.f : -1.f) * tan_y * depth;
+        for (int axis = 0; axis < 3; axis++) {
+            corners[i][axis] = camera.position[axis] + forward[axis] * depth + right[axis] * x + up[axis] * y;
+        }
+        vec3_add(sum, sum, corners[i]);
+    }
+
+    vec3_scale(center, sum, 1.f / 8.f);
+    *radius = 0.f;
+    for (int i = 0; i < 8; i++) {
+        vec3 offset;
+        vec3_sub(offset, corners[i], center);
+        *radius = fmaxf(*radius, vec3_len(offset));
+    }
+
+    // Rounded up so the size only changes in steps as the camera turns
+    *radius = ceilf(*radius * 16.f) / 16.f;
+}
+
+// Orthographic projection around the sphere, looking down the sun. Its
+// position is snapped to whole texels so static shadows do not shimmer, and
+// the near plane is pulled back to catch casters outside the sphere.
+static void cascade_matrix(const struct cascade* cascade, mat4x4 matrix) {
+    vec3 origin = {0.f, 0.f, 0.f};
+    vec3 up = {0.f, 1.f, 0.f};
+    if (fabsf(sun_direction[1]) > 0.99f) {
+        up[1] = 0.f;
+        up[2] = 1.f;
+    }
+
+    mat4x4 light_view;
+    mat4x4_look_at(light_view, origin, sun_direction, up);
+
+    vec4 center = {cascade->center[0], cascade->center[1], cascade->center[2], 1.f};
+    vec4 light_center;
+    mat4x4_mul_vec4(light_center, light_view, center);
+
+    float radius = cascade->radius;
+    float texel = 2.f * radius / SHADOW_MAP_SIZE;
+    float x = floorf(light_center[0] / texel) * texel;
+    float y = floorf(light_center[1] / texel) * texel;
+    float near_plane = -light_center[2] - radius - 2.f * scene_radius;
+    float far_plane = -light_center[2] + radius;
+
+    mat4x4 projection;
+    mat4x4_ortho(projection, x - radius, x + radius, y - radius, y + radius, near_plane, far_plane);
+    projection[2][2] = -1.f / (far_plane - near_plane);
+    projection[3][2] = -near_plane / (far_plane - near_plane);
+    mat4x4_mul(matrix, projection, light_view);
+}
+
+static bool sphere_inside(const vec3 center, float radius, const struct cascade* cascade) {
+    vec3 offset;
+    vec3_sub(offset, center, cascade->center);
+    return vec3_len(offset) + radius <= cascade->radius;
+}
+
+void shadows_prepare() {
+    if (!shadows_enabled) {
+        return;
+    }
+
+    // Streamed meshes becoming resident change the casters as well
+    uint32_t resident = 0;
+    for (uint32_t i = 0; i < scene.meshes_count; i++) {
+        resident += mesh_resident(&scene.meshes[i]);
+    }
+    if (resident != resident_meshes) {
+        resident_meshes = resident;
+        casters_version++;
+    }
+    uint64_t version = casters_version + scene.casters_version;
+
+    // Practical split scheme, a blend of logarithmic and uniform splits
+    float near_plane = camera.near_plane;
+    vec3 to_scene;
+    vec3_sub(to_scene, scene_center, camera.position);
+    float far_plane = fminf(camera.far_plane, vec3_len(to_scene) + scene_radius);
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        float fraction = (float)(i + 1) / SHADOW_CASCADES;
+        float logarithmic = near_plane * powf(far_plane / near_plane, fraction);
+        float uniform = near_plane + (far_plane - near_plane) * fraction;
+        shadow_splits[i] = SHADOW_SPLIT_LAMBDA * logarithmic + (1.f - SHADOW_SPLIT_LAMBDA) * uniform;
+    }
+
+    bool cached_refit = false;
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        struct cascade* cascade = &cascades[i];
+        vec3 center;
+        float radius;
+        slice_sphere(i == 0 ? near_plane : shadow_splits[i - 1], shadow_splits[i], center, &radius);
+
+        cascades_rendered[i] = false;
+        if (i < SHADOW_CACHED_CASCADE) {
+            vec3_dup(cascade->center, center);
+            cascade->radius = radius;
+            cascades_rendered[i] = true;
+        } else {
+            bool fits = cascade->valid && cascade->casters_version == version && sphere_inside(center, radius, cascade);
+            if (fits || (cached_refit && cascade->valid)) {
+                continue;
+            }
+
+            // Refit with room to move, at most one cached cascade a frame
+            // unless it has never been drawn
+            vec3_dup(cascade->center, center);
+            cascade->radius = radius * SHADOW_CACHE_MARGIN;
+            cascade->casters_version = version;
+            cascade->valid = true;
+            cascades_rendered[i] = true;
+            cached_refit = true;
+        }
+
+        cascade_matrix(cascade, shadow_matrices[i]);
+    }
+}
+
+static void render_cascade(VkCommandBuffer buffer, uint32_t index) {
+    VkClearValue clear = {.depthStencil = {1.f, 0}};
+    VkRenderPassBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = shadow_render_pass,
+        .framebuffer = framebuffers[index],
+        .renderArea = {{0, 0}, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE}},
+        .clearValueCount = 1,
+        .pClearValues = &clear,
+    };
+
+    vkCmdBeginRenderPass(buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline);
+
+    // Casters behind the cascade still throw shadows into it, so its near
+    // plane never rejects anything
+    vec4 planes[6];
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        mat4x4_row(rows[i], shadow_matrices[index], i);
+    }
+    vec4_add(planes[0], rows[3], rows[0]);
+    vec4_sub(planes[1], rows[3], rows[0]);
+    vec4_add(planes[2], rows[3], rows[1]);
+    vec4_sub(planes[3], rows[3], rows[1]);
+    vec4 always = {0.f, 0.f, 0.f, 1.f};
+    vec4_dup(planes[4], always);
+    vec4_sub(planes[5], rows[3], rows[2]);
+    for (int i = 0; i < 6; i++) {
+        float length = vec3_len(planes[i]);
+        if (length > 0.f) {
+            vec4_scale(planes[i], planes[i], 1.f / length);
+        }
+    }
+
+    uint32_t count = scene_cull((vec4 const*)planes, casters);
+    VkDeviceSize offset = 0;
+    uint32_t bound_mesh = UINT32_MAX;
+    for (uint32_t i = 0; i < count; i++) {
+        struct instance* instance = &scene.instances[casters[i]];
+        struct mesh* mesh = &scene.meshes[instance->mesh];
+        if (!mesh_resident(mesh) || mesh->lod_count == 0) {
+            continue;
+        }
+
+        if (instance->mesh != bound_mesh) {
+            vkCmdBindVertexBuffers(buffer, 0, 1, &mesh->buffers[MESH_SECTION_VERTICES], &offset);
+            vkCmdBindIndexBuffer(buffer, mesh->buffers[MESH_SECTION_INDICES], 0, VK_INDEX_TYPE_UINT32);
+            bound_mesh = instance->mesh;
+        }
+
+        // Wider cascades cover more of the scene per texel, coarser LODs do
+        uint32_t lod = index < mesh->lod_count ? index : mesh->lod_count - 1;
+        mat4x4 matrix;
+        mat4x4_mul(matrix, shadow_matrices[index], instance->transform);
+        vkCmdPushConstants(buffer, shadow_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mat4x4), matrix);
+        vkCmdDrawIndexed(buffer, mesh->lods[lod].index_count, 1, mesh->lods[lod].index_offset, 0, 0);
+    }
+
+    vkCmdEndRenderPass(buffer);
+}
+
+void shadows_render(VkCommandBuffer buffer) {
+    if (!shadow_map_initialized) {
+        // Every layer starts at the far plane, layers not drawn yet are
+        // sampled as fully lit
+        VkImageSubresourceRange layers = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, SHADOW_CASCADES};
+        VkImageMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = shadow_map,
+            .subresourceRange = layers,
+        };
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        VkClearDepthStencilValue far = {1.f, 0};
+        vkCmdClearDepthStencilImage(buffer, shadow_map, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &far, 1, &layers);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+            0, 0, NULL, 0, NULL, 1, &barrier);
+        shadow_map_initialized = true;
+    }
+
+    if (!shadows_enabled || scene.instances_count == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        if (cascades_rendered[i]) {
+            render_cascade(buffer, i);
+        }
+    }
+}
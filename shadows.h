@@ -0,0 +1,40 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#include "linmath.h"
+
+#define SHADOW_CASCADES 4
+#define SHADOW_MAP_SIZE 2048
+#define SHADOW_CACHED_CASCADE 2
+#define SHADOW_CACHE_MARGIN 1.3f
+#define SHADOW_SPLIT_LAMBDA 0.8f
+
+// A directional sun with cascaded shadow maps. Cascades are fitted to
+// slices of the view frustum, from SHADOW_CACHED_CASCADE on they are fitted
+// with a margin and only re-rendered once the view leaves it or the casters
+// change, one cascade per frame
+extern bool shadows_enabled;
+extern vec3 sun_direction;
+extern vec3 sun_color;
+
+// Sampled by the fragment shader through the light set
+extern VkImageView shadow_map_view;
+extern VkSampler shadow_sampler;
+
+extern mat4x4 shadow_matrices[SHADOW_CASCADES];
+extern float shadow_splits[SHADOW_CASCADES];
+
+VkResult create_shadows(bool enabled);
+void destroy_shadows();
+
+// Shadows reach as far as the scene does, cascades stay tight on small scenes
+void shadows_set_bounds(const vec3 center, float radius);
+
+// Fits the cascades to the camera, after the camera update
+void shadows_prepare();
+
+// Renders the cascades that need it, before the frame's passes
+void shadows_render(VkCommandBuffer buffer);
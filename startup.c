@@ -0,0 +1,130 @@
+#include "startup.h"
+#include "jobs.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct startup_record {
+    const char* name;
+    uint32_t thread;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+struct deferred_task {
+    const char* name;
+    startup_task task;
+    void* data;
+    VkResult result;
+};
+
+static uint64_t begin_ns = 0;
+static bool first_frame_seen = false;
+
+// Written from job threads, slots are claimed atomically
+static struct startup_record records[MAX_STARTUP_STAGES];
+static uint32_t records_count = 0;
+
+static struct deferred_task tasks[MAX_STARTUP_TASKS];
+static uint32_t tasks_count = 0;
+static struct job_counter tasks_counter;
+static bool deferring = false;
+
+static void add_record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    trace_event(name, start_ns, end_ns);
+
+    uint32_t slot = __atomic_fetch_add(&records_count, 1, __ATOMIC_RELAXED);
+    if (slot < MAX_STARTUP_STAGES) {
+        records[slot] = (struct startup_record){name, job_thread_index(), start_ns, end_ns};
+    }
+}
+
+void startup_begin() {
+    begin_ns = trace_now_ns();
+    deferring = true;
+}
+
+struct startup_stage startup_stage_begin(const char* name) {
+    return (struct startup_stage){name, trace_now_ns()};
+}
+
+void startup_stage_end(struct startup_stage* stage) {
+    if (stage->start_ns != 0) {
+        add_record(stage->name, stage->start_ns, trace_now_ns());
+        stage->start_ns = 0;
+    }
+}
+
+void startup_stage_next(struct startup_stage* stage, const char* name) {
+    uint64_t now = trace_now_ns();
+    if (stage->start_ns != 0) {
+        add_record(stage->name, stage->start_ns, now);
+    }
+    *stage = (struct startup_stage){name, now};
+}
+
+static void run_task(void* data, uint32_t index) {
+    (void)index;
+    struct deferred_task* task = data;
+    uint64_t start = trace_now_ns();
+    task->result = task->task(task->data);
+    add_record(task->name, start, trace_now_ns());
+}
+
+VkResult startup_defer(const char* name, startup_task task, void* data) {
+    if (!deferring || tasks_count == MAX_STARTUP_TASKS) {
+        struct deferred_task inline_task = {name, task, data, VK_SUCCESS};
+        run_task(&inline_task, 0);
+        return inline_task.result;
+    }
+
+    struct deferred_task* deferred = &tasks[tasks_count++];
+    *deferred = (struct deferred_task){name, task, data, VK_SUCCESS};
+    job_run_range(run_task, deferred, 1, name, &tasks_counter);
+    return VK_SUCCESS;
+}
+
+VkResult startup_finish() {
+    if (!deferring) {
+        return VK_SUCCESS;
+    }
+
+    STARTUP_STAGE(stage, "startup_finish");
+    job_wait(&tasks_counter);
+    deferring = false;
+
+    VkResult result = VK_SUCCESS;
+    for (uint32_t i = 0; i < tasks_count; i++) {
+        if (tasks[i].result != VK_SUCCESS) {
+            printf("Failed to create %s\n", tasks[i].name);
+            result = result == VK_SUCCESS ? tasks[i].result : result;
+        }
+    }
+
+    tasks_count = 0;
+    return result;
+}
+
+bool startup_deferring() {
+    return deferring;
+}
+
+void startup_first_frame() {
+    if (first_frame_seen) {
+        return;
+    }
+
+    first_frame_seen = true;
+    uint64_t now = trace_now_ns();
+    if (getenv("VL_STARTUP_TIMING") != NULL) {
+        uint32_t count = records_count < MAX_STARTUP_STAGES ? records_count : MAX_STARTUP_STAGES;
+        for (uint32_t i = 0; i < count; i++) {
+            const struct startup_record* record = &records[i];
+            printf("Startup %-28s thread %2u at %8.3f ms took %8.3f ms\n", record->name, record->thread,
+                (record->start_ns - begin_ns) / 1e6, (record->end_ns - record->start_ns) / 1e6);
+        }
+        printf("Time to first frame %.3f ms\n", (now - begin_ns) / 1e6);
+    }
+
+    add_record("first_frame", begin_ns, now);
+}
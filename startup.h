@@ -0,0 +1,48 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_STARTUP_STAGES 128
+#define MAX_STARTUP_TASKS 64
+
+// Startup runs its stages in order on the main thread and hands work that
+// only depends on the device, shader reads and pipeline compilation, to
+// the job system until startup_finish. Every stage and task is timed, with
+// VL_STARTUP_TIMING set they are printed with the time to first frame
+
+struct startup_stage {
+    const char* name;
+    // 0 once ended
+    uint64_t start_ns;
+};
+
+typedef VkResult (*startup_task)(void* data);
+
+// First thing in main, time to first frame counts from here
+void startup_begin();
+
+// Names must outlive the process
+struct startup_stage startup_stage_begin(const char* name);
+void startup_stage_end(struct startup_stage* stage);
+
+// Ends the stage and starts the next one where it ended
+void startup_stage_next(struct startup_stage* stage, const char* name);
+
+// A stage ending with the enclosing scope
+#define STARTUP_STAGE(stage, name) struct startup_stage stage __attribute__((cleanup(startup_stage_end))) = startup_stage_begin(name)
+
+// Runs the task on a job thread until startup_finish and inline after it.
+// Tasks may create objects and read what already exists, never record or
+// submit. A failing task is reported by startup_finish
+VkResult startup_defer(const char* name, startup_task task, void* data);
+
+// Waits for the deferred tasks, returns the first failure
+VkResult startup_finish();
+
+// True from startup_begin until startup_finish has waited for the tasks
+bool startup_deferring();
+
+// Called after every frame, only the first one counts
+void startup_first_frame();
@@ -0,0 +1,554 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "streaming.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <float.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+VkQueue transfer_queue;
+
+struct stream_entry {
+    bool used;
+    enum stream_state state;
+
+    // A released entry keeps its slot until the I/O thread is done reading
+    // it and none of its chunks are on the GPU
+    bool releasing;
+    bool reading;
+    uint32_t chunks_in_flight;
+
+    char path[256];
+    int fd;
+    uint64_t file_offset;
+    uint64_t size;
+
+    VkBuffer destination;
+    VkDeviceSize destination_offset;
+
+    vec3 center;
+    float radius;
+    float bias;
+    float priority;
+
+    uint64_t bytes_read;
+    uint64_t bytes_uploaded;
+
+    void (*on_resident)(stream_handle handle, void* user);
+    void* user;
+};
+
+struct stream_chunk {
+    stream_handle handle;
+    uint64_t offset;
+    uint32_t size;
+};
+
+struct stream_submission {
+    bool in_flight;
+    struct stream_chunk chunks[STREAM_CHUNK_POOL];
+    uint32_t chunks_count;
+};
+
+static struct stream_entry entries[MAX_STREAM_REQUESTS];
+
+// Chunk buffers cycle between the free list, the I/O thread and the ready list
+static uint8_t* chunk_memory;
+static uint32_t free_chunks[STREAM_CHUNK_POOL];
+static uint32_t free_chunks_count;
+static uint32_t ready_chunks[STREAM_CHUNK_POOL];
+static struct stream_chunk ready_info[STREAM_CHUNK_POOL];
+static uint32_t ready_chunks_count;
+
+static pthread_t io_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_wake = PTHREAD_COND_INITIALIZER;
+static bool quit = false;
+
+static vec3 last_camera_position;
+
+static VkBuffer staging_buffer;
+static VkDeviceMemory staging_memory;
+static uint8_t* staging_data;
+
+static VkCommandPool transfer_command_pool;
+static VkCommandBuffer transfer_command_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkFence transfer_fences[MAX_FRAMES_IN_FLIGHT];
+static struct stream_submission submissions[MAX_FRAMES_IN_FLIGHT];
+
+static float compute_priority(struct stream_entry* entry, const vec3 camera_position) {
+    vec3 delta;
+    vec3_sub(delta, entry->center, camera_position);
+
+    float distance = vec3_len(delta) - entry->radius;
+    if (distance < 0.f) {
+        distance = 0.f;
+    }
+
+    return distance + entry->bias;
+}
+
+// Caller holds the lock
+static stream_handle pick_next_read() {
+    stream_handle best = -1;
+    float best_priority = FLT_MAX;
+    for (stream_handle i = 0; i < MAX_STREAM_REQUESTS; i++) {
+        struct stream_entry* entry = &entries[i];
+        if (!entry->used || entry->releasing || entry->state != STREAM_PENDING || entry->bytes_read == entry->size) {
+            continue;
+        }
+
+        if (entry->priority < best_priority) {
+            best = i;
+            best_priority = entry->priority;
+        }
+    }
+
+    return best;
+}
+
+// Caller holds the lock
+static void finish_release(struct stream_entry* entry) {
+    if (!entry->releasing || entry->reading || entry->chunks_in_flight > 0) {
+        return;
+    }
+
+    if (entry->fd >= 0) {
+        close(entry->fd);
+        entry->fd = -1;
+    }
+
+    entry->releasing = false;
+    entry->used = false;
+}
+
+static bool read_fully(int fd, uint8_t* data, uint32_t size, uint64_t offset) {
+    uint32_t done = 0;
+    while (done < size) {
+        ssize_t count = pread(fd, data + done, size - done, offset + done);
+        if (count <= 0) {
+            return false;
+        }
+
+        done += count;
+    }
+
+    return true;
+}
+
+static void* io_thread_main(void* argument) {
+    (void)argument;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        stream_handle handle = -1;
+        while (!quit && (free_chunks_count == 0 || (handle = pick_next_read()) < 0)) {
+            pthread_cond_wait(&io_wake, &lock);
+        }
+
+        if (quit) {
+            break;
+        }
+
+        struct stream_entry* entry = &entries[handle];
+        uint32_t chunk = free_chunks[--free_chunks_count];
+        uint64_t offset = entry->bytes_read;
+        uint64_t remaining = entry->size - offset;
+        uint32_t size = remaining < STREAM_CHUNK_SIZE ? remaining : STREAM_CHUNK_SIZE;
+        entry->bytes_read += size;
+        bool last = entry->bytes_read == entry->size;
+
+        if (entry->fd < 0) {
+            entry->fd = open(entry->path, O_RDONLY);
+        }
+        int fd = entry->fd;
+        uint64_t file_offset = entry->file_offset;
+        entry->reading = true;
+
+        // The read itself runs unlocked, only this thread touches the descriptor
+        pthread_mutex_unlock(&lock);
+        bool ok = fd >= 0 && read_fully(fd, chunk_memory + (size_t)chunk * STREAM_CHUNK_SIZE, size, file_offset + offset);
+        pthread_mutex_lock(&lock);
+        entry->reading = false;
+
+        if (entry->releasing) {
+            free_chunks[free_chunks_count++] = chunk;
+            finish_release(entry);
+            continue;
+        }
+
+        if (!ok) {
+            printf("Failed to stream %s\n", entry->path);
+            entry->state = STREAM_FAILED;
+            free_chunks[free_chunks_count++] = chunk;
+        } else {
+            struct stream_chunk info = {
+                .handle = handle,
+                .offset = offset,
+                .size = size,
+            };
+
+            ready_chunks[ready_chunks_count] = chunk;
+            ready_info[ready_chunks_count] = info;
+            ready_chunks_count++;
+        }
+
+        if ((last || !ok) && entry->fd >= 0) {
+            close(entry->fd);
+            entry->fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+VkResult create_streaming() {
+    struct queue_family_indices* queues = &device_capabilities.queues;
+    uint32_t family = queues->transfer_family.assigned ? queues->transfer_family.value : queues->graphics_family.value;
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = family,
+    };
+
+    VkResult result = vkCreateCommandPool(logical_device, &pool_info, NULL, &transfer_command_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkCommandBufferAllocateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = transfer_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
+    };
+
+    result = vkAllocateCommandBuffers(logical_device, &buffer_info, transfer_command_buffers);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        result = vkCreateFence(logical_device, &fence_info, NULL, &transfer_fences[i]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    result = create_buffer(STREAM_FRAME_BUDGET * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, &staging_buffer, &staging_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = vkMapMemory(logical_device, staging_memory, 0, VK_WHOLE_SIZE, 0, (void**)&staging_data);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    chunk_memory = malloc((size_t)STREAM_CHUNK_POOL * STREAM_CHUNK_SIZE);
+    for (uint32_t i = 0; i < STREAM_CHUNK_POOL; i++) {
+        free_chunks[i] = i;
+    }
+    free_chunks_count = STREAM_CHUNK_POOL;
+    ready_chunks_count = 0;
+
+    for (int i = 0; i < MAX_STREAM_REQUESTS; i++) {
+        entries[i].used = false;
+        entries[i].fd = -1;
+    }
+
+    quit = false;
+    if (pthread_create(&io_thread, NULL, io_thread_main, NULL) != 0) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    return VK_SUCCESS;
+}
+
+void destroy_streaming() {
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&io_wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(io_thread, NULL);
+
+    for (int i = 0; i < MAX_STREAM_REQUESTS; i++) {
+        if (entries[i].fd >= 0) {
+            close(entries[i].fd);
+        }
+    }
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyFence(logical_device, transfer_fences[i], NULL);
+    }
+
+    vkDestroyCommandPool(logical_device, transfer_command_pool, NULL);
+
+    vkUnmapMemory(logical_device, staging_memory);
+    vkDestroyBuffer(logical_device, staging_buffer, NULL);
+    vkFreeMemory(logical_device, staging_memory, NULL);
+
+    free(chunk_memory);
+}
+
+stream_handle stream_request(const struct stream_request* request) {
+    if (strlen(request->path) >= sizeof(entries[0].path)) {
+        printf("Stream path too long: %s\n", request->path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    stream_handle handle = -1;
+    for (stream_handle i = 0; i < MAX_STREAM_REQUESTS; i++) {
+        if (!entries[i].used) {
+            handle = i;
+            break;
+        }
+    }
+
+    if (handle < 0) {
+        pthread_mutex_unlock(&lock);
+        puts("Too many stream requests");
+        return -1;
+    }
+
+    struct stream_entry* entry = &entries[handle];
+    memset(entry, 0, sizeof(struct stream_entry));
+    entry->used = true;
+    entry->state = request->size == 0 ? STREAM_RESIDENT : STREAM_PENDING;
+    strcpy(entry->path, request->path);
+    entry->fd = -1;
+    entry->file_offset = request->file_offset;
+    entry->size = request->size;
+    entry->destination = request->destination;
+    entry->destination_offset = request->destination_offset;
+    vec3_dup(entry->center, request->center);
+    entry->radius = request->radius;
+    entry->bias = request->bias;
+    entry->priority = compute_priority(entry, last_camera_position);
+    entry->on_resident = request->on_resident;
+    entry->user = request->user;
+
+    pthread_cond_signal(&io_wake);
+    pthread_mutex_unlock(&lock);
+
+    return handle;
+}
+
+enum stream_state stream_state(stream_handle handle) {
+    pthread_mutex_lock(&lock);
+    enum stream_state state = entries[handle].state;
+    pthread_mutex_unlock(&lock);
+
+    return state;
+}
+
+float stream_progress(stream_handle handle) {
+    pthread_mutex_lock(&lock);
+    struct stream_entry* entry = &entries[handle];
+    float progress = entry->size > 0 ? (float)entry->bytes_uploaded / entry->size : 1.f;
+    pthread_mutex_unlock(&lock);
+
+    return progress;
+}
+
+void stream_set_bounds(stream_handle handle, const vec3 center, float radius) {
+    pthread_mutex_lock(&lock);
+    vec3_dup(entries[handle].center, center);
+    entries[handle].radius = radius;
+    pthread_mutex_unlock(&lock);
+}
+
+// Chunks still waiting for upload are dropped, the slot is reused once the
+// current read and the chunks already submitted are done
+void stream_release(stream_handle handle) {
+    pthread_mutex_lock(&lock);
+    struct stream_entry* entry = &entries[handle];
+    entry->releasing = true;
+
+    for (uint32_t i = 0; i < ready_chunks_count;) {
+        if (ready_info[i].handle != handle) {
+            i++;
+            continue;
+        }
+
+        free_chunks[free_chunks_count++] = ready_chunks[i];
+        ready_chunks_count--;
+        ready_chunks[i] = ready_chunks[ready_chunks_count];
+        ready_info[i] = ready_info[ready_chunks_count];
+    }
+
+    finish_release(entry);
+    pthread_cond_signal(&io_wake);
+    pthread_mutex_unlock(&lock);
+}
+
+// Returns false while the previous upload from this frame slot is still on the GPU
+static bool retire_submission(uint32_t frame) {
+    struct stream_submission* submission = &submissions[frame];
+    if (!submission->in_flight) {
+        return true;
+    }
+
+    if (vkGetFenceStatus(logical_device, transfer_fences[frame]) != VK_SUCCESS) {
+        return false;
+    }
+
+    stream_handle completed[STREAM_CHUNK_POOL];
+    uint32_t completed_count = 0;
+
+    pthread_mutex_lock(&lock);
+    for (uint32_t i = 0; i < submission->chunks_count; i++) {
+        struct stream_chunk* chunk = &submission->chunks[i];
+        struct stream_entry* entry = &entries[chunk->handle];
+
+        entry->chunks_in_flight--;
+        if (entry->releasing) {
+            finish_release(entry);
+            continue;
+        }
+
+        entry->bytes_uploaded += chunk->size;
+        if (entry->bytes_uploaded == entry->size && entry->state == STREAM_PENDING) {
+            entry->state = STREAM_RESIDENT;
+            completed[completed_count++] = chunk->handle;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    submission->in_flight = false;
+    submission->chunks_count = 0;
+
+    // Callbacks may issue new requests, so they run unlocked
+    for (uint32_t i = 0; i < completed_count; i++) {
+        struct stream_entry* entry = &entries[completed[i]];
+        if (entry->on_resident != NULL) {
+            entry->on_resident(completed[i], entry->user);
+        }
+    }
+
+    return true;
+}
+
+void streaming_update(uint32_t frame, const vec3 camera_position) {
+    if (!retire_submission(frame)) {
+        return;
+    }
+
+    struct stream_submission* submission = &submissions[frame];
+    uint8_t* staging = staging_data + (size_t)frame * STREAM_FRAME_BUDGET;
+    uint32_t taken[STREAM_CHUNK_POOL];
+    uint32_t budget = STREAM_FRAME_BUDGET;
+
+    pthread_mutex_lock(&lock);
+    vec3_dup(last_camera_position, camera_position);
+    for (int i = 0; i < MAX_STREAM_REQUESTS; i++) {
+        if (entries[i].used && entries[i].state == STREAM_PENDING) {
+            entries[i].priority = compute_priority(&entries[i], camera_position);
+        }
+    }
+
+    // Highest priority ready chunks first until the frame budget runs out
+    while (ready_chunks_count > 0) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < ready_chunks_count; i++) {
+            if (entries[ready_info[i].handle].priority < entries[ready_info[best].handle].priority) {
+                best = i;
+            }
+        }
+
+        if (ready_info[best].size > budget) {
+            break;
+        }
+
+        budget -= ready_info[best].size;
+        entries[ready_info[best].handle].chunks_in_flight++;
+        taken[submission->chunks_count] = ready_chunks[best];
+        submission->chunks[submission->chunks_count++] = ready_info[best];
+
+        ready_chunks_count--;
+        ready_chunks[best] = ready_chunks[ready_chunks_count];
+        ready_info[best] = ready_info[ready_chunks_count];
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (submission->chunks_count == 0) {
+        return;
+    }
+
+    VkCommandBuffer buffer = transfer_command_buffers[frame];
+    vkResetCommandBuffer(buffer, 0);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(buffer, &begin_info);
+
+    VkDeviceSize staging_offset = 0;
+    for (uint32_t i = 0; i < submission->chunks_count; i++) {
+        struct stream_chunk* chunk = &submission->chunks[i];
+        struct stream_entry* entry = &entries[chunk->handle];
+
+        memcpy(staging + staging_offset, chunk_memory + (size_t)taken[i] * STREAM_CHUNK_SIZE, chunk->size);
+
+        VkBufferCopy region = {
+            .srcOffset = (VkDeviceSize)frame * STREAM_FRAME_BUDGET + staging_offset,
+            .dstOffset = entry->destination_offset + chunk->offset,
+            .size = chunk->size,
+        };
+        vkCmdCopyBuffer(buffer, staging_buffer, entry->destination, 1, &region);
+
+        staging_offset += chunk->size;
+    }
+
+    vkEndCommandBuffer(buffer);
+
+    pthread_mutex_lock(&lock);
+    for (uint32_t i = 0; i < submission->chunks_count; i++) {
+        free_chunks[free_chunks_count++] = taken[i];
+    }
+    pthread_cond_signal(&io_wake);
+    pthread_mutex_unlock(&lock);
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &buffer,
+    };
+
+    vkResetFences(logical_device, 1, &transfer_fences[frame]);
+    struct trace_zone zone = trace_zone_begin("submit_transfer");
+    VkResult result = vkQueueSubmit(transfer_queue, 1, &submit_info, transfer_fences[frame]);
+    trace_zone_end(&zone);
+    if (result == VK_SUCCESS) {
+        submission->in_flight = true;
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (uint32_t i = 0; i < submission->chunks_count; i++) {
+        struct stream_entry* entry = &entries[submission->chunks[i].handle];
+        entry->chunks_in_flight--;
+        entry->state = STREAM_FAILED;
+        finish_release(entry);
+    }
+    pthread_mutex_unlock(&lock);
+    submission->chunks_count = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#include "linmath.h"
+
+#define STREAM_CHUNK_SIZE (256 * 1024)
+#define STREAM_CHUNK_POOL 64
+#define STREAM_FRAME_BUDGET (4 * 1024 * 1024)
+#define MAX_STREAM_REQUESTS 1024
+
+extern VkQueue transfer_queue;
+
+typedef int32_t stream_handle;
+
+enum stream_state {
+    STREAM_PENDING,
+    STREAM_RESIDENT,
+    STREAM_FAILED,
+};
+
+// Destination buffers are written on the transfer queue, create them with
+// create_shared_buffer() and VK_BUFFER_USAGE_TRANSFER_DST_BIT
+struct stream_request {
+    const char* path;
+    uint64_t file_offset;
+    uint64_t size;
+
+    VkBuffer destination;
+    VkDeviceSize destination_offset;
+
+    // Closer requests upload first, bias is added on top of the distance
+    vec3 center;
+    float radius;
+    float bias;
+
+    void (*on_resident)(stream_handle handle, void* user);
+    void* user;
+};
+
+VkResult create_streaming();
+void destroy_streaming();
+
+stream_handle stream_request(const struct stream_request* request);
+enum stream_state stream_state(stream_handle handle);
+float stream_progress(stream_handle handle);
+void stream_set_bounds(stream_handle handle, const vec3 center, float radius);
+void stream_release(stream_handle handle);
+
+void streaming_update(uint32_t frame, const vec3 camera_position);
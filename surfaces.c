@@ -5,5 +5,18 @@
 VkSurfaceKHR surface;
 
 VkResult create_surface() {
-    return glfwCreateWindowSurface(instance, window, NULL, &surface);
+    if (!window_headless) {
+        return glfwCreateWindowSurface(instance, window, NULL, &surface);
+    }
+
+    PFN_vkCreateHeadlessSurfaceEXT create_headless_surface = (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+    if (create_headless_surface == NULL) {
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+
+    VkHeadlessSurfaceCreateInfoEXT create_info = {
+        .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+    };
+
+    return create_headless_surface(instance, &create_info, NULL, &surface);
 }
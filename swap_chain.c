@@ -1,6 +1,12 @@
 #include "swap_chain.h"
+#include "capabilities.h"
 #include "devices.h"
+#include "dynamic_resolution.h"
 #include "graphics_pipeline.h"
+#include "images.h"
+#include "occlusion.h"
+#include "post.h"
+#include "shading_rate.h"
 #include "surfaces.h"
 #include "window.h"
 #include <limits.h>
@@ -14,8 +20,19 @@ VkImageView* swap_chain_image_views;
 
 VkFormat swap_chain_format;
 VkExtent2D swap_chain_extent;
+VkImageUsageFlags swap_chain_usage;
 
-VkFramebuffer* swap_chain_frame_buffers;
+VkFramebuffer swap_chain_frame_buffer = VK_NULL_HANDLE;
+
+VkFormat color_format = VK_FORMAT_R16G16B16A16_SFLOAT;
+VkImage color_image;
+VkDeviceMemory color_image_memory;
+VkImageView color_image_view;
+
+VkFormat depth_format;
+VkImage depth_image;
+VkDeviceMemory depth_image_memory;
+VkImageView depth_image_view;
 
 static uint32_t clamp(uint32_t number, uint32_t min, uint32_t max) {
     if (number < min) {
@@ -35,7 +52,7 @@ static VkExtent2D choose_swap_chain_extent(VkSurfaceCapabilitiesKHR* capabilitie
     }
 
     int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
+    window_framebuffer_size(&width, &height);
 
     VkExtent2D extent = {
         .width = width,
@@ -78,30 +95,73 @@ static VkSurfaceFormatKHR choose_swap_chain_surface_format(VkSurfaceFormatKHR* f
 }
 
 VkResult create_frame_buffer() {
-    swap_chain_frame_buffers = malloc(sizeof(swap_chain_frame_buffers) * swap_chain_images_count);
+    // Dynamic rendering targets the image views directly
+    if (device_capabilities.dynamic_rendering) {
+        swap_chain_frame_buffer = VK_NULL_HANDLE;
+        return VK_SUCCESS;
+    }
 
-    for (uint32_t i = 0; i < swap_chain_images_count; i++) {
-        VkImageView* image_view = &swap_chain_image_views[i];
-
-        VkFramebufferCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = render_pass,
-            .attachmentCount = 1,
-            .pAttachments = image_view,
-            .width = swap_chain_extent.width,
-            .height = swap_chain_extent.height,
-            .layers = 1,
-        };
+    VkImageView attachments[2] = {
+        color_image_view,
+        depth_image_view,
+    };
 
-        VkResult result = vkCreateFramebuffer(logical_device, &create_info, NULL, &swap_chain_frame_buffers[i]);
-        if (result != VK_SUCCESS) {
-            return result;
-        }
+    VkFramebufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = render_pass,
+        .attachmentCount = 2,
+        .pAttachments = attachments,
+        .width = swap_chain_extent.width,
+        .height = swap_chain_extent.height,
+        .layers = 1,
+    };
+
+    return vkCreateFramebuffer(logical_device, &create_info, NULL, &swap_chain_frame_buffer);
+}
+
+// Post processing samples it and bloom reads it back at lower resolutions
+VkResult create_color_resources() {
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    VkResult result = create_image(swap_chain_extent.width, swap_chain_extent.height, 1, color_format, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &color_image, &color_image_memory);
+    if (result != VK_SUCCESS) {
+        return result;
     }
 
-    return VK_SUCCESS;
+    return create_image_view_2d(color_image, color_format, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, &color_image_view);
 }
 
+void destroy_color_resources() {
+    vkDestroyImageView(logical_device, color_image_view, NULL);
+    vkDestroyImage(logical_device, color_image, NULL);
+    vkFreeMemory(logical_device, color_image_memory, NULL);
+}
+
+VkResult create_depth_resources() {
+    // Depth only formats, D16 is always supported
+    const VkFormat candidates[2] = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D16_UNORM,
+    };
+
+    depth_format = find_supported_format(candidates, 2, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+    if (depth_format == VK_FORMAT_UNDEFINED) {
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    VkResult result = create_image(swap_chain_extent.width, swap_chain_extent.height, 1, depth_format, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depth_image, &depth_image_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return create_image_view_2d(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, &depth_image_view);
+}
+
+void destroy_depth_resources() {
+    vkDestroyImageView(logical_device, depth_image_view, NULL);
+    vkDestroyImage(logical_device, depth_image, NULL);
+    vkFreeMemory(logical_device, depth_image_memory, NULL);
+}
 
 VkResult create_image_view() {
     swap_chain_image_views = malloc(sizeof(VkImageView) * swap_chain_images_count);
@@ -162,6 +222,15 @@ VkResult create_swap_chain() {
         image_count = details.capabilities.maxImageCount;
     }
 
+    // Post processing blits its output in where the surface allows it and
+    // draws it in otherwise, headless runs read it back for golden image
+    // tests. Color attachment use is always supported
+    VkImageUsageFlags supported = details.capabilities.supportedUsageFlags;
+    swap_chain_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (supported & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    if (window_headless) {
+        swap_chain_usage |= supported & VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
     VkSwapchainCreateInfoKHR create_info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .surface = surface,
@@ -170,7 +239,7 @@ VkResult create_swap_chain() {
         .imageColorSpace = surface_format.colorSpace,
         .imageExtent = extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageUsage = swap_chain_usage,
         .preTransform = details.capabilities.currentTransform,
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
         .presentMode = present_mode,
@@ -178,7 +247,7 @@ VkResult create_swap_chain() {
         .oldSwapchain = VK_NULL_HANDLE
     };
 
-    struct queue_family_indices indices = find_queue_families(&physical_device);
+    struct queue_family_indices indices = device_capabilities.queues;
     uint32_t family_indices[2] = {
         indices.graphics_family.value, 
         indices.present_family.value
@@ -210,15 +279,27 @@ VkResult create_swap_chain() {
 void recreate_swap_chain() {
     int width = 0;
     int height = 0;
-    glfwGetFramebufferSize(window, &width, &height);
+    window_framebuffer_size(&width, &height);
     while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(window, &width, &height);
+        window_framebuffer_size(&width, &height);
         glfwWaitEvents();
     }
 
     vkDeviceWaitIdle(logical_device);
 
+    // It wraps the color and depth views destroyed below
+    vkDestroyFramebuffer(logical_device, swap_chain_frame_buffer, NULL);
+    swap_chain_frame_buffer = VK_NULL_HANDLE;
+    destroy_color_resources();
+    destroy_depth_resources();
+
     create_swap_chain();
     create_image_view();
+    create_color_resources();
+    create_depth_resources();
+    recreate_depth_pyramid();
+    dynamic_resolution_resize();
+    recreate_post();
+    recreate_shading_rate();
     create_frame_buffer();
 }
@@ -11,8 +11,23 @@ extern VkImageView* swap_chain_image_views;
 
 extern VkFormat swap_chain_format;
 extern VkExtent2D swap_chain_extent;
+extern VkImageUsageFlags swap_chain_usage;
 
-extern VkFramebuffer* swap_chain_frame_buffers;
+// The scene targets are shared by every swap chain image, so is the
+// framebuffer. VK_NULL_HANDLE with dynamic rendering
+extern VkFramebuffer swap_chain_frame_buffer;
+
+// The scene is drawn into an HDR color target, post processing writes the
+// swap chain image from it
+extern VkFormat color_format;
+extern VkImage color_image;
+extern VkDeviceMemory color_image_memory;
+extern VkImageView color_image_view;
+
+extern VkFormat depth_format;
+extern VkImage depth_image;
+extern VkDeviceMemory depth_image_memory;
+extern VkImageView depth_image_view;
 
 struct swap_chain_support_details {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -30,3 +45,7 @@ VkResult create_swap_chain();
 void recreate_swap_chain();
 VkResult create_image_view();
 VkResult create_frame_buffer();
+VkResult create_color_resources();
+void destroy_color_resources();
+VkResult create_depth_resources();
+void destroy_depth_resources();
@@ -0,0 +1,608 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "textures.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include "images.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint8_t ktx2_identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+
+struct ktx2_header {
+    uint8_t identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_offset;
+    uint32_t dfd_length;
+    uint32_t kvd_offset;
+    uint32_t kvd_length;
+    uint64_t sgd_offset;
+    uint64_t sgd_length;
+};
+
+// The level index follows the header, largest level first
+struct ktx2_level {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t uncompressed_length;
+};
+
+VkDescriptorSetLayout texture_set_layout;
+struct texture default_texture;
+
+static VkDescriptorPool descriptor_pool;
+
+static struct sampler_key sampler_keys[MAX_SAMPLERS];
+static VkSampler samplers[MAX_SAMPLERS];
+static uint32_t samplers_count = 0;
+
+uint32_t texture_block_size(VkFormat format, bool* compressed) {
+    *compressed = true;
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        return 8;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+        return 16;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        *compressed = false;
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static VkDeviceSize level_size(VkFormat format, uint32_t width, uint32_t height) {
+    bool compressed;
+    uint32_t block_size = texture_block_size(format, &compressed);
+    if (compressed) {
+        return (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4) * block_size;
+    }
+
+    return (VkDeviceSize)width * height * block_size;
+}
+
+static uint32_t full_mip_levels(uint32_t width, uint32_t height) {
+    uint32_t size = width > height ? width : height;
+    uint32_t levels = 1;
+    while (size > 1) {
+        size /= 2;
+        levels++;
+    }
+
+    return levels;
+}
+
+static bool can_generate_mips(VkFormat format) {
+    VkFormatFeatureFlags features = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return find_supported_format(&format, 1, features) != VK_FORMAT_UNDEFINED;
+}
+
+static void level_barrier(VkCommandBuffer buffer, VkImage image, uint32_t level, VkImageLayout old_layout, VkImageLayout new_layout,
+    VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = level,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+    };
+
+    vkCmdPipelineBarrier(buffer, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+// Every level is blitted from the one above it, each source level moves to
+// shader read once the next one is written
+static void generate_mips(VkCommandBuffer buffer, const struct texture* texture, uint32_t first_level) {
+    int32_t width = texture->width >> (first_level - 1);
+    int32_t height = texture->height >> (first_level - 1);
+    width = width > 0 ? width : 1;
+    height = height > 0 ? height : 1;
+
+    for (uint32_t level = first_level; level < texture->mip_levels; level++) {
+        int32_t next_width = width > 1 ? width / 2 : 1;
+        int32_t next_height = height > 1 ? height / 2 : 1;
+
+        level_barrier(buffer, texture->image, level - 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        VkImageBlit blit = {
+            .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},
+            .srcOffsets = {{0, 0, 0}, {width, height, 1}},
+            .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .dstOffsets = {{0, 0, 0}, {next_width, next_height, 1}},
+        };
+
+        vkCmdBlitImage(buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        level_barrier(buffer, texture->image, level - 1,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+        width = next_width;
+        height = next_height;
+    }
+
+    level_barrier(buffer, texture->image, texture->mip_levels - 1,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+// Blits need a graphics queue so textures are uploaded there rather than on
+// the transfer queue upload_buffers() uses, levels past level_count are
+// generated
+static VkResult upload_levels(struct texture* texture, const uint8_t* const* levels, const VkDeviceSize* sizes, uint32_t level_count) {
+    VkDeviceSize offsets[TEXTURE_MAX_LEVELS];
+    VkDeviceSize total = 0;
+    for (uint32_t i = 0; i < level_count; i++) {
+        offsets[i] = total;
+        total += (sizes[i] + 15) & ~(VkDeviceSize)15;
+    }
+
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_memory;
+    VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkResult result = create_buffer(total, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, &staging_buffer, &staging_memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    uint8_t* data;
+    vkMapMemory(logical_device, staging_memory, 0, total, 0, (void**)&data);
+    for (uint32_t i = 0; i < level_count; i++) {
+        memcpy(data + offsets[i], levels[i], sizes[i]);
+    }
+    vkUnmapMemory(logical_device, staging_memory);
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = device_capabilities.queues.graphics_family.value,
+    };
+
+    VkCommandPool pool;
+    vkCreateCommandPool(logical_device, &pool_info, NULL, &pool);
+
+    VkCommandBufferAllocateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer command_buffer;
+    vkAllocateCommandBuffers(logical_device, &buffer_info, &command_buffer);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    transition_image(command_buffer, texture->image, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    for (uint32_t i = 0; i < level_count; i++) {
+        uint32_t width = texture->width >> i;
+        uint32_t height = texture->height >> i;
+        VkBufferImageCopy region = {
+            .bufferOffset = offsets[i],
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1},
+            .imageExtent = {width > 0 ? width : 1, height > 0 ? height : 1, 1},
+        };
+        vkCmdCopyBufferToImage(command_buffer, staging_buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    if (texture->mip_levels > level_count) {
+        generate_mips(command_buffer, texture, level_count);
+    } else {
+        transition_image(command_buffer, texture->image, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+    vkEndCommandBuffer(command_buffer);
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VkFence fence;
+    vkCreateFence(logical_device, &fence_info, NULL, &fence);
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+    };
+
+    result = vkQueueSubmit(graphics_queue, 1, &submit_info, fence);
+    if (result == VK_SUCCESS) {
+        vkWaitForFences(logical_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+
+    vkDestroyFence(logical_device, fence, NULL);
+    vkDestroyCommandPool(logical_device, pool, NULL);
+    vkDestroyBuffer(logical_device, staging_buffer, NULL);
+    vkFreeMemory(logical_device, staging_memory, NULL);
+
+    return result;
+}
+
+static VkResult create_texture_set(struct texture* texture) {
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &texture_set_layout,
+    };
+
+    VkResult result = vkAllocateDescriptorSets(logical_device, &allocate_info, &texture->set);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    struct sampler_key key = {
+        .filter = VK_FILTER_LINEAR,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .max_anisotropy = TEXTURE_ANISOTROPY,
+    };
+
+    VkDescriptorImageInfo image_info = {
+        .sampler = get_sampler(&key),
+        .imageView = texture->view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = texture->set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &image_info,
+    };
+
+    vkUpdateDescriptorSets(logical_device, 1, &write, 0, NULL);
+    return VK_SUCCESS;
+}
+
+// Fills in the image, its view and its set once width, height, format and
+// mip_levels are known
+static VkResult build_texture(struct texture* texture, const uint8_t* const* levels, const VkDeviceSize* sizes, uint32_t level_count) {
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (texture->mip_levels > level_count) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
+    VkResult result = create_image(texture->width, texture->height, texture->mip_levels, texture->format, usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture->image, &texture->memory);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // The texture is left empty on failure, nothing of it outlives the call
+    result = upload_levels(texture, levels, sizes, level_count);
+    if (result != VK_SUCCESS) {
+        destroy_texture(texture);
+        return result;
+    }
+
+    result = create_image_view_2d(texture->image, texture->format, VK_IMAGE_ASPECT_COLOR_BIT, 0, texture->mip_levels, &texture->view);
+    if (result != VK_SUCCESS) {
+        destroy_texture(texture);
+        return result;
+    }
+
+    result = create_texture_set(texture);
+    if (result != VK_SUCCESS) {
+        destroy_texture(texture);
+    }
+
+    return result;
+}
+
+VkResult create_texture(const void* pixels, uint32_t width, uint32_t height, VkFormat format, struct texture* texture) {
+    memset(texture, 0, sizeof(struct texture));
+
+    bool compressed;
+    if (texture_block_size(format, &compressed) == 0 || compressed) {
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    texture->format = format;
+    texture->width = width;
+    texture->height = height;
+    texture->mip_levels = can_generate_mips(format) ? full_mip_levels(width, height) : 1;
+
+    const uint8_t* levels[1] = {pixels};
+    VkDeviceSize sizes[1] = {level_size(format, width, height)};
+    return build_texture(texture, levels, sizes, 1);
+}
+
+static bool validate_ktx2(const uint8_t* file, uint64_t file_size, const char* path) {
+    const struct ktx2_header* header = (const struct ktx2_header*)file;
+    if (memcmp(header->identifier, ktx2_identifier, sizeof(ktx2_identifier)) != 0) {
+        printf("%s is not a KTX2 file\n", path);
+        return false;
+    }
+
+    bool compressed;
+    if (texture_block_size(header->vk_format, &compressed) == 0) {
+        printf("%s has an unsupported format %u\n", path, header->vk_format);
+        return false;
+    }
+
+    if (header->supercompression_scheme != 0) {
+        printf("%s is supercompressed, only plain KTX2 is supported\n", path);
+        return false;
+    }
+
+    if (header->pixel_width == 0 || header->pixel_height == 0 || header->pixel_depth > 1 || header->layer_count > 1 || header->face_count != 1) {
+        printf("%s is not a single 2D texture\n", path);
+        return false;
+    }
+
+    uint32_t level_count = header->level_count > 0 ? header->level_count : 1;
+    if (level_count > TEXTURE_MAX_LEVELS || level_count > full_mip_levels(header->pixel_width, header->pixel_height) ||
+        sizeof(struct ktx2_header) + level_count * sizeof(struct ktx2_level) > file_size) {
+        printf("%s has an invalid level index\n", path);
+        return false;
+    }
+
+    const struct ktx2_level* levels = (const struct ktx2_level*)(file + sizeof(struct ktx2_header));
+    for (uint32_t i = 0; i < level_count; i++) {
+        uint32_t width = header->pixel_width >> i;
+        uint32_t height = header->pixel_height >> i;
+        VkDeviceSize expected = level_size(header->vk_format, width > 0 ? width : 1, height > 0 ? height : 1);
+        if (levels[i].offset > file_size || levels[i].length > file_size - levels[i].offset || levels[i].length != expected) {
+            printf("%s is truncated or has a level of the wrong size\n", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool map_ktx2(const char* path, struct ktx2_image* image) {
+    memset(image, 0, sizeof(struct ktx2_image));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open %s\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(struct ktx2_header)) {
+        close(fd);
+        printf("%s is too small to be a texture\n", path);
+        return false;
+    }
+
+    uint8_t* file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        printf("Failed to map %s\n", path);
+        return false;
+    }
+
+    if (!validate_ktx2(file, info.st_size, path)) {
+        munmap(file, info.st_size);
+        return false;
+    }
+
+    const struct ktx2_header* header = (const struct ktx2_header*)file;
+    const struct ktx2_level* index = (const struct ktx2_level*)(file + sizeof(struct ktx2_header));
+
+    image->file = file;
+    image->file_size = info.st_size;
+    image->format = header->vk_format;
+    image->width = header->pixel_width;
+    image->height = header->pixel_height;
+    image->level_count = header->level_count > 0 ? header->level_count : 1;
+    for (uint32_t i = 0; i < image->level_count; i++) {
+        image->levels[i] = file + index[i].offset;
+        image->sizes[i] = index[i].length;
+    }
+
+    return true;
+}
+
+void unmap_ktx2(struct ktx2_image* image) {
+    if (image->file != NULL) {
+        munmap(image->file, image->file_size);
+    }
+
+    memset(image, 0, sizeof(struct ktx2_image));
+}
+
+// BC data goes to the GPU as it is, a quarter to an eighth of the RGBA8 size
+// in memory and in sampling bandwidth
+VkResult load_texture(const char* path, struct texture* texture) {
+    memset(texture, 0, sizeof(struct texture));
+
+    struct ktx2_image image;
+    if (!map_ktx2(path, &image)) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    uint32_t max_dimension = device_capabilities.max_image_dimension_2d;
+    if (image.width > max_dimension || image.height > max_dimension) {
+        unmap_ktx2(&image);
+        printf("%s is larger than the device supports, load it as a virtual texture\n", path);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    bool compressed;
+    texture_block_size(image.format, &compressed);
+    if (compressed && (!device_capabilities.texture_compression_bc ||
+        find_supported_format(&image.format, 1, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == VK_FORMAT_UNDEFINED)) {
+        unmap_ktx2(&image);
+        printf("%s needs BC texture compression, which the device lacks\n", path);
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    texture->format = image.format;
+    texture->width = image.width;
+    texture->height = image.height;
+
+    // Uncompressed files with a single level get the rest of the chain
+    // generated, compressed ones keep what they ship with
+    texture->mip_levels = image.level_count;
+    if (!compressed && image.level_count == 1 && can_generate_mips(texture->format)) {
+        texture->mip_levels = full_mip_levels(texture->width, texture->height);
+    }
+
+    VkResult result = build_texture(texture, image.levels, image.sizes, image.level_count);
+    unmap_ktx2(&image);
+
+    return result;
+}
+
+void destroy_texture(struct texture* texture) {
+    if (texture->set != VK_NULL_HANDLE) {
+        vkFreeDescriptorSets(logical_device, descriptor_pool, 1, &texture->set);
+    }
+
+    vkDestroyImageView(logical_device, texture->view, NULL);
+    vkDestroyImage(logical_device, texture->image, NULL);
+    vkFreeMemory(logical_device, texture->memory, NULL);
+    memset(texture, 0, sizeof(struct texture));
+}
+
+// Textures share a handful of samplers, a linear scan is plenty at this size
+VkSampler get_sampler(const struct sampler_key* key) {
+    struct sampler_key normalized = *key;
+    if (!device_capabilities.sampler_anisotropy || normalized.max_anisotropy <= 1.f) {
+        normalized.max_anisotropy = 1.f;
+    } else if (normalized.max_anisotropy > device_capabilities.max_sampler_anisotropy) {
+        normalized.max_anisotropy = device_capabilities.max_sampler_anisotropy;
+    }
+
+    for (uint32_t i = 0; i < samplers_count; i++) {
+        if (memcmp(&sampler_keys[i], &normalized, sizeof(struct sampler_key)) == 0) {
+            return samplers[i];
+        }
+    }
+
+    if (samplers_count == MAX_SAMPLERS) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = normalized.filter,
+        .minFilter = normalized.filter,
+        .mipmapMode = normalized.mipmap_mode,
+        .addressModeU = normalized.address_mode,
+        .addressModeV = normalized.address_mode,
+        .addressModeW = normalized.address_mode,
+        .anisotropyEnable = normalized.max_anisotropy > 1.f,
+        .maxAnisotropy = normalized.max_anisotropy,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+
+    VkSampler sampler;
+    if (vkCreateSampler(logical_device, &sampler_info, NULL, &sampler) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    sampler_keys[samplers_count] = normalized;
+    samplers[samplers_count++] = sampler;
+    return sampler;
+}
+
+VkResult create_textures() {
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &layout_info, NULL, &texture_set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = MAX_TEXTURES,
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .maxSets = MAX_TEXTURES,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // Meshes without a texture sample plain white
+    const uint8_t white[4] = {255, 255, 255, 255};
+    return create_texture(white, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, &default_texture);
+}
+
+void destroy_textures() {
+    destroy_texture(&default_texture);
+
+    for (uint32_t i = 0; i < samplers_count; i++) {
+        vkDestroySampler(logical_device, samplers[i], NULL);
+    }
+    samplers_count = 0;
+
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, texture_set_layout, NULL);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_TEXTURES 256
+#define MAX_SAMPLERS 32
+#define TEXTURE_ANISOTROPY 8.f
+#define TEXTURE_MAX_LEVELS 16
+
+struct texture {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+
+    // Combined image sampler for set 1 of the graphics pipelines
+    VkDescriptorSet set;
+};
+
+// Samplers are deduplicated on these fields, anisotropy above 1 is clamped
+// to the device limit and ignored where the device has no support
+struct sampler_key {
+    VkFilter filter;
+    VkSamplerMipmapMode mipmap_mode;
+    VkSamplerAddressMode address_mode;
+    float max_anisotropy;
+};
+
+// A validated, mapped KTX2 file, level 0 is the largest
+struct ktx2_image {
+    uint8_t* file;
+    uint64_t file_size;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    const uint8_t* levels[TEXTURE_MAX_LEVELS];
+    VkDeviceSize sizes[TEXTURE_MAX_LEVELS];
+};
+
+extern VkDescriptorSetLayout texture_set_layout;
+extern struct texture default_texture;
+
+VkResult create_textures();
+void destroy_textures();
+
+// KTX2 files holding BC1, BC3, BC5, BC7 or RGBA8 data, RGBA8 files without
+// a mip chain get one generated on the GPU
+VkResult load_texture(const char* path, struct texture* texture);
+VkResult create_texture(const void* pixels, uint32_t width, uint32_t height, VkFormat format, struct texture* texture);
+void destroy_texture(struct texture* texture);
+
+bool map_ktx2(const char* path, struct ktx2_image* image);
+void unmap_ktx2(struct ktx2_image* image);
+
+// Bytes per 4x4 block for BC formats, per texel for the rest, 0 for formats
+// textures cannot be loaded in
+uint32_t texture_block_size(VkFormat format, bool* compressed);
+
+// Owned by the cache, never destroy the returned sampler
+VkSampler get_sampler(const struct sampler_key* key);
@@ -0,0 +1,465 @@
+// Offline mesh baker, turns a Wavefront OBJ into the mmap-able format in
+// mesh_format.h. Usage: mesh_baker input.obj output.mesh
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_format.h"
+#include "mesh_simplify.h"
+#include "meshlet_builder.h"
+
+struct float_array {
+    float* data;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct corner {
+    int32_t position;
+    int32_t uv;
+    int32_t normal;
+};
+
+struct baker {
+    struct float_array positions;
+    struct float_array colors;
+    struct float_array uvs;
+    struct float_array normals;
+
+    struct vertex* vertices;
+    uint32_t vertices_count;
+    uint32_t vertices_capacity;
+
+    uint32_t* indices;
+    uint32_t indices_count;
+    uint32_t indices_capacity;
+
+    // Open addressing table from corner to vertex index
+    struct corner* keys;
+    uint32_t* values;
+    uint32_t table_capacity;
+
+    bool has_normals;
+};
+
+static void* grow(void* data, uint32_t* capacity, uint32_t needed, size_t element) {
+    if (needed <= *capacity) {
+        return data;
+    }
+
+    while (*capacity < needed) {
+        *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+    }
+
+    data = realloc(data, element * *capacity);
+    if (data == NULL) {
+        puts("Out of memory");
+        exit(1);
+    }
+
+    return data;
+}
+
+static void push_floats(struct float_array* array, const float* values, uint32_t count) {
+    array->data = grow(array->data, &array->capacity, array->count + count, sizeof(float));
+    memcpy(array->data + array->count, values, sizeof(float) * count);
+    array->count += count;
+}
+
+static uint32_t hash_corner(struct corner corner) {
+    uint32_t hash = 2166136261u;
+    int32_t parts[3] = {corner.position, corner.uv, corner.normal};
+    for (int i = 0; i < 3; i++) {
+        hash = (hash ^ (uint32_t)parts[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void rehash(struct baker* baker) {
+    uint32_t old_capacity = baker->table_capacity;
+    struct corner* old_keys = baker->keys;
+    uint32_t* old_values = baker->values;
+
+    baker->table_capacity = old_capacity == 0 ? 4096 : old_capacity * 2;
+    baker->keys = malloc(sizeof(struct corner) * baker->table_capacity);
+    baker->values = malloc(sizeof(uint32_t) * baker->table_capacity);
+    memset(baker->values, 0xff, sizeof(uint32_t) * baker->table_capacity);
+
+    uint32_t mask = baker->table_capacity - 1;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_values[i] == UINT32_MAX) {
+            continue;
+        }
+
+        uint32_t slot = hash_corner(old_keys[i]) & mask;
+        while (baker->values[slot] != UINT32_MAX) {
+            slot = (slot + 1) & mask;
+        }
+        baker->keys[slot] = old_keys[i];
+        baker->values[slot] = old_values[i];
+    }
+
+    free(old_keys);
+    free(old_values);
+}
+
+static void fetch(const struct float_array* array, int32_t index, uint32_t width, float* out, const float* fallback) {
+    if (index < 0 || (uint32_t)(index + 1) * width > array->count) {
+        memcpy(out, fallback, sizeof(float) * width);
+        return;
+    }
+
+    memcpy(out, array->data + index * width, sizeof(float) * width);
+}
+
+static uint32_t emit_vertex(struct baker* baker, struct corner corner) {
+    if ((baker->vertices_count + 1) * 2 > baker->table_capacity) {
+        rehash(baker);
+    }
+
+    uint32_t mask = baker->table_capacity - 1;
+    uint32_t slot = hash_corner(corner) & mask;
+    while (baker->values[slot] != UINT32_MAX) {
+        struct corner* key = &baker->keys[slot];
+        if (key->position == corner.position && key->uv == corner.uv && key->normal == corner.normal) {
+            return baker->values[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    static const float zero[3] = {0.f, 0.f, 0.f};
+    static const float white[3] = {1.f, 1.f, 1.f};
+
+    struct vertex vertex;
+    fetch(&baker->positions, corner.position, 3, vertex.position, zero);
+    fetch(&baker->colors, corner.position, 3, vertex.color, white);
+    fetch(&baker->uvs, corner.uv, 2, vertex.uv, zero);
+    fetch(&baker->normals, corner.normal, 3, vertex.normal, zero);
+
+    // OBJ puts the uv origin bottom left, Vulkan samples from the top left
+    vertex.uv[1] = 1.f - vertex.uv[1];
+
+    baker->vertices = grow(baker->vertices, &baker->vertices_capacity, baker->vertices_count + 1, sizeof(struct vertex));
+    baker->vertices[baker->vertices_count] = vertex;
+
+    baker->keys[slot] = corner;
+    baker->values[slot] = baker->vertices_count;
+    return baker->vertices_count++;
+}
+
+static void emit_index(struct baker* baker, uint32_t index) {
+    baker->indices = grow(baker->indices, &baker->indices_capacity, baker->indices_count + 1, sizeof(uint32_t));
+    baker->indices[baker->indices_count++] = index;
+}
+
+// OBJ indices are 1 based, negative ones count back from the last element
+static int32_t resolve(long index, uint32_t count) {
+    if (index > 0) {
+        return (int32_t)(index - 1);
+    }
+
+    if (index < 0) {
+        return (int32_t)(count + index);
+    }
+
+    return -1;
+}
+
+static bool parse_corner(const struct baker* baker, char** cursor, struct corner* corner) {
+    char* end;
+    long position = strtol(*cursor, &end, 10);
+    if (end == *cursor) {
+        return false;
+    }
+
+    long uv = 0;
+    long normal = 0;
+    *cursor = end;
+    if (**cursor == '/') {
+        (*cursor)++;
+        uv = strtol(*cursor, &end, 10);
+        *cursor = end;
+        if (**cursor == '/') {
+            (*cursor)++;
+            normal = strtol(*cursor, &end, 10);
+            *cursor = end;
+        }
+    }
+
+    corner->position = resolve(position, baker->positions.count / 3);
+    corner->uv = resolve(uv, baker->uvs.count / 2);
+    corner->normal = resolve(normal, baker->normals.count / 3);
+    return true;
+}
+
+static void parse_face(struct baker* baker, char* cursor) {
+    uint32_t first = 0;
+    uint32_t previous = 0;
+    uint32_t corners = 0;
+
+    struct corner corner;
+    while (true) {
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+
+        if (!parse_corner(baker, &cursor, &corner)) {
+            break;
+        }
+
+        if (corner.normal >= 0) {
+            baker->has_normals = true;
+        }
+
+        uint32_t index = emit_vertex(baker, corner);
+        if (corners == 0) {
+            first = index;
+        } else if (corners >= 2) {
+            emit_index(baker, first);
+            emit_index(baker, previous);
+            emit_index(baker, index);
+        }
+
+        previous = index;
+        corners++;
+    }
+}
+
+static bool parse_obj(struct baker* baker, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Failed to open %s\n", path);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        float values[6];
+        if (strncmp(line, "v ", 2) == 0) {
+            int count = sscanf(line + 2, "%f %f %f %f %f %f", &values[0], &values[1], &values[2], &values[3], &values[4], &values[5]);
+            if (count < 3) {
+                continue;
+            }
+
+            push_floats(&baker->positions, values, 3);
+            if (count == 6) {
+                push_floats(&baker->colors, values + 3, 3);
+            } else {
+                static const float white[3] = {1.f, 1.f, 1.f};
+                push_floats(&baker->colors, white, 3);
+            }
+        } else if (strncmp(line, "vt ", 3) == 0) {
+            values[1] = 0.f;
+            if (sscanf(line + 3, "%f %f", &values[0], &values[1]) >= 1) {
+                push_floats(&baker->uvs, values, 2);
+            }
+        } else if (strncmp(line, "vn ", 3) == 0) {
+            if (sscanf(line + 3, "%f %f %f", &values[0], &values[1], &values[2]) == 3) {
+                push_floats(&baker->normals, values, 3);
+            }
+        } else if (strncmp(line, "f ", 2) == 0) {
+            parse_face(baker, line + 2);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Area weighted face normals, only used when the file has none
+static void compute_normals(struct baker* baker) {
+    for (uint32_t i = 0; i < baker->vertices_count; i++) {
+        vec3 zero = {0.f, 0.f, 0.f};
+        vec3_dup(baker->vertices[i].normal, zero);
+    }
+
+    for (uint32_t i = 0; i + 2 < baker->indices_count; i += 3) {
+        struct vertex* a = &baker->vertices[baker->indices[i]];
+        struct vertex* b = &baker->vertices[baker->indices[i + 1]];
+        struct vertex* c = &baker->vertices[baker->indices[i + 2]];
+
+        vec3 ab, ac, normal;
+        vec3_sub(ab, b->position, a->position);
+        vec3_sub(ac, c->position, a->position);
+        vec3_mul_cross(normal, ab, ac);
+
+        vec3_add(a->normal, a->normal, normal);
+        vec3_add(b->normal, b->normal, normal);
+        vec3_add(c->normal, c->normal, normal);
+    }
+
+    for (uint32_t i = 0; i < baker->vertices_count; i++) {
+        float length = vec3_len(baker->vertices[i].normal);
+        if (length > 0.f) {
+            vec3_scale(baker->vertices[i].normal, baker->vertices[i].normal, 1.f / length);
+        }
+    }
+}
+
+static struct mesh_bounds compute_bounds(const struct baker* baker) {
+    struct mesh_bounds bounds;
+    for (int axis = 0; axis < 3; axis++) {
+        bounds.min[axis] = INFINITY;
+        bounds.max[axis] = -INFINITY;
+    }
+
+    for (uint32_t i = 0; i < baker->vertices_count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds.min[axis] = fminf(bounds.min[axis], baker->vertices[i].position[axis]);
+            bounds.max[axis] = fmaxf(bounds.max[axis], baker->vertices[i].position[axis]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        bounds.center[axis] = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+    }
+
+    // Tighter than the box diagonal, the sphere is centred on the box
+    bounds.radius = 0.f;
+    for (uint32_t i = 0; i < baker->vertices_count; i++) {
+        vec3 offset;
+        vec3_sub(offset, baker->vertices[i].position, bounds.center);
+        bounds.radius = fmaxf(bounds.radius, vec3_len(offset));
+    }
+
+    return bounds;
+}
+
+// Each LOD halves the previous one, the chain stops when the simplifier
+// gets stuck on locked borders or the mesh is already tiny
+static uint32_t build_lods(struct baker* baker, struct mesh_lod* lods) {
+    uint32_t base_count = baker->indices_count;
+    lods[0] = (struct mesh_lod){.index_offset = 0, .index_count = base_count};
+
+    uint32_t lod_count = 1;
+    while (lod_count < MESH_MAX_LODS) {
+        struct mesh_lod* previous = &lods[lod_count - 1];
+        if (previous->index_count < 3 * 64) {
+            break;
+        }
+
+        baker->indices = grow(baker->indices, &baker->indices_capacity, baker->indices_count + previous->index_count, sizeof(uint32_t));
+
+        float error;
+        uint32_t* destination = baker->indices + baker->indices_count;
+        uint32_t count = simplify_mesh(destination, baker->indices + previous->index_offset, previous->index_count,
+            baker->vertices, baker->vertices_count, previous->index_count / 2 / 3 * 3, &error);
+
+        if (count == 0 || count > previous->index_count * 85 / 100) {
+            break;
+        }
+
+        // Errors add up along the chain since each LOD is built from the last
+        lods[lod_count] = (struct mesh_lod){
+            .index_offset = baker->indices_count,
+            .index_count = count,
+            .error = previous->error + error,
+        };
+        baker->indices_count += count;
+        lod_count++;
+    }
+
+    return lod_count;
+}
+
+static bool write_section(FILE* file, struct mesh_section* section, const void* data, uint64_t size, uint64_t* offset) {
+    static const uint8_t padding[MESH_SECTION_ALIGNMENT];
+
+    uint64_t aligned = mesh_align(*offset);
+    if (fwrite(padding, 1, aligned - *offset, file) != aligned - *offset || fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+
+    section->offset = aligned;
+    section->size = size;
+    *offset = aligned + size;
+    return true;
+}
+
+static bool write_mesh(struct baker* baker, const char* path) {
+    struct mesh_lod lods[MESH_MAX_LODS] = {0};
+    uint32_t lod_count = build_lods(baker, lods);
+
+    // Meshlets reorder each LOD's indices in place, the LOD ranges stay put
+    struct meshlet_builder meshlets = {0};
+    for (uint32_t i = 0; i < lod_count; i++) {
+        lods[i].meshlet_offset = meshlets.meshlets_count;
+        lods[i].meshlet_count = build_meshlets(&meshlets, baker->indices + lods[i].index_offset, lods[i].index_count,
+            lods[i].index_offset, baker->vertices, baker->vertices_count);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Failed to create %s\n", path);
+        return false;
+    }
+
+    struct mesh_header header = {
+        .magic = MESH_MAGIC,
+        .version = MESH_VERSION,
+        .vertex_stride = sizeof(struct vertex),
+        .vertex_count = baker->vertices_count,
+        .index_count = baker->indices_count,
+        .lod_count = lod_count,
+        .meshlet_count = meshlets.meshlets_count,
+        .meshlet_vertex_count = meshlets.vertices_count,
+        .meshlet_triangle_count = meshlets.triangles_count,
+        .bounds = compute_bounds(baker),
+    };
+    memcpy(header.lods, lods, sizeof(lods));
+
+    // The header is written twice, the second time with the section offsets
+    uint64_t offset = sizeof(header);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && write_section(file, &header.sections[MESH_SECTION_VERTICES], baker->vertices, (uint64_t)baker->vertices_count * sizeof(struct vertex), &offset);
+    ok = ok && write_section(file, &header.sections[MESH_SECTION_INDICES], baker->indices, (uint64_t)baker->indices_count * sizeof(uint32_t), &offset);
+    ok = ok && write_section(file, &header.sections[MESH_SECTION_MESHLETS], meshlets.meshlets, (uint64_t)meshlets.meshlets_count * sizeof(struct meshlet), &offset);
+    ok = ok && write_section(file, &header.sections[MESH_SECTION_MESHLET_VERTICES], meshlets.vertices, (uint64_t)meshlets.vertices_count * sizeof(uint32_t), &offset);
+    ok = ok && write_section(file, &header.sections[MESH_SECTION_MESHLET_TRIANGLES], meshlets.triangles, (uint64_t)meshlets.triangles_count * sizeof(uint32_t), &offset);
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    free_meshlet_builder(&meshlets);
+
+    if (fclose(file) != 0 || !ok) {
+        printf("Failed to write %s\n", path);
+        return false;
+    }
+
+    printf("%s: %u vertices\n", path, header.vertex_count);
+    for (uint32_t i = 0; i < header.lod_count; i++) {
+        printf("  lod %u: %u triangles, %u meshlets, error %g\n", i, header.lods[i].index_count / 3, header.lods[i].meshlet_count, header.lods[i].error);
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        puts("Usage: mesh_baker input.obj output.mesh");
+        return 1;
+    }
+
+    struct baker baker = {0};
+    if (!parse_obj(&baker, argv[1])) {
+        return 1;
+    }
+
+    if (baker.indices_count == 0) {
+        printf("%s has no faces\n", argv[1]);
+        return 1;
+    }
+
+    if (!baker.has_normals) {
+        compute_normals(&baker);
+    }
+
+    if (!write_mesh(&baker, argv[2])) {
+        return 1;
+    }
+
+    return 0;
+}
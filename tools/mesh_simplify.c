@@ -0,0 +1,334 @@
+#include "mesh_simplify.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Symmetric 4x4 plane quadric, xx xy xz xw yy yz yw zz zw ww, weighted by
+// triangle area so the error reads as a mean squared distance
+struct quadric {
+    double a[10];
+    double weight;
+};
+
+struct collapse {
+    uint32_t source;
+    uint32_t target;
+    double cost;
+};
+
+static void quadric_add_plane(struct quadric* q, double x, double y, double z, double w, double weight) {
+    double plane[4] = {x, y, z, w};
+    int k = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) {
+            q->a[k++] += plane[i] * plane[j] * weight;
+        }
+    }
+    q->weight += weight;
+}
+
+static void quadric_add(struct quadric* q, const struct quadric* other) {
+    for (int i = 0; i < 10; i++) {
+        q->a[i] += other->a[i];
+    }
+    q->weight += other->weight;
+}
+
+static double quadric_error(const struct quadric* q, const float* p) {
+    double x = p[0];
+    double y = p[1];
+    double z = p[2];
+    const double* a = q->a;
+
+    double error = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+        + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+        + a[7] * z * z + 2 * a[8] * z
+        + a[9];
+
+    return q->weight > 0 ? fabs(error) / q->weight : 0;
+}
+
+static uint32_t hash_bits(const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static uint32_t table_size(uint32_t count) {
+    uint32_t size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+// Vertices split along uv or normal seams share a position, the
+// simplifier works on positions so both sides of a seam move together
+static void weld_positions(uint32_t* remap, const struct vertex* vertices, uint32_t vertex_count) {
+    uint32_t size = table_size(vertex_count);
+    uint32_t* table = malloc(sizeof(uint32_t) * size);
+    memset(table, 0xff, sizeof(uint32_t) * size);
+
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        uint32_t slot = hash_bits(vertices[i].position, sizeof(vec3)) & (size - 1);
+        while (table[slot] != UINT32_MAX && memcmp(vertices[table[slot]].position, vertices[i].position, sizeof(vec3)) != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = i;
+        }
+        remap[i] = table[slot];
+    }
+
+    free(table);
+}
+
+static bool edge_find(const uint64_t* table, uint32_t size, uint64_t key) {
+    uint32_t slot = hash_bits(&key, sizeof(key)) & (size - 1);
+    while (table[slot] != UINT64_MAX) {
+        if (table[slot] == key) {
+            return true;
+        }
+        slot = (slot + 1) & (size - 1);
+    }
+
+    return false;
+}
+
+// Open edges only have one triangle, collapsing their vertices would pull
+// holes and mesh borders inwards
+static void lock_borders(bool* locked, const uint32_t* indices, uint32_t index_count, const uint32_t* remap) {
+    uint32_t size = table_size(index_count);
+    uint64_t* table = malloc(sizeof(uint64_t) * size);
+    memset(table, 0xff, sizeof(uint64_t) * size);
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t a = remap[indices[i]];
+        uint32_t b = remap[indices[i - i % 3 + (i + 1) % 3]];
+        uint64_t key = (uint64_t)a << 32 | b;
+
+        uint32_t slot = hash_bits(&key, sizeof(key)) & (size - 1);
+        while (table[slot] != UINT64_MAX && table[slot] != key) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = key;
+    }
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t a = remap[indices[i]];
+        uint32_t b = remap[indices[i - i % 3 + (i + 1) % 3]];
+        if (!edge_find(table, size, (uint64_t)b << 32 | a)) {
+            locked[a] = true;
+            locked[b] = true;
+        }
+    }
+
+    free(table);
+}
+
+static void triangle_normal(vec3 normal, const float* a, const float* b, const float* c) {
+    vec3 ab, ac;
+    vec3_sub(ab, (float*)b, (float*)a);
+    vec3_sub(ac, (float*)c, (float*)a);
+    vec3_mul_cross(normal, ab, ac);
+}
+
+static int compare_collapses(const void* a, const void* b) {
+    double x = ((const struct collapse*)a)->cost;
+    double y = ((const struct collapse*)b)->cost;
+    return (x > y) - (x < y);
+}
+
+// Moving source onto target must not turn any surviving triangle around
+static bool collapse_flips(const struct vertex* vertices, const uint32_t* indices, const uint32_t* remap,
+    const uint32_t* adjacency, uint32_t first, uint32_t last, uint32_t source, uint32_t target) {
+    for (uint32_t i = first; i < last; i++) {
+        const uint32_t* triangle = &indices[adjacency[i] * 3];
+        uint32_t corners[3] = {remap[triangle[0]], remap[triangle[1]], remap[triangle[2]]};
+        if (corners[0] == target || corners[1] == target || corners[2] == target) {
+            continue;
+        }
+
+        const float* before[3];
+        const float* after[3];
+        for (int k = 0; k < 3; k++) {
+            before[k] = vertices[corners[k]].position;
+            after[k] = corners[k] == source ? vertices[target].position : before[k];
+        }
+
+        vec3 n0, n1;
+        triangle_normal(n0, before[0], before[1], before[2]);
+        triangle_normal(n1, after[0], after[1], after[2]);
+        if (vec3_mul_inner(n0, n1) <= 0.f) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t simplify_mesh(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+    const struct vertex* vertices, uint32_t vertex_count, uint32_t target_count, float* error) {
+    uint32_t* remap = malloc(sizeof(uint32_t) * vertex_count);
+    bool* locked = calloc(vertex_count, sizeof(bool));
+    bool* touched = malloc(sizeof(bool) * vertex_count);
+    uint32_t* collapsed = malloc(sizeof(uint32_t) * vertex_count);
+    struct quadric* quadrics = calloc(vertex_count, sizeof(struct quadric));
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (vertex_count + 1));
+    uint32_t* adjacency = malloc(sizeof(uint32_t) * index_count);
+    struct collapse* collapses = malloc(sizeof(struct collapse) * index_count * 2);
+
+    weld_positions(remap, vertices, vertex_count);
+    lock_borders(locked, indices, index_count, remap);
+
+    for (uint32_t i = 0; i < index_count; i += 3) {
+        const float* a = vertices[remap[indices[i]]].position;
+        const float* b = vertices[remap[indices[i + 1]]].position;
+        const float* c = vertices[remap[indices[i + 2]]].position;
+
+        vec3 normal;
+        triangle_normal(normal, a, b, c);
+        float length = vec3_len(normal);
+        if (length == 0.f) {
+            continue;
+        }
+
+        double area = length * 0.5;
+        double x = normal[0] / length;
+        double y = normal[1] / length;
+        double z = normal[2] / length;
+        double w = -(x * a[0] + y * a[1] + z * a[2]);
+        for (int k = 0; k < 3; k++) {
+            quadric_add_plane(&quadrics[remap[indices[i + k]]], x, y, z, w, area);
+        }
+    }
+
+    memmove(destination, indices, sizeof(uint32_t) * index_count);
+    uint32_t count = index_count;
+    double max_error = 0;
+
+    while (count > target_count) {
+        // Triangles around each welded vertex
+        memset(offsets, 0, sizeof(uint32_t) * (vertex_count + 1));
+        for (uint32_t i = 0; i < count; i++) {
+            offsets[remap[destination[i]] + 1]++;
+        }
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            adjacency[offsets[remap[destination[i]]]++] = i / 3;
+        }
+        for (uint32_t i = vertex_count; i > 0; i--) {
+            offsets[i] = offsets[i - 1];
+        }
+        offsets[0] = 0;
+
+        uint32_t collapses_count = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t a = remap[destination[i]];
+            uint32_t b = remap[destination[i - i % 3 + (i + 1) % 3]];
+            if (a == b) {
+                continue;
+            }
+
+            uint32_t ends[2][2] = {{a, b}, {b, a}};
+            for (int k = 0; k < 2; k++) {
+                uint32_t source = ends[k][0];
+                uint32_t target = ends[k][1];
+                if (locked[source]) {
+                    continue;
+                }
+
+                struct quadric q = quadrics[source];
+                quadric_add(&q, &quadrics[target]);
+                collapses[collapses_count++] = (struct collapse){source, target, quadric_error(&q, vertices[target].position)};
+            }
+        }
+
+        qsort(collapses, collapses_count, sizeof(struct collapse), compare_collapses);
+
+        // Each collapse removes about two triangles, stop a pass short of the
+        // target so the cheapest edges of the next pass get a chance
+        uint32_t budget = (count - target_count) / 6 + 1;
+        uint32_t applied = 0;
+
+        memset(touched, 0, sizeof(bool) * vertex_count);
+        for (uint32_t i = 0; i < vertex_count; i++) {
+            collapsed[i] = i;
+        }
+
+        for (uint32_t i = 0; i < collapses_count && applied < budget; i++) {
+            struct collapse* collapse = &collapses[i];
+            if (touched[collapse->source] || touched[collapse->target]) {
+                continue;
+            }
+
+            uint32_t first = offsets[collapse->source];
+            uint32_t last = offsets[collapse->source + 1];
+            if (collapse_flips(vertices, destination, remap, adjacency, first, last, collapse->source, collapse->target)) {
+                continue;
+            }
+
+            collapsed[collapse->source] = collapse->target;
+            quadric_add(&quadrics[collapse->target], &quadrics[collapse->source]);
+            if (collapse->cost > max_error) {
+                max_error = collapse->cost;
+            }
+
+            // Triangles around the source change shape, their other
+            // vertices wait for the next pass
+            for (uint32_t j = first; j < last; j++) {
+                const uint32_t* triangle = &destination[adjacency[j] * 3];
+                for (int k = 0; k < 3; k++) {
+                    touched[remap[triangle[k]]] = true;
+                }
+            }
+            applied++;
+        }
+
+        if (applied == 0) {
+            break;
+        }
+
+        uint32_t written = 0;
+        for (uint32_t i = 0; i < count; i += 3) {
+            uint32_t triangle[3];
+            uint32_t corners[3];
+            for (int k = 0; k < 3; k++) {
+                uint32_t corner = remap[destination[i + k]];
+                corners[k] = collapsed[corner];
+                triangle[k] = corners[k] == corner ? destination[i + k] : corners[k];
+            }
+
+            if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]) {
+                continue;
+            }
+
+            memcpy(&destination[written], triangle, sizeof(triangle));
+            written += 3;
+        }
+        count = written;
+    }
+
+    *error = (float)sqrt(max_error);
+
+    free(remap);
+    free(locked);
+    free(touched);
+    free(collapsed);
+    free(quadrics);
+    free(offsets);
+    free(adjacency);
+    free(collapses);
+
+    return count;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "mesh_format.h"
+
+// Collapses edges in order of quadric error until at most target_count
+// indices are left or nothing more can be collapsed. Vertices are never moved
+// or added so every LOD indexes the same vertex section. destination must
+// have room for index_count indices, the new count is returned and error is
+// the largest distance between the result and the input in object units.
+uint32_t simplify_mesh(uint32_t* destination, const uint32_t* indices, uint32_t index_count,
+    const struct vertex* vertices, uint32_t vertex_count, uint32_t target_count, float* error);
@@ -0,0 +1,247 @@
+#include "meshlet_builder.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* grow(void* data, uint32_t* capacity, uint32_t needed, size_t element) {
+    if (needed <= *capacity) {
+        return data;
+    }
+
+    while (*capacity < needed) {
+        *capacity = *capacity == 0 ? 256 : *capacity * 2;
+    }
+
+    data = realloc(data, element * *capacity);
+    if (data == NULL) {
+        puts("Out of memory");
+        exit(1);
+    }
+
+    return data;
+}
+
+struct cluster {
+    uint32_t vertices[MESHLET_MAX_VERTICES];
+    uint32_t vertices_count;
+    uint32_t triangles[MESHLET_MAX_TRIANGLES];
+    uint32_t triangles_count;
+};
+
+static uint32_t new_vertices(const int16_t* local, const uint32_t* triangle) {
+    uint32_t count = 0;
+    for (int k = 0; k < 3; k++) {
+        count += local[triangle[k]] < 0;
+    }
+
+    return count;
+}
+
+static bool cluster_fits(const struct cluster* cluster, const int16_t* local, const uint32_t* triangle) {
+    return cluster->triangles_count < MESHLET_MAX_TRIANGLES &&
+        cluster->vertices_count + new_vertices(local, triangle) <= MESHLET_MAX_VERTICES;
+}
+
+static void cluster_add(struct cluster* cluster, int16_t* local, const uint32_t* triangle, uint32_t triangle_index) {
+    for (int k = 0; k < 3; k++) {
+        if (local[triangle[k]] < 0) {
+            local[triangle[k]] = (int16_t)cluster->vertices_count;
+            cluster->vertices[cluster->vertices_count++] = triangle[k];
+        }
+    }
+
+    cluster->triangles[cluster->triangles_count++] = triangle_index;
+}
+
+static void triangle_normal(vec3 normal, const struct vertex* vertices, const uint32_t* triangle) {
+    vec3 ab, ac;
+    vec3_sub(ab, (float*)vertices[triangle[1]].position, (float*)vertices[triangle[0]].position);
+    vec3_sub(ac, (float*)vertices[triangle[2]].position, (float*)vertices[triangle[0]].position);
+    vec3_mul_cross(normal, ab, ac);
+}
+
+static void compute_meshlet_bounds(struct meshlet* meshlet, const struct cluster* cluster, const uint32_t* indices, const struct vertex* vertices) {
+    vec3 min = {INFINITY, INFINITY, INFINITY};
+    vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = 0; i < cluster->vertices_count; i++) {
+        const float* position = vertices[cluster->vertices[i]].position;
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = fminf(min[axis], position[axis]);
+            max[axis] = fmaxf(max[axis], position[axis]);
+        }
+    }
+
+    meshlet->radius = 0.f;
+    for (int axis = 0; axis < 3; axis++) {
+        meshlet->center[axis] = (min[axis] + max[axis]) * 0.5f;
+    }
+
+    for (uint32_t i = 0; i < cluster->vertices_count; i++) {
+        vec3 offset;
+        vec3_sub(offset, (float*)vertices[cluster->vertices[i]].position, meshlet->center);
+        meshlet->radius = fmaxf(meshlet->radius, vec3_len(offset));
+    }
+
+    vec3 normals[MESHLET_MAX_TRIANGLES];
+    uint32_t normals_count = 0;
+    vec3 axis = {0.f, 0.f, 0.f};
+    for (uint32_t i = 0; i < cluster->triangles_count; i++) {
+        vec3 normal;
+        triangle_normal(normal, vertices, &indices[cluster->triangles[i] * 3]);
+        float length = vec3_len(normal);
+        if (length == 0.f) {
+            continue;
+        }
+
+        vec3_scale(normals[normals_count], normal, 1.f / length);
+        vec3_add(axis, axis, normals[normals_count]);
+        normals_count++;
+    }
+
+    float length = vec3_len(axis);
+    float min_dot = 1.f;
+    if (length > 0.f) {
+        vec3_scale(axis, axis, 1.f / length);
+        for (uint32_t i = 0; i < normals_count; i++) {
+            min_dot = fminf(min_dot, vec3_mul_inner(axis, normals[i]));
+        }
+    }
+
+    // Normals spread over more than a hemisphere leave no direction from
+    // which every triangle faces away
+    vec3_dup(meshlet->cone_axis, axis);
+    if (length == 0.f || min_dot <= 0.1f) {
+        meshlet->cone_cutoff = 1.f;
+    } else {
+        meshlet->cone_cutoff = sqrtf(1.f - min_dot * min_dot);
+    }
+}
+
+uint32_t build_meshlets(struct meshlet_builder* builder, uint32_t* indices, uint32_t index_count, uint32_t index_base,
+    const struct vertex* vertices, uint32_t vertex_count) {
+    uint32_t triangle_count = index_count / 3;
+
+    // Triangles around each vertex
+    uint32_t* offsets = calloc(vertex_count + 1, sizeof(uint32_t));
+    uint32_t* adjacency = malloc(sizeof(uint32_t) * index_count);
+    for (uint32_t i = 0; i < index_count; i++) {
+        offsets[indices[i] + 1]++;
+    }
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    uint32_t* cursor = malloc(sizeof(uint32_t) * vertex_count);
+    memcpy(cursor, offsets, sizeof(uint32_t) * vertex_count);
+    for (uint32_t i = 0; i < index_count; i++) {
+        adjacency[cursor[indices[i]]++] = i / 3;
+    }
+    free(cursor);
+
+    bool* emitted = calloc(triangle_count, sizeof(bool));
+    int16_t* local = malloc(sizeof(int16_t) * vertex_count);
+    memset(local, 0xff, sizeof(int16_t) * vertex_count);
+    uint32_t* reordered = malloc(sizeof(uint32_t) * index_count);
+
+    uint32_t first_meshlet = builder->meshlets_count;
+    uint32_t written = 0;
+    uint32_t seed = 0;
+    struct cluster cluster = {0};
+
+    while (written < index_count) {
+        // Grow across the cluster's vertices, preferring triangles that add
+        // the fewest new vertices, and restart from the next unused triangle
+        // in index order when the cluster has no open neighbours
+        uint32_t best = UINT32_MAX;
+        uint32_t best_cost = UINT32_MAX;
+        for (uint32_t i = 0; i < cluster.vertices_count && best_cost > 0; i++) {
+            uint32_t vertex = cluster.vertices[i];
+            for (uint32_t j = offsets[vertex]; j < offsets[vertex + 1]; j++) {
+                uint32_t triangle = adjacency[j];
+                if (emitted[triangle] || !cluster_fits(&cluster, local, &indices[triangle * 3])) {
+                    continue;
+                }
+
+                uint32_t cost = new_vertices(local, &indices[triangle * 3]);
+                if (cost < best_cost) {
+                    best = triangle;
+                    best_cost = cost;
+                }
+            }
+        }
+
+        if (best == UINT32_MAX) {
+            while (seed < triangle_count && emitted[seed]) {
+                seed++;
+            }
+
+            if (cluster.triangles_count > 0 && !cluster_fits(&cluster, local, &indices[seed * 3])) {
+                best = UINT32_MAX;
+            } else {
+                best = seed;
+            }
+        }
+
+        if (best != UINT32_MAX) {
+            emitted[best] = true;
+            cluster_add(&cluster, local, &indices[best * 3], best);
+        }
+
+        bool full = best == UINT32_MAX || cluster.triangles_count == MESHLET_MAX_TRIANGLES || cluster.vertices_count == MESHLET_MAX_VERTICES;
+        bool last = written + cluster.triangles_count * 3 == index_count;
+        if (!full && !last) {
+            continue;
+        }
+
+        builder->meshlets = grow(builder->meshlets, &builder->meshlets_capacity, builder->meshlets_count + 1, sizeof(struct meshlet));
+        builder->vertices = grow(builder->vertices, &builder->vertices_capacity, builder->vertices_count + cluster.vertices_count, sizeof(uint32_t));
+        builder->triangles = grow(builder->triangles, &builder->triangles_capacity, builder->triangles_count + cluster.triangles_count, sizeof(uint32_t));
+
+        struct meshlet* meshlet = &builder->meshlets[builder->meshlets_count++];
+        memset(meshlet, 0, sizeof(struct meshlet));
+        compute_meshlet_bounds(meshlet, &cluster, indices, vertices);
+        meshlet->index_offset = index_base + written;
+        meshlet->vertex_offset = builder->vertices_count;
+        meshlet->triangle_offset = builder->triangles_count;
+        meshlet->vertex_count = cluster.vertices_count;
+        meshlet->triangle_count = cluster.triangles_count;
+
+        memcpy(builder->vertices + builder->vertices_count, cluster.vertices, sizeof(uint32_t) * cluster.vertices_count);
+        builder->vertices_count += cluster.vertices_count;
+
+        for (uint32_t i = 0; i < cluster.triangles_count; i++) {
+            const uint32_t* triangle = &indices[cluster.triangles[i] * 3];
+            uint32_t packed = 0;
+            for (int k = 0; k < 3; k++) {
+                reordered[written++] = triangle[k];
+                packed |= (uint32_t)local[triangle[k]] << (k * 8);
+            }
+            builder->triangles[builder->triangles_count++] = packed;
+        }
+
+        for (uint32_t i = 0; i < cluster.vertices_count; i++) {
+            local[cluster.vertices[i]] = -1;
+        }
+        cluster.vertices_count = 0;
+        cluster.triangles_count = 0;
+    }
+
+    memcpy(indices, reordered, sizeof(uint32_t) * index_count);
+
+    free(offsets);
+    free(adjacency);
+    free(emitted);
+    free(local);
+    free(reordered);
+
+    return builder->meshlets_count - first_meshlet;
+}
+
+void free_meshlet_builder(struct meshlet_builder* builder) {
+    free(builder->meshlets);
+    free(builder->vertices);
+    free(builder->triangles);
+    memset(builder, 0, sizeof(struct meshlet_builder));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "mesh_format.h"
+
+struct meshlet_builder {
+    struct meshlet* meshlets;
+    uint32_t meshlets_count;
+    uint32_t meshlets_capacity;
+
+    uint32_t* vertices;
+    uint32_t vertices_count;
+    uint32_t vertices_capacity;
+
+    uint32_t* triangles;
+    uint32_t triangles_count;
+    uint32_t triangles_capacity;
+};
+
+// Splits the triangles of one LOD into meshlets of at most
+// MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles, growing
+// them across shared edges so clusters stay compact. indices is rewritten in
+// meshlet order, index_base is its position in the index section. Returns the
+// number of meshlets appended to the builder.
+uint32_t build_meshlets(struct meshlet_builder* builder, uint32_t* indices, uint32_t index_count, uint32_t index_base,
+    const struct vertex* vertices, uint32_t vertex_count);
+void free_meshlet_builder(struct meshlet_builder* builder);
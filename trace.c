@@ -0,0 +1,290 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "capabilities.h"
+#include "devices.h"
+#include "jobs.h"
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_THREAD_MASK (TRACE_THREAD_EVENTS - 1)
+#define TRACE_GPU_MASK (TRACE_GPU_EVENTS - 1)
+
+struct trace_event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// Only the owning thread writes, the count is published after the event so
+// the writer is visible to a reader once it has stopped
+struct trace_buffer {
+    char label[32];
+    uint64_t written;
+    struct trace_event events[TRACE_THREAD_EVENTS];
+};
+
+bool trace_enabled = false;
+
+static const char* trace_path = NULL;
+static uint64_t trace_start_ns = 0;
+
+static struct trace_buffer* buffers[MAX_TRACE_THREADS];
+static uint32_t buffers_count = 0;
+
+// Bumped by every trace_begin, thread state from an earlier trace points at
+// freed buffers and is dropped
+static uint32_t generation = 0;
+static __thread uint32_t local_generation = 0;
+static __thread struct trace_buffer* local_buffer = NULL;
+static __thread bool local_failed = false;
+
+static struct trace_event* gpu_events = NULL;
+static uint64_t gpu_written = 0;
+
+static bool calibration_probed = false;
+static bool calibration_available = false;
+static PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps = NULL;
+
+uint64_t trace_now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+static struct trace_buffer* thread_buffer(const char* label, uint32_t index) {
+    uint32_t current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if (local_generation != current) {
+        local_generation = current;
+        local_buffer = NULL;
+        local_failed = false;
+    }
+
+    if (local_buffer != NULL || local_failed) {
+        return local_buffer;
+    }
+
+    uint32_t slot = __atomic_fetch_add(&buffers_count, 1, __ATOMIC_ACQ_REL);
+    struct trace_buffer* buffer = slot < MAX_TRACE_THREADS ? calloc(1, sizeof(struct trace_buffer)) : NULL;
+    if (buffer == NULL) {
+        local_failed = true;
+        return NULL;
+    }
+
+    snprintf(buffer->label, sizeof(buffer->label), label, index);
+    __atomic_store_n(&buffers[slot], buffer, __ATOMIC_RELEASE);
+    local_buffer = buffer;
+    return buffer;
+}
+
+static void record(struct trace_buffer* buffer, const char* name, uint64_t start_ns, uint64_t end_ns) {
+    uint64_t written = buffer->written;
+    buffer->events[written & TRACE_THREAD_MASK] = (struct trace_event){name, start_ns, end_ns};
+    __atomic_store_n(&buffer->written, written + 1, __ATOMIC_RELEASE);
+}
+
+void trace_event(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    if (!trace_enabled) {
+        return;
+    }
+
+    struct trace_buffer* buffer = thread_buffer("thread %u", __atomic_load_n(&buffers_count, __ATOMIC_RELAXED));
+    if (buffer != NULL) {
+        record(buffer, name, start_ns, end_ns);
+    }
+}
+
+// Job threads are named after their worker index the first time they run
+// a job
+static void trace_job(const char* name, uint32_t thread, uint64_t start_ns, uint64_t end_ns) {
+    struct trace_buffer* buffer = thread_buffer("worker %u", thread);
+    if (buffer != NULL) {
+        record(buffer, name, start_ns, end_ns);
+    }
+}
+
+struct trace_zone trace_zone_begin(const char* name) {
+    return (struct trace_zone){name, trace_enabled ? trace_now_ns() : 0};
+}
+
+void trace_zone_end(struct trace_zone* zone) {
+    if (zone->start_ns != 0) {
+        trace_event(zone->name, zone->start_ns, trace_now_ns());
+        zone->start_ns = 0;
+    }
+}
+
+void trace_zone_next(struct trace_zone* zone, const char* name) {
+    if (zone->start_ns == 0) {
+        return;
+    }
+
+    uint64_t now = trace_now_ns();
+    trace_event(zone->name, zone->start_ns, now);
+    *zone = (struct trace_zone){name, now};
+}
+
+bool trace_begin(const char* path) {
+    gpu_events = malloc(sizeof(struct trace_event) * TRACE_GPU_EVENTS);
+    if (gpu_events == NULL) {
+        return false;
+    }
+
+    trace_path = path;
+    trace_start_ns = trace_now_ns();
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    trace_enabled = true;
+    thread_buffer("main", 0);
+    job_set_timing_hook(trace_job);
+    return true;
+}
+
+static void probe_calibration() {
+    calibration_probed = true;
+    if (!device_capabilities.calibrated_timestamps) {
+        return;
+    }
+
+    PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_domains =
+        (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    get_calibrated_timestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(logical_device, "vkGetCalibratedTimestampsEXT");
+    if (get_domains == NULL || get_calibrated_timestamps == NULL) {
+        return;
+    }
+
+    VkTimeDomainEXT domains[8];
+    uint32_t domains_count = 8;
+    get_domains(physical_device, &domains_count, domains);
+
+    bool device = false, monotonic = false;
+    for (uint32_t i = 0; i < domains_count; i++) {
+        device |= domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+        monotonic |= domains[i] == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+    }
+    calibration_available = device && monotonic;
+}
+
+// Nanoseconds to add to GPU ticks scaled by the timestamp period to land on
+// CLOCK_MONOTONIC
+static bool calibrate(double* offset_ns) {
+    if (!calibration_probed) {
+        probe_calibration();
+    }
+
+    if (!calibration_available) {
+        return false;
+    }
+
+    VkCalibratedTimestampInfoEXT infos[2] = {
+        {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT},
+        {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT},
+    };
+
+    uint64_t timestamps[2];
+    uint64_t deviation;
+    if (get_calibrated_timestamps(logical_device, 2, infos, timestamps, &deviation) != VK_SUCCESS) {
+        return false;
+    }
+
+    // Timer ticks are masked to the valid bits, the device time has to match
+    uint32_t bits = device_capabilities.timestamp_valid_bits;
+    uint64_t device_ticks = bits >= 64 ? timestamps[0] : timestamps[0] & ((1ull << bits) - 1);
+    *offset_ns = (double)timestamps[1] - (double)device_ticks * device_capabilities.timestamp_period;
+    return true;
+}
+
+void trace_gpu_zones(const char* const* names, const uint64_t* ticks, uint32_t count) {
+    if (!trace_enabled || count == 0) {
+        return;
+    }
+
+    double period = device_capabilities.timestamp_period;
+    double offset_ns;
+    if (!calibrate(&offset_ns)) {
+        uint64_t last = 0;
+        for (uint32_t i = 0; i < count * 2; i++) {
+            last = ticks[i] > last ? ticks[i] : last;
+        }
+        offset_ns = (double)trace_now_ns() - (double)last * period;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        gpu_events[gpu_written++ & TRACE_GPU_MASK] = (struct trace_event){
+            .name = names[i],
+            .start_ns = (uint64_t)(ticks[i * 2] * period + offset_ns),
+            .end_ns = (uint64_t)(ticks[i * 2 + 1] * period + offset_ns),
+        };
+    }
+}
+
+static void write_event(FILE* file, const struct trace_event* event, uint32_t pid, uint32_t tid, bool* first) {
+    // Events from before the start, GPU ones can land there, are clamped
+    uint64_t start = event->start_ns > trace_start_ns ? event->start_ns - trace_start_ns : 0;
+    uint64_t end = event->end_ns > trace_start_ns ? event->end_ns - trace_start_ns : 0;
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        *first ? "" : ",", event->name, pid, tid, start / 1e3, (end > start ? end - start : 0) / 1e3);
+    *first = false;
+}
+
+static void write_metadata(FILE* file, const char* kind, uint32_t pid, uint32_t tid, const char* name, bool* first) {
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        *first ? "" : ",", kind, pid, tid, name);
+    *first = false;
+}
+
+void trace_finish() {
+    if (!trace_enabled) {
+        return;
+    }
+
+    // Jobs already running may still call trace_job with the old hook
+    trace_enabled = false;
+    job_set_timing_hook(NULL);
+    job_wait_idle();
+
+    FILE* file = fopen(trace_path, "w");
+    if (file == NULL) {
+        printf("Failed to write %s\n", trace_path);
+    } else {
+        bool first = true;
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+        write_metadata(file, "process_name", 1, 0, "CPU", &first);
+        write_metadata(file, "process_name", 2, 0, "GPU", &first);
+        write_metadata(file, "thread_name", 2, 0, "graphics queue", &first);
+
+        uint32_t threads = buffers_count < MAX_TRACE_THREADS ? buffers_count : MAX_TRACE_THREADS;
+        for (uint32_t i = 0; i < threads; i++) {
+            struct trace_buffer* buffer = __atomic_load_n(&buffers[i], __ATOMIC_ACQUIRE);
+            if (buffer == NULL) {
+                continue;
+            }
+
+            write_metadata(file, "thread_name", 1, i, buffer->label, &first);
+            uint64_t written = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+            uint64_t oldest = written > TRACE_THREAD_EVENTS ? written - TRACE_THREAD_EVENTS : 0;
+            for (uint64_t k = oldest; k < written; k++) {
+                write_event(file, &buffer->events[k & TRACE_THREAD_MASK], 1, i, &first);
+            }
+        }
+
+        uint64_t oldest = gpu_written > TRACE_GPU_EVENTS ? gpu_written - TRACE_GPU_EVENTS : 0;
+        for (uint64_t k = oldest; k < gpu_written; k++) {
+            write_event(file, &gpu_events[k & TRACE_GPU_MASK], 2, 0, &first);
+        }
+
+        fputs("\n]}\n", file);
+        fclose(file);
+        printf("Trace written to %s\n", trace_path);
+    }
+
+    for (uint32_t i = 0; i < MAX_TRACE_THREADS; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+    }
+    buffers_count = 0;
+    free(gpu_events);
+    gpu_events = NULL;
+}
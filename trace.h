@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Events kept per thread and for the GPU, older ones are overwritten
+#define TRACE_THREAD_EVENTS 65536
+#define TRACE_GPU_EVENTS 65536
+#define MAX_TRACE_THREADS 64
+
+// A CPU and GPU timeline written as Chrome trace JSON, which Perfetto and
+// chrome://tracing both open. Every thread records into its own ring
+// without locks, job system jobs are recorded through its timing hook and
+// GPU timers through gpu_timers_update. Set VL_TRACE to the output path
+extern bool trace_enabled;
+
+struct trace_zone {
+    const char* name;
+    // 0 while tracing is off
+    uint64_t start_ns;
+};
+
+// Starts recording on the calling thread, which shows up as main
+bool trace_begin(const char* path);
+
+// Writes the file once running jobs are done, every other thread must have
+// stopped recording. A later trace_begin starts with new buffers
+void trace_finish();
+
+uint64_t trace_now_ns();
+
+// Names must outlive the trace, zones on one thread nest
+struct trace_zone trace_zone_begin(const char* name);
+void trace_zone_end(struct trace_zone* zone);
+
+// Ends the zone and starts the next one where it ended
+void trace_zone_next(struct trace_zone* zone, const char* name);
+
+// A zone ending with the enclosing scope
+#define TRACE_ZONE(zone, name) struct trace_zone zone __attribute__((cleanup(trace_zone_end))) = trace_zone_begin(name)
+
+// Already measured on the calling thread, in CLOCK_MONOTONIC nanoseconds
+void trace_event(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+// Begin and end ticks of count GPU zones on the graphics queue. They are
+// moved onto the CPU clock with VK_EXT_calibrated_timestamps, without it
+// each batch ends at the time it was read, which is late by up to the
+// fence wait
+void trace_gpu_zones(const char* const* names, const uint64_t* ticks, uint32_t count);
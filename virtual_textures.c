@@ -0,0 +1,929 @@
+#include "virtual_textures.h"
+#include "buffers.h"
+#include "capabilities.h"
+#include "commands.h"
+#include "devices.h"
+#include "images.h"
+#include "jobs.h"
+#include "swap_chain.h"
+#include "textures.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FEEDBACK_EMPTY 0xffffffffu
+#define MAX_PAGE_REQUESTS 4096
+#define VT_SPARSE_BLOCKS (VT_SPARSE_BUDGET_SLOTS / VT_SPARSE_BLOCK_SLOTS)
+
+// Matches the PageTable block in shader.frag, the page table follows
+struct page_table_header {
+    uint32_t feedback_width;
+    uint32_t feedback_capacity;
+    uint32_t jitter;
+    uint32_t page_size;
+    uint32_t slot_size;
+    uint32_t atlas_size;
+    uint32_t border;
+    uint32_t reserved;
+};
+
+struct page_table_texture {
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t table_offset;
+    uint32_t level_offsets[TEXTURE_MAX_LEVELS];
+};
+
+#define TABLE_ENTRIES_OFFSET (sizeof(struct page_table_header) + sizeof(struct page_table_texture) * MAX_VIRTUAL_TEXTURES)
+
+// Pages are numbered level by level, each level row by row
+struct virtual_texture {
+    struct ktx2_image image;
+    uint32_t unit;
+    uint32_t unit_bytes;
+    uint32_t level_offsets[TEXTURE_MAX_LEVELS];
+    uint32_t pages_count;
+    uint32_t table_offset;
+    int32_t* page_slots;
+    uint64_t* requested;
+    bool dirty;
+};
+
+struct atlas_slot {
+    int32_t texture;
+    uint32_t page;
+    uint64_t last_used;
+    bool pinned;
+};
+
+struct page_request {
+    uint32_t texture;
+    uint32_t page;
+    uint32_t level;
+};
+
+struct page_upload {
+    uint32_t texture;
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+    uint32_t slot;
+    VkDeviceSize staging_offset;
+};
+
+bool virtual_textures_sparse = false;
+VkDescriptorSetLayout virtual_texture_set_layout;
+
+static struct virtual_texture textures[MAX_VIRTUAL_TEXTURES];
+static uint32_t textures_count = 0;
+static uint32_t table_used = 0;
+static uint32_t table[VT_TABLE_CAPACITY];
+static uint64_t table_version = 1;
+static uint64_t frame_counter = 0;
+
+// Created with the first virtual texture, whose format every later one
+// has to share
+static VkImage atlas;
+static VkDeviceMemory atlas_memory;
+static VkImageView atlas_view;
+static VkFormat atlas_format = VK_FORMAT_UNDEFINED;
+static bool atlas_initialized = false;
+static uint32_t page_size;
+static uint32_t slot_size;
+static uint32_t slots_per_side;
+static uint32_t slots_count;
+static VkDeviceSize slot_bytes;
+static struct atlas_slot* slots;
+
+// The sparse backend only backs the slots in use, memory is allocated in
+// blocks of VT_SPARSE_BLOCK_SLOTS tiles as the cache grows
+static uint32_t slots_committed = 0;
+static VkDeviceSize sparse_tile_bytes;
+static uint32_t sparse_memory_type;
+static VkDeviceMemory sparse_blocks[VT_SPARSE_BLOCKS];
+static VkSparseImageMemoryBind sparse_binds[VT_UPLOADS_PER_FRAME];
+static uint32_t sparse_binds_count = 0;
+static VkFence sparse_fence;
+
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer table_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory table_memory[MAX_FRAMES_IN_FLIGHT];
+static uint8_t* table_data[MAX_FRAMES_IN_FLIGHT];
+static uint64_t table_uploaded[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer feedback_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory feedback_memory[MAX_FRAMES_IN_FLIGHT];
+static uint32_t* feedback_data[MAX_FRAMES_IN_FLIGHT];
+static uint32_t feedback_entries[MAX_FRAMES_IN_FLIGHT];
+static VkBuffer staging_buffers[MAX_FRAMES_IN_FLIGHT];
+static VkDeviceMemory staging_memory[MAX_FRAMES_IN_FLIGHT];
+static uint8_t* staging_data[MAX_FRAMES_IN_FLIGHT];
+
+// Pinned pages picked at load time, uploaded by the next update
+static struct page_upload load_uploads[MAX_VIRTUAL_TEXTURES];
+static uint32_t load_uploads_count = 0;
+static struct page_upload uploads[MAX_FRAMES_IN_FLIGHT][VT_UPLOADS_PER_FRAME];
+static uint32_t uploads_count[MAX_FRAMES_IN_FLIGHT];
+static uint32_t filling_frame;
+static struct page_request requests[MAX_PAGE_REQUESTS];
+static uint32_t requests_count;
+
+static uint32_t level_width(const struct virtual_texture* texture, uint32_t level) {
+    uint32_t width = texture->image.width >> level;
+    return width > 0 ? width : 1;
+}
+
+static uint32_t level_height(const struct virtual_texture* texture, uint32_t level) {
+    uint32_t height = texture->image.height >> level;
+    return height > 0 ? height : 1;
+}
+
+static uint32_t level_pages_x(const struct virtual_texture* texture, uint32_t level) {
+    return (level_width(texture, level) + page_size - 1) / page_size;
+}
+
+static uint32_t level_pages_y(const struct virtual_texture* texture, uint32_t level) {
+    return (level_height(texture, level) + page_size - 1) / page_size;
+}
+
+static uint32_t pack_entry(uint32_t slot, uint32_t level) {
+    return (slot % slots_per_side) | (slot / slots_per_side) << 10 | level << 20;
+}
+
+// Pages that are not resident point at the entry of the page above them,
+// so every lookup lands on the sharpest resident data in one read
+static void rebuild_table(struct virtual_texture* texture) {
+    uint32_t* entries = &table[texture->table_offset];
+    for (int32_t level = texture->image.level_count - 1; level >= 0; level--) {
+        uint32_t pages_x = level_pages_x(texture, level);
+        uint32_t pages_y = level_pages_y(texture, level);
+        for (uint32_t y = 0; y < pages_y; y++) {
+            for (uint32_t x = 0; x < pages_x; x++) {
+                uint32_t page = texture->level_offsets[level] + y * pages_x + x;
+                int32_t slot = texture->page_slots[page];
+                if (slot >= 0 || (uint32_t)level + 1 == texture->image.level_count) {
+                    entries[page] = pack_entry(slot >= 0 ? (uint32_t)slot : 0, level);
+                    continue;
+                }
+
+                uint32_t parent_pages_x = level_pages_x(texture, level + 1);
+                entries[page] = entries[texture->level_offsets[level + 1] + (y / 2) * parent_pages_x + x / 2];
+            }
+        }
+    }
+
+    texture->dirty = false;
+    table_version++;
+}
+
+static void evict_slot(uint32_t slot) {
+    struct atlas_slot* entry = &slots[slot];
+    if (entry->texture >= 0) {
+        struct virtual_texture* texture = &textures[entry->texture];
+        texture->page_slots[entry->page] = -1;
+        texture->dirty = true;
+    }
+
+    entry->texture = -1;
+}
+
+static void commit_sparse_slot(uint32_t slot) {
+    uint32_t block = slot / VT_SPARSE_BLOCK_SLOTS;
+    if (sparse_blocks[block] == VK_NULL_HANDLE) {
+        VkMemoryAllocateInfo allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = sparse_tile_bytes * VT_SPARSE_BLOCK_SLOTS,
+            .memoryTypeIndex = sparse_memory_type,
+        };
+
+        if (vkAllocateMemory(logical_device, &allocate_info, NULL, &sparse_blocks[block]) != VK_SUCCESS) {
+            sparse_blocks[block] = VK_NULL_HANDLE;
+            return;
+        }
+    }
+
+    sparse_binds[sparse_binds_count++] = (VkSparseImageMemoryBind){
+        .subresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0},
+        .offset = {(int32_t)((slot % slots_per_side) * slot_size), (int32_t)((slot / slots_per_side) * slot_size), 0},
+        .extent = {slot_size, slot_size, 1},
+        .memory = sparse_blocks[block],
+        .memoryOffset = (slot % VT_SPARSE_BLOCK_SLOTS) * sparse_tile_bytes,
+    };
+}
+
+// Free slots first, then pages unseen for VT_RECYCLE_FRAMES. The sparse
+// backend grows before it takes a page that was still seen recently, the
+// atlas only gives up pages not wanted this frame.
+static int32_t take_slot() {
+    int32_t oldest = -1;
+    uint32_t available = virtual_textures_sparse ? slots_committed : slots_count;
+    for (uint32_t i = 0; i < available; i++) {
+        if (slots[i].texture < 0) {
+            return i;
+        }
+
+        if (!slots[i].pinned && (oldest < 0 || slots[i].last_used < slots[oldest].last_used)) {
+            oldest = i;
+        }
+    }
+
+    if (oldest >= 0 && frame_counter - slots[oldest].last_used >= VT_RECYCLE_FRAMES) {
+        evict_slot(oldest);
+        return oldest;
+    }
+
+    if (virtual_textures_sparse && slots_committed < slots_count && sparse_binds_count < VT_UPLOADS_PER_FRAME) {
+        uint32_t slot = slots_committed;
+        commit_sparse_slot(slot);
+        if (sparse_blocks[slot / VT_SPARSE_BLOCK_SLOTS] != VK_NULL_HANDLE) {
+            slots_committed++;
+            slots[slot].texture = -1;
+            return slot;
+        }
+    }
+
+    if (oldest >= 0 && slots[oldest].last_used < frame_counter) {
+        evict_slot(oldest);
+        return oldest;
+    }
+
+    return -1;
+}
+
+static void place_page(uint32_t texture_index, uint32_t page, uint32_t slot, bool pinned) {
+    struct virtual_texture* texture = &textures[texture_index];
+    slots[slot] = (struct atlas_slot){
+        .texture = texture_index,
+        .page = page,
+        .last_used = frame_counter,
+        .pinned = pinned,
+    };
+
+    texture->page_slots[page] = slot;
+    texture->dirty = true;
+}
+
+// Every level of the page up to the top is wanted too, so a fallback is
+// always on its way. Stops at the first page already seen this frame.
+static void request_page(uint32_t texture_index, uint32_t level, uint32_t x, uint32_t y) {
+    struct virtual_texture* texture = &textures[texture_index];
+    for (; level < texture->image.level_count; level++, x /= 2, y /= 2) {
+        uint32_t page = texture->level_offsets[level] + y * level_pages_x(texture, level) + x;
+        if (texture->requested[page] == frame_counter) {
+            return;
+        }
+
+        texture->requested[page] = frame_counter;
+        int32_t slot = texture->page_slots[page];
+        if (slot >= 0) {
+            slots[slot].last_used = frame_counter;
+        } else if (requests_count < MAX_PAGE_REQUESTS) {
+            requests[requests_count++] = (struct page_request){texture_index, page, level};
+        }
+    }
+}
+
+// Coarse pages first, they cover the most screen for the least data
+static int compare_requests(const void* a, const void* b) {
+    const struct page_request* left = a;
+    const struct page_request* right = b;
+    if (left->level != right->level) {
+        return left->level > right->level ? -1 : 1;
+    }
+
+    return left->page < right->page ? -1 : left->page > right->page;
+}
+
+static void page_coordinates(const struct virtual_texture* texture, uint32_t page, uint32_t level, uint32_t* x, uint32_t* y) {
+    uint32_t local = page - texture->level_offsets[level];
+    uint32_t pages_x = level_pages_x(texture, level);
+    *x = local % pages_x;
+    *y = local / pages_x;
+}
+
+static int32_t wrap(int32_t value, int32_t size) {
+    return ((value % size) + size) % size;
+}
+
+// Copies the page and its border straight out of the mapped file, texels
+// past the level edge wrap around like the repeat sampler they replace
+static void fill_page(void* data, uint32_t index) {
+    (void)data;
+    const struct page_upload* upload = &uploads[filling_frame][index];
+    const struct virtual_texture* texture = &textures[upload->texture];
+
+    uint32_t unit = texture->unit;
+    uint32_t unit_bytes = texture->unit_bytes;
+    int32_t units_x = (level_width(texture, upload->level) + unit - 1) / unit;
+    int32_t units_y = (level_height(texture, upload->level) + unit - 1) / unit;
+    int32_t slot_units = slot_size / unit;
+    int32_t origin_x = (int32_t)(upload->x * page_size / unit) - VT_PAGE_BORDER / (int32_t)unit;
+    int32_t origin_y = (int32_t)(upload->y * page_size / unit) - VT_PAGE_BORDER / (int32_t)unit;
+
+    const uint8_t* source = texture->image.levels[upload->level];
+    uint8_t* destination = staging_data[filling_frame] + upload->staging_offset;
+    for (int32_t y = 0; y < slot_units; y++) {
+        const uint8_t* row = source + (size_t)wrap(origin_y + y, units_y) * units_x * unit_bytes;
+        for (int32_t x = 0; x < slot_units; x++) {
+            memcpy(destination, row + (size_t)wrap(origin_x + x, units_x) * unit_bytes, unit_bytes);
+            destination += unit_bytes;
+        }
+    }
+}
+
+static void flush_sparse_binds() {
+    if (sparse_binds_count == 0) {
+        return;
+    }
+
+    VkSparseImageMemoryBindInfo image_bind = {
+        .image = atlas,
+        .bindCount = sparse_binds_count,
+        .pBinds = sparse_binds,
+    };
+
+    VkBindSparseInfo bind_info = {
+        .sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO,
+        .imageBindCount = 1,
+        .pImageBinds = &image_bind,
+    };
+
+    // Only happens while the cache grows, the copies recorded next need the
+    // memory bound
+    if (vkQueueBindSparse(graphics_queue, 1, &bind_info, sparse_fence) == VK_SUCCESS) {
+        vkWaitForFences(logical_device, 1, &sparse_fence, VK_TRUE, UINT64_MAX);
+    }
+    vkResetFences(logical_device, 1, &sparse_fence);
+    sparse_binds_count = 0;
+}
+
+static void write_page_table(uint32_t frame) {
+    struct page_table_header header = {
+        .feedback_width = (swap_chain_extent.width + VT_FEEDBACK_TILE - 1) / VT_FEEDBACK_TILE,
+        .feedback_capacity = VT_FEEDBACK_CAPACITY,
+        .jitter = (uint32_t)((frame_counter * 29) % (VT_FEEDBACK_TILE * VT_FEEDBACK_TILE)),
+        .page_size = page_size,
+        .slot_size = slot_size,
+        .atlas_size = slots_per_side * slot_size,
+        .border = VT_PAGE_BORDER,
+    };
+    memcpy(table_data[frame], &header, sizeof(header));
+
+    uint32_t feedback_height = (swap_chain_extent.height + VT_FEEDBACK_TILE - 1) / VT_FEEDBACK_TILE;
+    feedback_entries[frame] = header.feedback_width * feedback_height;
+    if (feedback_entries[frame] > VT_FEEDBACK_CAPACITY) {
+        feedback_entries[frame] = VT_FEEDBACK_CAPACITY;
+    }
+
+    if (table_uploaded[frame] == table_version) {
+        return;
+    }
+
+    struct page_table_texture* infos = (struct page_table_texture*)(table_data[frame] + sizeof(header));
+    for (uint32_t i = 0; i < textures_count; i++) {
+        infos[i] = (struct page_table_texture){
+            .width = textures[i].image.width,
+            .height = textures[i].image.height,
+            .levels = textures[i].image.level_count,
+            .table_offset = textures[i].table_offset,
+        };
+        memcpy(infos[i].level_offsets, textures[i].level_offsets, sizeof(infos[i].level_offsets));
+    }
+
+    memcpy(table_data[frame] + TABLE_ENTRIES_OFFSET, table, table_used * sizeof(uint32_t));
+    table_uploaded[frame] = table_version;
+}
+
+void virtual_textures_update(uint32_t frame) {
+    uploads_count[frame] = 0;
+    if (textures_count == 0) {
+        return;
+    }
+
+    frame_counter++;
+    requests_count = 0;
+
+    for (uint32_t i = 0; i < load_uploads_count; i++) {
+        uploads[frame][uploads_count[frame]++] = load_uploads[i];
+    }
+    load_uploads_count = 0;
+
+    const uint32_t* feedback = feedback_data[frame];
+    for (uint32_t i = 0; i < feedback_entries[frame]; i++) {
+        uint32_t value = feedback[i];
+        if (value == FEEDBACK_EMPTY) {
+            continue;
+        }
+
+        uint32_t texture_index = value >> 28;
+        uint32_t level = (value >> 24) & 0xf;
+        uint32_t y = (value >> 12) & 0xfff;
+        uint32_t x = value & 0xfff;
+        if (texture_index >= textures_count || level >= textures[texture_index].image.level_count ||
+            x >= level_pages_x(&textures[texture_index], level) || y >= level_pages_y(&textures[texture_index], level)) {
+            continue;
+        }
+
+        request_page(texture_index, level, x, y);
+    }
+
+    qsort(requests, requests_count, sizeof(struct page_request), compare_requests);
+
+    for (uint32_t i = 0; i < requests_count && uploads_count[frame] < VT_UPLOADS_PER_FRAME; i++) {
+        int32_t slot = take_slot();
+        if (slot < 0) {
+            break;
+        }
+
+        struct page_request* request = &requests[i];
+        struct page_upload* upload = &uploads[frame][uploads_count[frame]];
+        upload->texture = request->texture;
+        upload->level = request->level;
+        upload->slot = slot;
+        page_coordinates(&textures[request->texture], request->page, request->level, &upload->x, &upload->y);
+        place_page(request->texture, request->page, slot, false);
+        uploads_count[frame]++;
+    }
+
+    flush_sparse_binds();
+
+    for (uint32_t i = 0; i < uploads_count[frame]; i++) {
+        uploads[frame][i].staging_offset = i * slot_bytes;
+    }
+
+    filling_frame = frame;
+    job_parallel_for(fill_page, NULL, uploads_count[frame], "vt_pages");
+
+    for (uint32_t i = 0; i < textures_count; i++) {
+        if (textures[i].dirty) {
+            rebuild_table(&textures[i]);
+        }
+    }
+
+    write_page_table(frame);
+}
+
+void virtual_textures_upload(VkCommandBuffer buffer, uint32_t frame) {
+    if (atlas == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkCmdFillBuffer(buffer, feedback_buffers[frame], 0, VK_WHOLE_SIZE, FEEDBACK_EMPTY);
+
+    if (!atlas_initialized) {
+        transition_image(buffer, atlas, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        atlas_initialized = true;
+    }
+
+    if (uploads_count[frame] > 0) {
+        // Slots being replaced may still be read by the previous frame
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+        VkBufferImageCopy regions[VT_UPLOADS_PER_FRAME];
+        for (uint32_t i = 0; i < uploads_count[frame]; i++) {
+            uint32_t slot = uploads[frame][i].slot;
+            regions[i] = (VkBufferImageCopy){
+                .bufferOffset = uploads[frame][i].staging_offset,
+                .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .imageOffset = {(int32_t)((slot % slots_per_side) * slot_size), (int32_t)((slot / slots_per_side) * slot_size), 0},
+                .imageExtent = {slot_size, slot_size, 1},
+            };
+        }
+
+        vkCmdCopyBufferToImage(buffer, staging_buffers[frame], atlas, VK_IMAGE_LAYOUT_GENERAL, uploads_count[frame], regions);
+    }
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void virtual_textures_feedback_barrier(VkCommandBuffer buffer, uint32_t frame) {
+    (void)frame;
+    if (atlas == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    };
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+VkDescriptorSet virtual_texture_set(uint32_t frame) {
+    return sets[frame];
+}
+
+static void write_atlas_descriptor(VkImageView view, VkSampler sampler) {
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        VkDescriptorImageInfo image_info = {
+            .sampler = sampler,
+            .imageView = view,
+            .imageLayout = view == atlas_view ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        };
+
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = sets[frame],
+            .dstBinding = 2,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &image_info,
+        };
+
+        vkUpdateDescriptorSets(logical_device, 1, &write, 0, NULL);
+    }
+}
+
+static bool graphics_queue_binds_sparse() {
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, NULL);
+
+    VkQueueFamilyProperties* families = malloc(sizeof(VkQueueFamilyProperties) * family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families);
+    bool supported = families[device_capabilities.queues.graphics_family.value].queueFlags & VK_QUEUE_SPARSE_BINDING_BIT;
+    free(families);
+
+    return supported;
+}
+
+// Slots are one sparse tile each so they can be backed one at a time
+static VkResult create_sparse_atlas(VkFormat format) {
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    VkSparseImageFormatProperties properties[4];
+    uint32_t count = 4;
+    vkGetPhysicalDeviceSparseImageFormatProperties(physical_device, format, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+        usage, VK_IMAGE_TILING_OPTIMAL, &count, properties);
+
+    if (count == 0) {
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    VkExtent3D granularity = properties[0].imageGranularity;
+    if (granularity.width != granularity.height || granularity.width <= 2 * VT_PAGE_BORDER) {
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    uint32_t side = device_capabilities.max_image_dimension_2d < 16384 ? device_capabilities.max_image_dimension_2d : 16384;
+    slot_size = granularity.width;
+    page_size = slot_size - 2 * VT_PAGE_BORDER;
+    slots_per_side = side / slot_size;
+    slots_count = slots_per_side * slots_per_side < VT_SPARSE_BUDGET_SLOTS ? slots_per_side * slots_per_side : VT_SPARSE_BUDGET_SLOTS;
+
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .flags = VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = {slots_per_side * slot_size, slots_per_side * slot_size, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VkResult result = vkCreateImage(logical_device, &create_info, NULL, &atlas);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    // The alignment of a sparse image is its tile size
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(logical_device, atlas, &requirements);
+    sparse_tile_bytes = requirements.alignment;
+    sparse_memory_type = find_memory_type(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    return vkCreateFence(logical_device, &fence_info, NULL, &sparse_fence);
+}
+
+static VkResult create_atlas(VkFormat format) {
+    VkResult result = VK_ERROR_FORMAT_NOT_SUPPORTED;
+    virtual_textures_sparse = false;
+    if (getenv("VL_VT_SPARSE") != NULL && device_capabilities.sparse_residency_image_2d && graphics_queue_binds_sparse()) {
+        result = create_sparse_atlas(format);
+        virtual_textures_sparse = result == VK_SUCCESS;
+        if (!virtual_textures_sparse && atlas != VK_NULL_HANDLE) {
+            vkDestroyImage(logical_device, atlas, NULL);
+            atlas = VK_NULL_HANDLE;
+        }
+    }
+
+    if (!virtual_textures_sparse) {
+        page_size = VT_PAGE_SIZE;
+        slot_size = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+        slots_per_side = VT_ATLAS_SLOTS;
+        slots_count = VT_ATLAS_SLOTS * VT_ATLAS_SLOTS;
+
+        result = create_image(slots_per_side * slot_size, slots_per_side * slot_size, 1, format,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &atlas, &atlas_memory);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    result = create_image_view_2d(atlas, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, &atlas_view);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    slots = malloc(sizeof(struct atlas_slot) * slots_count);
+    for (uint32_t i = 0; i < slots_count; i++) {
+        slots[i] = (struct atlas_slot){.texture = -1};
+    }
+
+    bool compressed;
+    uint32_t block_size = texture_block_size(format, &compressed);
+    uint32_t slot_units = compressed ? slot_size / 4 : slot_size;
+    slot_bytes = (VkDeviceSize)slot_units * slot_units * block_size;
+
+    VkMemoryPropertyFlags staging_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        VkDeviceSize size = slot_bytes * VT_UPLOADS_PER_FRAME;
+        result = create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, staging_flags, &staging_buffers[frame], &staging_memory[frame]);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        vkMapMemory(logical_device, staging_memory[frame], 0, size, 0, (void**)&staging_data[frame]);
+    }
+
+    struct sampler_key sampler_key = {
+        .filter = VK_FILTER_LINEAR,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+
+    write_atlas_descriptor(atlas_view, get_sampler(&sampler_key));
+    atlas_format = format;
+
+    printf("Virtual texture atlas: %u slots of %u texels%s\n", slots_count, slot_size, virtual_textures_sparse ? ", sparse" : "");
+    return VK_SUCCESS;
+}
+
+int32_t load_virtual_texture(const char* path) {
+    if (textures_count == MAX_VIRTUAL_TEXTURES) {
+        puts("Too many virtual textures");
+        return -1;
+    }
+
+    // The fragment shader reports the pages it wants through a storage buffer
+    if (!device_capabilities.fragment_stores_and_atomics) {
+        printf("%s needs fragment shader stores, which the device lacks\n", path);
+        return -1;
+    }
+
+    struct virtual_texture* texture = &textures[textures_count];
+    memset(texture, 0, sizeof(struct virtual_texture));
+    if (!map_ktx2(path, &texture->image)) {
+        return -1;
+    }
+
+    VkFormat format = texture->image.format;
+    bool compressed;
+    texture->unit_bytes = texture_block_size(format, &compressed);
+    texture->unit = compressed ? 4 : 1;
+
+    if (compressed && !device_capabilities.texture_compression_bc) {
+        printf("%s needs BC texture compression, which the device lacks\n", path);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    if (atlas_format != VK_FORMAT_UNDEFINED && format != atlas_format) {
+        printf("%s does not match the format of the virtual texture atlas\n", path);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    if (atlas_format == VK_FORMAT_UNDEFINED && create_atlas(format) != VK_SUCCESS) {
+        printf("Failed to create the virtual texture atlas for %s\n", path);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    uint32_t top = texture->image.level_count - 1;
+    if (level_pages_x(texture, top) != 1 || level_pages_y(texture, top) != 1 || level_pages_x(texture, 0) > 4096 || level_pages_y(texture, 0) > 4096) {
+        printf("%s needs a mip chain down to %u texels and at most 4096 pages a side\n", path, page_size);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    texture->pages_count = 0;
+    for (uint32_t level = 0; level < texture->image.level_count; level++) {
+        texture->level_offsets[level] = texture->pages_count;
+        texture->pages_count += level_pages_x(texture, level) * level_pages_y(texture, level);
+    }
+
+    if (table_used + texture->pages_count > VT_TABLE_CAPACITY) {
+        printf("%s does not fit in the virtual texture page table\n", path);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    texture->table_offset = table_used;
+    texture->page_slots = malloc(sizeof(int32_t) * texture->pages_count);
+    texture->requested = calloc(texture->pages_count, sizeof(uint64_t));
+    for (uint32_t i = 0; i < texture->pages_count; i++) {
+        texture->page_slots[i] = -1;
+    }
+
+    // The single page of the top level is always resident, every lookup
+    // falls back to it
+    int32_t slot = take_slot();
+    flush_sparse_binds();
+    if (slot < 0) {
+        printf("The virtual texture atlas is full, %s is not loaded\n", path);
+        free(texture->page_slots);
+        free(texture->requested);
+        unmap_ktx2(&texture->image);
+        return -1;
+    }
+
+    uint32_t index = textures_count++;
+    table_used += texture->pages_count;
+    place_page(index, texture->level_offsets[top], slot, true);
+    load_uploads[load_uploads_count++] = (struct page_upload){
+        .texture = index,
+        .level = top,
+        .slot = slot,
+    };
+
+    rebuild_table(texture);
+    return index;
+}
+
+static VkResult create_frame_buffers(int frame) {
+    VkMemoryPropertyFlags shared_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkDeviceSize table_size = TABLE_ENTRIES_OFFSET + VT_TABLE_CAPACITY * sizeof(uint32_t);
+    VkResult result = create_buffer(table_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, shared_flags, &table_buffers[frame], &table_memory[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    vkMapMemory(logical_device, table_memory[frame], 0, table_size, 0, (void**)&table_data[frame]);
+    memset(table_data[frame], 0, TABLE_ENTRIES_OFFSET);
+
+    // Feedback is read on the CPU, cached memory makes that a lot cheaper
+    VkMemoryPropertyFlags feedback_flags = shared_flags | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    if (find_memory_type(~0u, feedback_flags) == UINT32_MAX) {
+        feedback_flags = shared_flags;
+    }
+
+    VkDeviceSize feedback_size = VT_FEEDBACK_CAPACITY * sizeof(uint32_t);
+    result = create_buffer(feedback_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, feedback_flags,
+        &feedback_buffers[frame], &feedback_memory[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    vkMapMemory(logical_device, feedback_memory[frame], 0, feedback_size, 0, (void**)&feedback_data[frame]);
+    memset(feedback_data[frame], 0xff, feedback_size);
+    feedback_entries[frame] = 0;
+
+    VkDescriptorSetAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &virtual_texture_set_layout,
+    };
+
+    result = vkAllocateDescriptorSets(logical_device, &allocate_info, &sets[frame]);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorBufferInfo buffers[2] = {
+        {table_buffers[frame], 0, VK_WHOLE_SIZE},
+        {feedback_buffers[frame], 0, VK_WHOLE_SIZE},
+    };
+
+    VkWriteDescriptorSet writes[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = sets[frame],
+            .dstBinding = i,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffers[i],
+        };
+    }
+
+    vkUpdateDescriptorSets(logical_device, 2, writes, 0, NULL);
+    return VK_SUCCESS;
+}
+
+// Until a virtual texture is loaded the atlas binding shows the default
+// texture, nothing samples it then
+VkResult create_virtual_textures() {
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = i < 2 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(logical_device, &layout_info, NULL, &virtual_texture_set_layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkDescriptorPoolSize pool_sizes[2] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * MAX_FRAMES_IN_FLIGHT},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_FRAMES_IN_FLIGHT},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(logical_device, &pool_info, NULL, &descriptor_pool);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        result = create_frame_buffers(frame);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    struct sampler_key sampler_key = {
+        .filter = VK_FILTER_LINEAR,
+        .mipmap_mode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+
+    write_atlas_descriptor(default_texture.view, get_sampler(&sampler_key));
+    return VK_SUCCESS;
+}
+
+void destroy_virtual_textures() {
+    for (uint32_t i = 0; i < textures_count; i++) {
+        free(textures[i].page_slots);
+        free(textures[i].requested);
+        unmap_ktx2(&textures[i].image);
+    }
+    textures_count = 0;
+    table_used = 0;
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        vkDestroyBuffer(logical_device, table_buffers[frame], NULL);
+        vkFreeMemory(logical_device, table_memory[frame], NULL);
+        vkDestroyBuffer(logical_device, feedback_buffers[frame], NULL);
+        vkFreeMemory(logical_device, feedback_memory[frame], NULL);
+        vkDestroyBuffer(logical_device, staging_buffers[frame], NULL);
+        vkFreeMemory(logical_device, staging_memory[frame], NULL);
+    }
+
+    vkDestroyImageView(logical_device, atlas_view, NULL);
+    vkDestroyImage(logical_device, atlas, NULL);
+    vkFreeMemory(logical_device, atlas_memory, NULL);
+    for (uint32_t i = 0; i < VT_SPARSE_BLOCKS; i++) {
+        vkFreeMemory(logical_device, sparse_blocks[i], NULL);
+        sparse_blocks[i] = VK_NULL_HANDLE;
+    }
+    vkDestroyFence(logical_device, sparse_fence, NULL);
+
+    free(slots);
+    slots = NULL;
+    atlas = VK_NULL_HANDLE;
+    atlas_format = VK_FORMAT_UNDEFINED;
+
+    vkDestroyDescriptorPool(logical_device, descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(logical_device, virtual_texture_set_layout, NULL);
+}
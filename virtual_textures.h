@@ -0,0 +1,45 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <stdbool.h>
+
+#define MAX_VIRTUAL_TEXTURES 16
+#define VT_PAGE_SIZE 128
+#define VT_PAGE_BORDER 4
+#define VT_ATLAS_SLOTS 30
+#define VT_UPLOADS_PER_FRAME 32
+#define VT_RECYCLE_FRAMES 120
+#define VT_FEEDBACK_TILE 8
+#define VT_FEEDBACK_CAPACITY (512 * 512)
+#define VT_TABLE_CAPACITY (1 << 18)
+#define VT_SPARSE_BLOCK_SLOTS 64
+#define VT_SPARSE_BUDGET_SLOTS 4096
+
+// Pages of every virtual texture share one physical atlas, the fragment
+// shader finds them through a per page table that always points at the
+// nearest resident page and reports what it wanted to a feedback buffer.
+// Only pages seen in that feedback are ever uploaded.
+extern bool virtual_textures_sparse;
+extern VkDescriptorSetLayout virtual_texture_set_layout;
+
+VkResult create_virtual_textures();
+void destroy_virtual_textures();
+
+// Virtual textures are KTX2 files with a mip chain down to a single page,
+// the file stays mapped and pages are read from it as they are requested.
+// Returns the texture index or -1
+int32_t load_virtual_texture(const char* path);
+
+// Reads the feedback the frame's last submission wrote, must run after its
+// fence has signalled
+void virtual_textures_update(uint32_t frame);
+
+// Clears the feedback buffer and copies the pages picked by the update into
+// the atlas, recorded before the frame's passes
+void virtual_textures_upload(VkCommandBuffer buffer, uint32_t frame);
+
+// Makes the feedback written by the passes readable on the host
+void virtual_textures_feedback_barrier(VkCommandBuffer buffer, uint32_t frame);
+
+VkDescriptorSet virtual_texture_set(uint32_t frame);
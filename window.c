@@ -1,8 +1,13 @@
 #include "window.h"
 
 GLFWwindow* window = NULL;
+bool window_headless = false;
 
 void init_window() {
+    if (window_headless) {
+        return;
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
@@ -10,3 +15,22 @@ void init_window() {
 
     window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Meow :3", NULL, NULL);
 }
+
+void destroy_window() {
+    if (window_headless) {
+        return;
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
+
+void window_framebuffer_size(int* width, int* height) {
+    if (window_headless) {
+        *width = WINDOW_WIDTH;
+        *height = WINDOW_HEIGHT;
+        return;
+    }
+
+    glfwGetFramebufferSize(window, width, height);
+}
@@ -1,10 +1,17 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <stdbool.h>
 
 #define WINDOW_HEIGHT   512
 #define WINDOW_WIDTH    512
 
 extern GLFWwindow* window;
 
+// Headless runs never touch GLFW, the surface comes from
+// VK_EXT_headless_surface and the size stays at WINDOW_WIDTH by WINDOW_HEIGHT
+extern bool window_headless;
+
 void init_window();
+void destroy_window();
+void window_framebuffer_size(int* width, int* height);